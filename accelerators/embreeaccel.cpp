@@ -0,0 +1,397 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// embreeaccel.cpp*
+#include "embreeaccel.h"
+#include "shapes/mesh.h"
+#include "paramset.h"
+#include "dynload.h"
+#include "error.h"
+#include "timer.h"
+#include "randomgen.h"
+
+#include "luxrays/utils/mc.h"
+
+#include <map>
+
+#include <boost/thread/once.hpp>
+
+using namespace luxrays;
+
+namespace lux
+{
+
+const u_int EmbreeAccel::noPrototype;
+
+// Embree is initialized once for the whole process
+static boost::once_flag embreeInitFlag = BOOST_ONCE_INIT;
+static void InitEmbree()
+{
+	rtcInit(NULL);
+}
+
+// Return the triangle mesh of a primitive if Embree can store it
+static const Mesh *GetTriangleMesh(const Primitive *prim)
+{
+	const AreaLightPrimitive *alp =
+		dynamic_cast<const AreaLightPrimitive *>(prim);
+	if (alp)
+		prim = alp->GetPrimitive().get();
+	const Mesh *mesh = dynamic_cast<const Mesh *>(prim);
+	return mesh && mesh->IsTriangleMesh() ? mesh : NULL;
+}
+
+// Check whether Embree can store all the sources of an instance
+static bool CanInstance(const InstancePrimitive *ip)
+{
+	const vector<boost::shared_ptr<Primitive> > &sources(ip->GetInstanceSources());
+	if (sources.empty())
+		return false;
+	for (u_int i = 0; i < sources.size(); ++i) {
+		if (!GetTriangleMesh(sources[i].get()))
+			return false;
+	}
+	return true;
+}
+
+static RTCScene NewScene()
+{
+	return rtcNewScene(static_cast<RTCSceneFlags>(RTC_SCENE_STATIC |
+		RTC_SCENE_INCOHERENT), RTC_INTERSECT1);
+}
+
+static inline void InitRTCRay(const Ray &ray, RTCRay &rtcRay)
+{
+	rtcRay.org[0] = ray.o.x;
+	rtcRay.org[1] = ray.o.y;
+	rtcRay.org[2] = ray.o.z;
+	rtcRay.dir[0] = ray.d.x;
+	rtcRay.dir[1] = ray.d.y;
+	rtcRay.dir[2] = ray.d.z;
+	rtcRay.tnear = ray.mint;
+	rtcRay.tfar = ray.maxt;
+	rtcRay.time = ray.time;
+	rtcRay.mask = 0xffffffffu;
+	rtcRay.geomID = RTC_INVALID_GEOMETRY_ID;
+	rtcRay.primID = RTC_INVALID_GEOMETRY_ID;
+	rtcRay.instID = RTC_INVALID_GEOMETRY_ID;
+}
+
+void EmbreeAccel::AddMeshes(RTCScene scene,
+	const vector<boost::shared_ptr<Primitive> > &prims,
+	vector<const Primitive *> &geometries, vector<bool> &flips)
+{
+	for (u_int i = 0; i < prims.size(); ++i) {
+		const Mesh *mesh = GetTriangleMesh(prims[i].get());
+		const unsigned geomID = rtcNewTriangleMesh(scene,
+			RTC_GEOMETRY_STATIC, mesh->ntris, mesh->nverts);
+
+		// Embree vertices are padded to 16 bytes
+		float *vertices = static_cast<float *>(rtcMapBuffer(scene,
+			geomID, RTC_VERTEX_BUFFER));
+		for (u_int v = 0; v < mesh->nverts; ++v) {
+			vertices[4 * v] = mesh->p[v].x;
+			vertices[4 * v + 1] = mesh->p[v].y;
+			vertices[4 * v + 2] = mesh->p[v].z;
+			vertices[4 * v + 3] = 0.f;
+		}
+		rtcUnmapBuffer(scene, geomID, RTC_VERTEX_BUFFER);
+
+		// The triangle indices are the ones expected by GetIntersection
+		int *indices = static_cast<int *>(rtcMapBuffer(scene, geomID,
+			RTC_INDEX_BUFFER));
+		std::copy(mesh->triVertexIndex,
+			mesh->triVertexIndex + 3 * mesh->ntris, indices);
+		rtcUnmapBuffer(scene, geomID, RTC_INDEX_BUFFER);
+
+		if (geometries.size() <= geomID) {
+			geometries.resize(geomID + 1, NULL);
+			flips.resize(geomID + 1, false);
+		}
+		geometries[geomID] = prims[i].get();
+		flips[geomID] = mesh->reverseOrientation ^
+			mesh->transformSwapsHandedness;
+	}
+}
+
+/***************************************************/
+EmbreeAccel::EmbreeAccel(const vector<boost::shared_ptr<Primitive> > &p,
+	const string &accelName, const ParamSet &accelParams) : scene(NULL)
+{
+	boost::call_once(&InitEmbree, embreeInitFlag);
+
+	Timer buildTimer;
+	buildTimer.Start();
+
+	// Split what Embree can store from all the other primitives
+	vector<boost::shared_ptr<Primitive> > vPrims;
+	vector<boost::shared_ptr<Primitive> > instancePrims;
+	size_t nTriangles = 0;
+	for (u_int i = 0; i < p.size(); ++i) {
+		const Mesh *mesh = GetTriangleMesh(p[i].get());
+		if (mesh) {
+			embreePrims.push_back(p[i]);
+			nTriangles += mesh->ntris;
+			continue;
+		}
+		const InstancePrimitive *ip =
+			dynamic_cast<const InstancePrimitive *>(p[i].get());
+		if (ip && CanInstance(ip))
+			instancePrims.push_back(p[i]);
+		else
+			vPrims.push_back(p[i]);
+	}
+
+	if (embreePrims.size() + instancePrims.size() > 0) {
+		scene = NewScene();
+		AddMeshes(scene, embreePrims, geometries, geometryFlips);
+		geometryPrototypes.resize(geometries.size(), noPrototype);
+
+		// One scene per prototype, shared by all its instances
+		std::map<const Primitive *, u_int> prototypeIndexes;
+		for (u_int i = 0; i < instancePrims.size(); ++i) {
+			const InstancePrimitive *ip =
+				static_cast<const InstancePrimitive *>(instancePrims[i].get());
+			u_int proto;
+			std::map<const Primitive *, u_int>::const_iterator it =
+				prototypeIndexes.find(ip->GetInstance().get());
+			if (it != prototypeIndexes.end())
+				proto = it->second;
+			else {
+				proto = prototypeScenes.size();
+				RTCScene prototypeScene = NewScene();
+				prototypeGeometries.push_back(vector<const Primitive *>());
+				prototypeGeometryFlips.push_back(vector<bool>());
+				AddMeshes(prototypeScene, ip->GetInstanceSources(),
+					prototypeGeometries.back(),
+					prototypeGeometryFlips.back());
+				rtcCommit(prototypeScene);
+				prototypeScenes.push_back(prototypeScene);
+				prototypePrims.insert(prototypePrims.end(),
+					ip->GetInstanceSources().begin(),
+					ip->GetInstanceSources().end());
+				prototypeIndexes[ip->GetInstance().get()] = proto;
+			}
+
+			const unsigned geomID = rtcNewInstance(scene,
+				prototypeScenes[proto]);
+			const Transform &i2w(ip->GetTransform());
+			float xfm[12];
+			for (u_int r = 0; r < 3; ++r) {
+				for (u_int c = 0; c < 4; ++c)
+					xfm[r * 4 + c] = i2w.m.m[r][c];
+			}
+			rtcSetTransform(scene, geomID, RTC_MATRIX_ROW_MAJOR, xfm);
+
+			if (geometries.size() <= geomID) {
+				geometries.resize(geomID + 1, NULL);
+				geometryFlips.resize(geomID + 1, false);
+				geometryPrototypes.resize(geomID + 1, noPrototype);
+			}
+			geometries[geomID] = ip;
+			geometryPrototypes[geomID] = proto;
+		}
+		embreePrims.insert(embreePrims.end(), instancePrims.begin(),
+			instancePrims.end());
+
+		rtcCommit(scene);
+		const RTCError error = rtcGetError();
+		if (error != RTC_NO_ERROR) {
+			LOG(LUX_ERROR, LUX_SYSTEM) << "Embree error " << error <<
+				" while building the scene, using " << accelName <<
+				" for all the primitives";
+			rtcDeleteScene(scene);
+			scene = NULL;
+			for (u_int i = 0; i < prototypeScenes.size(); ++i)
+				rtcDeleteScene(prototypeScenes[i]);
+			prototypeScenes.clear();
+			prototypeGeometries.clear();
+			prototypeGeometryFlips.clear();
+			prototypePrims.clear();
+			geometries.clear();
+			geometryFlips.clear();
+			geometryPrototypes.clear();
+			vPrims.insert(vPrims.end(), embreePrims.begin(),
+				embreePrims.end());
+			embreePrims.clear();
+		}
+		for (u_int i = 0; i < embreePrims.size(); ++i)
+			worldBound = Union(worldBound, embreePrims[i]->WorldBound());
+	}
+
+	if (vPrims.size() > 0) {
+		others = MakeAccelerator(accelName, vPrims, accelParams);
+		if (!others)
+			others = MakeAccelerator("qbvh", vPrims, ParamSet());
+		if (others)
+			worldBound = Union(worldBound, others->WorldBound());
+	}
+
+	buildTimer.Stop();
+	LOG(LUX_INFO, LUX_NOERROR) << "Embree accelerator: " <<
+		(embreePrims.size() - instancePrims.size()) << " meshes (" <<
+		nTriangles << " triangles), " << instancePrims.size() <<
+		" instances of " << prototypeScenes.size() << " prototypes, " <<
+		vPrims.size() << " other primitives";
+	LOG(LUX_INFO, LUX_NOERROR) << "Embree accelerator build time: " <<
+		buildTimer.Time() << "s";
+
+	const int benchmarkRays = accelParams.FindOneInt("benchmarkrays", 0);
+	if (benchmarkRays > 0 && scene)
+		Benchmark(p, benchmarkRays);
+}
+
+void EmbreeAccel::Benchmark(const vector<boost::shared_ptr<Primitive> > &p,
+	u_int nRays) const
+{
+	Timer timer;
+	timer.Start();
+	boost::shared_ptr<Aggregate> qbvh(MakeAccelerator("qbvh", p, ParamSet()));
+	timer.Stop();
+	if (!qbvh)
+		return;
+	LOG(LUX_INFO, LUX_NOERROR) << "QBVH accelerator build time: " <<
+		timer.Time() << "s";
+
+	// Rays starting inside the scene bounds in uniform directions, the
+	// same rays are traced through both accelerators
+	RandomGenerator rng(1);
+	Point center;
+	float radius;
+	worldBound.BoundingSphere(&center, &radius);
+	vector<Ray> rays;
+	rays.reserve(nRays);
+	for (u_int i = 0; i < nRays; ++i) {
+		const Point o(Lerp(rng.floatValue(), worldBound.pMin.x, worldBound.pMax.x),
+			Lerp(rng.floatValue(), worldBound.pMin.y, worldBound.pMax.y),
+			Lerp(rng.floatValue(), worldBound.pMin.z, worldBound.pMax.z));
+		const float u1 = rng.floatValue();
+		const float u2 = rng.floatValue();
+		rays.push_back(Ray(o, UniformSampleSphere(u1, u2), 0.f,
+			2.f * radius));
+	}
+
+	const Aggregate *accels[2] = { this, qbvh.get() };
+	const char *names[2] = { "Embree", "QBVH" };
+	u_int hits[2];
+	for (u_int a = 0; a < 2; ++a) {
+		hits[a] = 0;
+		timer.Reset();
+		timer.Start();
+		for (u_int i = 0; i < nRays; ++i) {
+			Ray ray(rays[i]);
+			Intersection isect;
+			if (accels[a]->Intersect(ray, &isect))
+				++hits[a];
+		}
+		timer.Stop();
+		LOG(LUX_INFO, LUX_NOERROR) << names[a] << " traversal: " <<
+			nRays << " rays, " << hits[a] << " hits in " <<
+			timer.Time() << "s (" << nRays / max(timer.Time(), 1e-9) <<
+			" rays/s)";
+	}
+	if (hits[0] != hits[1])
+		LOG(LUX_WARNING, LUX_CONSISTENCY) << "Embree and QBVH found " <<
+			hits[0] << " and " << hits[1] << " hits for the same rays";
+}
+
+EmbreeAccel::~EmbreeAccel()
+{
+	// The instances reference the prototype scenes
+	if (scene)
+		rtcDeleteScene(scene);
+	for (u_int i = 0; i < prototypeScenes.size(); ++i)
+		rtcDeleteScene(prototypeScenes[i]);
+}
+
+bool EmbreeAccel::Intersect(const Ray &ray, Intersection *isect) const
+{
+	bool hit = false;
+	if (scene) {
+		RTCRay rtcRay;
+		InitRTCRay(ray, rtcRay);
+		rtcIntersect(scene, rtcRay);
+		if (rtcRay.geomID != RTC_INVALID_GEOMETRY_ID) {
+			RayHit rayHit;
+			rayHit.t = rtcRay.tfar;
+			rayHit.b1 = rtcRay.u;
+			rayHit.b2 = rtcRay.v;
+			rayHit.meshIndex = rtcRay.geomID;
+			rayHit.triangleIndex = rtcRay.primID;
+			if (rtcRay.instID == RTC_INVALID_GEOMETRY_ID) {
+				geometries[rtcRay.geomID]->GetIntersection(rayHit,
+					rtcRay.primID, isect);
+				if (geometryFlips[rtcRay.geomID])
+					isect->dg.nn = -isect->dg.nn;
+			} else {
+				const u_int proto = geometryPrototypes[rtcRay.instID];
+				prototypeGeometries[proto][rtcRay.geomID]->GetIntersection(rayHit,
+					rtcRay.primID, isect);
+				if (prototypeGeometryFlips[proto][rtcRay.geomID])
+					isect->dg.nn = -isect->dg.nn;
+				static_cast<const InstancePrimitive *>(geometries[rtcRay.instID])->TransformIntersection(isect);
+			}
+			ray.maxt = rtcRay.tfar;
+			hit = true;
+		}
+	}
+	if (others)
+		hit |= others->Intersect(ray, isect);
+	return hit;
+}
+
+bool EmbreeAccel::IntersectP(const Ray &ray) const
+{
+	if (scene) {
+		RTCRay rtcRay;
+		InitRTCRay(ray, rtcRay);
+		rtcOccluded(scene, rtcRay);
+		// Embree sets the geometry to 0 on hits
+		if (rtcRay.geomID == 0)
+			return true;
+	}
+	return others && others->IntersectP(ray);
+}
+
+void EmbreeAccel::GetPrimitives(vector<boost::shared_ptr<Primitive> > &prims) const
+{
+	if (others)
+		others->GetPrimitives(prims);
+	const PrimitiveRefinementHints refineHints(false);
+	for (u_int i = 0; i < embreePrims.size(); ++i) {
+		if (embreePrims[i]->CanIntersect())
+			prims.push_back(embreePrims[i]);
+		else
+			embreePrims[i]->Refine(prims, refineHints, embreePrims[i]);
+	}
+}
+
+Aggregate *EmbreeAccel::CreateAccelerator(const vector<boost::shared_ptr<Primitive> > &prims,
+	const ParamSet &ps)
+{
+	const string accelName = ps.FindOneString("baseaccelerator", "qbvh");
+	return new EmbreeAccel(prims, accelName, ps);
+}
+
+static DynamicLoader::RegisterAccelerator<EmbreeAccel> r("embree");
+
+}
@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// embreeaccel.h*
+#ifndef LUX_EMBREEACCEL_H
+#define LUX_EMBREEACCEL_H
+
+#include "lux.h"
+#include "primitive.h"
+
+#include "embree2/rtcore.h"
+#include "embree2/rtcore_ray.h"
+
+namespace lux
+{
+
+/**
+   Accelerator tracing the rays with Intel Embree.
+   The triangle meshes are copied in an Embree scene, and the instances of
+   prototypes only made of triangle meshes become Embree instances of a
+   shared scene per prototype. The hits are completed by the
+   GetIntersection method of the meshes, as for the LuxRays renderers.
+   The primitives Embree can't represent are stored in a base accelerator.
+*/
+class EmbreeAccel : public Aggregate {
+public:
+	/**
+	   Normal constructor.
+	   @param p the vector of shared primitives to put in the accelerator
+	   @param accelName the accelerator used for the other primitives
+	   @param accelParams the parameters of that accelerator
+	*/
+	EmbreeAccel(const vector<boost::shared_ptr<Primitive> > &p,
+		const string &accelName, const ParamSet &accelParams);
+	virtual ~EmbreeAccel();
+
+	virtual BBox WorldBound() const { return worldBound; }
+	virtual bool Intersect(const Ray &ray, Intersection *isect) const;
+	virtual bool IntersectP(const Ray &ray) const;
+	virtual Transform GetLocalToWorld(float time) const {
+		return Transform();
+	}
+
+	/**
+	   Fills an array with the primitives of the accelerator, the meshes
+	   stored in Embree are refined for that
+	   @param prims vector to be filled
+	*/
+	virtual void GetPrimitives(vector<boost::shared_ptr<Primitive> > &prims) const;
+
+	/**
+	   Read configuration parameters and create a new Embree accelerator
+	   @param prims vector of primitives to store into the accelerator
+	   @param ps configuration parameters
+	*/
+	static Aggregate *CreateAccelerator(const vector<boost::shared_ptr<Primitive> > &prims, const ParamSet &ps);
+
+private:
+	/**
+	   Copy the meshes of some primitives in an Embree scene
+	   @param scene the Embree scene
+	   @param prims the primitives, all made of a triangle mesh
+	   @param geometries filled with the primitive of each Embree geometry
+	   @param flips filled with whether the normals of each Embree
+	   geometry have to be flipped
+	*/
+	static void AddMeshes(RTCScene scene,
+		const vector<boost::shared_ptr<Primitive> > &prims,
+		vector<const Primitive *> &geometries, vector<bool> &flips);
+	/**
+	   Trace random rays through this accelerator and through a QBVH
+	   built over the same primitives and log the traversal speeds
+	   @param prims the primitives of the accelerator
+	   @param nRays the number of rays to trace
+	*/
+	void Benchmark(const vector<boost::shared_ptr<Primitive> > &prims,
+		u_int nRays) const;
+
+	RTCScene scene;
+	// Primitive of each geometry of the scene, the instances are
+	// InstancePrimitive
+	vector<const Primitive *> geometries;
+	// Whether the mesh of each geometry has a reversed orientation,
+	// Mesh::GetIntersection() doesn't account for it
+	vector<bool> geometryFlips;
+	// Prototype of each geometry of the scene, noPrototype for meshes
+	vector<u_int> geometryPrototypes;
+	static const u_int noPrototype = 0xffffffffu;
+
+	// The scenes of the prototypes and the primitive of their geometries
+	vector<RTCScene> prototypeScenes;
+	vector<vector<const Primitive *> > prototypeGeometries;
+	vector<vector<bool> > prototypeGeometryFlips;
+
+	// The primitives stored in Embree, kept alive for the hits
+	vector<boost::shared_ptr<Primitive> > embreePrims;
+	// The prototypes sources, kept alive for the hits
+	vector<boost::shared_ptr<Primitive> > prototypePrims;
+
+	/**
+	   The accelerator for everything Embree can't represent
+	*/
+	boost::shared_ptr<Aggregate> others;
+
+	BBox worldBound;
+};
+
+} // namespace lux
+#endif //LUX_EMBREEACCEL_H
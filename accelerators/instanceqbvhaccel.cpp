@@ -0,0 +1,403 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.net                       *
+ ***************************************************************************/
+
+// instanceqbvhaccel.cpp*
+#include "instanceqbvhaccel.h"
+#include "paramset.h"
+#include "dynload.h"
+#include "error.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace luxrays;
+
+namespace lux
+{
+
+const u_int CompactInstance::noMaterial;
+const u_short CompactInstance::noVolume;
+
+// CompactInstance Method Definitions
+CompactInstance::CompactInstance(const InstanceQBVHAccel *accel, u_int proto,
+	const Transform &i2w, u_int mat, u_short ex, u_short in) :
+	owner(accel), prototype(proto), material(mat), exterior(ex),
+	interior(in)
+{
+	for (u_int i = 0; i < 3; ++i) {
+		for (u_int j = 0; j < 4; ++j) {
+			instanceToWorld[i][j] = i2w.m.m[i][j];
+			worldToInstance[i][j] = i2w.mInv.m[i][j];
+		}
+	}
+}
+
+Transform CompactInstance::GetTransform() const
+{
+	const float (&m)[3][4] = instanceToWorld;
+	const float (&mi)[3][4] = worldToInstance;
+	return Transform(Matrix4x4(m[0][0], m[0][1], m[0][2], m[0][3],
+		m[1][0], m[1][1], m[1][2], m[1][3],
+		m[2][0], m[2][1], m[2][2], m[2][3],
+		0.f, 0.f, 0.f, 1.f),
+		Matrix4x4(mi[0][0], mi[0][1], mi[0][2], mi[0][3],
+		mi[1][0], mi[1][1], mi[1][2], mi[1][3],
+		mi[2][0], mi[2][1], mi[2][2], mi[2][3],
+		0.f, 0.f, 0.f, 1.f));
+}
+
+BBox CompactInstance::WorldBound() const
+{
+	return GetTransform() * owner->prototypes[prototype]->WorldBound();
+}
+
+const Volume *CompactInstance::GetExterior() const
+{
+	if (exterior != noVolume)
+		return owner->volumes[exterior].get();
+	return owner->prototypes[prototype]->GetExterior();
+}
+
+const Volume *CompactInstance::GetInterior() const
+{
+	if (interior != noVolume)
+		return owner->volumes[interior].get();
+	return owner->prototypes[prototype]->GetInterior();
+}
+
+bool CompactInstance::Intersect(const Ray &r, Intersection *isect) const
+{
+	const Ray ray(ToInstance(r));
+	if (!owner->prototypes[prototype]->Intersect(ray, isect))
+		return false;
+	r.maxt = ray.maxt;
+	const Transform InstanceToWorld(GetTransform());
+	isect->ObjectToWorld = InstanceToWorld * isect->ObjectToWorld;
+	// Transform instance's differential geometry to world space
+	isect->dg *= InstanceToWorld;
+	isect->dg.handle = this;
+	isect->primitive = this;
+	if (material != noMaterial)
+		isect->material = owner->materials[material].get();
+	if (exterior != noVolume)
+		isect->exterior = owner->volumes[exterior].get();
+	if (interior != noVolume)
+		isect->interior = owner->volumes[interior].get();
+	return true;
+}
+
+bool CompactInstance::IntersectP(const Ray &r) const
+{
+	return owner->prototypes[prototype]->IntersectP(ToInstance(r));
+}
+
+void CompactInstance::GetShadingGeometry(const Transform &obj2world,
+	const DifferentialGeometry &dg, DifferentialGeometry *dgShading) const
+{
+	// Transform instance's differential geometry to world space
+	DifferentialGeometry dgl(Inverse(obj2world) * dg);
+
+	dg.ihandle->GetShadingGeometry(obj2world, dgl, dgShading);
+	*dgShading *= obj2world;
+	dgShading->handle = this;
+	dgShading->ihandle = dg.ihandle;
+}
+
+void CompactInstance::GetShadingInformation(const DifferentialGeometry &dgShading,
+	RGBColor *color, float *alpha) const
+{
+	dgShading.ihandle->GetShadingInformation(dgShading, color, alpha);
+}
+
+Transform CompactInstance::GetLocalToWorld(float time) const
+{
+	return GetTransform() *
+		owner->prototypes[prototype]->GetLocalToWorld(time);
+}
+
+// Return the index of an item in a table, adding it if needed
+template <class T> static u_int TableIndex(const boost::shared_ptr<T> &item,
+	vector<boost::shared_ptr<T> > &table, std::map<const T *, u_int> &indexes)
+{
+	typename std::map<const T *, u_int>::const_iterator it =
+		indexes.find(item.get());
+	if (it != indexes.end())
+		return it->second;
+	const u_int index = table.size();
+	table.push_back(item);
+	indexes[item.get()] = index;
+	return index;
+}
+
+// Leaf intersector for the compact instance records
+class InstanceLeaves {
+public:
+	InstanceLeaves(const vector<CompactInstance> &i) : instances(i) { }
+	bool Intersect(u_int index, const Ray &ray, Intersection *isect) const {
+		// Qualified call to avoid the virtual dispatch
+		return instances[index].CompactInstance::Intersect(ray, isect);
+	}
+	bool IntersectP(u_int index, const Ray &ray) const {
+		return instances[index].CompactInstance::IntersectP(ray);
+	}
+private:
+	const vector<CompactInstance> &instances;
+};
+
+// Leaf intersector for the motion blurred instances of a time segment
+class MotionLeaves {
+public:
+	MotionLeaves(const vector<boost::shared_ptr<Primitive> > &p,
+		const vector<u_int> &o) : prims(p), order(o) { }
+	bool Intersect(u_int index, const Ray &ray, Intersection *isect) const {
+		return prims[order[index]]->Intersect(ray, isect);
+	}
+	bool IntersectP(u_int index, const Ray &ray) const {
+		return prims[order[index]]->IntersectP(ray);
+	}
+private:
+	const vector<boost::shared_ptr<Primitive> > &prims;
+	const vector<u_int> &order;
+};
+
+// Return the motion primitive driving the bound of a primitive if any
+static const MotionPrimitive *GetMotionPrimitive(const Primitive *prim)
+{
+	const AreaLightPrimitive *alp =
+		dynamic_cast<const AreaLightPrimitive *>(prim);
+	if (alp)
+		prim = alp->GetPrimitive().get();
+	return dynamic_cast<const MotionPrimitive *>(prim);
+}
+
+/***************************************************/
+InstanceQBVHAccel::InstanceQBVHAccel(const vector<boost::shared_ptr<Primitive> > &p,
+	u_int mi, u_int ts, const string &accelName,
+	const ParamSet &accelParams) : nTimeSegments(max(ts, 1U)),
+	motionTrees(NULL), motionStart(0.f), motionScale(0.f),
+	maxInstancesPerLeaf(max(1U, min(mi, 16U)))
+{
+	// Split instances from all the other primitives
+	vector<boost::shared_ptr<Primitive> > vPrims;
+	vector<const MotionPrimitive *> motions;
+	std::map<const Primitive *, u_int> prototypeIndexes;
+	std::map<const Material *, u_int> materialIndexes;
+	std::map<const Volume *, u_int> volumeIndexes;
+	for (u_int i = 0; i < p.size(); ++i) {
+		const MotionPrimitive *mp = GetMotionPrimitive(p[i].get());
+		if (mp && p[i]->CanIntersect()) {
+			motionPrims.push_back(p[i]);
+			motions.push_back(mp);
+			continue;
+		}
+
+		const InstancePrimitive *ip =
+			dynamic_cast<const InstancePrimitive *>(p[i].get());
+		// Volume indices are 16 bits, 2 new volumes at most per instance
+		if (!ip || !ip->GetInstance()->CanIntersect() ||
+			volumes.size() + 2 >= CompactInstance::noVolume) {
+			vPrims.push_back(p[i]);
+			continue;
+		}
+
+		const u_int proto = TableIndex(ip->GetInstance(), prototypes,
+			prototypeIndexes);
+		const u_int mat = ip->GetInstanceMaterial() ?
+			TableIndex(ip->GetInstanceMaterial(), materials,
+			materialIndexes) : CompactInstance::noMaterial;
+		const u_short ex = ip->GetInstanceExterior() ?
+			static_cast<u_short>(TableIndex(ip->GetInstanceExterior(),
+			volumes, volumeIndexes)) : CompactInstance::noVolume;
+		const u_short in = ip->GetInstanceInterior() ?
+			static_cast<u_short>(TableIndex(ip->GetInstanceInterior(),
+			volumes, volumeIndexes)) : CompactInstance::noVolume;
+		instances.push_back(CompactInstance(this, proto,
+			ip->GetTransform(), mat, ex, in));
+	}
+
+	if (vPrims.size() > 0) {
+		others = MakeAccelerator(accelName, vPrims, accelParams);
+		if (!others)
+			others = MakeAccelerator("qbvh", vPrims, ParamSet());
+		if (others)
+			worldBound = others->WorldBound();
+	}
+
+	const u_int nInstances = instances.size();
+	if (nInstances > 0) {
+		BBox *bboxes = new BBox[nInstances];
+		for (u_int i = 0; i < nInstances; ++i) {
+			bboxes[i] = instances[i].WorldBound();
+			bboxes[i].Expand(MachineEpsilon::E(bboxes[i]));
+			worldBound = Union(worldBound, bboxes[i]);
+		}
+
+		LOG(LUX_DEBUG, LUX_NOERROR) << "Building instance QBVH, instances: " << nInstances;
+		vector<u_int> order;
+		instancesTree.Build(nInstances, bboxes, maxInstancesPerLeaf,
+			order);
+		delete[] bboxes;
+
+		// Reorder the records so that leaves reference contiguous ranges
+		vector<CompactInstance> sorted;
+		sorted.reserve(nInstances);
+		for (u_int i = 0; i < nInstances; ++i)
+			sorted.push_back(instances[order[i]]);
+		instances.swap(sorted);
+	}
+
+	if (motions.size() > 0)
+		BuildMotionSegments(motions, maxInstancesPerLeaf);
+
+	// Memory statistics
+	const size_t recordsMemory = instances.capacity() * sizeof(CompactInstance);
+	const size_t nodesMemory = instancesTree.GetMemorySize();
+	const size_t tablesMemory = (prototypes.capacity() +
+		materials.capacity() + volumes.capacity()) *
+		sizeof(boost::shared_ptr<Primitive>);
+	LOG(LUX_INFO, LUX_NOERROR) << "Instance QBVH: " << nInstances <<
+		" instances of " << prototypes.size() << " prototypes, " <<
+		motionPrims.size() << " motion blurred instances, " <<
+		vPrims.size() << " other primitives";
+	LOG(LUX_INFO, LUX_NOERROR) << "Instance QBVH memory: " <<
+		(recordsMemory + nodesMemory + tablesMemory) / 1024 << "kBytes (" <<
+		recordsMemory / 1024 << "kBytes records, " <<
+		nodesMemory / 1024 << "kBytes nodes, " <<
+		tablesMemory / 1024 << "kBytes tables)";
+	if (nInstances > 0)
+		LOG(LUX_INFO, LUX_NOERROR) << "Instance QBVH memory per instance: " <<
+			(recordsMemory + nodesMemory) / nInstances <<
+			" bytes (" << sizeof(InstancePrimitive) <<
+			" bytes for an InstancePrimitive)";
+}
+
+InstanceQBVHAccel::~InstanceQBVHAccel()
+{
+	delete[] motionTrees;
+}
+
+void InstanceQBVHAccel::BuildMotionSegments(const vector<const MotionPrimitive *> &motions,
+	u_int maxPerLeaf)
+{
+	const u_int nMotions = motions.size();
+
+	// Time range covered by all the motion paths
+	float tStart = INFINITY, tEnd = -INFINITY;
+	for (u_int i = 0; i < nMotions; ++i) {
+		const MotionSystem &ms = motions[i]->GetMotionSystem();
+		if (ms.interpolatedTransforms.size() == 0)
+			continue;
+		tStart = min(tStart, ms.interpolatedTransforms.front().startTime);
+		tEnd = max(tEnd, ms.interpolatedTransforms.back().endTime);
+	}
+	if (!(tEnd > tStart))
+		nTimeSegments = 1;
+	motionStart = nTimeSegments > 1 ? tStart : 0.f;
+	motionScale = nTimeSegments > 1 ? nTimeSegments / (tEnd - tStart) : 0.f;
+
+	motionTrees = new RecordQBVH[nTimeSegments];
+	motionOrders.resize(nTimeSegments);
+	BBox *bboxes = new BBox[nMotions];
+	BBox *fullBboxes = new BBox[nMotions];
+	for (u_int i = 0; i < nMotions; ++i) {
+		fullBboxes[i] = motionPrims[i]->WorldBound();
+		fullBboxes[i].Expand(MachineEpsilon::E(fullBboxes[i]));
+		worldBound = Union(worldBound, fullBboxes[i]);
+	}
+
+	double segmentArea = 0.0, fullArea = 0.0;
+	for (u_int s = 0; s < nTimeSegments; ++s) {
+		if (nTimeSegments == 1) {
+			std::copy(fullBboxes, fullBboxes + nMotions, bboxes);
+		} else {
+			const float t0 = Lerp(static_cast<float>(s) / nTimeSegments,
+				tStart, tEnd);
+			const float t1 = Lerp(static_cast<float>(s + 1) / nTimeSegments,
+				tStart, tEnd);
+			for (u_int i = 0; i < nMotions; ++i) {
+				bboxes[i] = motions[i]->WorldBound(t0, t1);
+				bboxes[i].Expand(MachineEpsilon::E(bboxes[i]));
+			}
+		}
+		for (u_int i = 0; i < nMotions; ++i) {
+			segmentArea += bboxes[i].SurfaceArea();
+			fullArea += fullBboxes[i].SurfaceArea();
+		}
+
+		motionTrees[s].Build(nMotions, bboxes, maxPerLeaf,
+			motionOrders[s]);
+	}
+	delete[] fullBboxes;
+	delete[] bboxes;
+
+	LOG(LUX_INFO, LUX_NOERROR) << "Instance QBVH motion blur: " <<
+		nTimeSegments << " time segments, average segment bound area " <<
+		(fullArea > 0.0 ? 100.0 * segmentArea / fullArea : 100.0) <<
+		"% of the full motion bound";
+}
+
+bool InstanceQBVHAccel::Intersect(const Ray &ray, Intersection *isect) const
+{
+	bool hit = others && others->Intersect(ray, isect);
+	hit |= instancesTree.Intersect(InstanceLeaves(instances), ray, isect);
+	if (motionTrees) {
+		const u_int s = TimeSegment(ray.time);
+		hit |= motionTrees[s].Intersect(MotionLeaves(motionPrims,
+			motionOrders[s]), ray, isect);
+	}
+	return hit;
+}
+
+bool InstanceQBVHAccel::IntersectP(const Ray &ray) const
+{
+	if (others && others->IntersectP(ray))
+		return true;
+	if (instancesTree.IntersectP(InstanceLeaves(instances), ray))
+		return true;
+	if (motionTrees) {
+		const u_int s = TimeSegment(ray.time);
+		return motionTrees[s].IntersectP(MotionLeaves(motionPrims,
+			motionOrders[s]), ray);
+	}
+	return false;
+}
+
+void InstanceQBVHAccel::GetPrimitives(vector<boost::shared_ptr<Primitive> > &prims) const
+{
+	if (others)
+		others->GetPrimitives(prims);
+	prims.insert(prims.end(), motionPrims.begin(), motionPrims.end());
+}
+
+Aggregate *InstanceQBVHAccel::CreateAccelerator(const vector<boost::shared_ptr<Primitive> > &prims,
+	const ParamSet &ps)
+{
+	const int maxInstancesPerLeaf = ps.FindOneInt("maxinstancesperleaf", 4);
+	const int timeSegments = ps.FindOneInt("timesegments", 8);
+	const string accelName = ps.FindOneString("baseaccelerator", "qbvh");
+	return new InstanceQBVHAccel(prims, max(maxInstancesPerLeaf, 1),
+		max(timeSegments, 1), accelName, ps);
+}
+
+static DynamicLoader::RegisterAccelerator<InstanceQBVHAccel> r("instanceqbvh");
+
+}
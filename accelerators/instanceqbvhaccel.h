@@ -0,0 +1,197 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.net                       *
+ ***************************************************************************/
+
+// instanceqbvhaccel.h*
+#ifndef LUX_INSTANCEQBVHACCEL_H
+#define LUX_INSTANCEQBVHACCEL_H
+
+#include "lux.h"
+#include "primitive.h"
+#include "recordqbvh.h"
+
+namespace lux
+{
+
+class InstanceQBVHAccel;
+
+/**
+   Compact replacement for an InstancePrimitive stored in an
+   InstanceQBVHAccel. Only the affine part of the instance transformation
+   and its inverse are kept, everything else is an index in the tables of
+   the owning accelerator.
+   It still is a Primitive because it is used as the handle of the
+   differential geometry of the hits (shading and local texture mappings).
+*/
+class CompactInstance : public Primitive {
+public:
+	CompactInstance(const InstanceQBVHAccel *accel, u_int proto,
+		const Transform &i2w, u_int mat, u_short ex, u_short in);
+	virtual ~CompactInstance() { }
+
+	virtual BBox WorldBound() const;
+	virtual const Volume *GetExterior() const;
+	virtual const Volume *GetInterior() const;
+
+	virtual bool CanIntersect() const { return true; }
+	virtual bool Intersect(const Ray &r, Intersection *isect) const;
+	virtual bool IntersectP(const Ray &r) const;
+	virtual void GetShadingGeometry(const Transform &obj2world,
+		const DifferentialGeometry &dg,
+		DifferentialGeometry *dgShading) const;
+	virtual void GetShadingInformation(const DifferentialGeometry &dgShading,
+		RGBColor *color, float *alpha) const;
+
+	virtual bool CanSample() const { return false; }
+
+	virtual Transform GetLocalToWorld(float time) const;
+
+	/**
+	   Rebuild the full instance to world transformation
+	*/
+	Transform GetTransform() const;
+
+	/**
+	   Transform a world space ray in the prototype space
+	   @param r the world space ray
+	   @return the ray in instance space, sharing mint, maxt and time
+	*/
+	inline Ray ToInstance(const Ray &r) const {
+		Ray ray(r);
+		const float (&m)[3][4] = worldToInstance;
+		ray.o.x = m[0][0] * r.o.x + m[0][1] * r.o.y + m[0][2] * r.o.z + m[0][3];
+		ray.o.y = m[1][0] * r.o.x + m[1][1] * r.o.y + m[1][2] * r.o.z + m[1][3];
+		ray.o.z = m[2][0] * r.o.x + m[2][1] * r.o.y + m[2][2] * r.o.z + m[2][3];
+		ray.d.x = m[0][0] * r.d.x + m[0][1] * r.d.y + m[0][2] * r.d.z;
+		ray.d.y = m[1][0] * r.d.x + m[1][1] * r.d.y + m[1][2] * r.d.z;
+		ray.d.z = m[2][0] * r.d.x + m[2][1] * r.d.y + m[2][2] * r.d.z;
+		return ray;
+	}
+
+	static const u_int noMaterial = 0xffffffffu;
+	static const u_short noVolume = 0xffffu;
+
+private:
+	friend class InstanceQBVHAccel;
+
+	// Rows of the affine instance to world matrix and of its inverse,
+	// the last row is always (0, 0, 0, 1)
+	float instanceToWorld[3][4];
+	float worldToInstance[3][4];
+	const InstanceQBVHAccel *owner;
+	u_int prototype, material;
+	u_short exterior, interior;
+};
+
+/**
+   Two level accelerator: a top level QBVH built over compact instance
+   records, the rays are directly transformed into the prototype
+   accelerators.
+   Motion blurred instances are stored in a separate set of QBVHs, one per
+   time segment, each built with the bounds of the instances over its
+   segment only, so that a ray only tests the bounds relevant to its time.
+   All the other primitives are stored in a base accelerator.
+*/
+class InstanceQBVHAccel : public Aggregate {
+public:
+	/**
+	   Normal constructor.
+	   @param p the vector of shared primitives to put in the accelerator
+	   @param mi the maximum number of instances per leaf
+	   @param ts the number of time segments for motion blurred instances
+	   @param accelName the accelerator used for non instanced primitives
+	   @param accelParams the parameters of that accelerator
+	*/
+	InstanceQBVHAccel(const vector<boost::shared_ptr<Primitive> > &p,
+		u_int mi, u_int ts, const string &accelName,
+		const ParamSet &accelParams);
+	virtual ~InstanceQBVHAccel();
+
+	virtual BBox WorldBound() const { return worldBound; }
+	virtual bool Intersect(const Ray &ray, Intersection *isect) const;
+	virtual bool IntersectP(const Ray &ray) const;
+	virtual Transform GetLocalToWorld(float time) const {
+		return Transform();
+	}
+
+	/**
+	   Fills an array with the non instanced primitives and the motion
+	   blurred instances, compact instances can't be shared outside of the
+	   accelerator
+	   @param prims vector to be filled
+	*/
+	virtual void GetPrimitives(vector<boost::shared_ptr<Primitive> > &prims) const;
+
+	/**
+	   Read configuration parameters and create a new instance accelerator
+	   @param prims vector of primitives to store into the accelerator
+	   @param ps configuration parameters
+	*/
+	static Aggregate *CreateAccelerator(const vector<boost::shared_ptr<Primitive> > &prims, const ParamSet &ps);
+
+private:
+	friend class CompactInstance;
+
+	void BuildMotionSegments(const vector<const MotionPrimitive *> &motions,
+		u_int maxPerLeaf);
+
+	/**
+	   Return the time segment to use for the given ray time
+	*/
+	inline u_int TimeSegment(float time) const {
+		const float s = (time - motionStart) * motionScale;
+		return min(static_cast<u_int>(max(0.f, s)), nTimeSegments - 1);
+	}
+
+	/**
+	   The instance records, sorted so that each leaf references
+	   a contiguous range
+	*/
+	vector<CompactInstance> instances;
+	RecordQBVH instancesTree;
+
+	// Tables indexed by the instance records
+	vector<boost::shared_ptr<Primitive> > prototypes;
+	vector<boost::shared_ptr<Material> > materials;
+	vector<boost::shared_ptr<Volume> > volumes;
+
+	/**
+	   The motion blurred instances, with for each time segment its tree
+	   and the leaf ordering of the motion primitives
+	*/
+	vector<boost::shared_ptr<Primitive> > motionPrims;
+	u_int nTimeSegments;
+	RecordQBVH *motionTrees;
+	vector<vector<u_int> > motionOrders;
+	float motionStart, motionScale;
+
+	/**
+	   The accelerator for everything that isn't an instance
+	*/
+	boost::shared_ptr<Aggregate> others;
+
+	BBox worldBound;
+
+	u_int maxInstancesPerLeaf;
+};
+
+} // namespace lux
+#endif //LUX_INSTANCEQBVHACCEL_H
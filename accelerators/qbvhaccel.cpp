@@ -24,39 +24,13 @@
 #include "paramset.h"
 #include "dynload.h"
 #include "error.h"
+#include "numa.h"
 
 using namespace luxrays;
 
 namespace lux
 {
 
-#if defined(WIN32) && !defined(__CYGWIN__)
-class __declspec(align(16)) QuadRay {
-#else 
-class QuadRay {
-#endif
-public:
-	QuadRay(const Ray &ray)
-	{
-		ox = _mm_set1_ps(ray.o.x);
-		oy = _mm_set1_ps(ray.o.y);
-		oz = _mm_set1_ps(ray.o.z);
-		dx = _mm_set1_ps(ray.d.x);
-		dy = _mm_set1_ps(ray.d.y);
-		dz = _mm_set1_ps(ray.d.z);
-		mint = _mm_set1_ps(ray.mint);
-		maxt = _mm_set1_ps(ray.maxt);
-	}
-
-	__m128 ox, oy, oz;
-	__m128 dx, dy, dz;
-	mutable __m128 mint, maxt;
-#if defined(WIN32) && !defined(__CYGWIN__)
-};
-#else 
-} __attribute__ ((aligned(16)));
-#endif 
-
 class QuadPrimitive : public Aggregate {
 public:
 	// Don't use references to force temporaries and increase use count
@@ -333,6 +307,7 @@ QBVHAccel::QBVHAccel(const vector<boost::shared_ptr<Primitive> > &p,
 	nQuads = 0;
 	PreSwizzle(0, primsIndexes, vPrims);
 	LOG(LUX_DEBUG,LUX_NOERROR) << "QBVH completed with " << nNodes << "/" << maxNodes << " nodes";
+	NumaInterleaveArray(nodes, nNodes);
 	
 	// Collect statistics
 	maxDepth = 0;
@@ -660,34 +635,6 @@ void QBVHAccel::CreateSwizzledLeaf(int32_t parentIndex, int32_t childIndex,
 	node.InitializeLeaf(childIndex, nbQuads, startQuad);
 }
 
-int32_t QBVHNode::BBoxIntersect(const QuadRay &ray4, const __m128 invDir[3],
-	const int sign[3]) const
-{
-	__m128 tMin = ray4.mint;
-	__m128 tMax = ray4.maxt;
-
-	// X coordinate
-	tMin = _mm_max_ps(tMin, _mm_mul_ps(_mm_sub_ps(bboxes[sign[0]][0],
-		ray4.ox), invDir[0]));
-	tMax = _mm_min_ps(tMax, _mm_mul_ps(_mm_sub_ps(bboxes[1 - sign[0]][0],
-		ray4.ox), invDir[0]));
-
-	// Y coordinate
-	tMin = _mm_max_ps(tMin, _mm_mul_ps(_mm_sub_ps(bboxes[sign[1]][1],
-		ray4.oy), invDir[1]));
-	tMax = _mm_min_ps(tMax, _mm_mul_ps(_mm_sub_ps(bboxes[1 - sign[1]][1],
-		ray4.oy), invDir[1]));
-
-	// Z coordinate
-	tMin = _mm_max_ps(tMin, _mm_mul_ps(_mm_sub_ps(bboxes[sign[2]][2],
-		ray4.oz), invDir[2]));
-	tMax = _mm_min_ps(tMax, _mm_mul_ps(_mm_sub_ps(bboxes[1 - sign[2]][2],
-		ray4.oz), invDir[2]));
-
-	//return the visit flags
-	return _mm_movemask_ps(_mm_cmpge_ps(tMax, tMin));;
-}
-
 /***************************************************/
 bool QBVHAccel::Intersect(const Ray &ray, Intersection *isect) const
 {
@@ -32,9 +32,36 @@
 namespace lux
 {
 
-class QuadRay;
 class QuadPrimitive;
 
+#if defined(WIN32) && !defined(__CYGWIN__)
+class __declspec(align(16)) QuadRay {
+#else 
+class QuadRay {
+#endif
+public:
+	QuadRay() { }
+	QuadRay(const Ray &ray)
+	{
+		ox = _mm_set1_ps(ray.o.x);
+		oy = _mm_set1_ps(ray.o.y);
+		oz = _mm_set1_ps(ray.o.z);
+		dx = _mm_set1_ps(ray.d.x);
+		dy = _mm_set1_ps(ray.d.y);
+		dz = _mm_set1_ps(ray.d.z);
+		mint = _mm_set1_ps(ray.mint);
+		maxt = _mm_set1_ps(ray.maxt);
+	}
+
+	__m128 ox, oy, oz;
+	__m128 dx, dy, dz;
+	mutable __m128 mint, maxt;
+#if defined(WIN32) && !defined(__CYGWIN__)
+};
+#else 
+} __attribute__ ((aligned(16)));
+#endif 
+
 // This code is based on Flexray by Anthony Pajot (anthony.pajot@alumni.enseeiht.fr)
 
 /**
@@ -228,8 +255,33 @@ public:
 	   @return an int used to index the array of paths in the bboxes
 	   (the visit array)
 	*/
-	int32_t inline BBoxIntersect(const QuadRay &ray4, const __m128 invDir[3],
-		const int sign[3]) const;
+	inline int32_t BBoxIntersect(const QuadRay &ray4, const __m128 invDir[3],
+		const int sign[3]) const
+	{
+		__m128 tMin = ray4.mint;
+		__m128 tMax = ray4.maxt;
+
+		// X coordinate
+		tMin = _mm_max_ps(tMin, _mm_mul_ps(_mm_sub_ps(bboxes[sign[0]][0],
+			ray4.ox), invDir[0]));
+		tMax = _mm_min_ps(tMax, _mm_mul_ps(_mm_sub_ps(bboxes[1 - sign[0]][0],
+			ray4.ox), invDir[0]));
+
+		// Y coordinate
+		tMin = _mm_max_ps(tMin, _mm_mul_ps(_mm_sub_ps(bboxes[sign[1]][1],
+			ray4.oy), invDir[1]));
+		tMax = _mm_min_ps(tMax, _mm_mul_ps(_mm_sub_ps(bboxes[1 - sign[1]][1],
+			ray4.oy), invDir[1]));
+
+		// Z coordinate
+		tMin = _mm_max_ps(tMin, _mm_mul_ps(_mm_sub_ps(bboxes[sign[2]][2],
+			ray4.oz), invDir[2]));
+		tMax = _mm_min_ps(tMax, _mm_mul_ps(_mm_sub_ps(bboxes[1 - sign[2]][2],
+			ray4.oz), invDir[2]));
+
+		//return the visit flags
+		return _mm_movemask_ps(_mm_cmpge_ps(tMax, tMin));;
+	}
 };
 
 /***************************************************/
@@ -0,0 +1,221 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// recordqbvh.cpp*
+#include "recordqbvh.h"
+#include "error.h"
+
+#include <cstring>
+
+using namespace luxrays;
+
+namespace lux
+{
+
+// RecordQBVH Method Definitions
+RecordQBVH::~RecordQBVH()
+{
+	if (nodes)
+		FreeAligned(nodes);
+}
+
+bool RecordQBVH::Build(u_int n, const BBox *bboxes, u_int maxPerLeaf,
+	vector<u_int> &order)
+{
+	if (n > maxRecords) {
+		LOG(LUX_ERROR, LUX_LIMIT) << "Unable to build a record QBVH over " <<
+			n << " records, the limit is " << maxRecords;
+		order.clear();
+		return false;
+	}
+	order.resize(n);
+	if (n == 0)
+		return true;
+	maxPerLeaf = max(1U, min(maxPerLeaf, 16U));
+
+	Point *centroids = new Point[n];
+	BBox nodeBbox, centroidsBbox;
+	for (u_int i = 0; i < n; ++i) {
+		order[i] = i;
+		centroids[i] = (bboxes[i].pMin + bboxes[i].pMax) * .5f;
+		nodeBbox = Union(nodeBbox, bboxes[i]);
+		centroidsBbox = Union(centroidsBbox, centroids[i]);
+	}
+
+	// Same bound as the QBVH, grown on demand
+	maxNodes = 1;
+	for (u_int layer = ((n + maxPerLeaf - 1) / maxPerLeaf + 3) / 4; layer > 1; layer = (layer + 3) / 4)
+		maxNodes += layer;
+	nodes = AllocAligned<QBVHNode>(maxNodes);
+	for (u_int i = 0; i < maxNodes; ++i)
+		nodes[i] = QBVHNode();
+
+	BuildTree(0, n, &order[0], bboxes, centroids, nodeBbox, centroidsBbox,
+		-1, 0, 0, maxPerLeaf);
+
+	delete[] centroids;
+	return true;
+}
+
+int32_t RecordQBVH::CreateIntermediateNode(int32_t parentIndex,
+	int32_t childIndex, const BBox &nodeBbox)
+{
+	int32_t index = nNodes++; // increment after assignment
+	if (nNodes >= maxNodes) {
+		QBVHNode *newNodes = AllocAligned<QBVHNode>(2 * maxNodes);
+		memcpy(newNodes, nodes, sizeof(QBVHNode) * maxNodes);
+		for (u_int i = 0; i < maxNodes; ++i)
+			newNodes[maxNodes + i] = QBVHNode();
+		FreeAligned(nodes);
+		nodes = newNodes;
+		maxNodes *= 2;
+	}
+
+	if (parentIndex >= 0) {
+		nodes[parentIndex].children[childIndex] = index;
+		nodes[parentIndex].SetBBox(childIndex, nodeBbox);
+	}
+	return index;
+}
+
+void RecordQBVH::CreateLeaf(int32_t parentIndex, int32_t childIndex,
+	u_int start, u_int end, const BBox &nodeBbox)
+{
+	if (parentIndex < 0) {
+		// The entire tree is a leaf
+		nNodes = 1;
+		parentIndex = 0;
+	}
+
+	QBVHNode &node = nodes[parentIndex];
+	node.SetBBox(childIndex, nodeBbox);
+	// Leaves directly encode the number of records
+	node.InitializeLeaf(childIndex, end - start, start);
+}
+
+void RecordQBVH::BuildTree(u_int start, u_int end, u_int *indexes,
+	const BBox *bboxes, const Point *centroids, const BBox &nodeBbox,
+	const BBox &centroidsBbox, int32_t parentIndex, int32_t childIndex,
+	int depth, u_int maxPerLeaf)
+{
+	if (end - start <= maxPerLeaf) {
+		CreateLeaf(parentIndex, childIndex, start, end, nodeBbox);
+		return;
+	}
+
+	// Binned SAH object split along the largest centroids extent
+	const int axis = centroidsBbox.MaximumExtent();
+	const float k0 = centroidsBbox.pMin[axis];
+	const float k1 = OBJECT_SPLIT_BINS / (centroidsBbox.pMax[axis] - k0);
+
+	BBox leftChildBbox, rightChildBbox;
+	BBox leftChildCentroidsBbox, rightChildCentroidsBbox;
+	u_int storeIndex = start;
+	if (isinf(k1) || depth > maxSAHDepth) {
+		// All centroids are the same or the tree is degenerated, split
+		// at the middle of the records so that none of them is lost
+		storeIndex = start + (end - start) / 2;
+		for (u_int i = start; i < storeIndex; ++i) {
+			leftChildBbox = Union(leftChildBbox, bboxes[indexes[i]]);
+			leftChildCentroidsBbox = Union(leftChildCentroidsBbox, centroids[indexes[i]]);
+		}
+		for (u_int i = storeIndex; i < end; ++i) {
+			rightChildBbox = Union(rightChildBbox, bboxes[indexes[i]]);
+			rightChildCentroidsBbox = Union(rightChildCentroidsBbox, centroids[indexes[i]]);
+		}
+	} else {
+		u_int bins[OBJECT_SPLIT_BINS];
+		BBox binsBbox[OBJECT_SPLIT_BINS];
+		for (int i = 0; i < OBJECT_SPLIT_BINS; ++i)
+			bins[i] = 0;
+		for (u_int i = start; i < end; ++i) {
+			const u_int index = indexes[i];
+			const int binId = max(0, min(OBJECT_SPLIT_BINS - 1,
+				Floor2Int(k1 * (centroids[index][axis] - k0))));
+			++bins[binId];
+			binsBbox[binId] = Union(binsBbox[binId], bboxes[index]);
+		}
+
+		float areaRight[OBJECT_SPLIT_BINS];
+		u_int countRight[OBJECT_SPLIT_BINS];
+		BBox bboxRight;
+		u_int nRight = 0;
+		for (int i = OBJECT_SPLIT_BINS - 1; i >= 0; --i) {
+			bboxRight = Union(bboxRight, binsBbox[i]);
+			nRight += bins[i];
+			areaRight[i] = bboxRight.SurfaceArea();
+			countRight[i] = nRight;
+		}
+
+		int minBin = 0;
+		float minCost = INFINITY;
+		BBox bboxLeft;
+		u_int nLeft = 0;
+		for (int i = 0; i < OBJECT_SPLIT_BINS - 1; ++i) {
+			bboxLeft = Union(bboxLeft, binsBbox[i]);
+			nLeft += bins[i];
+			const float cost = bboxLeft.SurfaceArea() * nLeft +
+				areaRight[i + 1] * countRight[i + 1];
+			if (cost < minCost) {
+				minBin = i;
+				minCost = cost;
+			}
+		}
+
+		// Partition, using the same bin computation than the binning
+		for (u_int i = start; i < end; ++i) {
+			const u_int index = indexes[i];
+			const int binId = max(0, min(OBJECT_SPLIT_BINS - 1,
+				Floor2Int(k1 * (centroids[index][axis] - k0))));
+			if (binId <= minBin) {
+				indexes[i] = indexes[storeIndex];
+				indexes[storeIndex] = index;
+				++storeIndex;
+				leftChildBbox = Union(leftChildBbox, bboxes[index]);
+				leftChildCentroidsBbox = Union(leftChildCentroidsBbox, centroids[index]);
+			} else {
+				rightChildBbox = Union(rightChildBbox, bboxes[index]);
+				rightChildCentroidsBbox = Union(rightChildCentroidsBbox, centroids[index]);
+			}
+		}
+	}
+
+	int32_t currentNode = parentIndex;
+	int32_t leftChildIndex = childIndex;
+	int32_t rightChildIndex = childIndex + 1;
+
+	// Create an intermediate node every 2 levels of the binary hierarchy
+	if (depth % 2 == 0) {
+		currentNode = CreateIntermediateNode(parentIndex, childIndex, nodeBbox);
+		leftChildIndex = 0;
+		rightChildIndex = 2;
+	}
+
+	BuildTree(start, storeIndex, indexes, bboxes, centroids,
+		leftChildBbox, leftChildCentroidsBbox, currentNode,
+		leftChildIndex, depth + 1, maxPerLeaf);
+	BuildTree(storeIndex, end, indexes, bboxes, centroids,
+		rightChildBbox, rightChildCentroidsBbox, currentNode,
+		rightChildIndex, depth + 1, maxPerLeaf);
+}
+
+} // namespace lux
@@ -0,0 +1,304 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// recordqbvh.h*
+#ifndef LUX_RECORDQBVH_H
+#define LUX_RECORDQBVH_H
+
+#include "lux.h"
+#include "qbvhaccel.h"
+
+namespace lux
+{
+
+/**
+   A QBVH over records referenced by index. Leaves directly encode a range
+   of up to 16 records in the order computed at build time.
+*/
+class RecordQBVH {
+public:
+	RecordQBVH() : nodes(NULL), nNodes(0), maxNodes(0) { }
+	~RecordQBVH();
+
+	/**
+	   Build the tree with a binned SAH object split
+	   @param n the number of records, at most maxRecords
+	   @param bboxes the world bounding box of each record
+	   @param maxPerLeaf the maximum number of records per leaf (max 16)
+	   @param order will contain the record indices in leaf order,
+	   leaves reference ranges of this array
+	   @return false if there are too many records, the tree is then
+	   left empty
+	*/
+	bool Build(u_int n, const BBox *bboxes, u_int maxPerLeaf,
+		vector<u_int> &order);
+
+	// Leaves store the position of their first record on 27 bits
+	static const u_int maxRecords = 0x07ffffffu;
+
+	/**
+	   Traverse the tree, calling Intersect(index, ray, isect) on the
+	   leaf intersector for each position of the leaf ranges
+	*/
+	template <class T> bool Intersect(const T &leaves, const Ray &ray,
+		Intersection *isect) const;
+	/**
+	   Traverse the tree, calling IntersectP(index, ray) on the
+	   leaf intersector for each position of the leaf ranges
+	*/
+	template <class T> bool IntersectP(const T &leaves,
+		const Ray &ray) const;
+	/**
+	   Traverse the tree with a packet of up to 16 rays sharing the same
+	   direction signs, calling Intersect(index, rayIndex, ray) on the leaf
+	   intersector for each position of the leaf ranges and each ray of
+	   the packet reaching the leaf. The intersector shortens ray.maxt
+	   when it finds a closer hit.
+	*/
+	template <class T> void IntersectPacket(const T &leaves,
+		const Ray *rays, u_int nRays) const;
+
+	bool IsEmpty() const { return nodes == NULL; }
+	size_t GetMemorySize() const { return maxNodes * sizeof(QBVHNode); }
+
+private:
+	RecordQBVH(const RecordQBVH &);
+	RecordQBVH &operator=(const RecordQBVH &);
+
+	void BuildTree(u_int start, u_int end, u_int *indexes,
+		const BBox *bboxes, const Point *centroids, const BBox &nodeBbox,
+		const BBox &centroidsBbox, int32_t parentIndex,
+		int32_t childIndex, int depth, u_int maxPerLeaf);
+	int32_t CreateIntermediateNode(int32_t parentIndex, int32_t childIndex,
+		const BBox &nodeBbox);
+	void CreateLeaf(int32_t parentIndex, int32_t childIndex, u_int start,
+		u_int end, const BBox &nodeBbox);
+
+	// Number of binary levels split with the SAH, deeper levels split at
+	// the median of the records which adds at most 32 more levels
+	static const int maxSAHDepth = 64;
+	// There are 2 binary levels per node and the traversal of a node
+	// replaces 1 stack entry with up to 4
+	static const u_int stackSize = 3 * (maxSAHDepth + 32) / 2 + 1;
+
+	QBVHNode *nodes;
+	u_int nNodes, maxNodes;
+};
+
+template <class T> inline bool RecordQBVH::Intersect(const T &leaves,
+	const Ray &ray, Intersection *isect) const
+{
+	if (!nodes)
+		return false;
+
+	//------------------------------
+	// Prepare the ray for intersection
+	QuadRay ray4(ray);
+	__m128 invDir[3];
+	invDir[0] = _mm_set1_ps(1.f / ray.d.x);
+	invDir[1] = _mm_set1_ps(1.f / ray.d.y);
+	invDir[2] = _mm_set1_ps(1.f / ray.d.z);
+
+	int signs[3];
+	ray.GetDirectionSigns(signs);
+
+	//------------------------------
+	// Main loop
+	bool hit = false;
+	int todoNode = 0; // the index in the stack
+	int32_t nodeStack[stackSize];
+	nodeStack[0] = 0; // first node to handle: root node
+
+	while (todoNode >= 0) {
+		// Leaves are identified by a negative index
+		if (!QBVHNode::IsLeaf(nodeStack[todoNode])) {
+			QBVHNode &node = nodes[nodeStack[todoNode]];
+			--todoNode;
+
+			const int32_t visit = node.BBoxIntersect(ray4, invDir,
+				signs);
+
+			if (visit & 0x1)
+				nodeStack[++todoNode] = node.children[0];
+			if (visit & 0x2)
+				nodeStack[++todoNode] = node.children[1];
+			if (visit & 0x4)
+				nodeStack[++todoNode] = node.children[2];
+			if (visit & 0x8)
+				nodeStack[++todoNode] = node.children[3];
+		} else {
+			const int32_t leafData = nodeStack[todoNode];
+			--todoNode;
+
+			if (QBVHNode::IsEmpty(leafData))
+				continue;
+
+			const u_int nbRecords = QBVHNode::NbQuadPrimitives(leafData);
+			const u_int offset = QBVHNode::FirstQuadIndex(leafData);
+			for (u_int i = offset; i < offset + nbRecords; ++i) {
+				if (leaves.Intersect(i, ray, isect)) {
+					hit = true;
+					ray4.maxt = _mm_set1_ps(ray.maxt);
+				}
+			}
+		}
+	}
+
+	return hit;
+}
+
+template <class T> inline bool RecordQBVH::IntersectP(const T &leaves,
+	const Ray &ray) const
+{
+	if (!nodes)
+		return false;
+
+	//------------------------------
+	// Prepare the ray for intersection
+	QuadRay ray4(ray);
+	__m128 invDir[3];
+	invDir[0] = _mm_set1_ps(1.f / ray.d.x);
+	invDir[1] = _mm_set1_ps(1.f / ray.d.y);
+	invDir[2] = _mm_set1_ps(1.f / ray.d.z);
+
+	int signs[3];
+	ray.GetDirectionSigns(signs);
+
+	//------------------------------
+	// Main loop
+	int todoNode = 0; // the index in the stack
+	int32_t nodeStack[stackSize];
+	nodeStack[0] = 0; // first node to handle: root node
+
+	while (todoNode >= 0) {
+		// Leaves are identified by a negative index
+		if (!QBVHNode::IsLeaf(nodeStack[todoNode])) {
+			QBVHNode &node = nodes[nodeStack[todoNode]];
+			--todoNode;
+
+			const int32_t visit = node.BBoxIntersect(ray4, invDir,
+				signs);
+
+			if (visit & 0x1)
+				nodeStack[++todoNode] = node.children[0];
+			if (visit & 0x2)
+				nodeStack[++todoNode] = node.children[1];
+			if (visit & 0x4)
+				nodeStack[++todoNode] = node.children[2];
+			if (visit & 0x8)
+				nodeStack[++todoNode] = node.children[3];
+		} else {
+			const int32_t leafData = nodeStack[todoNode];
+			--todoNode;
+
+			if (QBVHNode::IsEmpty(leafData))
+				continue;
+
+			const u_int nbRecords = QBVHNode::NbQuadPrimitives(leafData);
+			const u_int offset = QBVHNode::FirstQuadIndex(leafData);
+			for (u_int i = offset; i < offset + nbRecords; ++i) {
+				if (leaves.IntersectP(i, ray))
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+template <class T> inline void RecordQBVH::IntersectPacket(const T &leaves,
+	const Ray *rays, u_int nRays) const
+{
+	if (!nodes || nRays == 0)
+		return;
+	nRays = min(nRays, 16U);
+
+	//------------------------------
+	// Prepare the rays for intersection
+	QuadRay ray4[16];
+	__m128 invDir[16][3];
+	for (u_int r = 0; r < nRays; ++r) {
+		ray4[r] = QuadRay(rays[r]);
+		invDir[r][0] = _mm_set1_ps(1.f / rays[r].d.x);
+		invDir[r][1] = _mm_set1_ps(1.f / rays[r].d.y);
+		invDir[r][2] = _mm_set1_ps(1.f / rays[r].d.z);
+	}
+
+	int signs[3];
+	rays[0].GetDirectionSigns(signs);
+
+	//------------------------------
+	// Main loop, each stack entry carries the mask of the rays
+	// that reached the node
+	int todoNode = 0; // the index in the stack
+	int32_t nodeStack[stackSize];
+	u_int maskStack[stackSize];
+	nodeStack[0] = 0; // first node to handle: root node
+	maskStack[0] = (1U << nRays) - 1;
+
+	while (todoNode >= 0) {
+		const int32_t nodeData = nodeStack[todoNode];
+		const u_int mask = maskStack[todoNode];
+		--todoNode;
+
+		// Leaves are identified by a negative index
+		if (!QBVHNode::IsLeaf(nodeData)) {
+			const QBVHNode &node = nodes[nodeData];
+
+			u_int childMasks[4] = { 0, 0, 0, 0 };
+			for (u_int r = 0; r < nRays; ++r) {
+				if (!(mask & (1U << r)))
+					continue;
+				const int32_t visit = node.BBoxIntersect(ray4[r],
+					invDir[r], signs);
+				for (u_int c = 0; c < 4; ++c) {
+					if (visit & (1 << c))
+						childMasks[c] |= 1U << r;
+				}
+			}
+
+			for (u_int c = 0; c < 4; ++c) {
+				if (childMasks[c]) {
+					nodeStack[++todoNode] = node.children[c];
+					maskStack[todoNode] = childMasks[c];
+				}
+			}
+		} else {
+			if (QBVHNode::IsEmpty(nodeData))
+				continue;
+
+			const u_int nbRecords = QBVHNode::NbQuadPrimitives(nodeData);
+			const u_int offset = QBVHNode::FirstQuadIndex(nodeData);
+			for (u_int r = 0; r < nRays; ++r) {
+				if (!(mask & (1U << r)))
+					continue;
+				for (u_int i = offset; i < offset + nbRecords; ++i) {
+					if (leaves.Intersect(i, r, rays[r]))
+						ray4[r].maxt = _mm_set1_ps(rays[r].maxt);
+				}
+			}
+		}
+	}
+}
+
+} // namespace lux
+#endif //LUX_RECORDQBVH_H
@@ -25,12 +25,18 @@
 #include "paramset.h"
 #include "error.h"
 #include "dynload.h"
+#include "numa.h"
 #include "luxrays/core/epsilon.h"
 using luxrays::MachineEpsilon;
 
+#include <boost/bind.hpp>
+
 using namespace luxrays;
 using namespace lux;
 
+// Minimum number of primitives of a subtree to build it as a separate task
+static const int minTaskPrims = 4096;
+
 // TaBRecKdTreeAccel Method Definitions
 TaBRecKdTreeAccel::TaBRecKdTreeAccel(const vector<boost::shared_ptr<Primitive> > &p,
         int icost, int tcost,
@@ -71,59 +77,137 @@ TaBRecKdTreeAccel::TaBRecKdTreeAccel(const vector<boost::shared_ptr<Primitive> >
         primBounds.push_back(b);
     }
 
-    // Allocate working memory for kd-tree construction
+	LOG(LUX_DEBUG,LUX_NOERROR)<< "Building KDTree, primitives: " << nPrims;;
+    // Build the subtrees with the task pool, the calling thread takes
+    // part in the construction
+    TaBRecKdBuildTask root(bounds, vPrims.size(), maxDepth, 0);
+    for (u_int i = 0; i < vPrims.size(); ++i)
+        root.primNums[i] = i;
+    TaskGroup group;
+    buildSubtree(group, &root, &primBounds);
+    group.Wait();
+
+    // Link the subtrees in a single array of nodes
+    nextFreeNode = nAllocedNodes = root.CountNodes();
+    nodes = AllocAligned<TaBRecKdAccelNode>(nAllocedNodes);
+    flattenTree(root, 0);
+    NumaInterleaveArray(nodes, nAllocedNodes);
+}
+
+TaBRecKdTreeAccel::~TaBRecKdTreeAccel() {
+	for(u_int i=0; i<nPrims; i++)
+		prims[i].~shared_ptr();
+    FreeAligned(prims);
+    FreeAligned(nodes);
+}
+
+void TaBRecKdTreeAccel::buildSubtree(TaskGroup &group,
+        TaBRecKdBuildTask *task, const vector<BBox> *primBounds) {
+    // Allocate working memory for the subtree construction
+    const int nP = task->primNums.size();
     TaBRecBoundEdge *edges[3];
     for (int i = 0; i < 3; ++i)
-        edges[i] = new TaBRecBoundEdge[2*vPrims.size()];
-    int *prims0 = new int[vPrims.size()];
-    int *prims1 = new int[(maxDepth+1) * vPrims.size()];
-    // Initialize _primNums_ for kd-tree construction
-    int *primNums = new int[vPrims.size()];
-    for (u_int i = 0; i < vPrims.size(); ++i)
-        primNums[i] = i;
+        edges[i] = new TaBRecBoundEdge[2*nP];
+    int *prims0 = new int[nP];
+    int *prims1 = new int[(task->depth+1) * nP];
 
-	LOG(LUX_DEBUG,LUX_NOERROR)<< "Building KDTree, primitives: " << nPrims;;
-    // Start recursive construction of kd-tree
-    buildTree(0, bounds, primBounds, primNums,
-            vPrims.size(), maxDepth, edges,
-            prims0, prims1);
-    // Free working memory for kd-tree construction
-    delete[] primNums;
+    buildTree(group, *task, 0, task->bounds, *primBounds,
+            nP > 0 ? &task->primNums[0] : NULL, nP, task->depth,
+            edges, prims0, prims1, task->badRefines);
+
+    // Free working memory for the subtree construction
     for (int i = 0; i < 3; ++i)
         delete[] edges[i];
     delete[] prims0;
     delete[] prims1;
 }
 
-TaBRecKdTreeAccel::~TaBRecKdTreeAccel() {
-	for(u_int i=0; i<nPrims; i++)
-		prims[i].~shared_ptr();
-    FreeAligned(prims);
-    FreeAligned(nodes);
+int TaBRecKdBuildTask::CountNodes() const {
+    int n = nodes.size();
+    for (u_int i = 0; i < children.size(); ++i)
+        n += children[i].second->CountNodes();
+    return n;
+}
+
+int TaBRecKdTreeAccel::flattenTree(const TaBRecKdBuildTask &task,
+        int offset) {
+    for (u_int i = 0; i < task.nodes.size(); ++i) {
+        TaBRecKdAccelNode &node = nodes[offset + i];
+        node = task.nodes[i];
+        // Leaves reference their primitives in the task until here
+        if (node.IsLeaf()) {
+            int *primNums = task.leafPrimNums.empty() ? NULL :
+                    const_cast<int *>(&task.leafPrimNums[0]) + node.aboveChild;
+            node.initLeaf(primNums, node.nPrimitives(), prims, arena);
+        } else
+            node.aboveChild += offset;
+    }
+    int nextOffset = offset + task.nodes.size();
+    for (u_int i = 0; i < task.children.size(); ++i) {
+        nodes[offset + task.children[i].first].aboveChild = nextOffset;
+        nextOffset = flattenTree(*task.children[i].second, nextOffset);
+    }
+    return nextOffset;
+}
+
+// Map a float to an unsigned integer with the same ordering
+static inline u_int edgeKey(float t) {
+    union { float f; u_int u; } v;
+    // Dade - adding 0 turns -0 into +0 so that both compare equal
+    v.f = t + 0.f;
+    return (v.u & 0x80000000u) ? ~v.u : (v.u | 0x80000000u);
 }
 
-void TaBRecKdTreeAccel::buildTree(int nodeNum,
+// Sort edges with a 3 passes LSD radix sort in linear time, the edges are
+// expected with all the starting edges first so that the stable sort
+// gives the same order as TaBRecBoundEdge::operator<
+static void sortEdges(TaBRecBoundEdge *edges, TaBRecBoundEdge *buffer,
+        int nEdges) {
+    if (nEdges < 128) {
+        sort(edges, edges + nEdges);
+        return;
+    }
+    static const int bits[3] = { 11, 11, 10 };
+    u_int counts[3][2048];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < nEdges; ++i) {
+        const u_int key = edgeKey(edges[i].t);
+        ++counts[0][key & 0x7ff];
+        ++counts[1][(key >> 11) & 0x7ff];
+        ++counts[2][key >> 22];
+    }
+    TaBRecBoundEdge *src = edges, *dst = buffer;
+    int shift = 0;
+    for (int pass = 0; pass < 3; ++pass) {
+        // Turn the counts into starting offsets
+        u_int sum = 0;
+        for (int b = 0; b < (1 << bits[pass]); ++b) {
+            const u_int c = counts[pass][b];
+            counts[pass][b] = sum;
+            sum += c;
+        }
+        const u_int mask = (1u << bits[pass]) - 1;
+        for (int i = 0; i < nEdges; ++i)
+            dst[counts[pass][(edgeKey(src[i].t) >> shift) & mask]++] = src[i];
+        std::swap(src, dst);
+        shift += bits[pass];
+    }
+    // After an odd number of passes the result is in the buffer
+    memcpy(edges, src, nEdges * sizeof(TaBRecBoundEdge));
+}
+
+void TaBRecKdTreeAccel::buildTree(TaskGroup &group,
+        TaBRecKdBuildTask &task, int nodeNum,
         const BBox &nodeBounds,
         const vector<BBox> &allPrimBounds, int *primNums,
         int nP, int depth, TaBRecBoundEdge *edges[3],
         int *prims0, int *prims1, int badRefines) {
-    BOOST_ASSERT(nodeNum == nextFreeNode); // NOBOOK
-    // Get next free node from _nodes_ array
-    if (nextFreeNode == nAllocedNodes) {
-        int nAlloc = max(2 * nAllocedNodes, 512);
-        TaBRecKdAccelNode *n = AllocAligned<TaBRecKdAccelNode>(nAlloc);
-        if (nAllocedNodes > 0) {
-            memcpy(n, nodes,
-                    nAllocedNodes * sizeof(TaBRecKdAccelNode));
-            FreeAligned(nodes);
-        }
-        nodes = n;
-        nAllocedNodes = nAlloc;
-    }
-    ++nextFreeNode;
+    BOOST_ASSERT(nodeNum == static_cast<int>(task.nodes.size())); // NOBOOK
+    // Get next free node from the task nodes
+    task.nodes.push_back(TaBRecKdAccelNode());
     // Initialize leaf node if termination criteria met
     if (nP <= maxPrims || depth == 0) {
-        nodes[nodeNum].initLeaf(primNums, nP, prims, arena);
+        task.initLeaf(nodeNum, primNums, nP);
         return;
     }
     // Initialize interior node and continue recursion
@@ -140,16 +224,17 @@ void TaBRecKdTreeAccel::buildTree(int nodeNum,
     else axis = (d.y > d.z) ? 1 : 2;
     int retries = 0;
     retrySplit:
-        // Initialize edges for _axis_
+        // Initialize edges for _axis_, starting edges first
         for (int i = 0; i < nP; ++i) {
             int pn = primNums[i];
             const BBox &bbox = allPrimBounds[pn];
-            edges[axis][2*i] =
+            edges[axis][i] =
                     TaBRecBoundEdge(bbox.pMin[axis], pn, true);
-            edges[axis][2*i+1] =
+            edges[axis][nP+i] =
                     TaBRecBoundEdge(bbox.pMax[axis], pn, false);
         }
-    sort(&edges[axis][0], &edges[axis][2*nP]);
+    // The edges of the next axis aren't in use and serve as sort buffer
+    sortEdges(&edges[axis][0], &edges[(axis+1) % 3][0], 2*nP);
     // Compute cost of all splits for _axis_ to find best
     int nBelow = 0, nAbove = nP;
     for (int i = 0; i < 2*nP; ++i) {
@@ -191,7 +276,7 @@ void TaBRecKdTreeAccel::buildTree(int nodeNum,
     if (bestCost > oldCost) ++badRefines;
     if ((bestCost > 4.f * oldCost && nP < 16) ||
             bestAxis == -1 || badRefines == 3) {
-        nodes[nodeNum].initLeaf(primNums, nP, prims, arena);
+        task.initLeaf(nodeNum, primNums, nP);
         return;
     }
     // Classify primitives with respect to split
@@ -204,15 +289,30 @@ void TaBRecKdTreeAccel::buildTree(int nodeNum,
             prims1[n1++] = edges[bestAxis][i].primNum;
     // Recursively initialize children nodes
     float tsplit = edges[bestAxis][bestOffset].t;
-    nodes[nodeNum].initInterior(bestAxis, tsplit);
+    task.nodes[nodeNum].initInterior(bestAxis, tsplit);
     BBox bounds0 = nodeBounds, bounds1 = nodeBounds;
     bounds0.pMax[bestAxis] = bounds1.pMin[bestAxis] = tsplit;
-    buildTree(nodeNum+1, bounds0,
+    // Hand large enough above children to another thread, the copy of
+    // their primitives frees the scratch memory of this thread
+    const bool spawn = n1 >= minTaskPrims &&
+            TaskPool::Global().GetThreadCount() > 1;
+    if (spawn) {
+        boost::shared_ptr<TaBRecKdBuildTask> child(new TaBRecKdBuildTask(
+                bounds1, n1, depth-1, badRefines));
+        memcpy(&child->primNums[0], prims1, n1 * sizeof(int));
+        task.children.push_back(std::make_pair(nodeNum, child));
+        group.Run(boost::bind(&TaBRecKdTreeAccel::buildSubtree, this,
+                boost::ref(group), child.get(), &allPrimBounds),
+                "kd-tree subtree");
+    }
+    buildTree(group, task, nodeNum+1, bounds0,
             allPrimBounds, prims0, n0, depth-1, edges,
             prims0, prims1 + nP, badRefines);
-    nodes[nodeNum].aboveChild = nextFreeNode;
-    buildTree(nodes[nodeNum].aboveChild, bounds1, allPrimBounds,
-            prims1, n1, depth-1, edges,
+    if (spawn)
+        return;
+    task.nodes[nodeNum].aboveChild = task.nodes.size();
+    buildTree(group, task, task.nodes[nodeNum].aboveChild, bounds1,
+            allPrimBounds, prims1, n1, depth-1, edges,
             prims0, prims1 + nP, badRefines);
 }
 
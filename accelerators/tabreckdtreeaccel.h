@@ -26,6 +26,7 @@
 // tabreckdtree.cpp*
 #include "lux.h"
 #include "primitive.h"
+#include "taskpool.h"
 
 namespace lux
 {
@@ -136,6 +137,39 @@ struct TaBRecInverseMailboxes {
     }
 };
 
+class TaBRecKdTreeAccel;
+
+/**
+   A subtree of the kd-tree built by a single thread. The nodes are
+   numbered locally, the leaves reference their primitives in leafPrimNums
+   and the above children handed to other threads are linked when the
+   subtrees are gathered in the final array of nodes.
+*/
+struct TaBRecKdBuildTask {
+    TaBRecKdBuildTask(const BBox &b, int np, int d, int br) :
+            bounds(b), primNums(np), depth(d), badRefines(br) { }
+
+    void initLeaf(int nodeNum, const int *leafPrims, int np) {
+        TaBRecKdAccelNode &node(nodes[nodeNum]);
+        node.nPrims = np << 2;
+        node.flags |= 3;
+        node.aboveChild = leafPrimNums.size();
+        leafPrimNums.insert(leafPrimNums.end(), leafPrims, leafPrims + np);
+    }
+    int CountNodes() const;
+
+    // Root of the subtree
+    BBox bounds;
+    vector<int> primNums;
+    int depth, badRefines;
+
+    vector<TaBRecKdAccelNode> nodes;
+    vector<int> leafPrimNums;
+    // Local index of the parent node and subtree of the above children
+    // built by other tasks
+    vector<std::pair<int, boost::shared_ptr<TaBRecKdBuildTask> > > children;
+};
+
 // TaBRecKdTreeAccel Declarations
 class  TaBRecKdTreeAccel : public Aggregate {
 public:
@@ -157,11 +191,15 @@ public:
     static Aggregate *CreateAccelerator(const vector<boost::shared_ptr<Primitive> > &prims, const ParamSet &ps);
 
 private:
-    void buildTree(int nodeNum, const BBox &bounds,
+    void buildSubtree(TaskGroup &group, TaBRecKdBuildTask *task,
+            const vector<BBox> *primBounds);
+    void buildTree(TaskGroup &group, TaBRecKdBuildTask &task,
+            int nodeNum, const BBox &bounds,
             const vector<BBox> &primBounds,
             int *primNums, int nprims, int depth,
             TaBRecBoundEdge *edges[3],
             int *prims0, int *prims1, int badRefines = 0);
+    int flattenTree(const TaBRecKdBuildTask &task, int offset);
     // TaBRecKdTreeAccel Private Data
     BBox bounds;
     int isectCost, traversalCost, maxPrims;
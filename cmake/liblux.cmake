@@ -58,6 +58,7 @@ SOURCE_GROUP("Source Files\\Core\\Generated" FILES ${lux_core_generated_src})
 
 SET(lux_core_src
 	core/api.cpp
+	core/assetcache.cpp
 	core/asyncstream.cpp
 	core/camera.cpp
 	core/cameraresponse.cpp
@@ -67,22 +68,28 @@ SET(lux_core_src
 	core/dynload.cpp
 	core/exrio.cpp
 	core/filedata.cpp
+	core/filetransfer.cpp
 	core/film.cpp
 	core/igiio.cpp
 	core/imagereader.cpp
 	core/light.cpp
 	core/material.cpp
+	core/metrics.cpp
+	core/numa.cpp
 	core/osfunc.cpp
 	core/paramset.cpp
 	core/photonmap.cpp
 	core/pngio.cpp
 	core/primitive.cpp
+	core/rendercounters.cpp
 	core/rendererstatistics.cpp
 	core/renderfarm.cpp
 	core/renderinghints.cpp
 	core/sampling.cpp
 	core/scene.cpp
 	core/shape.cpp
+	core/sparsegrid.cpp
+	core/taskpool.cpp
 	core/texture.cpp
 	core/tgaio.cpp
 	core/timer.cpp
@@ -179,7 +186,10 @@ SET(lux_core_all_src
 SET(lux_accelerators_src
 	accelerators/bruteforce.cpp
 	accelerators/bvhaccel.cpp
+	accelerators/embreeaccel.cpp
+	accelerators/instanceqbvhaccel.cpp
 	accelerators/qbvhaccel.cpp
+	accelerators/recordqbvh.cpp
 	accelerators/sqbvhaccel.cpp
 	accelerators/tabreckdtree.cpp
 	accelerators/unsafekdtree.cpp
@@ -277,6 +287,7 @@ SET(lux_pixelsamplers_src
 	pixelsamplers/hilbertpx.cpp
 	pixelsamplers/linear.cpp
 	pixelsamplers/lowdiscrepancypx.cpp
+	pixelsamplers/progressive.cpp
 	pixelsamplers/tilepx.cpp
 	pixelsamplers/vegas.cpp
 	)
@@ -297,6 +308,7 @@ SET(lux_renderers_src
 	renderers/samplerrenderer.cpp
 	renderers/luxcorerenderer.cpp
 	renderers/sppmrenderer.cpp
+	renderers/wavefronttracer.cpp
 	renderers/sppm/photonsampler.cpp
 	renderers/sppm/lookupaccel.cpp
 	renderers/sppm/hashgrid.cpp
@@ -328,9 +340,11 @@ SET(lux_shapes_src
 	shapes/loopsubdiv.cpp
 	shapes/mesh.cpp
 	shapes/meshbarytriangle.cpp
+	shapes/meshcompressed.cpp
 	shapes/meshmicrodisplacementtriangle.cpp
 	shapes/meshquadrilateral.cpp
 	shapes/meshwaldtriangle.cpp
+	shapes/microdisplacementcache.cpp
 	shapes/mikktspace/mikktspace.c
 	shapes/mikktspace/weldmesh.c
 	shapes/nurbs.cpp
@@ -383,6 +397,7 @@ SOURCE_GROUP("Source Files\\Textures\\Fresnel" FILES ${lux_fresnel_textures_src}
 
 SET(lux_textures_src
 	textures/add.cpp
+	textures/bake.cpp
 	textures/band.cpp
 	textures/bilerp.cpp
 	textures/brick.cpp
@@ -475,6 +490,7 @@ SOURCE_GROUP("Source Files\\C++ API" FILES ${lux_cpp_api_src})
 
 SET(lux_core_hdr
 	core/api.h
+	core/assetcache.h
 	core/asyncstream.h
 	core/bsh.h
 	core/camera.h
@@ -487,6 +503,7 @@ SET(lux_core_hdr
 	core/exrio.h
 	core/fastmutex.h
 	core/filedata.h
+	core/filetransfer.h
 	core/film.h
 	core/filter.h
 	core/igiio.h
@@ -495,7 +512,9 @@ SET(lux_core_hdr
 	core/light.h
 	core/lux.h
 	core/material.h
+	core/metrics.h
 	core/mipmap.h
+	core/numa.h
 	core/octree.h
 	core/osfunc.h
 	core/paramset.h
@@ -503,6 +522,7 @@ SET(lux_core_hdr
 	core/pngio.h
 	core/primitive.h
 	core/randomgen.h
+	core/rendercounters.h
 	core/renderer.h
 	core/rendererstatistics.h
 	core/renderfarm.h
@@ -510,7 +530,9 @@ SET(lux_core_hdr
 	core/sampling.h
 	core/scene.h
 	core/shape.h
+	core/sparsegrid.h
 	core/streamio.h
+	core/taskpool.h
 	core/texture.h
 	core/texturecolor.h
 	core/tgaio.h
@@ -593,7 +615,10 @@ SOURCE_GROUP("Header Files\\Core\\Reflection\\Microfacet Distribution" FILES ${l
 SET(lux_accelerators_hdr
 	accelerators/bruteforce.h
 	accelerators/bvhaccel.h
+	accelerators/embreeaccel.h
+	accelerators/instanceqbvhaccel.h
 	accelerators/qbvhaccel.h
+	accelerators/recordqbvh.h
 	accelerators/tabreckdtreeaccel.h
 	accelerators/unsafekdtreeaccel.h
 	)
@@ -694,6 +719,7 @@ SET(lux_pixelsamplers_hdr
 	pixelsamplers/hilbertpx.h
 	pixelsamplers/linear.h
 	pixelsamplers/lowdiscrepancypx.h
+	pixelsamplers/progressive.h
 	pixelsamplers/tilepx.h
 	pixelsamplers/vegas.h
 	)
@@ -704,6 +730,7 @@ SET(lux_renderers_hdr
 	renderers/samplerrenderer.h
 	renderers/luxcorerenderer.h
 	renderers/sppmrenderer.h
+	renderers/wavefronttracer.h
 	)
 SOURCE_GROUP("Header Files\\Renderers" FILES ${lux_renderers_hdr})
 SET(lux_rendererstatistics_hdr
@@ -735,6 +762,7 @@ SET(lux_shapes_hdr
 	shapes/lenscomponent.h
 	shapes/loopsubdiv.h
 	shapes/mesh.h
+	shapes/microdisplacementcache.h
 	shapes/mikktspace/mikktspace.h
 	shapes/mikktspace/weldmesh.h
 	shapes/nurbs.h
@@ -747,6 +775,7 @@ SET(lux_shapes_hdr
 	)
 SOURCE_GROUP("Header Files\\Shapes" FILES ${lux_shapes_hdr})
 SET(lux_textures_hdr
+	textures/bake.h
 	textures/band.h
 	textures/bilerp.h
 	textures/brick.h
@@ -81,6 +81,7 @@ bool ProcessCommandLine(int argc, char **argv, clConfig& config, unsigned int fe
 			if (!(features & featureSet::INTERACTIVE))
 				optStandalone.add_options()
 					("bindump,b",        "Dump binary RGB framebuffer to stdout when finished")
+					("daemon,D",         "Keep running, render the scene files read from stdin and reuse unchanged assets between scenes")
 					;
 		}
 
@@ -93,6 +94,8 @@ bool ProcessCommandLine(int argc, char **argv, clConfig& config, unsigned int fe
 					("useserver,u",      po::value< std::vector< std::string > >()->composing(), "Specify the address of a slave node to use\n(May be used multiple times)")
 					("serverinterval,i", po::value< unsigned int >()->default_value(config.pollInterval), "Specify the number of seconds between update requests to slave nodes")
 					("resetserver",      po::value< std::vector< std::string > >()->composing(), "Specify the address of a slave node to reset\n(May be used multiple times)")
+					("servercompression", po::value< int >()->default_value(luxGetIntAttribute("render_farm", "fileCompression")), "Specify the compression level (0-9) of the scene files sent to slave nodes")
+					("serverrelay",      po::value< int >()->default_value(luxGetIntAttribute("render_farm", "relayFanout")), "Specify the number of slave nodes a slave node can forward scene files to at once (0 to disable)")
 					;
 		}
 
@@ -125,6 +128,9 @@ bool ProcessCommandLine(int argc, char **argv, clConfig& config, unsigned int fe
 		if (features & featureSet::RENDERER)
 			optConfig.add_options()
 				("threads,t",     po::value< unsigned int >(), "Specify the number of threads to run in parallel")
+				("numa",          "Pin the threads and place the scene data for NUMA systems")
+				("metrics",       po::value< std::string >(), "Export the render metrics to 'http:<port>', 'unix:<path>' or a file")
+				("metricsinterval", po::value< unsigned int >()->default_value(10), "Specify the number of seconds between two writes of the metrics file")
 				;
 
 		if (features & (featureSet::MASTERNODE | featureSet::SLAVENODE))
@@ -204,7 +210,7 @@ bool ProcessCommandLine(int argc, char **argv, clConfig& config, unsigned int fe
 		}
 
 		if (!(features & featureSet::INTERACTIVE))
-			if (!vm.count("input-file") && !vm.count("list-file") && !vm.count("server") && !vm.count("resetserver")) {
+			if (!vm.count("input-file") && !vm.count("list-file") && !vm.count("server") && !vm.count("resetserver") && !vm.count("daemon")) {
 				warn << "Usage: luxconsole [options] file\n" << optVisible;
 				return false;
 			}
@@ -239,12 +245,19 @@ bool ProcessCommandLine(int argc, char **argv, clConfig& config, unsigned int fe
 			luxEnableDebugMode();
 		}
 
-		if (vm.count("threads"))
+		if (vm.count("threads")) {
 			config.threadCount = vm["threads"].as<unsigned int>();
-		else
+			luxSetTaskThreads(config.threadCount);
+		} else
 			config.threadCount = std::max<unsigned int>(1, boost::thread::hardware_concurrency());
 		LOG(LUX_INFO,LUX_NOERROR) << "Threads: " << config.threadCount;
 
+		if (vm.count("numa"))
+			luxSetNumaPlacement(1);
+
+		if (vm.count("metrics"))
+			luxStartMetrics(vm["metrics"].as<std::string>().c_str(), vm["metricsinterval"].as<unsigned int>());
+
 		config.password = vm["password"].as<std::string>();
 
 		// BEGIN Handling standalone and standalone / master node options
@@ -264,6 +277,8 @@ bool ProcessCommandLine(int argc, char **argv, clConfig& config, unsigned int fe
 
 			config.pollInterval = vm["serverinterval"].as<unsigned int>();
 			luxSetIntAttribute("render_farm", "pollingInterval", config.pollInterval);
+			luxSetIntAttribute("render_farm", "fileCompression", vm["servercompression"].as<int>());
+			luxSetIntAttribute("render_farm", "relayFanout", vm["serverrelay"].as<int>());
 
 			if (vm.count("useserver"))
 				config.slaveNodeList = vm["useserver"].as< std::vector<std::string> >();
@@ -334,6 +349,9 @@ bool ProcessCommandLine(int argc, char **argv, clConfig& config, unsigned int fe
 
 			if (vm.count("bindump"))
 				config.binDump = true;
+
+			if (vm.count("daemon"))
+				config.daemon = true;
 		// END Handling standalone and standalone / master node options
 
 		// BEGIN Handling slave node options
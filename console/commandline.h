@@ -38,7 +38,7 @@
 struct clConfig
 {
 	clConfig() :
-		slave(false), binDump(false), log2console(false), writeFlmFile(false),
+		slave(false), binDump(false), daemon(false), log2console(false), writeFlmFile(false),
 		verbosity(0), pollInterval(luxGetIntAttribute("render_farm", "pollingInterval")),
 		tcpPort(luxGetIntAttribute("render_farm", "defaultTcpPort")), threadCount(0) {};
 
@@ -46,6 +46,7 @@ struct clConfig
 
 	bool slave;
 	bool binDump;
+	bool daemon;
 	bool log2console;
 	bool writeFlmFile;
 	bool fixedSeed;
@@ -89,6 +89,99 @@ void serverErrorHandler(int code, int severity, const char *msg) {
 	prevErrorHandler(code, severity, msg);
 }
 
+// render one scene file, "-" for a piped scene
+bool renderScene(const std::string &sceneFile, const clConfig &config) {
+	if (config.fixedSeed)
+		luxDisableRandomMode();
+
+	sceneFileName = sceneFile;
+	if (sceneFileName != "-") {
+		LOG(LUX_INFO,LUX_NOERROR) << "Loading scene file: '" << sceneFileName << "'...";
+		boost::filesystem::path workingDirectory = boost::filesystem::path(sceneFileName).parent_path();
+		try {
+			boost::filesystem::current_path(workingDirectory);
+		} catch (boost::filesystem::filesystem_error &) {
+			LOG(LUX_SEVERE,LUX_NOFILE) << "Unable to change to directory '" << workingDirectory.string() << "'";
+			return false;
+		}
+	} else
+		LOG(LUX_INFO,LUX_NOERROR) << "Loading piped scene...";
+
+	parseError = false;
+	boost::thread engine(&engineThread);
+
+	// add slaves, need to do this for each scene file
+	boost::thread addSlaves(boost::bind(addNetworkSlavesThread, config.slaveNodeList));
+
+	// wait the scene parsing to finish
+	while (!luxStatistics("sceneIsReady") && !parseError)
+		boost::this_thread::sleep(boost::posix_time::seconds(1));
+
+	if (parseError) {
+		LOG(LUX_SEVERE,LUX_BADFILE) << "Skipping invalid scenefile '" << sceneFileName << "'";
+
+		// Leave a clean context for the next scenes
+		addSlaves.interrupt();
+		addSlaves.join();
+		engine.join();
+
+		luxExit();
+		luxCleanup();
+		if (config.daemon)
+			luxReleaseUnusedAssets();
+		return false;
+	}
+
+	// add rendering threads
+	int threadsToAdd = config.threadCount;
+	while (--threadsToAdd)
+		luxAddThread();
+
+	// launch info printing thread
+	boost::thread info(&infoThread);
+
+	// Dade - wait for the end of the rendering
+	luxWait();
+
+	// We have to stop the info thread before to call luxExit()/luxCleanup()
+	info.interrupt();
+	// Stop adding slaves before proceeding
+	addSlaves.interrupt();
+
+	info.join();
+	addSlaves.join();
+
+	luxExit();
+
+	// Dade - print the total rendering time
+	boost::posix_time::time_duration td(0, 0, (int)luxStatistics("secElapsed"), 0);
+	LOG(LUX_INFO,LUX_NOERROR) << "100% rendering done [" << config.threadCount << " threads] " << td;
+
+	if (config.binDump) {
+		// Get pointer to framebuffer data if needed
+		unsigned char* fb = luxFramebuffer();
+
+		int w = luxGetIntAttribute("film", "xPixelCount");
+		int h = luxGetIntAttribute("film", "yPixelCount");
+		luxUpdateFramebuffer();
+
+#if defined(WIN32) && !defined(__CYGWIN__) /* On WIN32 we need to set stdout to binary */
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+		// Dump RGB imagebuffer data to stdout
+		for (int i = 0; i < w * h * 3; i++)
+			std::cout << fb[i];
+	}
+
+	luxCleanup();
+
+	// release the assets the next scenes are unlikely to need
+	if (config.daemon)
+		luxReleaseUnusedAssets();
+	return true;
+}
+
 int main(int argc, char **argv) {
 	// Dade - initialize rand() number generator
 	srand(time(NULL));
@@ -100,6 +193,10 @@ int main(int argc, char **argv) {
 		return 1;
 
 	if (!config.slave) {
+		const boost::filesystem::path startDirectory(boost::filesystem::current_path());
+		if (config.daemon)
+			luxEnableAssetCache(1);
+
 		// build queue
 		std::vector<std::string> queue(config.inputFiles);
 		if (!config.queueFiles.empty()) {
@@ -129,81 +226,25 @@ int main(int argc, char **argv) {
 		}
 
 		// process queue
-		for (std::vector<std::string>::iterator it = queue.begin(); it < queue.end(); it++) {
-			if (config.fixedSeed)
-				luxDisableRandomMode();
-
-			sceneFileName = *it;
-			if (sceneFileName != "-") {
-				LOG(LUX_INFO,LUX_NOERROR) << "Loading scene file: '" << sceneFileName << "'...";
-				boost::filesystem::path workingDirectory = boost::filesystem::path(sceneFileName).parent_path();
-				try {
-					boost::filesystem::current_path(workingDirectory);
-				} catch (boost::filesystem::filesystem_error &) {
-					LOG(LUX_SEVERE,LUX_NOFILE) << "Unable to change to directory '" << workingDirectory.string() << "'";
+		for (std::vector<std::string>::iterator it = queue.begin(); it < queue.end(); it++)
+			renderScene(*it, config);
+
+		// in daemon mode, keep rendering the scene files read from stdin
+		if (config.daemon) {
+			LOG(LUX_INFO,LUX_NOERROR) << "Waiting for scene files on standard input...";
+			std::string sceneFile;
+			while (std::getline(std::cin, sceneFile)) {
+				if (sceneFile.empty())
+					continue;
+				// scene paths are relative to the initial directory
+				boost::filesystem::current_path(startDirectory);
+				boost::filesystem::path sceneFileComplete(boost::filesystem::system_complete(sceneFile));
+				if (sceneFileComplete.empty() || !boost::filesystem::exists(sceneFileComplete)) {
+					LOG(LUX_ERROR,LUX_NOFILE) << "Could not find scene file '" << sceneFile << "'";
 					continue;
 				}
-			} else
-				LOG(LUX_INFO,LUX_NOERROR) << "Loading piped scene...";
-
-			parseError = false;
-			boost::thread engine(&engineThread);
-
-			// add slaves, need to do this for each scene file
-			boost::thread addSlaves(boost::bind(addNetworkSlavesThread, config.slaveNodeList));
-
-			// wait the scene parsing to finish
-			while (!luxStatistics("sceneIsReady") && !parseError)
-				boost::this_thread::sleep(boost::posix_time::seconds(1));
-
-			if (parseError) {
-				LOG(LUX_SEVERE,LUX_BADFILE) << "Skipping invalid scenefile '" << sceneFileName << "'";
-				continue;
-			}
-
-			// add rendering threads
-			int threadsToAdd = config.threadCount;
-			while (--threadsToAdd)
-				luxAddThread();
-
-			// launch info printing thread
-			boost::thread info(&infoThread);
-
-			// Dade - wait for the end of the rendering
-			luxWait();
-
-			// We have to stop the info thread before to call luxExit()/luxCleanup()
-			info.interrupt();
-			// Stop adding slaves before proceeding
-			addSlaves.interrupt();
-
-			info.join();
-			addSlaves.join();
-
-			luxExit();
-
-			// Dade - print the total rendering time
-			boost::posix_time::time_duration td(0, 0, (int)luxStatistics("secElapsed"), 0);
-			LOG(LUX_INFO,LUX_NOERROR) << "100% rendering done [" << config.threadCount << " threads] " << td;
-
-			if (config.binDump) {
-				// Get pointer to framebuffer data if needed
-				unsigned char* fb = luxFramebuffer();
-
-				int w = luxGetIntAttribute("film", "xPixelCount");
-				int h = luxGetIntAttribute("film", "yPixelCount");
-				luxUpdateFramebuffer();
-
-#if defined(WIN32) && !defined(__CYGWIN__) /* On WIN32 we need to set stdout to binary */
-				_setmode(_fileno(stdout), _O_BINARY);
-#endif
-
-				// Dump RGB imagebuffer data to stdout
-				for (int i = 0; i < w * h * 3; i++)
-					std::cout << fb[i];
+				renderScene(sceneFileComplete.string(), config);
 			}
-
-			luxCleanup();
 		}
 	} else {
 		renderServer = new RenderServer(config.threadCount, config.password, config.tcpPort, config.writeFlmFile);
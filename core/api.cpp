@@ -28,6 +28,10 @@
 #include "error.h"
 #include "version.h"
 #include "osfunc.h"
+#include "assetcache.h"
+#include "metrics.h"
+#include "taskpool.h"
+#include "numa.h"
 
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include <boost/thread/mutex.hpp>
@@ -1159,6 +1163,36 @@ extern "C" void luxDisableRandomMode()
 	Context::GetActive()->DisableRandomMode();
 }
 
+extern "C" void luxSetTaskThreads(unsigned int count)
+{
+	TaskPool::SetThreadCount(count);
+}
+
+extern "C" void luxSetNumaPlacement(int enable)
+{
+	SetNumaPlacement(enable != 0);
+}
+
+extern "C" void luxEnableAssetCache(int enable)
+{
+	AssetCache::Enable(enable != 0);
+}
+
+extern "C" void luxReleaseUnusedAssets()
+{
+	AssetCache::EndJob();
+}
+
+extern "C" int luxStartMetrics(const char *target, unsigned int interval)
+{
+	return Metrics::Start(target, interval) ? 1 : 0;
+}
+
+extern "C" void luxStopMetrics()
+{
+	Metrics::Stop();
+}
+
 extern "C" void luxUpdateFilmFromNetwork()
 {
 	Context::GetActive()->UpdateFilmFromNetwork();
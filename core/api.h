@@ -344,6 +344,24 @@ LUX_EXPORT void luxUpdateStatisticsWindow();
 LUX_EXPORT void luxEnableDebugMode();
 LUX_EXPORT void luxDisableRandomMode();
 
+/* Number of threads of the task pool shared by the accelerator builds and
+   the film processing, 0 for one per core */
+LUX_EXPORT void luxSetTaskThreads(unsigned int count);
+/* Pin the render threads and spread the read mostly scene data over the
+   NUMA nodes, to be called before parsing the scene */
+LUX_EXPORT void luxSetNumaPlacement(int enable);
+
+/* Asset cache, keeps decoded textures, meshes and prototype accelerators
+   alive between consecutive scenes */
+LUX_EXPORT void luxEnableAssetCache(int enable);
+// Release the assets that weren't used by the last scene
+LUX_EXPORT void luxReleaseUnusedAssets();
+
+/* Metrics export in the Prometheus text format, target is "http:<port>",
+   "unix:<path>" or a file name rewritten every interval seconds */
+LUX_EXPORT int luxStartMetrics(const char *target, unsigned int interval);
+LUX_EXPORT void luxStopMetrics();
+
 /* Error Handlers */
 LUX_EXPORT extern int luxLastError; /*  Keeps track of the last error code */
 LUX_EXPORT extern void luxErrorFilter(int severity); /* Sets the minimal level of severity to report */
@@ -0,0 +1,204 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// assetcache.cpp*
+#include "assetcache.h"
+#include "tigerhash.h"
+#include "error.h"
+
+#include <sstream>
+#include <boost/filesystem.hpp>
+
+using namespace lux;
+
+boost::mutex AssetCache::mutex;
+map<string, AssetCache::Entry> AssetCache::entries;
+map<const void *, u_int> AssetCache::assets;
+map<string, AssetCache::FileStamp> AssetCache::files;
+bool AssetCache::enabled = false;
+u_int AssetCache::job = 0;
+
+static string AssetKey(const string &kind, const string &filename,
+	const string &params)
+{
+	return kind + '\n' + filename + '\n' + params;
+}
+
+void AssetCache::Erase(map<string, Entry>::iterator it,
+	vector<boost::shared_ptr<void> > &released)
+{
+	map<const void *, u_int>::iterator a = assets.find(it->second.asset.get());
+	if (a != assets.end() && --(a->second) == 0)
+		assets.erase(a);
+	released.push_back(it->second.asset);
+	entries.erase(it);
+}
+
+void AssetCache::Enable(bool enable)
+{
+	// Assets may ask the cache about themselves when destroyed, the
+	// released ones are destroyed after the lock
+	vector<boost::shared_ptr<void> > released;
+	boost::mutex::scoped_lock lock(mutex);
+	enabled = enable;
+	if (!enabled) {
+		while (!entries.empty())
+			Erase(entries.begin(), released);
+		files.clear();
+	}
+}
+
+bool AssetCache::IsEnabled()
+{
+	boost::mutex::scoped_lock lock(mutex);
+	return enabled;
+}
+
+boost::shared_ptr<void> AssetCache::FindAsset(const string &kind,
+	const string &filename, const string &params)
+{
+	const string key(AssetKey(kind, filename, params));
+	string signature;
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		if (!enabled)
+			return boost::shared_ptr<void>();
+		map<string, Entry>::iterator it = entries.find(key);
+		if (it == entries.end())
+			return boost::shared_ptr<void>();
+		if (filename == "") {
+			it->second.lastJob = job;
+			return it->second.asset;
+		}
+		signature = it->second.signature;
+	}
+
+	// The file may have to be hashed, don't block the other lookups
+	const bool outdated = signature != FileSignature(filename);
+
+	vector<boost::shared_ptr<void> > released;
+	boost::mutex::scoped_lock lock(mutex);
+	map<string, Entry>::iterator it = entries.find(key);
+	if (it == entries.end() || it->second.signature != signature)
+		return boost::shared_ptr<void>();
+	// Drop the asset if its file has changed
+	if (outdated) {
+		LOG(LUX_DEBUG, LUX_NOERROR) << "Cached " << kind << " for '" <<
+			filename << "' is outdated";
+		Erase(it, released);
+		return boost::shared_ptr<void>();
+	}
+	it->second.lastJob = job;
+	return it->second.asset;
+}
+
+void AssetCache::InsertAsset(const string &kind, const string &filename,
+	const string &params, const boost::shared_ptr<void> &asset)
+{
+	if (!asset || !IsEnabled())
+		return;
+	const string signature(filename != "" ? FileSignature(filename) : "");
+
+	vector<boost::shared_ptr<void> > released;
+	boost::mutex::scoped_lock lock(mutex);
+	if (!enabled)
+		return;
+	const string key(AssetKey(kind, filename, params));
+	map<string, Entry>::iterator it = entries.find(key);
+	if (it != entries.end())
+		Erase(it, released);
+	Entry &entry(entries[key]);
+	entry.asset = asset;
+	entry.signature = signature;
+	entry.lastJob = job;
+	++assets[asset.get()];
+}
+
+bool AssetCache::IsCached(const void *asset)
+{
+	boost::mutex::scoped_lock lock(mutex);
+	return assets.find(asset) != assets.end();
+}
+
+string AssetCache::FileSignature(const string &filename)
+{
+	FileStamp stamp;
+	try {
+		stamp.size = boost::filesystem::file_size(filename);
+		stamp.modified = boost::filesystem::last_write_time(filename);
+	} catch (boost::filesystem::filesystem_error &) {
+		boost::mutex::scoped_lock lock(mutex);
+		files.erase(filename);
+		return "";
+	}
+	// Exporters often rewrite unchanged files for every frame, so the
+	// content is hashed again when the stamp changes instead of
+	// invalidating the assets
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		map<string, FileStamp>::iterator it = files.find(filename);
+		if (it != files.end() && it->second.size == stamp.size &&
+			it->second.modified == stamp.modified)
+			return it->second.signature;
+	}
+	// Hash outside of the lock, concurrent lookups of the same file
+	// compute the same signature
+	std::stringstream ss;
+	ss << stamp.size << ':' << digest_string(file_hash<tigerhash>(filename));
+	stamp.signature = ss.str();
+	boost::mutex::scoped_lock lock(mutex);
+	files[filename] = stamp;
+	return stamp.signature;
+}
+
+u_int AssetCache::CurrentJob()
+{
+	boost::mutex::scoped_lock lock(mutex);
+	return job;
+}
+
+void AssetCache::EndJob(u_int maxAge)
+{
+	vector<boost::shared_ptr<void> > released;
+	boost::mutex::scoped_lock lock(mutex);
+	for (map<string, Entry>::iterator it = entries.begin();
+		it != entries.end(); ) {
+		if (it->second.lastJob + maxAge <= job)
+			Erase(it++, released);
+		else
+			++it;
+	}
+	++job;
+	if (enabled)
+		LOG(LUX_INFO, LUX_NOERROR) << "Asset cache: " <<
+			entries.size() << " assets kept, " << released.size() <<
+			" released";
+}
+
+void AssetCache::Clear()
+{
+	vector<boost::shared_ptr<void> > released;
+	boost::mutex::scoped_lock lock(mutex);
+	while (!entries.empty())
+		Erase(entries.begin(), released);
+	files.clear();
+}
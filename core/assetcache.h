@@ -0,0 +1,140 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_ASSETCACHE_H
+#define LUX_ASSETCACHE_H
+// assetcache.h*
+#include "lux.h"
+
+#include <ctime>
+#include <map>
+using std::map;
+#include <vector>
+using std::vector;
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace lux
+{
+
+/**
+   Process wide cache of decoded assets (MIPMaps, meshes, prototype
+   accelerators) kept alive across consecutive rendering jobs.
+   Assets are keyed by a kind, the file they come from and a string of
+   the parameters used to decode them, and are only reused while the
+   content hash of the file is unchanged.
+   The cache is disabled by default, assets are then only shared inside
+   a single job as before.
+*/
+class AssetCache {
+public:
+	/**
+	   Enable or disable the cache, disabling it drops all the assets
+	*/
+	static void Enable(bool enable);
+	static bool IsEnabled();
+
+	/**
+	   Look for an asset
+	   @param kind the type of the asset
+	   @param filename the file the asset comes from, may be empty
+	   @param params the parameters used to create the asset
+	   @return the asset or an empty pointer if it isn't cached or its
+	   file has changed
+	*/
+	template <class T> static boost::shared_ptr<T> Find(const string &kind,
+		const string &filename, const string &params) {
+		return boost::static_pointer_cast<T>(FindAsset(kind, filename,
+			params));
+	}
+	/**
+	   Store an asset, does nothing if the cache is disabled
+	*/
+	template <class T> static void Insert(const string &kind,
+		const string &filename, const string &params,
+		const boost::shared_ptr<T> &asset) {
+		InsertAsset(kind, filename, params,
+			boost::static_pointer_cast<void>(asset));
+	}
+
+	/**
+	   Test whether the cache holds a reference to an asset
+	*/
+	static bool IsCached(const void *asset);
+
+	/**
+	   Return a hash of the content of a file, it is only recomputed
+	   when the size or the modification time of the file change
+	   @return the hash as a string or an empty string if the file can't
+	   be read
+	*/
+	static string FileSignature(const string &filename);
+
+	/**
+	   Return the current job number
+	*/
+	static u_int CurrentJob();
+	/**
+	   Signal the end of a job, assets that haven't been used during the
+	   last maxAge jobs are released
+	*/
+	static void EndJob(u_int maxAge = 1);
+
+	/**
+	   Release all the assets
+	*/
+	static void Clear();
+
+private:
+	static boost::shared_ptr<void> FindAsset(const string &kind,
+		const string &filename, const string &params);
+	static void InsertAsset(const string &kind, const string &filename,
+		const string &params, const boost::shared_ptr<void> &asset);
+
+	struct Entry {
+		boost::shared_ptr<void> asset;
+		string signature;
+		u_int lastJob;
+	};
+	struct FileStamp {
+		boost::uintmax_t size;
+		std::time_t modified;
+		string signature;
+	};
+
+	// Remove an entry, the asset is moved to released so that it is
+	// destroyed once the mutex isn't held anymore
+	static void Erase(map<string, Entry>::iterator it,
+		vector<boost::shared_ptr<void> > &released);
+
+	static boost::mutex mutex;
+	static map<string, Entry> entries;
+	// Number of entries of each asset, for IsCached()
+	static map<const void *, u_int> assets;
+	static map<string, FileStamp> files;
+	static bool enabled;
+	static u_int job;
+};
+
+}//namespace lux
+
+#endif // LUX_ASSETCACHE_H
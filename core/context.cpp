@@ -34,6 +34,9 @@
 #include "volume.h"
 #include "material.h"
 #include "renderfarm.h"
+#include "assetcache.h"
+#include "metrics.h"
+#include "taskpool.h"
 #include "film/fleximage.h"
 #include "luxrays/core/epsilon.h"
 using luxrays::MachineEpsilon;
@@ -147,7 +150,20 @@ void lux::Context::ResetFLM()
 		luxCurrentScene->camera()->film->ClearBuffers();
 }
 
+lux::Context::~Context() {
+	Free();
+
+	// The metrics export looks up the attributes in the active context
+	boost::mutex::scoped_lock metricsLock(Metrics::sourcesMutex);
+	if (activeContext == this)
+		activeContext = NULL;
+}
+
 void lux::Context::Free() {
+	// The metrics export may be reading the attributes of the
+	// renderer, the film or the render farm
+	boost::mutex::scoped_lock metricsLock(Metrics::sourcesMutex);
+
 	// Dade - free memory
 
 	delete luxCurrentRenderer;
@@ -713,6 +729,50 @@ void lux::Context::PortalShape(const string &n, const ParamSet &params) {
 	}
 }
 
+// Only the triangles of PLY meshes without subdivision or displacement
+// read their material and volumes from the mesh itself, so that a cached
+// prototype made of them can be rebound to the materials of a new job.
+// Their geometry is fully identified by the parameters and the file content.
+static bool IsRebindableShape(const string &n, const ParamSet &params)
+{
+	return n == "plymesh" && params.FindOneInt("nsubdivlevels", 0) == 0 &&
+		params.FindOneString("displacementmap", "") == "" &&
+		params.FindTexture("displacementmap") == "";
+}
+
+static string ShapeSignature(const string &n, const Transform &t, bool ro,
+	const ParamSet &params)
+{
+	std::stringstream ss;
+	ss.precision(9);
+	ss << n << (ro ? " reversed [" : " [");
+	for (u_int i = 0; i < 4; ++i)
+		for (u_int j = 0; j < 4; ++j)
+			ss << t.m.m[i][j] << " ";
+	ss << "] " << params.ToString() << " " <<
+		AssetCache::FileSignature(AdjustFilename(params.FindOneString("filename", ""))) <<
+		"\n";
+	return ss.str();
+}
+
+// Replace the refined primitives of an instance by an aggregate if needed
+static void MakeInstanceAggregate(vector<boost::shared_ptr<Primitive> > &in,
+	const string &accelName, const ParamSet &accelParams)
+{
+	if (in.size() == 0 || (in.size() == 1 && in[0]->CanIntersect()))
+		return;
+	// Refine instance _Primitive_s and create aggregate
+	boost::shared_ptr<Primitive> accel(MakeAccelerator(accelName, in,
+		accelParams));
+	if (!accel)
+		accel = MakeAccelerator("kdtree", in, ParamSet());
+	if (!accel)
+		LOG(LUX_SEVERE,LUX_BUG) <<
+			"Unable to find \"kdtree\" accelerator";
+	in.clear();
+	in.push_back(accel);
+}
+
 void lux::Context::Shape(const string &n, const ParamSet &params) {
 	VERIFY_WORLD("Shape");
 	renderFarm->send("luxShape", n, params);
@@ -749,6 +809,7 @@ void lux::Context::Shape(const string &n, const ParamSet &params) {
 	// Create primitive and add to scene or current instance
 	if (renderOptions->currentInstanceRefined) {
 		if (graphicsState->areaLight != "") {
+			FlushInstanceShapes();
 			u_int lg = GetLightGroup();
 			boost::shared_ptr<AreaLight> area(MakeAreaLight(graphicsState->areaLight,
 				curTransform.StaticTransform(),
@@ -774,7 +835,15 @@ void lux::Context::Shape(const string &n, const ParamSet &params) {
 			} else
 				aList.push_back(prim);
 			renderOptions->currentAreaLightInstance->push_back(aList);
+		} else if (renderOptions->currentInstanceCacheable &&
+			IsRebindableShape(n, params)) {
+			renderOptions->currentInstanceSource->push_back(sh);
+			renderOptions->currentInstanceShapes.push_back(sh);
+			renderOptions->currentInstanceSignature += ShapeSignature(n,
+				curTransform.StaticTransform(),
+				graphicsState->reverseOrientation, params);
 		} else {
+			FlushInstanceShapes();
 			renderOptions->currentInstanceSource->push_back(sh);
 			if (!sh->CanIntersect())
 				sh->Refine(*(renderOptions->currentInstanceRefined),
@@ -868,6 +937,10 @@ void lux::Context::ObjectBegin(const string &n) {
 	renderOptions->currentLightInstance = &renderOptions->lightInstances[n];
 	renderOptions->areaLightInstances[n] = vector<vector<boost::shared_ptr<AreaLightPrimitive> > >();
 	renderOptions->currentAreaLightInstance = &renderOptions->areaLightInstances[n];
+	renderOptions->currentInstanceCacheable = AssetCache::IsEnabled();
+	renderOptions->currentInstanceName = n;
+	renderOptions->currentInstanceSignature = "";
+	renderOptions->currentInstanceShapes.clear();
 }
 void lux::Context::ObjectEnd() {
 	VERIFY_WORLD("ObjectEnd");
@@ -877,12 +950,75 @@ void lux::Context::ObjectEnd() {
 			"ObjectEnd called outside of instance definition";
 		return;
 	}
+	if (renderOptions->currentInstanceCacheable &&
+		!renderOptions->currentInstanceShapes.empty())
+		EndCacheableInstance();
+	else
+		FlushInstanceShapes();
 	renderOptions->currentInstanceSource = NULL;
 	renderOptions->currentInstanceRefined = NULL;
 	renderOptions->currentLightInstance = NULL;
 	renderOptions->currentAreaLightInstance = NULL;
 	AttributeEnd();
 }
+void lux::Context::FlushInstanceShapes() {
+	// Refine the deferred shapes, the instance won't be cached anymore
+	renderOptions->currentInstanceCacheable = false;
+	vector<boost::shared_ptr<lux::Shape> > &shapes(renderOptions->currentInstanceShapes);
+	for (u_int i = 0; i < shapes.size(); ++i) {
+		if (!shapes[i]->CanIntersect())
+			shapes[i]->Refine(*(renderOptions->currentInstanceRefined),
+				PrimitiveRefinementHints(false), shapes[i]);
+		else
+			renderOptions->currentInstanceRefined->push_back(shapes[i]);
+	}
+	shapes.clear();
+}
+
+// Prototype of an object block kept by the asset cache
+struct CachedPrototype {
+	vector<boost::shared_ptr<lux::Shape> > shapes;
+	vector<boost::shared_ptr<Primitive> > refined;
+	// Last job that bound its own materials to the shapes
+	u_int job;
+};
+
+void lux::Context::EndCacheableInstance() {
+	vector<boost::shared_ptr<lux::Shape> > &shapes(renderOptions->currentInstanceShapes);
+	vector<boost::shared_ptr<Primitive> > &in(*(renderOptions->currentInstanceRefined));
+	const string signature(renderOptions->acceleratorName + " " +
+		renderOptions->acceleratorParams.ToString() + "\n" +
+		renderOptions->currentInstanceSignature);
+	const u_int job = AssetCache::CurrentJob();
+	boost::shared_ptr<CachedPrototype> cached(AssetCache::Find<CachedPrototype>("prototype",
+		"", signature));
+	// The shapes of a prototype can only be bound to one set of
+	// materials at a time, so an identical block in the same job gets
+	// its own copy
+	if (cached && cached->job != job &&
+		cached->shapes.size() == shapes.size()) {
+		for (u_int i = 0; i < shapes.size(); ++i)
+			cached->shapes[i]->CopyBindings(*(shapes[i]));
+		cached->job = job;
+		renderOptions->currentInstanceSource->assign(cached->shapes.begin(),
+			cached->shapes.end());
+		in = cached->refined;
+		shapes.clear();
+		LOG(LUX_INFO, LUX_NOERROR) << "Reusing cached prototype for object '" <<
+			renderOptions->currentInstanceName << "'";
+		return;
+	}
+
+	cached.reset(new CachedPrototype());
+	cached->shapes = shapes;
+	cached->job = job;
+	FlushInstanceShapes();
+	MakeInstanceAggregate(in, renderOptions->acceleratorName,
+		renderOptions->acceleratorParams);
+	cached->refined = in;
+	AssetCache::Insert("prototype", "", signature, cached);
+}
+
 void lux::Context::ObjectInstance(const string &n) {
 	VERIFY_WORLD("ObjectInstance");
 	renderFarm->send("luxObjectInstance", n);
@@ -898,6 +1034,9 @@ void lux::Context::ObjectInstance(const string &n) {
 		LOG(LUX_ERROR,LUX_NESTING) << "ObjectInstance '" << n << "' self reference";
 		return;
 	}
+	// Instances of instances can't be cached
+	if (renderOptions->currentInstanceRefined)
+		FlushInstanceShapes();
 	for (u_int i = 0; i < renderOptions->areaLightInstances[n].size(); ++i) {
 		if (renderOptions->areaLightInstances[n][i].size() == 0)
 			continue;
@@ -943,20 +1082,8 @@ void lux::Context::ObjectInstance(const string &n) {
 		}
 	}
 	if (in.size() != 0) {
-		if (in.size() > 1 || !in[0]->CanIntersect()) {
-			// Refine instance _Primitive_s and create aggregate
-			boost::shared_ptr<Primitive> accel(
-				MakeAccelerator(renderOptions->acceleratorName,
-				in, renderOptions->acceleratorParams));
-			if (!accel)
-				accel = MakeAccelerator("kdtree", in,
-					ParamSet());
-			if (!accel)
-				LOG(LUX_SEVERE,LUX_BUG) <<
-					"Unable to find \"kdtree\" accelerator";
-			in.clear();
-			in.push_back(accel);
-		}
+		MakeInstanceAggregate(in, renderOptions->acceleratorName,
+			renderOptions->acceleratorParams);
 
 		boost::shared_ptr<Primitive> o;
 		if (curTransform.IsStatic()) {
@@ -1033,6 +1160,8 @@ void lux::Context::MotionInstance(const string &n, float startTime, float endTim
 		LOG(LUX_ERROR,LUX_NESTING) << "MotionInstance '" << n << "' self reference";
 		return;
 	}
+	if (renderOptions->currentInstanceRefined)
+		FlushInstanceShapes();
 	if (in.size() == 0)
 		return;
 	if (in.size() > 1 || !in[0]->CanIntersect()) {
@@ -1274,11 +1403,13 @@ void lux::Context::OverrideFilename(const string &filename) {
 
 //user interactive thread functions
 void lux::Context::Resume() {
+	TaskPool::Global().Resume();
 	luxCurrentRenderer->Resume();
 }
 
 void lux::Context::Pause() {
 	luxCurrentRenderer->Pause();
+	TaskPool::Global().Pause();
 }
 
 void lux::Context::SetHaltSamplesPerPixel(int haltspp, bool haveEnoughSamplesPerPixel,
@@ -1318,6 +1449,9 @@ void lux::Context::Exit() {
 	MachineEpsilon::SetMin(DEFAULT_EPSILON_MIN);
 	MachineEpsilon::SetMax(DEFAULT_EPSILON_MAX);
 
+	// Tasks left in a paused pool would keep their groups waiting
+	TaskPool::Global().Resume();
+
 	if (luxCurrentRenderer)
 		luxCurrentRenderer->Terminate();
 }
@@ -1488,6 +1622,15 @@ float *lux::Context::GetNoiseAwareMap() {
 	return luxCurrentScene->camera()->film->GetNoiseAwareMap();
 }
 
+void lux::Context::UpdateNetworkTileMask() {
+	// Transmit the new mask to the slaves
+	renderFarm->updateTileMask();
+}
+
+void lux::Context::SetTileMask(u_int tileSize, u_int count, const unsigned char *mask) {
+	luxCurrentScene->camera()->film->SetTileMask(tileSize, count, mask);
+}
+
 void lux::Context::SetUserSamplingMap(const float *map) {
 	luxCurrentScene->camera()->film->SetUserSamplingMap(map);
 
@@ -49,9 +49,7 @@ public:
 
 	Context(std::string n = "Lux default context") : name(n) {}
 
-	~Context() {
-		Free();
-	}
+	~Context();
 
 	//TODO jromang - const & reference
 	static Context* GetActive() {
@@ -228,6 +226,8 @@ public:
 	void SetUserSamplingMap(const float *map);
 	// NOTE: returns a copy of the map, it is up to the caller to free the allocated memory !
 	float *GetUserSamplingMap();
+	void UpdateNetworkTileMask();
+	void SetTileMask(u_int tileSize, u_int count, const unsigned char *mask);
 
 	//! Registry containing all queryable objects of the current context
 	//! \author jromang
@@ -255,6 +255,7 @@ private:
 			currentInstanceSource = NULL;
 			currentLightInstance = NULL;
 			currentAreaLightInstance = NULL;
+			currentInstanceCacheable = false;
 			debugMode = false;
 			randomMode = true;
 		}
@@ -301,6 +302,12 @@ private:
 		mutable vector<boost::shared_ptr<Primitive> > *currentInstanceRefined;
 		mutable vector<boost::shared_ptr<Light> > *currentLightInstance;
 		mutable vector<vector<boost::shared_ptr<AreaLightPrimitive> > > *currentAreaLightInstance;
+		// Shapes of the current instance whose refinement is deferred
+		// until ObjectEnd, where a cached prototype may be reused
+		mutable bool currentInstanceCacheable;
+		mutable string currentInstanceName;
+		mutable string currentInstanceSignature;
+		mutable vector<boost::shared_ptr<lux::Shape> > currentInstanceShapes;
 		bool gotSearchPath;
 		bool debugMode;
 		bool randomMode;
@@ -335,6 +342,9 @@ private:
 		bool reverseOrientation;
 	};
 
+	void FlushInstanceShapes();
+	void EndCacheableInstance();
+
 	static Context *activeContext;
 	string name;
 	u_int shapeNo; // used to identify anonymous shapes
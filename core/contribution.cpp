@@ -24,6 +24,8 @@
 #include "lux.h"
 #include "contribution.h"
 #include "film.h"
+#include "metrics.h"
+#include "numa.h"
 
 #include <boost/thread/locks.hpp>
 
@@ -32,12 +34,14 @@ using namespace luxrays;
 namespace lux
 {
 
-ContributionBuffer::Buffer::Buffer() : pos(0) {
+ContributionBuffer::Buffer::Buffer() : node(GetCurrentNumaNode()), pos(0) {
 	contribs = AllocAligned<Contribution>(CONTRIB_BUF_SIZE);
+	Metrics::AddMemory("contributions", CONTRIB_BUF_SIZE * sizeof(Contribution));
 }
 
 ContributionBuffer::Buffer::~Buffer() {
 	FreeAligned(contribs);
+	Metrics::AddMemory("contributions", -static_cast<double>(CONTRIB_BUF_SIZE * sizeof(Contribution)));
 }
 
 
@@ -133,8 +137,7 @@ void ContributionPool::Next(ContributionBuffer::Buffer* volatile *b, float *sc,
 		// Another thread is splatting this tile, so
 		// get a free buffer
 		if (!CFree.empty()) {
-			*b = CFree.back();
-			CFree.pop_back();
+			*b = TakeBuffer(CFree);
 			return;
 		}
 		// No free buffers, try allocating a new one
@@ -193,8 +196,7 @@ void ContributionPool::Next(ContributionBuffer::Buffer* volatile *b, float *sc,
 	}
 
 	// get buffer from the now free buffers
-	*b = splat_buffers.back();
-	splat_buffers.pop_back();
+	*b = TakeBuffer(splat_buffers);
 
 	{
 		// reaquire pool lock
@@ -205,6 +207,28 @@ void ContributionPool::Next(ContributionBuffer::Buffer* volatile *b, float *sc,
 	}
 }
 
+ContributionBuffer::Buffer *ContributionPool::TakeBuffer(
+	vector<ContributionBuffer::Buffer*> &buffers)
+{
+	const int node = GetCurrentNumaNode();
+	u_int index = buffers.size() - 1;
+	if (node >= 0) {
+		for (u_int i = buffers.size(); i-- > 0; ) {
+			if (buffers[i]->node == node) {
+				index = i;
+				break;
+			}
+		}
+	}
+	ContributionBuffer::Buffer *buffer = buffers[index];
+	buffers[index] = buffers.back();
+	buffers.pop_back();
+	// The pages of a buffer not used yet will be touched by this thread
+	if (buffer->node < 0)
+		buffer->node = node;
+	return buffer;
+}
+
 void ContributionPool::Flush()
 {
 	for (u_int tileIndex = 0; tileIndex < CFull.size(); ++tileIndex) {
@@ -226,8 +250,19 @@ void ContributionPool::Delete()
 		delete CFree[i];
 }
 
-u_int ContributionPool::GetFilmTileIndexes(const Contribution &contrib, u_int *tileIndex0, u_int *tileIndex1) const {
-	return film->GetTileIndexes(contrib, tileIndex0, tileIndex1);
+u_int ContributionPool::GetQueueDepth()
+{
+	fast_mutex::scoped_lock poolAction(poolMutex);
+	u_int depth = 0;
+	for (u_int i = 0; i < CFull.size(); ++i) {
+		for (u_int j = 0; j < CFull[i].size(); ++j)
+			depth += CFull[i][j].size();
+	}
+	return depth;
+}
+
+u_int ContributionPool::GetFilmTileIndexes(const Contribution &contrib, u_int tileIndexes[4]) const {
+	return film->GetTileIndexes(contrib, tileIndexes);
 }
 
 }
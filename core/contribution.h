@@ -85,6 +85,10 @@ class ContributionBuffer {
 
 		void Splat(Film *film, u_int tileIndex);
 
+		// NUMA node of the first thread that filled the buffer,
+		// -1 if unknown
+		int node;
+
 	private:
 		u_int pos;
 		Contribution *contribs;
@@ -158,14 +162,23 @@ public:
 
 	/**
 	 * Get the indexes that the current contribution spans.
-	 * Current implementation is limited to at most two tiles, ie the tiles are slabs.
-	 * @param tileIndex0 First tile index, always set.
-	 * @param tileIndex1 Second tile index if the contribution spans more than one tile, otherwise undefined.
-	 * @return Number of tiles that the contribution spans, 1 or 2.
+	 * @param tileIndexes Array receiving the tile indexes.
+	 * @return Number of tiles that the contribution spans, 1 to 4.
+	 */
+	u_int GetFilmTileIndexes(const Contribution &contrib, u_int tileIndexes[4]) const;
+
+	/**
+	 * Get the number of full buffers waiting to be splatted.
+	 * This method is thread-safe.
 	 */
-	u_int GetFilmTileIndexes(const Contribution &contrib, u_int *tileIndex0, u_int *tileIndex1) const;
+	u_int GetQueueDepth();
 
 private:
+	// Remove a buffer from buffers, preferably one already filled on the
+	// NUMA node of the current thread
+	static ContributionBuffer::Buffer *TakeBuffer(
+		vector<ContributionBuffer::Buffer*> &buffers);
+
 	typedef boost::mutex tile_mutex;
 	//typedef fast_mutex tile_mutex;
 
@@ -184,13 +197,13 @@ private:
 inline void ContributionBuffer::Add(const Contribution &c, float weight)
 {
 
-	u_int tileIndex0, tileIndex1;
+	u_int tileIndexes[4];
 	// Add the contribution to each tile that it spans.
-	u_int num_tiles = pool->GetFilmTileIndexes(c, &tileIndex0, &tileIndex1);
+	const u_int num_tiles = pool->GetFilmTileIndexes(c, tileIndexes);
 
-	//if (num_tiles > 0) is always true
-	{
-		Buffer* volatile* const buf = &(buffers[tileIndex0][c.bufferGroup]);
+	for (u_int t = 0; t < num_tiles; ++t) {
+		const u_int tileIndex = tileIndexes[t];
+		Buffer* volatile* const buf = &(buffers[tileIndex][c.bufferGroup]);
 		u_int i = 0;
 		// Try adding contribution to the active buffer
 		// if the buffer is full, try to get a fresh buffer.
@@ -200,22 +213,13 @@ inline void ContributionBuffer::Add(const Contribution &c, float weight)
 			// Get an empty buffer from the pool.
 			// Next() will reset sampleCount if current thread 
 			// swaps buffers.
-			pool->Next(buf, &sampleCount, tileIndex0, c.bufferGroup);
+			pool->Next(buf, &sampleCount, tileIndex, c.bufferGroup);
 			// Another thread may have swapped buf before we managed to.
 			// Technically there's a chance we waited so long for the lock
 			// in Next() that the buffer we got back has already been filled
 			// thus we try to Add() again in a loop just to be sure.
 		}
 	}
-
-	if (num_tiles > 1) {
-		Buffer* volatile* const buf = &(buffers[tileIndex1][c.bufferGroup]);
-		u_int i = 0;
-		while (!((*buf)->Add(c, weight)) && (i++ < 10)) {
-			pool->Next(buf, &sampleCount, tileIndex1, c.bufferGroup);
-		}
-	}
-
 }
 
 }//namespace lux
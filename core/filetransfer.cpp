@@ -0,0 +1,343 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// filetransfer.cpp*
+#include "filetransfer.h"
+#include "error.h"
+#include "metrics.h"
+#include "osfunc.h"
+#include "tigerhash.h"
+
+#include <cctype>
+#include <fstream>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/positioning.hpp>
+
+using namespace lux;
+using namespace std;
+using namespace boost::iostreams;
+using boost::asio::ip::tcp;
+
+// Size of the chunks the files are read, sent and compressed by
+static const uint64_t chunkSize = 1 * 1024 * 1024;
+// Upper bound of a compressed chunk, deflate adds at most 5 bytes per
+// 16KB stored block plus the gzip header and trailer
+static const uint32_t maxCompressedChunkSize = chunkSize + chunkSize / 1024 + 1024;
+
+static string compressChunk(const char *data, streamsize size, int level)
+{
+	string compressed;
+	filtering_stream<output> out;
+	out.push(gzip_compressor(gzip_params(level)));
+	out.push(boost::iostreams::back_inserter(compressed));
+	out.write(data, size);
+	// Close the chain to write the gzip trailer
+	out.reset();
+	return compressed;
+}
+
+static string fileExtension(const string &filename)
+{
+	const string::size_type dot = filename.find_last_of('.');
+	const string::size_type sep = filename.find_last_of("/\\");
+	if (dot == string::npos || (sep != string::npos && dot < sep))
+		return "";
+	return filename.substr(dot);
+}
+
+bool FileTransfer::Send(ostream &stream, const string &filename, int compression)
+{
+	LOG(LUX_DEBUG,LUX_NOERROR) << "Sending file '" << filename << "'";
+
+	ifstream in(filename.c_str(), ios::in | ios::binary);
+
+	// Get length of file
+	in.seekg(0, ifstream::end);
+	uint64_t len = position_to_offset(in.tellg());
+	in.seekg(0, ifstream::beg);
+
+	if (in.fail()) {
+		// AdjustFilename should guarantee that file exists
+		LOG( LUX_ERROR,LUX_SYSTEM) << "There was an error while checking the size of file '" << filename << "'";
+
+		stream << "\nnone\n0\n";
+		return false;
+	}
+
+	stream << filename << "\n";
+	stream << (compression > 0 ? "gzip" : "raw") << "\n";
+	stream << len << "\n";
+
+	const bool isLittleEndian = osIsLittleEndian();
+	vector<char> buffer(chunkSize, 0);
+	double sent = 0.;
+	while (len > 0) {
+		const streamsize rs = static_cast<streamsize>(min(chunkSize, len));
+		in.read(&buffer[0], rs);
+		if (compression > 0) {
+			const string chunk(compressChunk(&buffer[0], rs,
+				min(compression, 9)));
+			osWriteLittleEndianUInt(isLittleEndian, stream,
+				static_cast<uint32_t>(chunk.size()));
+			stream.write(chunk.data(), chunk.size());
+			sent += chunk.size() + 4;
+		} else {
+			stream.write(&buffer[0], rs);
+			sent += rs;
+		}
+		len -= rs;
+	}
+	if (compression > 0)
+		osWriteLittleEndianUInt(isLittleEndian, stream, 0);
+	Metrics::AddCounter("lux_network_bytes_total", sent, "direction=\"out\"");
+
+	if (in.bad()) {
+		LOG( LUX_ERROR,LUX_SYSTEM) << "There was an error sending file '" << filename << "'";
+		return false;
+	}
+
+	return true;
+}
+
+void FileTransfer::SendRelay(ostream &stream, const string &filename,
+	const string &host, const string &port, int compression)
+{
+	LOG(LUX_DEBUG,LUX_NOERROR) << "Relaying file '" << filename << "' from " << host << ":" << port;
+
+	stream << filename << "\n";
+	stream << "relay" << "\n";
+	stream << host << "\n";
+	stream << port << "\n";
+	stream << compression << "\n";
+}
+
+bool FileTransfer::Receive(istream &stream, const string &filename,
+	const string &filehash, bool fromPeer)
+{
+	string fname, encoding;
+	getline(stream, fname);
+	getline(stream, encoding);
+
+	if (encoding == "relay") {
+		string host, port, level;
+		getline(stream, host);
+		getline(stream, port);
+		getline(stream, level);
+		if (fromPeer)
+			return false;
+
+		LOG( LUX_INFO,LUX_NOERROR) << "Fetching file: '" << fname << "' as '" << filename << "' from " << host << ":" << port;
+		return Fetch(host, port, filename, filehash,
+			boost::lexical_cast<int>(level));
+	}
+
+	string slen;
+	getline(stream, slen);
+
+	uint64_t len = boost::lexical_cast<uint64_t>(slen);
+
+	if (encoding == "none") {
+		// The sender couldn't read the file
+		LOG( LUX_WARNING,LUX_NOFILE) << "File '" << filename << "' is not available";
+		return !fromPeer;
+	}
+	if (encoding != "raw" && encoding != "gzip") {
+		if (fromPeer)
+			return false;
+		throw std::runtime_error("Unknown file encoding '" + encoding + "'");
+	}
+
+	LOG( LUX_INFO,LUX_NOERROR) << "Receiving file: '" << fname << "' as '" << filename << "', size: " << (len / 1000) << " Kbytes";
+
+	// Dade - fix for bug 514: avoid to create the file if it is empty
+	if (len == 0 && encoding == "raw")
+		return true;
+
+	ofstream out(filename.c_str(), ios::out | ios::binary);
+
+	tigerhash h;
+
+	const uint64_t source_len = len;
+	bool corrupt = false;
+	// Set when the stream can no longer be parsed
+	bool stream_error = false;
+	double received = 0.;
+
+	if (encoding == "raw") {
+		vector<char> buffer(chunkSize, 0);
+		while (len > 0 && !stream.bad()) {
+			const streamsize rs = static_cast<streamsize>(min(chunkSize, len));
+
+			stream.read(&buffer[0], rs);
+			received += rs;
+			h.update(&buffer[0], rs);
+			out.write(&buffer[0], rs);
+
+			len -= rs;
+		}
+	} else {
+		const bool isLittleEndian = osIsLittleEndian();
+		vector<char> buffer;
+		while (!stream.bad()) {
+			const uint32_t size = osReadLittleEndianUInt(isLittleEndian, stream);
+			if (size == 0 || !stream.good())
+				break;
+			if (size > maxCompressedChunkSize) {
+				LOG( LUX_ERROR,LUX_LIMIT) << "Compressed chunk too large while receiving file '" << filename << "' (" << size << " bytes)";
+				corrupt = true;
+				stream_error = true;
+				break;
+			}
+			buffer.resize(size);
+			stream.read(&buffer[0], size);
+			received += size + 4;
+			// Keep reading the chunks after an error to stay in sync
+			if (corrupt)
+				continue;
+			string chunk;
+			try {
+				filtering_stream<input> in;
+				in.push(gzip_decompressor());
+				in.push(array_source(&buffer[0], size));
+				boost::iostreams::copy(in,
+					boost::iostreams::back_inserter(chunk));
+			} catch (std::exception &e) {
+				LOG( LUX_ERROR,LUX_SYSTEM) << "Error uncompressing file '" << filename << "': " << e.what();
+				corrupt = true;
+				continue;
+			}
+			if (chunk.size() > len) {
+				corrupt = true;
+				continue;
+			}
+			h.update(chunk.data(), chunk.size());
+			out.write(chunk.data(), chunk.size());
+			len -= chunk.size();
+		}
+	}
+
+	out.flush();
+	Metrics::AddCounter("lux_network_bytes_total", received, "direction=\"in\"");
+
+	string hash = digest_string(h.end_message());
+
+	uint64_t written = source_len - len;
+
+	if (out.fail() || corrupt || written != source_len || hash != filehash) {
+		bool output_error = out.fail();
+		out.close();
+
+		LOG( LUX_ERROR,LUX_SYSTEM) << "There was an error while receiving file '" << filename << "', received " << written 
+			<< " bytes, source size " << source_len << " bytes, received file hash " << hash << ", source hash " << filehash;
+		LOG( LUX_INFO,LUX_SYSTEM) << "Removing incomplete file '" << filename << "'";
+
+		boost::system::error_code ec;
+		if (!boost::filesystem::remove(filename, ec)) {
+			LOG( LUX_ERROR,LUX_SYSTEM) << "Error removing file '" << filename << "', error code: '" << ec << "'";
+		}
+
+		if (output_error)
+			// throw exception so the connection is terminated
+			throw std::runtime_error("Error writing file '" + filename + "'");
+		if (stream_error)
+			// the rest of the stream is out of sync, terminate the connection
+			throw std::runtime_error("Error reading file '" + filename + "'");
+
+		return false;
+	}
+
+	return true;
+}
+
+bool FileTransfer::Fetch(const string &host, const string &port,
+	const string &filename, const string &filehash, int compression)
+{
+	try {
+		tcp::iostream stream(host, port);
+		if (!stream) {
+			LOG( LUX_WARNING,LUX_SYSTEM) << "Unable to connect to " << host << ":" << port << " to fetch file '" << filename << "'";
+			return false;
+		}
+		stream.rdbuf()->set_option(tcp::no_delay(true));
+
+		stream << "GetFile" << "\n";
+		stream << filehash << "\n";
+		stream << fileExtension(filename) << "\n";
+		stream << compression << "\n";
+		stream.flush();
+
+		return Receive(stream, filename, filehash, true);
+	} catch (boost::system::system_error &e) {
+		LOG( LUX_WARNING,LUX_SYSTEM) << "Error fetching file '" << filename << "' from " << host << ":" << port << ": " << e.what();
+	} catch (std::runtime_error &e) {
+		// Local write errors must end the session
+		throw;
+	} catch (std::exception &e) {
+		LOG( LUX_WARNING,LUX_SYSTEM) << "Error fetching file '" << filename << "' from " << host << ":" << port << ": " << e.what();
+	}
+	return false;
+}
+
+void FileTransfer::Serve(iostream &stream)
+{
+	string filehash, extension, level;
+	getline(stream, filehash);
+	getline(stream, extension);
+	getline(stream, level);
+
+	// Don't let peers walk out of the current directory
+	bool valid = !filehash.empty() && extension.size() < 16 &&
+		(extension.empty() || extension[0] == '.');
+	for (size_t i = 0; i < filehash.size(); ++i)
+		valid = valid && isalnum(static_cast<unsigned char>(filehash[i]));
+	for (size_t i = 1; i < extension.size(); ++i)
+		valid = valid && isalnum(static_cast<unsigned char>(extension[i]));
+
+	const string filename("tmp_" + filehash + extension);
+	boost::system::error_code ec;
+	if (!valid || !boost::filesystem::exists(filename, ec)) {
+		LOG( LUX_DEBUG,LUX_NOERROR) << "Peer requested unavailable file '" << filename << "'";
+		stream << "\nnone\n0\n";
+	} else {
+		LOG( LUX_INFO,LUX_NOERROR) << "Serving file '" << filename << "' to peer";
+		int compression = 0;
+		try {
+			compression = boost::lexical_cast<int>(level);
+		} catch (boost::bad_lexical_cast &) {
+		}
+		Send(stream, filename, compression);
+	}
+	stream.flush();
+}
+
+string FileTransfer::LocalName(const string &filename, const string &filehash)
+{
+	return "tmp_" + filehash + fileExtension(filename);
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_FILETRANSFER_H
+#define LUX_FILETRANSFER_H
+// filetransfer.h*
+
+#include "lux.h"
+
+#include <string>
+#include <iostream>
+
+namespace lux
+{
+
+/**
+   Transfer of the files referenced by a scene between the master and the
+   render servers, and between the render servers themselves.
+   A file is sent as a header followed by its content:
+     original filename
+     encoding: "raw", "gzip", "relay" or "none" if the file isn't available
+     uncompressed length ("relay": host, port and compression level lines)
+   "raw" content is sent as is, "gzip" content is a sequence of
+   independently compressed chunks, each prefixed by its little endian
+   compressed size, terminated by an empty chunk.
+   "relay" tells the receiver to fetch the file from another render server
+   with the GetFile command.
+*/
+class FileTransfer
+{
+public:
+	/**
+	   Send a file
+	   @param stream the stream to write to
+	   @param filename the file on disk
+	   @param compression the gzip level, 0 to send the file uncompressed
+	   @return false if the file couldn't be read
+	*/
+	static bool Send(std::ostream &stream, const std::string &filename,
+		int compression);
+	/**
+	   Tell the receiver to fetch a file from another render server
+	*/
+	static void SendRelay(std::ostream &stream, const std::string &filename,
+		const std::string &host, const std::string &port,
+		int compression);
+	/**
+	   Receive a file sent with Send or SendRelay
+	   @param stream the stream to read from
+	   @param filename the destination file
+	   @param filehash the expected tiger hash of the file
+	   @param fromPeer true when reading from another render server,
+	   relays and unavailable files are then errors
+	   @return false if the file is corrupt or couldn't be fetched, the
+	   partial file is removed
+	   Throws if the destination file can't be written.
+	*/
+	static bool Receive(std::istream &stream, const std::string &filename,
+		const std::string &filehash, bool fromPeer = false);
+	/**
+	   Fetch a file from another render server
+	*/
+	static bool Fetch(const std::string &host, const std::string &port,
+		const std::string &filename, const std::string &filehash,
+		int compression);
+	/**
+	   Answer a GetFile request from another render server, only the files
+	   received in the current directory can be requested
+	*/
+	static void Serve(std::iostream &stream);
+
+	/**
+	   Name of the local copy of a received file
+	*/
+	static std::string LocalName(const std::string &filename,
+		const std::string &filehash);
+};
+
+} // namespace lux
+
+#endif // LUX_FILETRANSFER_H
@@ -33,17 +33,26 @@
 #include "osfunc.h"
 #include "streamio.h"
 #include "exrio.h"
+#include "taskpool.h"
+#include "numa.h"
+#include "rendercounters.h"
 
 #include <algorithm>
 #include <fstream>
+#include <xmmintrin.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/stream_buffer.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/filesystem.hpp>
 //#include <boost/math/special_functions/bessel.hpp>
 #include <complex>
@@ -274,12 +283,13 @@ struct BloomFilterX
 		xyzpixels(xyzpixels_)
 	{}
 
-	void operator()()
+	// Filters rows [yStart, yEnd)
+	void operator()(u_int yStart, u_int yEnd) const
 	{
 		// working row
 		std::vector<XYZColor> row(xResolution, XYZColor(0.f));
 		// Apply bloom filter to image pixels
-		for (u_int y = 0; y < yResolution; ++y) {
+		for (u_int y = yStart; y < yEnd; ++y) {
 			for (u_int x = 0; x < xResolution; ++x) {
 				// Compute bloom for pixel _(x,y)_
 				// Compute extent of pixels contributing bloom
@@ -291,6 +301,7 @@ struct BloomFilterX
 				float sumWt = 0.f;
 				const u_int by = y;
 				XYZColor &pixel(row[x]);
+				pixel = XYZColor(0.f);
 				for (u_int bx = x0; bx <= x1; ++bx) {
 					// Accumulate bloom from pixel $(bx,by)$
 					const u_int dist2 = (x - bx) * (x - bx) + (y - by) * (y - by);
@@ -336,12 +347,13 @@ struct BloomFilterY
 		xyzpixels(xyzpixels_)
 	{}
 
-	void operator()()
+	// Filters columns [xStart, xEnd)
+	void operator()(u_int xStart, u_int xEnd) const
 	{
 		// working column
 		std::vector<XYZColor> col(yResolution, XYZColor(0.f));
 		// Apply bloom filter to image pixels
-		for (u_int x = 0; x < xResolution; ++x) {
+		for (u_int x = xStart; x < xEnd; ++x) {
 			for (u_int y = 0; y < yResolution; ++y) {
 				// Compute bloom for pixel _(x,y)_
 				// Compute extent of pixels contributing bloom
@@ -352,6 +364,7 @@ struct BloomFilterY
 				//const u_int offset = y * xResolution + x;
 				float sumWt = 0.f;
 				XYZColor &pixel(col[y]);
+				pixel = XYZColor(0.f);
 				for (u_int by = y0; by <= y1; ++by) {
 					const u_int bx = x;
 					// Accumulate bloom from pixel $(bx,by)$
@@ -409,10 +422,11 @@ struct VignettingFilter
 		invyRes(1.f / yResolution_)
 	{}
 
-	void operator()()
+	// Filters rows [yStart, yEnd)
+	void operator()(u_int yStart, u_int yEnd) const
 	{
 		//for each pixel in the source image
-		for(u_int y = 0; y < yResolution; ++y) {
+		for(u_int y = yStart; y < yEnd; ++y) {
 			for(u_int x = 0; x < xResolution; ++x) {
 				const float nPx = x * invxRes;
 				const float nPy = y * invyRes;
@@ -631,9 +645,10 @@ void ApplyImagingPipeline(vector<XYZColor> &xyzpixels, u_int xResolution, u_int
 
 			//BloomFilter(xResolution, yResolution, bloomWidth, bloomFilter, bloomImage, xyzpixels)();
 
-			// apply separable filter
-			BloomFilterX(xResolution, yResolution, bloomWidth, bloomFilter, bloomImage, &xyzpixels[0])();
-			BloomFilterY(xResolution, yResolution, bloomWidth, bloomFilter, bloomImage, bloomImage)();
+			// apply separable filter, the rows and then the columns
+			// are filtered concurrently by the task pool
+			ParallelFor(0, yResolution, 0, BloomFilterX(xResolution, yResolution, bloomWidth, bloomFilter, bloomImage, &xyzpixels[0]), "bloom");
+			ParallelFor(0, xResolution, 0, BloomFilterY(xResolution, yResolution, bloomWidth, bloomFilter, bloomImage, bloomImage), "bloom");
 		}
 
 		// Mix bloom effect into each pixel
@@ -879,7 +894,7 @@ void ApplyImagingPipeline(vector<XYZColor> &xyzpixels, u_int xResolution, u_int
 		}
 
 		// VignettingFilter
-		VignettingFilter(xResolution, yResolution, aberrationEnabled, aberrationAmount, outp, rgbpixels, VignettingEnabled, VignetScale)();
+		ParallelFor(0, yResolution, 0, VignettingFilter(xResolution, yResolution, aberrationEnabled, aberrationAmount, outp, rgbpixels, VignettingEnabled, VignetScale), "vignetting");
 
 		if (aberrationEnabled) {
 			for(u_int i = 0; i < nPix; ++i)
@@ -1005,6 +1020,153 @@ void ApplyImagingPipeline(vector<XYZColor> &xyzpixels, u_int xResolution, u_int
 }
 
 
+// Feature guided denoiser Definitions
+// The color is divided by the first hit albedo so that textures are not
+// blurred, the resulting irradiance is filtered with a cross-bilateral
+// filter whose weights combine the similarity of the features with a
+// color distance normalized by the estimated noise of each pixel, then
+// the albedo is multiplied back.
+class DenoiseFilter {
+public:
+	DenoiseFilter(u_int xRes, u_int yRes, const DenoiserParams &p,
+		const vector<XYZColor> &irr, const vector<XYZColor> &alb,
+		const vector<Normal> &n, const vector<float> &z,
+		const vector<float> &v, bool useFeatures,
+		vector<XYZColor> &outPixels) :
+		xResolution(xRes), yResolution(yRes), params(p),
+		irradiance(irr), albedo(alb), normal(n), depth(z), noise(v),
+		features(useFeatures), out(outPixels) {
+		const int r = static_cast<int>(params.radius);
+		const float invSigma2 = 1.f / (2.f * (.5f * r + .5f) * (.5f * r + .5f));
+		spatial.resize((2 * r + 1) * (2 * r + 1));
+		for (int dy = -r, i = 0; dy <= r; ++dy)
+			for (int dx = -r; dx <= r; ++dx, ++i)
+				spatial[i] = expf(-(dx * dx + dy * dy) * invSigma2);
+		invColor = 1.f / max(params.sigmaColor * params.sigmaColor, 1e-6f);
+		invAlbedo = 1.f / max(params.sigmaAlbedo * params.sigmaAlbedo, 1e-6f);
+		invNormal = 1.f / max(params.sigmaNormal * params.sigmaNormal, 1e-6f);
+		invDepth = 1.f / max(params.sigmaDepth * params.sigmaDepth, 1e-6f);
+	}
+
+	void operator()(u_int yStart, u_int yEnd) const {
+		const int r = static_cast<int>(params.radius);
+		for (u_int y = yStart; y < yEnd; ++y) {
+			const int y0 = max(0, static_cast<int>(y) - r);
+			const int y1 = min(static_cast<int>(yResolution) - 1, static_cast<int>(y) + r);
+			for (u_int x = 0; x < xResolution; ++x) {
+				const int x0 = max(0, static_cast<int>(x) - r);
+				const int x1 = min(static_cast<int>(xResolution) - 1, static_cast<int>(x) + r);
+				const u_int p = y * xResolution + x;
+				const float Yp = irradiance[p].c[1];
+
+				XYZColor sum(0.f);
+				float weightSum = 0.f;
+				for (int ty = y0; ty <= y1; ++ty) {
+					const int rowOffset = (ty - static_cast<int>(y) + r) *
+						(2 * r + 1) + r - static_cast<int>(x);
+					for (int tx = x0; tx <= x1; ++tx) {
+						const u_int q = ty * xResolution + tx;
+
+						// Color distance, the part explained by the noise
+						// of both pixels is ignored
+						const float dY = Yp - irradiance[q].c[1];
+						const float v = noise[p] + noise[q];
+						float d = max(0.f, dY * dY - v) * invColor /
+							(v + 1e-4f * Yp * Yp + 1e-10f);
+
+						if (features) {
+							const XYZColor dA(albedo[p] - albedo[q]);
+							d += (dA.c[0] * dA.c[0] + dA.c[1] * dA.c[1] +
+								dA.c[2] * dA.c[2]) * invAlbedo;
+							const Normal dN(normal[p] - normal[q]);
+							d += (dN.x * dN.x + dN.y * dN.y + dN.z * dN.z) *
+								invNormal;
+							const float dZ = depth[p] - depth[q];
+							d += dZ * dZ * invDepth /
+								max(depth[p] * depth[p], 1e-8f);
+						}
+
+						// Skip the exponential for negligible weights
+						if (d > 20.f)
+							continue;
+						const float w = spatial[rowOffset + tx] * expf(-d);
+						sum += irradiance[q] * w;
+						weightSum += w;
+					}
+				}
+
+				// The center pixel always has a positive weight
+				out[p] = sum / weightSum;
+			}
+		}
+	}
+
+private:
+	u_int xResolution, yResolution;
+	const DenoiserParams &params;
+	const vector<XYZColor> &irradiance, &albedo;
+	const vector<Normal> &normal;
+	const vector<float> &depth, &noise;
+	bool features;
+	vector<XYZColor> &out;
+	vector<float> spatial;
+	float invColor, invAlbedo, invNormal, invDepth;
+};
+
+void DenoiseImage(vector<XYZColor> &pixels, u_int xResolution, u_int yResolution,
+	const DenoiserParams &params, const FeatureBuffer *features,
+	const VarianceBuffer *variance)
+{
+	const u_int nPix = xResolution * yResolution;
+	if (nPix == 0 || params.radius == 0)
+		return;
+
+	vector<XYZColor> irradiance(nPix), albedo(nPix, XYZColor(0.f));
+	vector<Normal> normal(nPix, Normal(0.f, 0.f, 0.f));
+	vector<float> depth(nPix, 0.f), noise(nPix);
+	vector<XYZColor> modulation(nPix, XYZColor(1.f));
+	for (u_int y = 0, i = 0; y < yResolution; ++y) {
+		for (u_int x = 0; x < xResolution; ++x, ++i) {
+			if (features && features->GetData(x, y, &albedo[i],
+				&normal[i], &depth[i])) {
+				// Too dark albedos would amplify the noise
+				for (u_int c = 0; c < 3; ++c) {
+					if (albedo[i].c[c] > .01f)
+						modulation[i].c[c] = albedo[i].c[c];
+				}
+			}
+			irradiance[i] = pixels[i] / modulation[i];
+
+			// The variance buffer holds the variance of the samples
+			// luminance, use it relative to the mean so that it doesn't
+			// depend on the buffers scale
+			const float Y = irradiance[i].c[1];
+			float relativeVariance = .01f;
+			if (variance) {
+				const VariancePixel &vp = variance->pixels(x, y);
+				if (vp.weightSum > 0.f && vp.mean > 0.f)
+					relativeVariance = fabsf(vp.Sn / vp.weightSum) /
+						(vp.weightSum * vp.mean * vp.mean);
+			}
+			noise[i] = relativeVariance * Y * Y;
+		}
+	}
+
+	vector<XYZColor> filtered(nPix);
+	const DenoiseFilter filter(xResolution, yResolution, params,
+		irradiance, albedo, normal, depth, noise, features != NULL,
+		filtered);
+
+	// The threads parameter sets the number of slabs of rows
+	const u_int nSlabs = min(yResolution, params.threads > 0 ?
+		params.threads : 4 * TaskPool::Global().GetThreadCount());
+	ParallelFor(0, yResolution, (yResolution + nSlabs - 1) / nSlabs,
+		boost::bind<void>(boost::cref(filter), _1, _2), "Denoise");
+
+	for (u_int i = 0; i < nPix; ++i)
+		pixels[i] = filtered[i] * modulation[i];
+}
+
 // Filter Look Up Table Definitions
 
 FilterLUT::FilterLUT(Filter *filter, const float offsetX, const float offsetY) {
@@ -1015,7 +1177,8 @@ FilterLUT::FilterLUT(Filter *filter, const float offsetX, const float offsetY) {
 	lutWidth = max(1, x1 - x0 + 1);
 	lutHeight = max(1, y1 - y0 + 1);
 	//lut = new float[lutWidth * lutHeight];
-	lut.resize(lutWidth * lutHeight);
+	// padded with zeros to a multiple of 4 for the vectorized splatting
+	lut.resize((lutWidth * lutHeight + 3) & ~3u, 0.f);
 
 	float totalWeight = 0.f;
 	unsigned int index = 0;
@@ -1061,6 +1224,7 @@ FilterLUTs::FilterLUTs(Filter *filter, const unsigned int size) {
 	step = 1.f / float(size);
 
 	luts.resize(lutsSize * lutsSize);
+	maxSize = 0;
 
 	for (unsigned int iy = 0; iy < lutsSize; ++iy) {
 		for (unsigned int ix = 0; ix < lutsSize; ++ix) {
@@ -1068,6 +1232,8 @@ FilterLUTs::FilterLUTs(Filter *filter, const unsigned int size) {
 			const float y = iy * step - 0.5f + step / 2.f;
 
 			luts[ix + iy * lutsSize] = FilterLUT(filter, x, y);
+			maxSize = max(maxSize, luts[ix + iy * lutsSize].GetWidth() *
+				luts[ix + iy * lutsSize].GetHeight());
 		}
 	}
 }
@@ -1106,6 +1272,11 @@ void BufferGroup::CreateBuffers(const vector<BufferConfig> &configs, u_int x, u_
 
 // Film Function Definitions
 
+u_int Film::GetContributionQueueDepth()
+{
+	return contribPool ? contribPool->GetQueueDepth() : 0;
+}
+
 u_int Film::GetXResolution()
 {
 	return xResolution;
@@ -1136,6 +1307,12 @@ u_int Film::GetYPixelCount()
 	return yPixelCount;
 }
 
+// Splatting state of the film the calling thread splatted into last
+static fast_mutex splatSerialMutex;
+static u_int lastSplatSerial = 0;
+static LUX_THREAD_LOCAL u_int currentSplatSerial = 0;
+static LUX_THREAD_LOCAL void *currentSplatState = NULL;
+
 Film::Film(u_int xres, u_int yres, Filter *filt, u_int filtRes, const float crop[4], 
 		   const string &filename1, bool premult, bool useZbuffer,
 		   bool w_resume_FLM, bool restart_resume_FLM, bool write_FLM_direct,
@@ -1148,16 +1325,24 @@ Film::Film(u_int xres, u_int yres, Filter *filt, u_int filtRes, const float crop
 	contribPool(NULL), filter(filt), filterTable(NULL), filterLUTs(NULL),
 	filename(filename1),
 	colorSpace(0.63f, 0.34f, 0.31f, 0.595f, 0.155f, 0.07f, 0.314275f, 0.329411f), // default is SMPTE
-	convTest(NULL), varianceBuffer(NULL),
+	convTest(NULL), varianceBuffer(NULL), featureBuffer(NULL),
 	noiseAwareMapVersion(0),
 	userSamplingMapFileName(samplingmapfilename), userSamplingMapVersion(0),
+	tileMaskSize(0),
 	ZBuffer(NULL), use_Zbuf(useZbuffer),
 	debug_mode(debugmode), premultiplyAlpha(premult),
 	writeResumeFlm(w_resume_FLM), restartResumeFlm(restart_resume_FLM), writeFlmDirect(write_FLM_direct),
 	outlierRejection_k(outlierk), haltSamplesPerPixel(haltspp),
 	haltTime(halttime), haltThreshold(haltthreshold), haltThresholdComplete(0.f),
-	histogram(NULL), enoughSamplesPerPixel(false)
+	tileHaltThreshold(-1.f), previewStride(1), histogram(NULL), enoughSamplesPerPixel(false),
+	writeLockTime(0.0),
+	filmWriter(NULL)
 {
+	{
+		fast_mutex::scoped_lock lock(splatSerialMutex);
+		splatSerial = ++lastSplatSerial;
+	}
+
 	// Compute film image extent
 	memcpy(cropWindow, crop, 4 * sizeof(float));
 	xPixelStart = Ceil2UInt(xResolution * cropWindow[0]);
@@ -1182,11 +1367,14 @@ Film::Film(u_int xres, u_int yres, Filter *filt, u_int filtRes, const float crop
 	AddDoubleAttribute(*this, "numberOfLocalSamples", "Number of samples contributed to film on the local machine", &Film::numberOfLocalSamples);
 	AddDoubleAttribute(*this, "numberOfSamplesFromNetwork", "Number of samples contributed from network slaves", &Film::numberOfSamplesFromNetwork);
 	AddDoubleAttribute(*this, "numberOfResumedSamples", "Number of samples loaded from saved film", &Film::numberOfResumedSamples);
+	AddDoubleAttribute(*this, "splatRate", "Number of contributions splatted per second of splatting time", &Film::GetSplatRate);
 	AddBoolAttribute(*this, "enoughSamples", "Indicates if the halt condition been reached", &Film::enoughSamplesPerPixel);
 	AddIntAttribute(*this, "haltSamplesPerPixel", "Halt Samples per Pixel", haltSamplesPerPixel, &Film::haltSamplesPerPixel, Queryable::ReadWriteAccess);
 	AddIntAttribute(*this, "haltTime", "Halt time in seconds", haltTime, &Film::haltTime, Queryable::ReadWriteAccess);
 	AddFloatAttribute(*this, "haltThreshold", "Halt threshold", haltThreshold, &Film::haltThreshold, Queryable::ReadWriteAccess);
 	AddFloatAttribute(*this, "haltThresholdComplete", "Halt threshold complete", &Film::haltThresholdComplete);
+	AddFloatAttribute(*this, "tileHaltThreshold", "Tile halt threshold", &Film::tileHaltThreshold);
+	AddIntAttribute(*this, "previewStride", "Resolution divider of the progressive preview", &Film::previewStride);
 	AddBoolAttribute(*this, "writeResumeFlm", "Write resume file", writeResumeFlm, &Film::writeResumeFlm, Queryable::ReadWriteAccess);
 	AddBoolAttribute(*this, "restartResumeFlm", "Restart (overwrite) resume file", restartResumeFlm, &Film::restartResumeFlm, Queryable::ReadWriteAccess);
 	AddBoolAttribute(*this, "writeFlmDirect", "Write resume file directly to disk", writeFlmDirect, &Film::writeFlmDirect, Queryable::ReadWriteAccess);	
@@ -1194,6 +1382,8 @@ Film::Film(u_int xres, u_int yres, Filter *filt, u_int filtRes, const float crop
 	AddFloatAttribute(*this, "cropWindow.1", "Crop window 1", &Film::GetCropWindow1);
 	AddFloatAttribute(*this, "cropWindow.2", "Crop window 2", &Film::GetCropWindow2);
 	AddFloatAttribute(*this, "cropWindow.3", "Crop window 3", &Film::GetCropWindow3);
+	AddIntAttribute(*this, "contributionQueueDepth", "Contribution buffers waiting to be splatted", &Film::GetContributionQueueDepth);
+	AddDoubleAttribute(*this, "writeLockTime", "Seconds the splatting was locked to copy the film for writing", &Film::GetWriteLockTime);
 
 	// Precompute filter tables
 	filterLUTs = new FilterLUTs(filt, max(min(filtRes, 64u), 2u));
@@ -1214,22 +1404,41 @@ Film::Film(u_int xres, u_int yres, Filter *filt, u_int filtRes, const float crop
 	
 	LOG(LUX_DEBUG, LUX_NOERROR) << "Requested film tile count: " << tileCount;
 
-	tileCount = Clamp(tileCount, 1u, yRealHeight / minTileHeight);
-	//tileCount = 2;
-
-	tileHeight = max(Ceil2UInt(static_cast<float>(yRealHeight) / tileCount), minTileHeight);
 	if (outlierRejection_k > 0) {
-		// if outlier rejection is enabled, tileHeight must be multiple of outlierCellHeight
+		// outlier rejection only duplicates the rows above and below
+		// a tile, so tiles have to be horizontal slabs
+		tileCount = Clamp(tileCount, 1u, yRealHeight / minTileHeight);
+		tileHeight = max(Ceil2UInt(static_cast<float>(yRealHeight) / tileCount), minTileHeight);
+		// tileHeight must be multiple of outlierCellHeight
 		// increase tileHeight to ensure this
 		tileHeight = outlierCellHeight * max(Ceil2UInt(static_cast<float>(tileHeight) / outlierCellHeight), 1u);
 		tileCount = max(Ceil2UInt(static_cast<float>(yRealHeight) / tileHeight), 1u);
+		tileColumns = 1;
+		tileRows = tileCount;
+		tileWidth = max(xPixelCount, 1u);
+	} else {
+		// square tiles, large enough so that a filter footprint
+		// spans at most 2 tiles in each direction
+		const u_int minTileSize = max(Ceil2UInt(2.f * max(filter->xWidth, filter->yWidth)), 1u);
+		tileCount = Clamp(tileCount, 1u, max(static_cast<u_int>(xRealWidth * yRealHeight) / (minTileSize * minTileSize), 1u));
+		const u_int tileSize = max(Ceil2UInt(sqrtf(static_cast<float>(xRealWidth) * yRealHeight / tileCount)), minTileSize);
+		tileWidth = tileSize;
+		tileHeight = tileSize;
+		tileColumns = max(Ceil2UInt(static_cast<float>(xPixelCount) / tileWidth), 1u);
+		tileRows = max(Ceil2UInt(static_cast<float>(yPixelCount) / tileHeight), 1u);
+		tileCount = tileColumns * tileRows;
 	}
 
-	LOG(LUX_DEBUG, LUX_NOERROR) << "Actual film tile count: " << tileCount;
+	LOG(LUX_DEBUG, LUX_NOERROR) << "Actual film tile count: " << tileCount <<
+		" (" << tileColumns << "x" << tileRows << " tiles of " <<
+		tileWidth << "x" << tileHeight << " pixels)";
 
+	invTileWidth = 1.f / tileWidth;
 	invTileHeight = 1.f / tileHeight;
-	tileOffset = -0.5f - filter->yWidth - yPixelStart;
-	tileOffset2 = 2 * filter->yWidth * invTileHeight;
+	tileOffsetX = -0.5f - filter->xWidth - xPixelStart;
+	tileOffsetY = -0.5f - filter->yWidth - yPixelStart;
+	tileOffset2X = 2 * filter->xWidth * invTileWidth;
+	tileOffset2Y = 2 * filter->yWidth * invTileHeight;
 
 	if (outlierRejection_k > 0) {
 		const u_int outliers_width = xRealWidth / outlierCellWidth;
@@ -1284,23 +1493,54 @@ Film::Film(u_int xres, u_int yres, Filter *filt, u_int filtRes, const float crop
 
 Film::~Film()
 {
+	WaitFilmWrite();
 	delete filterLUTs;
 	delete filter;
 	delete ZBuffer;
 	delete convTest;
 	delete varianceBuffer;
+	delete featureBuffer;
 	delete histogram;
 	delete contribPool;
+	for (size_t i = 0; i < splatThreadStates.size(); ++i)
+		delete splatThreadStates[i];
 }
 
 void Film::EnableNoiseAwareMap() {
-	varianceBuffer = new VarianceBuffer(xPixelCount, yPixelCount);
-	varianceBuffer->Clear();
+	// The variance buffer may already be used by the denoiser
+	if (!varianceBuffer) {
+		varianceBuffer = new VarianceBuffer(xPixelCount, yPixelCount);
+		varianceBuffer->Clear();
+	}
 
 	noiseAwareMap.reset(new float[xPixelCount * yPixelCount]);
 	std::fill(noiseAwareMap.get(), noiseAwareMap.get() + xPixelCount * yPixelCount, 1.f);
 }
 
+void Film::EnableFeatureBuffer() {
+	if (!featureBuffer)
+		featureBuffer = new FeatureBuffer(xPixelCount, yPixelCount);
+
+	// The denoiser also uses the pixel variance to estimate the noise
+	if (!varianceBuffer) {
+		varianceBuffer = new VarianceBuffer(xPixelCount, yPixelCount);
+		varianceBuffer->Clear();
+	}
+}
+
+void Film::AddFeatures(float imageX, float imageY, const XYZColor &albedo,
+	const Normal &n, float depth)
+{
+	if (!featureBuffer)
+		return;
+	const int x = Floor2Int(imageX) - static_cast<int>(xPixelStart);
+	const int y = Floor2Int(imageY) - static_cast<int>(yPixelStart);
+	if (x < 0 || y < 0 || x >= static_cast<int>(xPixelCount) ||
+		y >= static_cast<int>(yPixelCount))
+		return;
+	featureBuffer->Add(x, y, albedo, n, depth);
+}
+
 void Film::RequestBufferGroups(const vector<string> &bg)
 {
 	for (u_int i = 0; i < bg.size(); ++i)
@@ -1320,6 +1560,11 @@ void Film::CreateBuffers()
 		bufferGroups.push_back(BufferGroup("default"));
 	for (u_int i = 0; i < bufferGroups.size(); ++i)
 		bufferGroups[i].CreateBuffers(bufferConfigs, xPixelCount, yPixelCount);
+	// The pixels are splatted by the render threads of all the NUMA nodes
+	for (u_int i = 0; i < bufferGroups.size(); ++i) {
+		for (u_int j = 0; j < bufferConfigs.size(); ++j)
+			NumaInterleave(bufferGroups[i].getBuffer(j)->pixels);
+	}
 
 	// Allocate ZBuf buffer if needed
 	if (use_Zbuf)
@@ -1387,6 +1632,8 @@ void Film::ClearBuffers()
 
 		bufferGroup.numberOfSamples = 0;
 	}
+	if (featureBuffer)
+		featureBuffer->Clear();
 	ReSetSamplesNumber();
 }
 
@@ -1621,29 +1868,112 @@ u_int Film::GetTileCount() const {
 	return tileCount;
 }
 
-u_int Film::GetTileIndexes(const Contribution &contrib, u_int *tile0, u_int *tile1) const {
-	const float imageY = contrib.imageY + tileOffset;
-
-	const float tileY = imageY * invTileHeight;
+u_int Film::GetTileIndexes(const Contribution &contrib, u_int tiles[4]) const {
+	const float tileX = (contrib.imageX + tileOffsetX) * invTileWidth;
+	const u_int tileX0 = static_cast<u_int>(Clamp(static_cast<int>(tileX), 0, static_cast<int>(tileColumns - 1)));
+	const u_int nX = (tileX0 + 1 < tileColumns && tileX + tileOffset2X >= tileX0 + 1) ? 2u : 1u;
 
-	*tile0 = static_cast<u_int>(Clamp(static_cast<int>(tileY), 0, static_cast<int>(tileCount-1)));
-	*tile1 = *tile0 + 1;
+	const float tileY = (contrib.imageY + tileOffsetY) * invTileHeight;
+	const u_int tileY0 = static_cast<u_int>(Clamp(static_cast<int>(tileY), 0, static_cast<int>(tileRows - 1)));
+	const u_int nY = (tileY0 + 1 < tileRows && tileY + tileOffset2Y >= tileY0 + 1) ? 2u : 1u;
 
-	if (*tile1 >= tileCount || tileY + tileOffset2 < *tile1)
-		return 1u;
+	u_int n = 0;
+	for (u_int y = tileY0; y < tileY0 + nY; ++y) {
+		for (u_int x = tileX0; x < tileX0 + nX; ++x)
+			tiles[n++] = y * tileColumns + x;
+	}
 
-	return 2u;
+	return n;
 }
 
 void Film::GetTileExtent(u_int tileIndex, int *xstart, int *xend, int *ystart, int *yend) const {
-	*xstart = xPixelStart;
-	*xend = xPixelStart + xPixelCount;
-	*ystart = yPixelStart + min(tileIndex * tileHeight, yPixelCount);
-	*yend = yPixelStart + min((tileIndex+1) * tileHeight, yPixelCount);
+	const u_int tileX = tileIndex % tileColumns;
+	const u_int tileY = tileIndex / tileColumns;
+	*xstart = xPixelStart + min(tileX * tileWidth, xPixelCount);
+	*xend = xPixelStart + min((tileX+1) * tileWidth, xPixelCount);
+	*ystart = yPixelStart + min(tileY * tileHeight, yPixelCount);
+	*yend = yPixelStart + min((tileY+1) * tileHeight, yPixelCount);
+}
+
+Film::SplatThreadState &Film::GetSplatThreadState() {
+	if (currentSplatSerial == splatSerial)
+		return *static_cast<SplatThreadState *>(currentSplatState);
+
+	// The thread may come back from splatting into another film
+	const boost::thread::id self(boost::this_thread::get_id());
+	SplatThreadState *state = NULL;
+	{
+		fast_mutex::scoped_lock lock(splatStatsMutex);
+		for (size_t i = 0; i < splatThreadStates.size(); ++i) {
+			if (splatThreadStates[i]->owner == self) {
+				state = splatThreadStates[i];
+				break;
+			}
+		}
+		if (!state) {
+			state = new SplatThreadState(self);
+			state->weights.resize((filterLUTs->GetMaxSize() + 3) & ~3u);
+			splatThreadStates.push_back(state);
+		}
+	}
+	currentSplatSerial = splatSerial;
+	currentSplatState = state;
+	return *state;
 }
 
 void Film::AddTileSamples(const Contribution* const contribs, u_int num_contribs,
 		u_int tileIndex) {
+	SplatThreadState &state(GetSplatThreadState());
+	const bool timed = state.flushes++ % splatTimingStride == 0;
+	const double start = timed ? WallClockTime() : 0.0;
+
+	// Select the splat kernel for the active per pixel buffers
+	float *weights = &state.weights[0];
+	const bool useZ = use_Zbuf && ZBuffer;
+	if (useZ) {
+		if (varianceBuffer)
+			SplatTileSamples<true, true>(contribs, num_contribs, tileIndex, weights);
+		else
+			SplatTileSamples<true, false>(contribs, num_contribs, tileIndex, weights);
+	} else {
+		if (varianceBuffer)
+			SplatTileSamples<false, true>(contribs, num_contribs, tileIndex, weights);
+		else
+			SplatTileSamples<false, false>(contribs, num_contribs, tileIndex, weights);
+	}
+
+	if (timed) {
+		state.contributions += num_contribs;
+		state.time += WallClockTime() - start;
+	}
+}
+
+double Film::GetSplatRate() {
+	// The per thread statistics are read without synchronization,
+	// the rate may lag a little behind
+	fast_mutex::scoped_lock lock(splatStatsMutex);
+	double contributions = 0.0, time = 0.0;
+	for (size_t i = 0; i < splatThreadStates.size(); ++i) {
+		contributions += splatThreadStates[i]->contributions;
+		time += splatThreadStates[i]->time;
+	}
+	return time > 0.0 ? contributions / time : 0.0;
+}
+
+void Film::AddWriteLockTime(double seconds) {
+	fast_mutex::scoped_lock lock(splatStatsMutex);
+	writeLockTime += seconds;
+}
+
+double Film::GetWriteLockTime() {
+	fast_mutex::scoped_lock lock(splatStatsMutex);
+	return writeLockTime;
+}
+
+template <bool useZ, bool useVariance> void Film::SplatTileSamples(
+	const Contribution* const contribs, u_int num_contribs, u_int tileIndex,
+	float *weights)
+{
 	int xTilePixelStart, xTilePixelEnd;
 	int yTilePixelStart, yTilePixelEnd;
 	GetTileExtent(tileIndex, &xTilePixelStart, &xTilePixelEnd, &yTilePixelStart, &yTilePixelEnd);
@@ -1701,9 +2031,10 @@ void Film::AddTileSamples(const Contribution* const contribs, u_int num_contribs
 		const FilterLUT &filterLUT = 
 			filterLUTs->GetLUT(dImageX - Floor2Int(contrib.imageX), dImageY - Floor2Int(contrib.imageY));
 		const float *lut = filterLUT.GetLUT();
+		const u_int lutWidth = filterLUT.GetWidth();
 
 		int x0 = Ceil2Int (dImageX - filter->xWidth);
-		int x1 = x0 + filterLUT.GetWidth();
+		int x1 = x0 + lutWidth;
 		int y0 = Ceil2Int (dImageY - filter->yWidth);
 		int y1 = y0 + filterLUT.GetHeight();
 		if (x1 < x0 || y1 < y0 || x1 < 0 || y1 < 0)
@@ -1713,26 +2044,40 @@ void Film::AddTileSamples(const Contribution* const contribs, u_int num_contribs
 		const u_int yStart = static_cast<u_int>(max(y0, yTilePixelStart));
 		const u_int xEnd = static_cast<u_int>(min(x1, xTilePixelEnd));
 		const u_int yEnd = static_cast<u_int>(min(y1, yTilePixelEnd));
+		if (xStart >= xEnd || yStart >= yEnd)
+			continue;
+
+		// Scale the filter table of the whole footprint at once
+		const u_int lutSize = lutWidth * filterLUT.GetHeight();
+		const __m128 weight4 = _mm_set1_ps(weight);
+		for (u_int i = 0; i < lutSize; i += 4)
+			_mm_storeu_ps(&weights[i], _mm_mul_ps(_mm_loadu_ps(lut + i), weight4));
+
+		// X, Y, Z and alpha are contiguous in a Pixel,
+		// they are updated with a single vector operation
+		// (unaligned since a Pixel is 20 bytes)
+		const __m128 color4 = _mm_setr_ps(xyz.c[0], xyz.c[1], xyz.c[2], alpha);
+		const bool addZ = useZ && contrib.zdepth != 0.f;
 
 		for (u_int y = yStart; y < yEnd; ++y) {
-			const int yoffset = (y - y0) * filterLUT.GetWidth();
+			const float *rowWeights = weights + (y - y0) * lutWidth;
 			const u_int yPixel = y - yPixelStart;
 			for (u_int x = xStart; x < xEnd; ++x) {
-				// Evaluate filter value at $(x,y)$ pixel
-				const int xoffset = x-x0;
-				const float filterWt = lut[yoffset + xoffset];
-
 				// Update pixel values with filtered sample contribution
 				const u_int xPixel = x - xPixelStart;
-				const float w = filterWt * weight;
-				buffer->Add(xPixel, yPixel, xyz, alpha, w);
+				const float w = rowWeights[x - x0];
+				Pixel &pixel = buffer->pixels(xPixel, yPixel);
+				float *values = &pixel.L.c[0];
+				_mm_storeu_ps(values, _mm_add_ps(_mm_loadu_ps(values),
+					_mm_mul_ps(color4, _mm_set1_ps(w))));
+				pixel.weightSum += w;
 
 				// Update ZBuffer values with filtered zdepth contribution
-				if(use_Zbuf && contrib.zdepth != 0.f)
+				if (addZ)
 					ZBuffer->Add(xPixel, yPixel, contrib.zdepth, 1.0f);
 
 				// Update variance information
-				if (varianceBuffer)
+				if (useVariance)
 					varianceBuffer->Add(xPixel, yPixel, xyz, w);
 			}
 		}
@@ -1740,11 +2085,10 @@ void Film::AddTileSamples(const Contribution* const contribs, u_int num_contribs
 }
 
 void Film::AddSample(Contribution *contrib) {
-	u_int tileIndex0, tileIndex1;
-	u_int tiles = GetTileIndexes(*contrib, &tileIndex0, &tileIndex1);
-	AddTileSamples(contrib, 1, tileIndex0);
-	if (tiles > 1)
-		AddTileSamples(contrib, 1, tileIndex1);
+	u_int tileIndexes[4];
+	const u_int tiles = GetTileIndexes(*contrib, tileIndexes);
+	for (u_int i = 0; i < tiles; ++i)
+		AddTileSamples(contrib, 1, tileIndexes[i]);
 }
 
 void Film::SetSample(const Contribution *contrib) {
@@ -1925,9 +2269,41 @@ void Film::AddSampleNoFiltering(const Contribution *contrib) {
  *  - data is written as binary little-endian
  *  - data is gzipped
  *  - the version is not intended for backward/forward compatibility but just as a check
+ *
+ * Chunked FLM format (version 1)
+ * ------------------------------
+ *
+ * The pixels are split in tiles compressed independently, so that they can
+ * be compressed and decompressed in parallel and that selected light groups
+ * or regions can be read without decompressing the rest of the film.
+ * Nothing is gzipped as a whole, a version 0 file is recognized by the
+ * gzip magic number in its first byte.
+ *
+ * Layout:
+ *
+ *   HEADER                        -       - same as version 0, uncompressed
+ *   tile_size                     - u_int - width and height of the tiles
+ *   for i in 1:#buffer_groups
+ *     #samples                    - double - the number of samples in the i'th buffer group
+ *   #chunks                       - u_int - the number of chunks
+ *   for c in 1:#chunks
+ *     buffer_group                - u_int - the buffer group of the c'th chunk
+ *     buffer_config               - u_int - the buffer of the c'th chunk
+ *     tile                        - u_int - the tile of the c'th chunk in raster order
+ *     compressed_size             - u_int - the size of the c'th chunk in bytes
+ *     raw_size                    - u_int - the decompressed size of the c'th chunk
+ *   for c in 1:#chunks
+ *     data                        -       - the zlib compressed pixels of the c'th chunk
+ *
+ * The pixels of a tile are stored in raster order one field (X, Y, Z,
+ * alpha, weight_sum) at a time, and each field one byte of its little-endian
+ * representation at a time, which compresses better than interleaved floats.
  */
 static const int FLM_MAGIC_NUMBER = 0xCEBCD816;
 static const int FLM_VERSION = 0; // should be incremented on each change to the format to allow detecting unsupported FLM data!
+static const int FLM_VERSION_CHUNKED = 1;
+static const u_int FLM_TILE_SIZE = 64;
+static const u_int FLM_PIXEL_FIELDS = 5;
 enum FlmParameterType {
 	FLM_PARAMETER_TYPE_FLOAT = 0,
 	FLM_PARAMETER_TYPE_STRING = 1,
@@ -2065,7 +2441,7 @@ private:
 class FlmHeader {
 public:
 	FlmHeader() {}
-	bool Read(boost::iostreams::filtering_stream<boost::iostreams::input> &in, bool isLittleEndian, Film *film );
+	bool Read(std::basic_istream<char> &in, bool isLittleEndian, Film *film, int version);
 	void Write(std::basic_ostream<char> &os, bool isLittleEndian) const;
 
 	int magicNumber;
@@ -2079,7 +2455,201 @@ public:
 	vector<FlmParameter> params;
 };
 
-bool FlmHeader::Read(boost::iostreams::filtering_stream<boost::iostreams::input> &in, bool isLittleEndian, Film *film ) {
+// Copy of the film taken under the pool lock, written without holding it
+class FilmSnapshot {
+public:
+	FlmHeader header;
+	vector<double> numberOfSamples; // Per buffer group
+	// Pixels of each buffer of each buffer group in raster order,
+	// empty if they couldn't be copied
+	vector<vector<Pixel> > pixels;
+};
+
+// Tiles of a chunked film
+class FlmTiling {
+public:
+	FlmTiling(u_int size, u_int xRes, u_int yRes) : tileSize(size),
+		xResolution(xRes), yResolution(yRes),
+		xTiles((xRes + size - 1) / size), yTiles((yRes + size - 1) / size) { }
+
+	u_int TileCount() const { return xTiles * yTiles; }
+	// Pixel extent of a tile, interval is [start, end)
+	void Extent(u_int tile, u_int *xStart, u_int *xEnd,
+		u_int *yStart, u_int *yEnd) const {
+		*xStart = (tile % xTiles) * tileSize;
+		*yStart = (tile / xTiles) * tileSize;
+		*xEnd = min(*xStart + tileSize, xResolution);
+		*yEnd = min(*yStart + tileSize, yResolution);
+	}
+	u_int RawSize(u_int tile) const {
+		u_int xStart, xEnd, yStart, yEnd;
+		Extent(tile, &xStart, &xEnd, &yStart, &yEnd);
+		return (xEnd - xStart) * (yEnd - yStart) * FLM_PIXEL_FIELDS * 4;
+	}
+
+	u_int tileSize, xResolution, yResolution, xTiles, yTiles;
+};
+
+// Index entry and compressed data of a chunk of a chunked film
+class FlmChunk {
+public:
+	FlmChunk() : group(0), buffer(0), tile(0), compressedSize(0),
+		rawSize(0) { }
+
+	u_int group, buffer, tile;
+	u_int compressedSize, rawSize;
+	vector<char> data;
+};
+
+static inline float GetPixelField(const Pixel &pixel, u_int field)
+{
+	return field < 3 ? pixel.L.c[field] :
+		(field == 3 ? pixel.alpha : pixel.weightSum);
+}
+
+static inline void SetPixelField(Pixel &pixel, u_int field, float value)
+{
+	if (field < 3)
+		pixel.L.c[field] = value;
+	else if (field == 3)
+		pixel.alpha = value;
+	else
+		pixel.weightSum = value;
+}
+
+// Shuffle and compress the pixels of a chunk, they are read from the
+// snapshot copy of the buffer if there is one, from the live buffer otherwise
+static bool CompressFlmChunk(const FlmTiling &tiling,
+	vector<FlmChunk> *chunks, const vector<const Pixel *> *copies,
+	const vector<const BlockedArray<Pixel> *> *buffers, u_int numBufferConfigs,
+	u_int index)
+{
+	FlmChunk &chunk((*chunks)[index]);
+	const u_int b = chunk.group * numBufferConfigs + chunk.buffer;
+	const Pixel *copy = (*copies)[b];
+	const BlockedArray<Pixel> *live = (*buffers)[b];
+	u_int xStart, xEnd, yStart, yEnd;
+	tiling.Extent(chunk.tile, &xStart, &xEnd, &yStart, &yEnd);
+	const u_int width = xEnd - xStart;
+	const u_int nPixels = width * (yEnd - yStart);
+	try {
+		vector<char> raw(tiling.RawSize(chunk.tile));
+		for (u_int y = yStart; y < yEnd; ++y) {
+			for (u_int x = xStart; x < xEnd; ++x) {
+				const Pixel &pixel = copy ?
+					copy[y * tiling.xResolution + x] : (*live)(x, y);
+				const u_int p = (y - yStart) * width + (x - xStart);
+				for (u_int f = 0; f < FLM_PIXEL_FIELDS; ++f) {
+					const float value = GetPixelField(pixel, f);
+					uint32_t bits;
+					memcpy(&bits, &value, 4);
+					for (u_int k = 0; k < 4; ++k)
+						raw[(f * 4 + k) * nPixels + p] =
+							static_cast<char>((bits >> (8 * k)) & 0xff);
+				}
+			}
+		}
+
+		filtering_stream<boost::iostreams::output> out;
+		out.push(zlib_compressor(zlib::best_speed));
+		out.push(boost::iostreams::back_inserter(chunk.data));
+		out.write(&raw[0], raw.size());
+		// Flush and close the compressor
+		out.reset();
+		chunk.rawSize = raw.size();
+		chunk.compressedSize = chunk.data.size();
+	} catch (std::exception &e) {
+		LOG(LUX_ERROR, LUX_SYSTEM) << "Error while compressing film chunk: " << e.what();
+		return false;
+	}
+	return true;
+}
+
+// Decompress and unshuffle the pixels of a chunk in its buffer
+static bool DecompressFlmChunk(const FlmTiling &tiling,
+	const vector<FlmChunk> *chunks, const vector<u_int> *selected,
+	vector<BlockedArray<Pixel> *> *pixels, u_int numBufferConfigs,
+	u_int index)
+{
+	const FlmChunk &chunk((*chunks)[(*selected)[index]]);
+	BlockedArray<Pixel> &buffer(*(*pixels)[chunk.group * numBufferConfigs + chunk.buffer]);
+	u_int xStart, xEnd, yStart, yEnd;
+	tiling.Extent(chunk.tile, &xStart, &xEnd, &yStart, &yEnd);
+	const u_int width = xEnd - xStart;
+	const u_int nPixels = width * (yEnd - yStart);
+	try {
+		vector<char> raw(chunk.rawSize);
+		filtering_stream<input> in;
+		in.push(zlib_decompressor());
+		in.push(array_source(&chunk.data[0], chunk.data.size()));
+		in.read(&raw[0], raw.size());
+		if (static_cast<u_int>(in.gcount()) != chunk.rawSize) {
+			LOG(LUX_ERROR, LUX_SYSTEM) << "Truncated film chunk";
+			return false;
+		}
+
+		for (u_int y = yStart; y < yEnd; ++y) {
+			for (u_int x = xStart; x < xEnd; ++x) {
+				Pixel &pixel = buffer(x, y);
+				const u_int p = (y - yStart) * width + (x - xStart);
+				for (u_int f = 0; f < FLM_PIXEL_FIELDS; ++f) {
+					uint32_t bits = 0;
+					for (u_int k = 0; k < 4; ++k)
+						bits |= static_cast<uint32_t>(static_cast<unsigned char>(raw[(f * 4 + k) * nPixels + p])) << (8 * k);
+					float value;
+					memcpy(&value, &bits, 4);
+					SetPixelField(pixel, f, value);
+				}
+			}
+		}
+	} catch (std::exception &e) {
+		LOG(LUX_ERROR, LUX_SYSTEM) << "Error while decompressing film chunk: " << e.what();
+		return false;
+	}
+	return true;
+}
+
+static void ProcessFlmChunkRange(
+	const boost::function<bool (u_int)> *process, char *ok,
+	u_int first, u_int last)
+{
+	for (u_int i = first; i < last; ++i)
+		ok[i] = (*process)(i) ? 1 : 0;
+}
+
+// Run process on each chunk, spreading them over the task pool
+static bool ProcessFlmChunks(u_int count,
+	const boost::function<bool (u_int)> &process)
+{
+	if (count == 0)
+		return true;
+	vector<char> ok(count, 1);
+	ParallelFor(0, count, 1, boost::bind(&ProcessFlmChunkRange, &process,
+		&ok[0], _1, _2), "FLM chunk");
+	return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+// Version 0 films are gzipped as a whole while chunked films start with
+// their uncompressed header
+static bool IsChunkedFlm(std::basic_istream<char> &stream)
+{
+	return stream.peek() != 0x1f;
+}
+
+// Read only the header of a film of any version
+static bool ReadFlmHeader(std::basic_istream<char> &stream, FlmHeader &header)
+{
+	const bool isLittleEndian = osIsLittleEndian();
+	if (IsChunkedFlm(stream))
+		return header.Read(stream, isLittleEndian, NULL, FLM_VERSION_CHUNKED);
+
+	filtering_stream<input> in;
+	in.push(gzip_decompressor());
+	in.push(stream);
+	return header.Read(in, isLittleEndian, NULL, FLM_VERSION);
+}
+
+bool FlmHeader::Read(std::basic_istream<char> &in, bool isLittleEndian, Film *film, int version) {
 	// Read and verify magic number and version
 	magicNumber = osReadLittleEndianInt(isLittleEndian, in);
 	if (!in.good()) {
@@ -2096,8 +2666,8 @@ bool FlmHeader::Read(boost::iostreams::filtering_stream<boost::iostreams::input>
 		LOG(LUX_ERROR,LUX_SYSTEM)<< "Error while receiving film";
 		return false;
 	}
-	if (versionNumber != FLM_VERSION) {
-		LOG(LUX_ERROR,LUX_SYSTEM) << "Invalid FLM version (expected=" << FLM_VERSION 
+	if (versionNumber != version) {
+		LOG(LUX_ERROR,LUX_SYSTEM) << "Invalid FLM version (expected=" << version 
 			<< ", received=" << versionNumber << ")";
 		return false;
 	}
@@ -2204,6 +2774,62 @@ void FlmHeader::Write(std::basic_ostream<char> &os, bool isLittleEndian) const
 }
 
 bool Film::WriteFilmToFile(const string &filename)
+{
+	// Don't race with a background write of the same file
+	WaitFilmWrite();
+	return WriteSnapshotToFile(NULL, filename);
+}
+
+bool Film::WriteFilmToFileAsync(const string &filename)
+{
+	boost::mutex::scoped_lock lock(filmWriterMutex);
+	if (filmWriter) {
+		if (!filmWriter->timed_join(boost::posix_time::seconds(0))) {
+			LOG(LUX_WARNING, LUX_NOERROR) << "Previous resume film is still being written, skipping this one";
+			return false;
+		}
+		delete filmWriter;
+		filmWriter = NULL;
+	}
+
+	boost::shared_ptr<FilmSnapshot> snapshot(new FilmSnapshot());
+	{
+		ScopedPoolLock poolLock(contribPool);
+		const double start = WallClockTime();
+		const bool copied = TakeSnapshot(*snapshot, true);
+		AddWriteLockTime(WallClockTime() - start);
+		if (!copied) {
+			// Not enough memory for a copy, write the film in place
+			poolLock.unlock();
+			lock.unlock();
+			return WriteFilmToFile(filename);
+		}
+	}
+
+	// The snapshot is kept alive by the writer thread
+	filmWriter = new boost::thread(boost::bind(&Film::FilmWriterThread,
+		this, snapshot, filename));
+	return true;
+}
+
+void Film::FilmWriterThread(boost::shared_ptr<FilmSnapshot> snapshot,
+	const string filename)
+{
+	WriteSnapshotToFile(snapshot.get(), filename);
+}
+
+void Film::WaitFilmWrite()
+{
+	boost::mutex::scoped_lock lock(filmWriterMutex);
+	if (filmWriter) {
+		filmWriter->join();
+		delete filmWriter;
+		filmWriter = NULL;
+	}
+}
+
+bool Film::WriteSnapshotToFile(const FilmSnapshot *snapshot,
+	const string &filename)
 {
 	const string tempFilename = filename + ".temp";
 
@@ -2216,7 +2842,15 @@ bool Film::WriteFilmToFile(const string &filename)
 		return false;
 	}
 
-	bool writeSuccessful = WriteFilmToStream(ofs, false, true, writeFlmDirect);
+	bool writeSuccessful;
+	if (snapshot) {
+		writeSuccessful = WriteSnapshotToStream(*snapshot, ofs);
+		if (!writeSuccessful || !ofs.good()) {
+			LOG(LUX_SEVERE, LUX_SYSTEM) << "Error while writing film to stream";
+			writeSuccessful = false;
+		}
+	} else
+		writeSuccessful = WriteFilmToStream(ofs, false, true, writeFlmDirect);
 	ofs.close();
 
 	if (writeSuccessful)
@@ -2274,297 +2908,490 @@ bool Film::WriteFilmToStream(
 	return true;
 }
 
-double Film::MergeFilmFromFile(const std::string& filename)
+double Film::MergeFilmFromFile(const std::string& filename,
+	const FlmSelection &selection)
 {
 	std::ifstream ifs(filename.c_str(), std::ios_base::in | std::ios_base::binary);
 	if (!ifs.good())
 		return 0;
 
 	LOG(LUX_INFO, LUX_NOERROR) << "Reading resume film from file " << filename;
-	return MergeFilmFromStream(ifs);
+	return MergeFilmFromStream(ifs, selection);
 }
 
-double Film::MergeFilmFromStream(std::basic_istream<char> &stream) {
+double Film::MergeFilmFromStream(std::basic_istream<char> &stream,
+	const FlmSelection &selection) {
+	LOG(LUX_DEBUG, LUX_NOERROR) << "Receiving film (little endian=" << boost::lexical_cast<std::string>(osIsLittleEndian()) << ")";
+
+	FlmHeader header;
+	vector<double> bufferGroupNumSamples;
+	vector<BlockedArray<Pixel>*> tmpPixelArrays;
+	double maxTotNumberOfSamples = 0.;
+	if (ReadFilmData(stream, header, bufferGroupNumSamples, tmpPixelArrays, selection)) {
+		// Update parameters
+		for (vector<FlmParameter>::iterator it = header.params.begin(); it != header.params.end(); ++it)
+			it->Set(this);
+
+		// lock the pool
+		ScopedPoolLock poolLock(contribPool);
+
+		maxTotNumberOfSamples = AddFilmData(bufferGroupNumSamples,
+			vector<const BlockedArray<Pixel> *>(tmpPixelArrays.begin(),
+			tmpPixelArrays.end()), selection);
+	}
+
+	// Clean up
+	for (u_int i = 0; i < tmpPixelArrays.size(); ++i)
+		delete tmpPixelArrays[i];
+
+	return maxTotNumberOfSamples;
+}
+
+bool Film::ReadFilmData(std::basic_istream<char> &stream, FlmHeader &header,
+	vector<double> &numberOfSamples, vector<BlockedArray<Pixel> *> &pixels,
+	const FlmSelection &selection)
+{
 	const bool isLittleEndian = osIsLittleEndian();
-	LOG(LUX_DEBUG, LUX_NOERROR) << "Receiving film (little endian=" << boost::lexical_cast<std::string>(isLittleEndian) << ")";
+	const u_int numBufferConfigs = bufferConfigs.size();
+	numberOfSamples.assign(bufferGroups.size(), 0.);
+	pixels.assign(bufferGroups.size() * numBufferConfigs, NULL);
 
-	// Enable compression
-	// TODO Move this below header when implementing FILM VERSION 2
-	boost::iostreams::filtering_stream<boost::iostreams::input> in;
-	in.push(boost::iostreams::gzip_decompressor());
-	in.push(stream);
+	if (!IsChunkedFlm(stream)) {
+		// Version 0 film, a single gzip stream that has to be fully read
+		filtering_stream<input> in;
+		in.push(gzip_decompressor());
+		in.push(stream);
 
-	// Read header
-	FlmHeader header;
-	if (!header.Read(in, isLittleEndian, this))
-		return 0.f;
+		if (!header.Read(in, isLittleEndian, this, FLM_VERSION))
+			return false;
 
-	// Read buffer groups
-	vector<double> bufferGroupNumSamples(bufferGroups.size());
-	vector<BlockedArray<Pixel>*> tmpPixelArrays(bufferGroups.size() * bufferConfigs.size());
-	for (u_int i = 0; i < bufferGroups.size(); i++) {
-		double numberOfSamples;
-		numberOfSamples = osReadLittleEndianDouble(isLittleEndian, in);
-		if (!in.good())
-			break;
-		bufferGroupNumSamples[i] = numberOfSamples;
-
-		// Read buffers
-		for(u_int j = 0; j < bufferConfigs.size(); ++j) {
-			const Buffer* localBuffer = bufferGroups[i].getBuffer(j);
-			// Read pixels
-			BlockedArray<Pixel> *tmpPixelArr = new BlockedArray<Pixel>(
-				localBuffer->xPixelCount, localBuffer->yPixelCount);
-			tmpPixelArrays[i*bufferConfigs.size() + j] = tmpPixelArr;
-			for (u_int y = 0; y < tmpPixelArr->vSize(); ++y) {
-				for (u_int x = 0; x < tmpPixelArr->uSize(); ++x) {
-					Pixel &pixel = (*tmpPixelArr)(x, y);
-					pixel.L.c[0] = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.L.c[1] = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.L.c[2] = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.alpha = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.weightSum = osReadLittleEndianFloat(isLittleEndian, in);
+		for (u_int i = 0; i < bufferGroups.size(); i++) {
+			numberOfSamples[i] = osReadLittleEndianDouble(isLittleEndian, in);
+			if (!in.good())
+				break;
+
+			// Read buffers
+			for(u_int j = 0; j < numBufferConfigs; ++j) {
+				const Buffer* localBuffer = bufferGroups[i].getBuffer(j);
+				// Read pixels
+				BlockedArray<Pixel> *tmpPixelArr = new BlockedArray<Pixel>(
+					localBuffer->xPixelCount, localBuffer->yPixelCount);
+				pixels[i * numBufferConfigs + j] = tmpPixelArr;
+				for (u_int y = 0; y < tmpPixelArr->vSize(); ++y) {
+					for (u_int x = 0; x < tmpPixelArr->uSize(); ++x) {
+						Pixel &pixel = (*tmpPixelArr)(x, y);
+						pixel.L.c[0] = osReadLittleEndianFloat(isLittleEndian, in);
+						pixel.L.c[1] = osReadLittleEndianFloat(isLittleEndian, in);
+						pixel.L.c[2] = osReadLittleEndianFloat(isLittleEndian, in);
+						pixel.alpha = osReadLittleEndianFloat(isLittleEndian, in);
+						pixel.weightSum = osReadLittleEndianFloat(isLittleEndian, in);
+					}
 				}
+				if (!in.good())
+					break;
 			}
 			if (!in.good())
 				break;
+
+			LOG( LUX_DEBUG,LUX_NOERROR)
+				<< "Received " << numberOfSamples[i] << " samples for buffer group " << i
+				<< " (buffer config size: " << numBufferConfigs << ")";
 		}
-		if (!in.good())
-			break;
 
+		if (!in.good()) {
+			LOG( LUX_ERROR,LUX_SYSTEM)<< "IO error while receiving film buffers";
+			return false;
+		}
+		return true;
+	}
+
+	if (!header.Read(stream, isLittleEndian, this, FLM_VERSION_CHUNKED))
+		return false;
+	const u_int tileSize = osReadLittleEndianUInt(isLittleEndian, stream);
+	if (!stream.good() || tileSize == 0) {
+		LOG(LUX_ERROR,LUX_SYSTEM) << "Invalid FLM tile size (received=" << tileSize << ")";
+		return false;
+	}
+	const FlmTiling tiling(tileSize, header.xResolution, header.yResolution);
+	for (u_int i = 0; i < bufferGroups.size(); ++i) {
+		numberOfSamples[i] = osReadLittleEndianDouble(isLittleEndian, stream);
 		LOG( LUX_DEBUG,LUX_NOERROR)
-			<< "Received " << bufferGroupNumSamples[i] << " samples for buffer group " << i
-			<< " (buffer config size: " << bufferConfigs.size() << ")";
+			<< "Received " << numberOfSamples[i] << " samples for buffer group " << i
+			<< " (buffer config size: " << numBufferConfigs << ")";
 	}
 
-	// Dade - check for errors
-	double totNumberOfSamples = 0.;
-	double maxTotNumberOfSamples = 0.;
-	if (in.good()) {
-		// Update parameters
-		for (vector<FlmParameter>::iterator it = header.params.begin(); it != header.params.end(); ++it)
-			it->Set(this);
+	// Read and check the chunk index
+	const u_int nChunks = osReadLittleEndianUInt(isLittleEndian, stream);
+	if (!stream.good() ||
+		nChunks > bufferGroups.size() * numBufferConfigs * tiling.TileCount()) {
+		LOG(LUX_ERROR,LUX_SYSTEM) << "Invalid number of FLM chunks (received=" << nChunks << ")";
+		return false;
+	}
+	vector<FlmChunk> chunks(nChunks);
+	vector<u_int> selected;
+	for (u_int c = 0; c < nChunks; ++c) {
+		FlmChunk &chunk(chunks[c]);
+		chunk.group = osReadLittleEndianUInt(isLittleEndian, stream);
+		chunk.buffer = osReadLittleEndianUInt(isLittleEndian, stream);
+		chunk.tile = osReadLittleEndianUInt(isLittleEndian, stream);
+		chunk.compressedSize = osReadLittleEndianUInt(isLittleEndian, stream);
+		chunk.rawSize = osReadLittleEndianUInt(isLittleEndian, stream);
+		if (!stream.good()) {
+			LOG(LUX_ERROR,LUX_SYSTEM)<< "Error while receiving film";
+			return false;
+		}
+		if (chunk.group >= bufferGroups.size() ||
+			chunk.buffer >= numBufferConfigs ||
+			chunk.tile >= tiling.TileCount() ||
+			chunk.compressedSize == 0 ||
+			chunk.rawSize != tiling.RawSize(chunk.tile)) {
+			LOG(LUX_ERROR,LUX_SYSTEM) << "Invalid FLM chunk " << c;
+			return false;
+		}
 
-		// lock the pool
-		ScopedPoolLock poolLock(contribPool);
+		u_int xStart, xEnd, yStart, yEnd;
+		tiling.Extent(chunk.tile, &xStart, &xEnd, &yStart, &yEnd);
+		if (selection.HasGroup(chunk.group) &&
+			selection.Overlaps(xStart, xEnd, yStart, yEnd))
+			selected.push_back(c);
+	}
 
-		// Dade - add all received data
-		for (u_int i = 0; i < bufferGroups.size(); ++i) {
-			BufferGroup &currentGroup = bufferGroups[i];
-			for (u_int j = 0; j < bufferConfigs.size(); ++j) {
-				const BlockedArray<Pixel> *receivedPixels = tmpPixelArrays[ i * bufferConfigs.size() + j ];
-				Buffer *buffer = currentGroup.getBuffer(j);
-
-				for (u_int y = 0; y < buffer->yPixelCount; ++y) {
-					for (u_int x = 0; x < buffer->xPixelCount; ++x) {
-						const Pixel &pixel = (*receivedPixels)(x, y);
-						Pixel &pixelResult = buffer->pixels(x, y);
-						pixelResult.L.c[0] += pixel.L.c[0];
-						pixelResult.L.c[1] += pixel.L.c[1];
-						pixelResult.L.c[2] += pixel.L.c[2];
-						pixelResult.alpha += pixel.alpha;
-						pixelResult.weightSum += pixel.weightSum;
-					}
+	// Only read the selected chunks, the stream is left after the last one
+	for (u_int c = 0, s = 0; s < selected.size(); ++c) {
+		FlmChunk &chunk(chunks[c]);
+		if (selected[s] != c) {
+			stream.ignore(chunk.compressedSize);
+			continue;
+		}
+		++s;
+		chunk.data.resize(chunk.compressedSize);
+		stream.read(&(chunk.data[0]), chunk.compressedSize);
+		if (!stream.good()) {
+			LOG( LUX_ERROR,LUX_SYSTEM)<< "IO error while receiving film buffers";
+			return false;
+		}
+
+		BlockedArray<Pixel> *&tmpPixelArr(pixels[chunk.group * numBufferConfigs + chunk.buffer]);
+		if (!tmpPixelArr)
+			tmpPixelArr = new BlockedArray<Pixel>(header.xResolution,
+				header.yResolution);
+	}
+
+	return ProcessFlmChunks(selected.size(), boost::bind(&DecompressFlmChunk,
+		boost::cref(tiling), &chunks, &selected, &pixels, numBufferConfigs,
+		_1));
+}
+
+double Film::AddFilmData(const vector<double> &numberOfSamples,
+	const vector<const BlockedArray<Pixel> *> &pixels,
+	const FlmSelection &selection)
+{
+	double totNumberOfSamples = 0.;
+	double maxTotNumberOfSamples = 0.;
+	for (u_int i = 0; i < bufferGroups.size(); ++i) {
+		if (!selection.HasGroup(i))
+			continue;
+		BufferGroup &currentGroup = bufferGroups[i];
+		for (u_int j = 0; j < bufferConfigs.size(); ++j) {
+			const BlockedArray<Pixel> *receivedPixels = pixels[ i * bufferConfigs.size() + j ];
+			if (!receivedPixels)
+				continue;
+			Buffer *buffer = currentGroup.getBuffer(j);
+
+			const u_int xEnd = min(selection.xEnd, buffer->xPixelCount);
+			const u_int yEnd = min(selection.yEnd, buffer->yPixelCount);
+			for (u_int y = selection.yStart; y < yEnd; ++y) {
+				for (u_int x = selection.xStart; x < xEnd; ++x) {
+					const Pixel &pixel = (*receivedPixels)(x, y);
+					Pixel &pixelResult = buffer->pixels(x, y);
+					pixelResult.L.c[0] += pixel.L.c[0];
+					pixelResult.L.c[1] += pixel.L.c[1];
+					pixelResult.L.c[2] += pixel.L.c[2];
+					pixelResult.alpha += pixel.alpha;
+					pixelResult.weightSum += pixel.weightSum;
 				}
 			}
-
-			currentGroup.numberOfSamples += bufferGroupNumSamples[i];
-			// Check if we have enough samples per pixel
-			if ((haltSamplesPerPixel > 0) &&
-				(currentGroup.numberOfSamples >= haltSamplesPerPixel * samplePerPass))
-				enoughSamplesPerPixel = true;
-			totNumberOfSamples += bufferGroupNumSamples[i];
-			maxTotNumberOfSamples = max(maxTotNumberOfSamples, bufferGroupNumSamples[i]);
 		}
 
-		LOG( LUX_DEBUG,LUX_NOERROR) << "Received film with " << totNumberOfSamples << " samples";
-	} else
-		LOG( LUX_ERROR,LUX_SYSTEM)<< "IO error while receiving film buffers";
+		currentGroup.numberOfSamples += numberOfSamples[i];
+		// Check if we have enough samples per pixel
+		if ((haltSamplesPerPixel > 0) &&
+			(currentGroup.numberOfSamples >= haltSamplesPerPixel * samplePerPass))
+			enoughSamplesPerPixel = true;
+		totNumberOfSamples += numberOfSamples[i];
+		maxTotNumberOfSamples = max(maxTotNumberOfSamples, numberOfSamples[i]);
+	}
 
-	// Clean up
-	for (u_int i = 0; i < tmpPixelArrays.size(); ++i)
-		delete tmpPixelArrays[i];
+	LOG( LUX_DEBUG,LUX_NOERROR) << "Received film with " << totNumberOfSamples << " samples";
 
 	return maxTotNumberOfSamples;
 }
 
+double Film::MergeFilm(const Film &film, const FlmSelection &selection)
+{
+	if (film.xPixelCount != xPixelCount || film.yPixelCount != yPixelCount ||
+		film.bufferGroups.size() != bufferGroups.size() ||
+		film.bufferConfigs.size() != bufferConfigs.size()) {
+		LOG(LUX_ERROR,LUX_SYSTEM) << "Can't merge a film with different buffers (resolution=" <<
+			film.xPixelCount << "x" << film.yPixelCount << ", buffer groups=" <<
+			film.bufferGroups.size() << ", buffers=" << film.bufferConfigs.size() << ")";
+		return 0.;
+	}
+	for (u_int j = 0; j < bufferConfigs.size(); ++j) {
+		if (film.bufferConfigs[j].type != bufferConfigs[j].type) {
+			LOG(LUX_ERROR,LUX_SYSTEM) << "Can't merge a film with different buffer types (buffer " << j <<
+				" expected=" << bufferConfigs[j].type << ", received=" << film.bufferConfigs[j].type << ")";
+			return 0.;
+		}
+	}
+
+	vector<double> numberOfSamples;
+	vector<const BlockedArray<Pixel> *> pixels;
+	for (u_int i = 0; i < film.bufferGroups.size(); ++i) {
+		numberOfSamples.push_back(film.bufferGroups[i].numberOfSamples);
+		for (u_int j = 0; j < film.bufferConfigs.size(); ++j)
+			pixels.push_back(&(film.bufferGroups[i].getBuffer(j)->pixels));
+	}
+
+	ScopedPoolLock poolLock(contribPool);
+	return AddFilmData(numberOfSamples, pixels, selection);
+}
+
 bool Film::WriteFilmDataToStream(
 		std::basic_ostream<char> &os,
 		bool clearBuffers,
 		bool transmitParams)
 {
-	const bool isLittleEndian = osIsLittleEndian();
-	LOG(LUX_DEBUG, LUX_NOERROR) << "Transmitting film (little endian=" << boost::lexical_cast<std::string>(isLittleEndian) << ")";
-
-	std::streampos osStartPosition = os.tellp();
+	FilmSnapshot snapshot;
 
+	// Only lock the splatting while the film is copied
 	ScopedPoolLock lock(contribPool);
+	const double start = WallClockTime();
+	if (TakeSnapshot(snapshot, transmitParams)) {
+		// Clear buffers here if requested,
+		// because the saved contribPool will unlock at end of scope
+		if (clearBuffers)
+			ClearBuffers();
+		AddWriteLockTime(WallClockTime() - start);
+		lock.unlock();
+
+		return WriteSnapshotToStream(snapshot, os);
+	}
 
-	// Enable compression
-	// TODO Move this below header when implementing FILM VERSION 2
-	boost::iostreams::filtering_stream<boost::iostreams::output> fs;
-	fs.push(boost::iostreams::gzip_compressor(4));
-	fs.push(os);
+	// Not enough memory for a copy, write the live buffers under the lock
+	const bool result = WriteSnapshotToStream(snapshot, os);
+	if (result && clearBuffers)
+		ClearBuffers();
+	AddWriteLockTime(WallClockTime() - start);
 
-	// Write the header
-	FlmHeader header;
-	header.magicNumber = FLM_MAGIC_NUMBER;
-	header.versionNumber = FLM_VERSION;
-	header.xResolution = xPixelCount;
-	header.yResolution = yPixelCount;
-	header.numBufferGroups = bufferGroups.size();
-	header.numBufferConfigs = bufferConfigs.size();
+	return result;
+}
+
+bool Film::TakeSnapshot(FilmSnapshot &snapshot, bool transmitParams)
+{
+	// Copy the header
+	snapshot.header.magicNumber = FLM_MAGIC_NUMBER;
+	snapshot.header.versionNumber = FLM_VERSION_CHUNKED;
+	snapshot.header.xResolution = xPixelCount;
+	snapshot.header.yResolution = yPixelCount;
+	snapshot.header.numBufferGroups = bufferGroups.size();
+	snapshot.header.numBufferConfigs = bufferConfigs.size();
 	for (u_int i = 0; i < bufferConfigs.size(); ++i)
-		header.bufferTypes.push_back(bufferConfigs[i].type);
-	// Write parameters
+		snapshot.header.bufferTypes.push_back(bufferConfigs[i].type);
+	// Copy the parameters
 	if (transmitParams) {
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_TONEMAPKERNEL, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_REINHARD_PRESCALE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_REINHARD_POSTSCALE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_REINHARD_BURN, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_SENSITIVITY, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_EXPOSURE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_FSTOP, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_GAMMA, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_CONTRAST_YWA, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LDR_CLAMP_METHOD, 0));		
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_WHITE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_WHITE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_RED, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_RED, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_GREEN, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_GREEN, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_BLUE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_BLUE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_GAMMA, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_CAMERA_RESPONSE_ENABLED, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_CAMERA_RESPONSE_FILE, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_UPDATEBLOOMLAYER, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_DELETEBLOOMLAYER, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_BLOOMRADIUS, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_BLOOMWEIGHT, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_VIGNETTING_ENABLED, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_VIGNETTING_SCALE, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_ABERRATION_ENABLED, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_ABERRATION_AMOUNT, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_UPDATEGLARELAYER, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_DELETEGLARELAYER, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_AMOUNT, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_RADIUS, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_BLADES, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_THRESHOLD, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_MAP, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_GLARE_PUPIL, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_GLARE_LASHES, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_CHIU_ENABLED, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_CHIU_RADIUS, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_CHIU_INCLUDECENTER, 0));
-
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_ENABLED, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_AMPLITUDE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_NBITER, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_SHARPNESS, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_ANISOTROPY, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_ALPHA, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_SIGMA, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_FASTAPPROX, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_GAUSSPREC, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_DL, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_DA, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_INTERP, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_TILE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_BTILE, 0));
-		header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_THREADS, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_TONEMAPKERNEL, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_REINHARD_PRESCALE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_REINHARD_POSTSCALE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_REINHARD_BURN, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_SENSITIVITY, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_EXPOSURE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_FSTOP, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_LINEAR_GAMMA, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TM_CONTRAST_YWA, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LDR_CLAMP_METHOD, 0));		
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_WHITE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_WHITE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_RED, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_RED, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_GREEN, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_GREEN, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_X_BLUE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_Y_BLUE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_TORGB_GAMMA, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_CAMERA_RESPONSE_ENABLED, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_CAMERA_RESPONSE_FILE, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_UPDATEBLOOMLAYER, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_DELETEBLOOMLAYER, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_BLOOMRADIUS, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_BLOOMWEIGHT, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_VIGNETTING_ENABLED, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_VIGNETTING_SCALE, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_ABERRATION_ENABLED, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_ABERRATION_AMOUNT, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_UPDATEGLARELAYER, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_DELETEGLARELAYER, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_AMOUNT, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_RADIUS, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_BLADES, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_THRESHOLD, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_GLARE_MAP, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_GLARE_PUPIL, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_GLARE_LASHES, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_CHIU_ENABLED, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_CHIU_RADIUS, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_CHIU_INCLUDECENTER, 0));
+
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_ENABLED, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_AMPLITUDE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_NBITER, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_SHARPNESS, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_ANISOTROPY, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_ALPHA, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_SIGMA, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_FASTAPPROX, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_GAUSSPREC, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_DL, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_DA, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_INTERP, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_TILE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_BTILE, 0));
+		snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_NOISE_GREYC_THREADS, 0));
 
 		for(u_int i = 0; i < GetNumBufferGroups(); ++i) {
-			header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE, i));
-			header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_ENABLE, i));
-			header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE_RED, i));
-			header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE_GREEN, i));
-			header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE_BLUE, i));
-			header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_TEMPERATURE, i));
-
-			header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_LG_NAME, i));
+			snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE, i));
+			snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_ENABLE, i));
+			snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE_RED, i));
+			snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE_GREEN, i));
+			snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_SCALE_BLUE, i));
+			snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_FLOAT, LUX_FILM_LG_TEMPERATURE, i));
+
+			snapshot.header.params.push_back(FlmParameter(this, FLM_PARAMETER_TYPE_STRING, LUX_FILM_LG_NAME, i));
 		}
 
-		header.numParams = header.params.size();
+		snapshot.header.numParams = snapshot.header.params.size();
 	} else {
-		header.numParams = 0;
+		snapshot.header.numParams = 0;
 	}
-	header.Write(fs, isLittleEndian);
 
-	// Write each buffer group
-	double totNumberOfSamples = 0.;
-	for (u_int i = 0; i < bufferGroups.size(); ++i) {
-		BufferGroup& bufferGroup = bufferGroups[i];
-		// Write number of samples
-		osWriteLittleEndianDouble(isLittleEndian, fs, bufferGroup.numberOfSamples);
-
-		// Write each buffer
-		for (u_int j = 0; j < bufferConfigs.size(); ++j) {
-			Buffer* buffer = bufferGroup.getBuffer(j);
+	for (u_int i = 0; i < bufferGroups.size(); ++i)
+		snapshot.numberOfSamples.push_back(bufferGroups[i].numberOfSamples);
 
-			// Write pixels
-			const BlockedArray<Pixel>* pixelBuf = &(buffer->pixels);
-			for (u_int y = 0; y < pixelBuf->vSize(); ++y) {
-				for (u_int x = 0; x < pixelBuf->uSize(); ++x) {
-					const Pixel &pixel = (*pixelBuf)(x, y);
-					osWriteLittleEndianFloat(isLittleEndian, fs, pixel.L.c[0]);
-					osWriteLittleEndianFloat(isLittleEndian, fs, pixel.L.c[1]);
-					osWriteLittleEndianFloat(isLittleEndian, fs, pixel.L.c[2]);
-					osWriteLittleEndianFloat(isLittleEndian, fs, pixel.alpha);
-					osWriteLittleEndianFloat(isLittleEndian, fs, pixel.weightSum);
+	// Copy the pixels of each buffer of each buffer group
+	try {
+		snapshot.pixels.resize(bufferGroups.size() * bufferConfigs.size());
+		for (u_int i = 0; i < bufferGroups.size(); ++i) {
+			for (u_int j = 0; j < bufferConfigs.size(); ++j) {
+				const BlockedArray<Pixel> &pixelBuf(bufferGroups[i].getBuffer(j)->pixels);
+				vector<Pixel> &pixels(snapshot.pixels[i * bufferConfigs.size() + j]);
+				pixels.reserve(pixelBuf.uSize() * pixelBuf.vSize());
+				for (u_int y = 0; y < pixelBuf.vSize(); ++y) {
+					for (u_int x = 0; x < pixelBuf.uSize(); ++x)
+						pixels.push_back(pixelBuf(x, y));
 				}
-				if (!fs.good())
-					// error during transmission, abort
-					return false;
 			}
 		}
+	} catch (std::bad_alloc &) {
+		LOG(LUX_WARNING, LUX_NOMEM) << "Not enough memory to copy the film, writing it while splatting is locked";
+		vector<vector<Pixel> >().swap(snapshot.pixels);
+		return false;
+	}
+
+	return true;
+}
+
+bool Film::WriteSnapshotToStream(const FilmSnapshot &snapshot,
+	std::basic_ostream<char> &os)
+{
+	const bool isLittleEndian = osIsLittleEndian();
+	LOG(LUX_DEBUG, LUX_NOERROR) << "Transmitting film (little endian=" << boost::lexical_cast<std::string>(isLittleEndian) << ")";
+
+	std::streampos osStartPosition = os.tellp();
+
+	const u_int numBufferGroups = snapshot.header.numBufferGroups;
+	const u_int numBufferConfigs = snapshot.header.numBufferConfigs;
+	const FlmTiling tiling(FLM_TILE_SIZE, snapshot.header.xResolution,
+		snapshot.header.yResolution);
+	const u_int nTiles = tiling.TileCount();
+
+	// Compress the tiles of each buffer of each buffer group in parallel
+	vector<const Pixel *> copies(numBufferGroups * numBufferConfigs, NULL);
+	vector<const BlockedArray<Pixel> *> buffers(numBufferGroups * numBufferConfigs, NULL);
+	for (u_int i = 0; i < numBufferGroups; ++i) {
+		for (u_int j = 0; j < numBufferConfigs; ++j) {
+			const u_int b = i * numBufferConfigs + j;
+			if (snapshot.pixels.empty())
+				buffers[b] = &(bufferGroups[i].getBuffer(j)->pixels);
+			else
+				copies[b] = &(snapshot.pixels[b][0]);
+		}
+	}
+	vector<FlmChunk> chunks(numBufferGroups * numBufferConfigs * nTiles);
+	for (u_int c = 0; c < chunks.size(); ++c) {
+		chunks[c].group = c / (numBufferConfigs * nTiles);
+		chunks[c].buffer = (c / nTiles) % numBufferConfigs;
+		chunks[c].tile = c % nTiles;
+	}
+	if (!ProcessFlmChunks(chunks.size(), boost::bind(&CompressFlmChunk,
+		boost::cref(tiling), &chunks, &copies, &buffers,
+		numBufferConfigs, _1)))
+		return false;
 
-		totNumberOfSamples += bufferGroup.numberOfSamples;
-		LOG(LUX_DEBUG,LUX_NOERROR) << "Transmitted " << bufferGroup.numberOfSamples << " samples for buffer group " << i <<
-			" (buffer config size: " << bufferConfigs.size() << ")";
+	snapshot.header.Write(os, isLittleEndian);
+	osWriteLittleEndianUInt(isLittleEndian, os, tiling.tileSize);
+
+	// Write the number of samples of each buffer group
+	double totNumberOfSamples = 0.;
+	for (u_int i = 0; i < numBufferGroups; ++i) {
+		osWriteLittleEndianDouble(isLittleEndian, os, snapshot.numberOfSamples[i]);
+		totNumberOfSamples += snapshot.numberOfSamples[i];
+		LOG(LUX_DEBUG,LUX_NOERROR) << "Transmitted " << snapshot.numberOfSamples[i] << " samples for buffer group " << i <<
+			" (buffer config size: " << numBufferConfigs << ")";
 	}
 
-	flush(fs);
+	// Write the chunk index then the chunks
+	osWriteLittleEndianUInt(isLittleEndian, os, chunks.size());
+	for (u_int c = 0; c < chunks.size(); ++c) {
+		osWriteLittleEndianUInt(isLittleEndian, os, chunks[c].group);
+		osWriteLittleEndianUInt(isLittleEndian, os, chunks[c].buffer);
+		osWriteLittleEndianUInt(isLittleEndian, os, chunks[c].tile);
+		osWriteLittleEndianUInt(isLittleEndian, os, chunks[c].compressedSize);
+		osWriteLittleEndianUInt(isLittleEndian, os, chunks[c].rawSize);
+	}
+	for (u_int c = 0; c < chunks.size(); ++c) {
+		os.write(&(chunks[c].data[0]), chunks[c].compressedSize);
+		if (!os.good())
+			// error during transmission, abort
+			return false;
+	}
+
+	os.flush();
 	std::streamoff size = os.tellp() - osStartPosition;
 
 	LOG(LUX_DEBUG, LUX_NOERROR) << "Transmitted film with " << totNumberOfSamples << " samples";
 	LOG(LUX_INFO, LUX_NOERROR) << "Film transmission done (" << (size / 1024) << " Kbytes sent)";
 
-	// Clear buffers here if requested,
-	// because the saved contribPool will unlock at end of scope
-	if (clearBuffers)
-		ClearBuffers();
-
 	return true;
 }
 
 bool Film::LoadResumeFilm(const string &filename)
 {
-	const bool isLittleEndian = osIsLittleEndian();
-	LOG(LUX_DEBUG,LUX_NOERROR) << "Loading film (little endian=" << boost::lexical_cast<std::string>(isLittleEndian) << ")";
+	LOG(LUX_DEBUG,LUX_NOERROR) << "Loading film (little endian=" << boost::lexical_cast<std::string>(osIsLittleEndian()) << ")";
 	std::ifstream is(filename.c_str(), std::ios_base::in | std::ios_base::binary);
 
-	// Enable compression
-	// TODO Move this below header when implementing FILM VERSION 2
-	boost::iostreams::filtering_stream<boost::iostreams::input> fs;
-	fs.push(boost::iostreams::gzip_decompressor());
-	fs.push(is);
-
 	FlmHeader header;
-	if (!header.Read(fs, isLittleEndian, NULL))
+	if (!ReadFlmHeader(is, header))
 		return false;
 	is.close();
 
@@ -2592,98 +3419,23 @@ bool Film::LoadResumeFilm(const string &filename)
 }
 
 double Film::UpdateFilm(std::basic_istream<char> &stream) {
-	const bool isLittleEndian = osIsLittleEndian();
+	LOG(LUX_DEBUG,LUX_NOERROR) << "Receiving film (little endian=" << (osIsLittleEndian() ? "true" : "false") << ")";
 
-	filtering_stream<input> in;
-	in.push(gzip_decompressor());
-	in.push(stream);
-	LOG(LUX_DEBUG,LUX_NOERROR) << "Receiving film (little endian=" << (isLittleEndian ? "true" : "false") << ")";
-
-	// Read header
 	FlmHeader header;
-	if (!header.Read(in, isLittleEndian, this))
-		return 0.f;
-
-	// Read buffer groups
-	vector<double> bufferGroupNumSamples(bufferGroups.size());
-	vector<BlockedArray<Pixel>*> tmpPixelArrays(bufferGroups.size() * bufferConfigs.size());
-	for (u_int i = 0; i < bufferGroups.size(); i++) {
-		double numberOfSamples;
-		numberOfSamples = osReadLittleEndianDouble(isLittleEndian, in);
-		if (!in.good())
-			break;
-		bufferGroupNumSamples[i] = numberOfSamples;
-
-		// Read buffers
-		for(u_int j = 0; j < bufferConfigs.size(); ++j) {
-			const Buffer* localBuffer = bufferGroups[i].getBuffer(j);
-			// Read pixels
-			BlockedArray<Pixel> *tmpPixelArr = new BlockedArray<Pixel>(
-				localBuffer->xPixelCount, localBuffer->yPixelCount);
-			tmpPixelArrays[i*bufferConfigs.size() + j] = tmpPixelArr;
-			for (u_int y = 0; y < tmpPixelArr->vSize(); ++y) {
-				for (u_int x = 0; x < tmpPixelArr->uSize(); ++x) {
-					Pixel &pixel = (*tmpPixelArr)(x, y);
-					pixel.L.c[0] = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.L.c[1] = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.L.c[2] = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.alpha = osReadLittleEndianFloat(isLittleEndian, in);
-					pixel.weightSum = osReadLittleEndianFloat(isLittleEndian, in);
-				}
-			}
-			if (!in.good())
-				break;
-		}
-		if (!in.good())
-			break;
-
-		LOG( LUX_DEBUG,LUX_NOERROR)
-			<< "Received " << bufferGroupNumSamples[i] << " samples for buffer group " << i
-			<< " (buffer config size: " << bufferConfigs.size() << ")";
-	}
-
-	// Check for errors
-	double totNumberOfSamples = 0.;
+	vector<double> bufferGroupNumSamples;
+	vector<BlockedArray<Pixel>*> tmpPixelArrays;
+	const FlmSelection all;
 	double maxTotNumberOfSamples = 0.;
-	if (in.good()) {
+	if (ReadFilmData(stream, header, bufferGroupNumSamples, tmpPixelArrays, all)) {
 		// Update parameters
 		for (vector<FlmParameter>::iterator it = header.params.begin(); it != header.params.end(); ++it)
 			it->Set(this);
 
-		// Dade - add all received data
-		for (u_int i = 0; i < bufferGroups.size(); ++i) {
-			BufferGroup &currentGroup = bufferGroups[i];
-			for (u_int j = 0; j < bufferConfigs.size(); ++j) {
-				const BlockedArray<Pixel> *receivedPixels = tmpPixelArrays[ i * bufferConfigs.size() + j ];
-				Buffer *buffer = currentGroup.getBuffer(j);
-
-				for (u_int y = 0; y < buffer->yPixelCount; ++y) {
-					for (u_int x = 0; x < buffer->xPixelCount; ++x) {
-						const Pixel &pixel = (*receivedPixels)(x, y);
-						Pixel &pixelResult = buffer->pixels(x, y);
-						pixelResult.L.c[0] += pixel.L.c[0];
-						pixelResult.L.c[1] += pixel.L.c[1];
-						pixelResult.L.c[2] += pixel.L.c[2];
-						pixelResult.alpha += pixel.alpha;
-						pixelResult.weightSum += pixel.weightSum;
-					}
-				}
-			}
-
-			currentGroup.numberOfSamples += bufferGroupNumSamples[i];
-			// Check if we have enough samples per pixel
-			if ((haltSamplesPerPixel > 0) &&
-				(currentGroup.numberOfSamples >= haltSamplesPerPixel * samplePerPass))
-				enoughSamplesPerPixel = true;
-			totNumberOfSamples += bufferGroupNumSamples[i];
-			maxTotNumberOfSamples = max(maxTotNumberOfSamples, bufferGroupNumSamples[i]);
-		}
-
+		maxTotNumberOfSamples = AddFilmData(bufferGroupNumSamples,
+			vector<const BlockedArray<Pixel> *>(tmpPixelArrays.begin(),
+			tmpPixelArrays.end()), all);
 		numberOfSamplesFromNetwork += maxTotNumberOfSamples;
-
-		LOG( LUX_DEBUG,LUX_NOERROR) << "Received film with " << totNumberOfSamples << " samples";
-	} else
-		LOG( LUX_ERROR,LUX_SYSTEM)<< "IO error while receiving film buffers";
+	}
 
 	// Clean up
 	for (u_int i = 0; i < tmpPixelArrays.size(); ++i)
@@ -2716,12 +3468,8 @@ bool Film::LoadResumeFilmFromStream(char* buffer, unsigned int bufSize){
 	std::basic_stringstream<char> stream(str);
 	std::basic_stringstream<char> bufferStream(str);
 	//std::ifstream stream(filename.c_str(), std::ios_base::in | std::ios_base::binary);
-	filtering_stream<input> in;
-	in.push(gzip_decompressor());
-	in.push(stream);
-	const bool isLittleEndian = osIsLittleEndian();
 	FlmHeader header;
-	bool headerOk = header.Read(in, isLittleEndian, NULL);
+	bool headerOk = ReadFlmHeader(stream, header);
 	//stream.close();
 	if (!headerOk)
 		return false;
@@ -3254,6 +4002,9 @@ void Film::GenerateNoiseAwareMap() {
 
 		// Just use a uniform distribution
 		std::fill(noiseAwareMap.get(), noiseAwareMap.get() + nPix, 1.f);
+		// The retired tiles have to be excluded anyway
+		if (!tileMask.empty())
+			++noiseAwareMapVersion;
 	} else {
 		++noiseAwareMapVersion;
 		LOG(LUX_DEBUG, LUX_NOERROR) << "Noise aware map based on: noise information (version: " <<
@@ -3333,6 +4084,7 @@ void Film::GenerateNoiseAwareMap() {
 		}
 	}
 
+	ApplyTileMask(noiseAwareMap.get());
 	noiseAwareDistribution2D.reset(new Distribution2D(noiseAwareMap.get(), xPixelCount, yPixelCount));
 
 	UpdateSamplingMap();
@@ -3373,6 +4125,7 @@ void Film::SetNoiseAwareMap(const float *map) {
 	noiseAwareMap.reset(new float[nPix]);
 
 	std::copy(map, map + nPix, noiseAwareMap.get());
+	ApplyTileMask(noiseAwareMap.get());
 	++noiseAwareMapVersion;
 
 	noiseAwareDistribution2D.reset(new Distribution2D(noiseAwareMap.get(), xPixelCount, yPixelCount));
@@ -3429,6 +4182,170 @@ void Film::SetUserSamplingMap(const float *map) {
 	}
 }
 
+//------------------------------------------------------------------------------
+// Tile retirement
+//------------------------------------------------------------------------------
+
+// Size of the tiles retired by tilehaltthreshold
+static const u_int convergenceTileSize = 32;
+
+bool Film::UpdateTileConvergence(const float *frameBuffer) {
+	const u_int size = convergenceTileSize;
+	const u_int xTiles = (xPixelCount + size - 1) / size;
+	const u_int yTiles = (yPixelCount + size - 1) / size;
+	const u_int nPix = xPixelCount * yPixelCount;
+
+	// Luminance of the film pixels, the frame buffer covers the whole
+	// image and not only the crop window
+	vector<float> luminance(nPix);
+	for (u_int y = 0, i = 0; y < yPixelCount; ++y) {
+		const float *row = frameBuffer + 3 * ((yPixelStart + y) * xResolution + xPixelStart);
+		for (u_int x = 0; x < xPixelCount; ++x, ++i)
+			luminance[i] = row[3 * x] + row[3 * x + 1] + row[3 * x + 2];
+	}
+
+	// The first update only records the reference
+	if (tileReference.empty()) {
+		tileReference.swap(luminance);
+		return false;
+	}
+
+	vector<unsigned char> mask;
+	{
+		fast_mutex::scoped_lock lock(samplingMapMutex);
+		mask = tileMask;
+	}
+	if (mask.empty())
+		mask.resize(xTiles * yTiles, 1);
+
+	// A tile is retired once none of its pixels changed by more than
+	// the threshold since the previous update, retired tiles stay so
+	u_int activeTiles = 0, retiredTiles = 0;
+	for (u_int ty = 0; ty < yTiles; ++ty) {
+		for (u_int tx = 0; tx < xTiles; ++tx) {
+			unsigned char &active(mask[ty * xTiles + tx]);
+			if (!active)
+				continue;
+
+			bool converged = true;
+			const u_int yEnd = min((ty + 1) * size, yPixelCount);
+			const u_int xEnd = min((tx + 1) * size, xPixelCount);
+			for (u_int y = ty * size; y < yEnd && converged; ++y) {
+				for (u_int x = tx * size; x < xEnd; ++x) {
+					const u_int i = y * xPixelCount + x;
+					if (fabsf(luminance[i] - tileReference[i]) >
+						tileHaltThreshold * tileReference[i]) {
+						converged = false;
+						break;
+					}
+				}
+			}
+
+			if (converged) {
+				active = 0;
+				++retiredTiles;
+			} else
+				++activeTiles;
+		}
+	}
+	tileReference.swap(luminance);
+
+	// Keep the last tiles in the map, the whole image is done
+	if (activeTiles == 0) {
+		LOG(LUX_DEBUG, LUX_NOERROR) << "All tiles have converged";
+		enoughSamplesPerPixel = true;
+		return false;
+	}
+	if (retiredTiles == 0)
+		return false;
+
+	LOG(LUX_DEBUG, LUX_NOERROR) << "Tiles retired: " << retiredTiles <<
+		" (" << activeTiles << " still sampled)";
+	SetTileMask(size, mask.size(), &mask[0]);
+
+	return true;
+}
+
+void Film::ApplyTileMask(float *map) const {
+	if (tileMask.empty())
+		return;
+
+	const u_int size = tileMaskSize;
+	const u_int xTiles = (xPixelCount + size - 1) / size;
+
+	// Don't produce an empty map if the remaining tiles have
+	// nothing to sample
+	bool hasSamples = false;
+	for (u_int y = 0, i = 0; y < yPixelCount && !hasSamples; ++y) {
+		const unsigned char *tiles = &tileMask[(y / size) * xTiles];
+		for (u_int x = 0; x < xPixelCount; ++x, ++i) {
+			if (tiles[x / size] && map[i] > 0.f) {
+				hasSamples = true;
+				break;
+			}
+		}
+	}
+	if (!hasSamples)
+		return;
+
+	for (u_int y = 0, i = 0; y < yPixelCount; ++y) {
+		const unsigned char *tiles = &tileMask[(y / size) * xTiles];
+		for (u_int x = 0; x < xPixelCount; ++x, ++i) {
+			if (!tiles[x / size])
+				map[i] = 0.f;
+		}
+	}
+}
+
+// NOTE: returns a copy of the mask, it is up to the caller to free the allocated memory !
+unsigned char *Film::GetTileMask(u_int *tileSize, u_int *count) {
+	fast_mutex::scoped_lock lock(samplingMapMutex);
+
+	if (tileMask.empty())
+		return NULL;
+
+	unsigned char *mask = new unsigned char[tileMask.size()];
+	std::copy(tileMask.begin(), tileMask.end(), mask);
+	*tileSize = tileMaskSize;
+	*count = tileMask.size();
+
+	return mask;
+}
+
+void Film::SetTileMask(u_int tileSize, u_int count, const unsigned char *mask) {
+	fast_mutex::scoped_lock lock(samplingMapMutex);
+
+	if (tileSize == 0 || count != ((xPixelCount + tileSize - 1) / tileSize) *
+		((yPixelCount + tileSize - 1) / tileSize)) {
+		LOG(LUX_ERROR, LUX_CONSISTENCY) << "Tile mask doesn't match the film size";
+		return;
+	}
+
+	tileMaskSize = tileSize;
+	tileMask.assign(mask, mask + count);
+
+	// The mask only restricts the noise-aware map, the other samplers
+	// have no map to apply it to
+	if (!noiseAwareMap)
+		return;
+
+	// Retire the tiles from a new noise-aware map, starting from a
+	// uniform one if there isn't a map yet
+	const u_int nPix = xPixelCount * yPixelCount;
+	boost::shared_array<float> map(new float[nPix]);
+	if (noiseAwareMapVersion > 0)
+		std::copy(noiseAwareMap.get(), noiseAwareMap.get() + nPix, map.get());
+	else
+		std::fill(map.get(), map.get() + nPix, 1.f);
+	ApplyTileMask(map.get());
+
+	noiseAwareMap = map;
+	++noiseAwareMapVersion;
+	noiseAwareDistribution2D.reset(new Distribution2D(noiseAwareMap.get(), xPixelCount, yPixelCount));
+
+	UpdateSamplingMap();
+}
+
 void Film::UpdateSamplingMap() {	
 	// Update noise-aware map * user sampling map
 
@@ -34,7 +34,10 @@
 #include "luxrays/utils/memory.h"
 #include "slg/utils/convtest/convtest.h"
 
+#include <limits>
+
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/thread/xtime.hpp>
 #include <boost/shared_array.hpp>
 
@@ -409,6 +412,25 @@ public:
 	bool enabled, includecenter;
 };
 
+// Feature guided denoiser Parameter structure
+class DenoiserParams {
+public:
+	DenoiserParams() { Reset(); }
+	void Reset() {
+		enabled = false;		 // Denoiser is enabled/disabled
+		radius = 5;				 // Half size of the filter window in pixels
+		sigmaColor = 1.f;		 // Color tolerance, relative to the estimated pixel noise
+		sigmaAlbedo = .1f;		 // First hit albedo tolerance
+		sigmaNormal = .3f;		 // First hit shading normal tolerance
+		sigmaDepth = .05f;		 // First hit depth tolerance, relative to the depth
+		threads = 0;			 // Number of threads used, 0 for all cores
+	}
+
+	u_int radius, threads;
+	float sigmaColor, sigmaAlbedo, sigmaNormal, sigmaDepth;
+	bool enabled;
+};
+
 
 //Histogram Declarations
 class Histogram {
@@ -491,6 +513,65 @@ public:
 	luxrays::BlockedArray<VariancePixel> pixels;
 };
 
+//------------------------------------------------------------------------------
+// First hit features used to guide the denoiser
+//------------------------------------------------------------------------------
+
+struct FeaturePixel {
+	FeaturePixel() : albedo(0.f), normal(0.f, 0.f, 0.f), depth(0.f),
+		weightSum(0.f) { }
+
+	XYZColor albedo;
+	Normal normal;
+	float depth, weightSum;
+};
+
+class FeatureBuffer {
+public:
+	FeatureBuffer(u_int x, u_int y) : pixels(x, y) {
+	}
+
+	~FeatureBuffer() { }
+
+	// Thread-safe, rows are protected by a small set of mutexes since
+	// the features are added once per camera sample without filtering
+	void Add(u_int x, u_int y, const XYZColor &albedo, const Normal &n,
+		float depth) {
+		fast_mutex::scoped_lock lock(rowMutexes[y % FEATURE_ROW_MUTEXES]);
+		FeaturePixel &pixel = pixels(x, y);
+		pixel.albedo += albedo;
+		pixel.normal += n;
+		pixel.depth += depth;
+		pixel.weightSum += 1.f;
+	}
+
+	void Clear() {
+		for (u_int y = 0; y < pixels.vSize(); ++y) {
+			for (u_int x = 0; x < pixels.uSize(); ++x)
+				pixels(x, y) = FeaturePixel();
+		}
+	}
+
+	// Returns false for a pixel that have yet to be sampled
+	bool GetData(u_int x, u_int y, XYZColor *albedo, Normal *n,
+		float *depth) const {
+		const FeaturePixel &pixel = pixels(x, y);
+		if (!(pixel.weightSum > 0.f))
+			return false;
+		const float inv = 1.f / pixel.weightSum;
+		*albedo = pixel.albedo * inv;
+		*n = pixel.normal * inv;
+		*depth = pixel.depth * inv;
+		return true;
+	}
+
+	luxrays::BlockedArray<FeaturePixel> pixels;
+
+private:
+	static const u_int FEATURE_ROW_MUTEXES = 32;
+	fast_mutex rowMutexes[FEATURE_ROW_MUTEXES];
+};
+
 //------------------------------------------------------------------------------
 // Filter Look Up Table
 //------------------------------------------------------------------------------
@@ -521,6 +602,9 @@ public:
 
 	~FilterLUTs() {	}
 
+	// Largest width * height of the tables
+	u_int GetMaxSize() const { return maxSize; }
+
 	const FilterLUT &GetLUT(const float x, const float y) const {
 		const int ix = max<int>(0, min<int>(luxrays::Floor2Int(lutsSize * (x + 0.5f)), lutsSize - 1));
 		const int iy = max<int>(0, min<int>(luxrays::Floor2Int(lutsSize * (y + 0.5f)), lutsSize - 1));
@@ -529,7 +613,7 @@ public:
 	}
 
 private:
-	unsigned int lutsSize;
+	unsigned int lutsSize, maxSize;
 	float step;
 	std::vector<FilterLUT> luts;
 };
@@ -599,6 +683,33 @@ public:
 typedef OutlierDataXYLY OutlierData;
 
 // Film Declarations
+class FilmSnapshot;
+class FlmHeader;
+
+/**
+ * Selection of the light groups and of the pixel region read from a film
+ * file, everything is selected by default.
+ * The sample counts of the selected light groups are always read in full.
+ */
+class FlmSelection {
+public:
+	FlmSelection() : xStart(0), xEnd(std::numeric_limits<u_int>::max()),
+		yStart(0), yEnd(std::numeric_limits<u_int>::max()) { }
+
+	bool HasGroup(u_int group) const {
+		return groups.empty() || (group < groups.size() && groups[group]);
+	}
+	// Check whether a pixel region, interval is [start, end), is selected
+	bool Overlaps(u_int x0, u_int x1, u_int y0, u_int y1) const {
+		return x0 < xEnd && xStart < x1 && y0 < yEnd && yStart < y1;
+	}
+
+	// Flags of the selected light groups, empty to select all of them
+	vector<bool> groups;
+	// Selected pixel region, interval is [start, end)
+	u_int xStart, xEnd, yStart, yEnd;
+};
+
 class LUX_EXPORT Film : public Queryable {
 public:
 	// Film Interface
@@ -638,9 +749,38 @@ public:
 	virtual void CheckWriteOuputInterval() { }
 
 	virtual bool WriteFilmToFile(const string &filename);
+	/**
+	 * Write the film to a file from a background thread. The splatting is
+	 * only locked while the buffers are copied, the compression and the
+	 * writing of the copy happen on the writer thread.
+	 * @param filename the name of the film file
+	 * @return false if the previous background write isn't done yet,
+	 * the film isn't written then
+	 */
+	virtual bool WriteFilmToFileAsync(const string &filename);
+	/**
+	 * Wait for the end of the background film write if any
+	 */
+	void WaitFilmWrite();
 	virtual bool WriteFilmToStream(std::basic_ostream<char> &stream, bool clearBuffers = true, bool transmitParams = false, bool directWrite = false);
-	virtual double MergeFilmFromFile(const std::string& filename);
-	virtual double MergeFilmFromStream(std::basic_istream<char> &stream);
+	/**
+	 * Add the content of a film file to this film. Chunked films only
+	 * decompress the selected light groups and region, in parallel.
+	 * @return the highest number of samples of the merged light groups,
+	 * 0 on error
+	 */
+	virtual double MergeFilmFromFile(const std::string& filename,
+		const FlmSelection &selection = FlmSelection());
+	virtual double MergeFilmFromStream(std::basic_istream<char> &stream,
+		const FlmSelection &selection = FlmSelection());
+	/**
+	 * Add the selected part of another film with the same buffers to this
+	 * film, the other film mustn't be modified during the merge
+	 * @return the highest number of samples of the merged light groups,
+	 * 0 on error
+	 */
+	double MergeFilm(const Film &film,
+		const FlmSelection &selection = FlmSelection());
 	virtual bool LoadResumeFilm(const string &filename);
 
 	virtual void RequestBufferGroups(const vector<string> &bg);
@@ -661,12 +801,13 @@ public:
 
 	/**
 	 * Get the indexes that the current contribution spans.
-	 * Current implementation is limited to at most two tiles, ie the tiles are slabs.
-	 * @param tileIndex0 First tile index, always set.
-	 * @param tileIndex1 Second tile index if the contribution spans more than one tile, otherwise undefined.
-	 * @return Number of tiles that the contribution spans, 1 or 2.
+	 * Tiles are square (or slabs when outlier rejection is enabled) and
+	 * at least as large as the filter, so at most 4 tiles are spanned.
+	 * @param tiles Array receiving the tile indexes, only the first
+	 * returned count entries are set.
+	 * @return Number of tiles that the contribution spans, 1 to 4.
 	 */
-	virtual u_int GetTileIndexes(const Contribution &contrib, u_int *tile0, u_int *tile1) const;
+	virtual u_int GetTileIndexes(const Contribution &contrib, u_int tiles[4]) const;
 	/*
 	 * Returns the total number of tiles in the film.
 	 * @return Total number of tiles in the film.
@@ -701,6 +842,15 @@ public:
 	virtual string GetStringParameterValue(luxComponentParameters param, u_int index) = 0;
 
 	virtual void EnableNoiseAwareMap();
+	// Allocates the first hit feature and variance buffers used by the denoiser
+	virtual void EnableFeatureBuffer();
+	bool HasFeatureBuffer() const { return featureBuffer != NULL; }
+	/**
+	 * Records the first hit features of a camera sample, thread-safe.
+	 * Misses are recorded with a black albedo and null normal and depth.
+	 */
+	void AddFeatures(float imageX, float imageY, const XYZColor &albedo,
+		const Normal &n, float depth);
 	virtual const bool GetNoiseAwareMap(u_int &version, boost::shared_array<float> &map,
 		boost::shared_ptr<luxrays::Distribution2D> &distrib);
 	// NOTE: returns a copy of the map, it is up to the caller to free the allocated memory !
@@ -713,6 +863,18 @@ public:
 	// NOTE: returns a copy of the map, it is up to the caller to free the allocated memory !
 	virtual float *GetUserSamplingMap();
 	virtual void SetUserSamplingMap(const float *map);
+	/**
+	 * Returns a copy of the mask of the tiles still sampled (1) or retired
+	 * because they have converged (0), NULL if no tile has been retired.
+	 * It is up to the caller to free the allocated memory !
+	 */
+	virtual unsigned char *GetTileMask(u_int *tileSize, u_int *count);
+	/**
+	 * Retires the converged tiles from the noise-aware map so that the
+	 * samplers using it stop sampling them. Used by network slaves to
+	 * receive the mask computed by the master.
+	 */
+	virtual void SetTileMask(u_int tileSize, u_int count, const unsigned char *mask);
 
 	// Return noise-aware map * user sampling map
 	virtual const bool GetSamplingMap(u_int &naMapVersion, u_int &usMapVersion,
@@ -735,13 +897,50 @@ public:
 
 protected:
 	bool WriteFilmDataToStream(std::basic_ostream<char> &stream, bool clearBuffers = true, bool transmitParams = false);
+	/**
+	 * Copy the film header and buffers, the pool lock must be held
+	 * @return false if there wasn't enough memory to copy the pixels,
+	 * the snapshot then only holds the header and sample counts
+	 */
+	bool TakeSnapshot(FilmSnapshot &snapshot, bool transmitParams);
+	/**
+	 * Compress and write a snapshot, reading the live buffers if it has
+	 * no pixels in which case the pool lock must be held
+	 */
+	bool WriteSnapshotToStream(const FilmSnapshot &snapshot, std::basic_ostream<char> &os);
+	bool WriteSnapshotToFile(const FilmSnapshot *snapshot, const string &filename);
+	/**
+	 * Read the header and the selected buffers of a film of any version,
+	 * the buffers that weren't read are left NULL
+	 */
+	bool ReadFilmData(std::basic_istream<char> &stream, FlmHeader &header,
+		vector<double> &numberOfSamples, vector<BlockedArray<Pixel> *> &pixels,
+		const FlmSelection &selection);
+	/**
+	 * Add the selected part of buffers read by ReadFilmData to the film
+	 * @return the highest number of samples of the added light groups
+	 */
+	double AddFilmData(const vector<double> &numberOfSamples,
+		const vector<const BlockedArray<Pixel> *> &pixels,
+		const FlmSelection &selection);
+	void FilmWriterThread(boost::shared_ptr<FilmSnapshot> snapshot, const string filename);
+	// Account for the time the splatting was locked to write the film
+	void AddWriteLockTime(double seconds);
 	// Reject outliers for a tile. Rejected contributions get their variance set to -1.
 	void RejectTileOutliers(const Contribution &contrib, u_int tileIndex, int yTilePixelStart, int yTilePixelEnd);
 	// Gets the extents of a tile, interval is [start, end).
 	void GetTileExtent(u_int tileIndex, int *xstart, int *xend, int *ystart, int *yend) const;
 	void UpdateSamplingMap();
 	void UpdateConvergenceInfo(const float *frameBuffer);
+	/**
+	 * Compares the frame buffer with the one of the previous update and
+	 * retires the tiles where no pixel changed by more than
+	 * tileHaltThreshold. Returns true if new tiles have been retired.
+	 */
+	bool UpdateTileConvergence(const float *frameBuffer);
 	void GenerateNoiseAwareMap();
+	// Zeroes the retired tiles of a map, samplingMapMutex must be held
+	void ApplyTileMask(float *map) const;
 
 public:
 	// Film Public Data
@@ -757,6 +956,8 @@ public:
 	u_int GetXPixelCount() const { return xPixelCount; }
 	u_int GetYPixelCount() const { return yPixelCount; }
 
+	u_int GetContributionQueueDepth();
+
 	u_int xResolution, yResolution;
 
 	// Statistics
@@ -783,8 +984,10 @@ protected: // Put it here for better data alignment
 	string filename;
 
 	u_int xPixelStart, yPixelStart, xPixelCount, yPixelCount;
-	u_int tileCount, tileHeight;
-	float invTileHeight, tileOffset, tileOffset2;
+	// tiles are stored row by row, tileCount = tileColumns * tileRows
+	u_int tileCount, tileColumns, tileRows, tileWidth, tileHeight;
+	float invTileWidth, invTileHeight;
+	float tileOffsetX, tileOffsetY, tileOffset2X, tileOffset2Y;
 	ColorSystem colorSpace; // needed here for ComputeGroupScale()
 
 	std::vector<BufferConfig> bufferConfigs;
@@ -797,6 +1000,7 @@ protected: // Put it here for better data alignment
 
 	// May be enabled by the sampler
 	VarianceBuffer *varianceBuffer; // Used to build the noise map
+	FeatureBuffer *featureBuffer; // Used to guide the denoiser
 	// Using boost::shared_array in order to have a garbage collector-like
 	// behavior (i.e. the map is really de-allocated only when all reference are
 	// gone)
@@ -810,6 +1014,13 @@ protected: // Put it here for better data alignment
 	u_int userSamplingMapVersion;
 	boost::shared_ptr<luxrays::Distribution2D> userSamplingDistribution2D;
 	
+	// Enabled by tilehaltthreshold: the converged tiles are retired from
+	// the noise-aware map, tileReference is the frame buffer luminance of
+	// the previous convergence update
+	u_int tileMaskSize;
+	vector<unsigned char> tileMask;
+	vector<float> tileReference;
+
 	// Noise-aware map * user sampling map
 	boost::shared_array<float> samplingMap;
 	boost::shared_ptr<luxrays::Distribution2D> samplingDistribution2D;
@@ -843,6 +1054,12 @@ public:
 	// Convergence threshold to reach before to stop the rendering
 	float haltThreshold;
 	float haltThresholdComplete;
+	// Relative change of a tile between two convergence updates below
+	// which it is retired from sampling, disabled when <= 0
+	float tileHaltThreshold;
+	// Samplers using a progressive pixel sampler update this with the
+	// resolution divider of the display while the coarse passes render
+	u_int previewStride;
 
 	Histogram *histogram;
 	bool enoughSamplesPerPixel; // At the end to get better data alignment
@@ -853,13 +1070,53 @@ private:
 	float GetCropWindow1() { return cropWindow[1]; }
 	float GetCropWindow2() { return cropWindow[2]; }
 	float GetCropWindow3() { return cropWindow[3]; }
+	double GetSplatRate();
+	double GetWriteLockTime();
+
+	// Splats contributions to a tile, specialized on the active
+	// Z and variance buffers to keep the per pixel loop branch free
+	template <bool useZ, bool useVariance> void SplatTileSamples(
+		const Contribution* const contribs, u_int num_contribs,
+		u_int tileIndex, float *weights);
 
 	// Gets a reference to the appropriate outlier row data for a given position and tile index.
 	std::vector<OutlierAccel>& GetOutlierAccelRow(u_int oY, u_int tileIndex, u_int tileStart, u_int tileEnd);
 	
 	boost::mutex histMutex;
+
+	// Splatting state of a thread: the filter weights scratch buffer and
+	// the statistics, only 1 flush out of splatTimingStride is timed
+	struct SplatThreadState {
+		SplatThreadState(const boost::thread::id &id) : owner(id),
+			flushes(0), contributions(0.0), time(0.0) { }
+		boost::thread::id owner;
+		std::vector<float> weights;
+		u_int flushes;
+		double contributions, time;
+	};
+	static const u_int splatTimingStride = 16;
+	SplatThreadState &GetSplatThreadState();
+
+	// Splatting statistics, the thread states are owned by the film and
+	// found through the serial number so a film allocated at the address
+	// of a deleted one never picks up its states
+	fast_mutex splatStatsMutex;
+	u_int splatSerial;
+	vector<SplatThreadState *> splatThreadStates;
+	// Time the splatting was locked by film and image writes
+	double writeLockTime;
+
+	// Background film write
+	boost::mutex filmWriterMutex;
+	boost::thread *filmWriter;
 };
 
+// Feature guided denoiser, works on the pixel colors before tonemapping,
+// features and variance are optional
+void DenoiseImage(vector<XYZColor> &pixels, u_int xResolution, u_int yResolution,
+	const DenoiserParams &params, const FeatureBuffer *features,
+	const VarianceBuffer *variance);
+
 // Image Pipeline Declarations
 void ApplyImagingPipeline(vector<XYZColor> &pixels, u_int xResolution, u_int yResolution, 
 	const GREYCStorationParams &GREYCParams, const ChiuParams &chiuParams,
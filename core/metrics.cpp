@@ -0,0 +1,437 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// metrics.cpp*
+#include "metrics.h"
+#include "context.h"
+#include "rendererstatistics.h"
+#include "taskpool.h"
+#include "error.h"
+
+#include <cctype>
+#include <cfloat>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace lux;
+using boost::asio::ip::tcp;
+
+boost::mutex Metrics::mutex;
+boost::mutex Metrics::sourcesMutex;
+map<string, Metrics::Metric> Metrics::metrics;
+
+void Metrics::Update(const string &name, bool counter, const string &labels,
+	double value, bool add)
+{
+	boost::mutex::scoped_lock lock(mutex);
+	Metric &metric(metrics[name]);
+	metric.counter = counter;
+	if (add)
+		metric.values[labels] += value;
+	else
+		metric.values[labels] = value;
+}
+
+void Metrics::AddCounter(const string &name, double delta,
+	const string &labels)
+{
+	Update(name, true, labels, delta, true);
+}
+
+void Metrics::AddGauge(const string &name, double delta, const string &labels)
+{
+	Update(name, false, labels, delta, true);
+}
+
+void Metrics::SetGauge(const string &name, double value, const string &labels)
+{
+	Update(name, false, labels, value, false);
+}
+
+// Convert a camelCase attribute name to a snake_case metric name
+static string MetricName(const string &prefix, const string &attribute)
+{
+	string name(prefix);
+	for (size_t i = 0; i < attribute.size(); ++i) {
+		const char c = attribute[i];
+		if (isupper(c)) {
+			name += '_';
+			name += static_cast<char>(tolower(c));
+		} else if (isalnum(c))
+			name += c;
+		else
+			name += '_';
+	}
+	return name;
+}
+
+static string FormatValue(double value)
+{
+	if (value != value)
+		return "NaN";
+	if (value > DBL_MAX)
+		return "+Inf";
+	if (value < -DBL_MAX)
+		return "-Inf";
+	std::ostringstream os;
+	os.precision(std::numeric_limits<double>::digits10);
+	os << value;
+	return os.str();
+}
+
+static void ExportHeader(std::ostream &os, const string &name,
+	const string &help, const char *type)
+{
+	if (!help.empty())
+		os << "# HELP " << name << " " << help << "\n";
+	os << "# TYPE " << name << " " << type << "\n";
+}
+
+// Export the numeric attributes of a Queryable as gauges,
+// only the attributes listed in the NULL terminated array if any
+static void ExportQueryable(std::ostream &os, Queryable *object,
+	const string &prefix, const char * const *only = NULL)
+{
+	if (!object)
+		return;
+	for (Queryable::iterator it = object->begin(); it != object->end(); ++it) {
+		if (only) {
+			const char * const *o = only;
+			while (*o && it->first != *o)
+				++o;
+			if (!*o)
+				continue;
+		}
+		QueryableAttribute &attribute(*(it->second));
+		double value;
+		try {
+			switch (attribute.Type()) {
+				case AttributeType::Bool:
+					value = attribute.BoolValue() ? 1. : 0.;
+					break;
+				case AttributeType::Int:
+					value = attribute.IntValue();
+					break;
+				case AttributeType::Float:
+					value = attribute.FloatValue();
+					break;
+				case AttributeType::Double:
+					value = attribute.DoubleValue();
+					break;
+				default:
+					continue;
+			}
+		} catch (std::exception &) {
+			continue;
+		}
+		const string name(MetricName(prefix, it->first));
+		ExportHeader(os, name, attribute.Description(), "gauge");
+		os << name << " " << FormatValue(value) << "\n";
+	}
+}
+
+string Metrics::Export()
+{
+	std::ostringstream os;
+
+	// The export runs on its own thread, the context can't free the
+	// sampled objects meanwhile
+	boost::mutex::scoped_lock sourcesLock(sourcesMutex);
+	Context *ctx = Context::GetActive();
+	if (ctx) {
+		Queryable *statistics = ctx->registry["renderer_statistics"];
+		ExportQueryable(os, statistics, "lux_renderer_");
+
+		static const char * const filmAttributes[] = {
+			"numberOfLocalSamples", "numberOfSamplesFromNetwork",
+			"contributionQueueDepth", "writeLockTime", NULL };
+		ExportQueryable(os, ctx->registry["film"], "lux_film_",
+			filmAttributes);
+		static const char * const farmAttributes[] = {
+			"slaveNodeCount", NULL };
+		ExportQueryable(os, ctx->registry["render_farm"],
+			"lux_render_farm_", farmAttributes);
+
+		RendererStatistics *rs = dynamic_cast<RendererStatistics *>(statistics);
+		if (rs) {
+			vector<double> samples;
+			rs->getThreadSamples(samples);
+			if (!samples.empty())
+				ExportHeader(os, "lux_thread_samples_total",
+					"Samples computed by each local render thread",
+					"counter");
+			for (u_int i = 0; i < samples.size(); ++i)
+				os << "lux_thread_samples_total{thread=\"" << i <<
+					"\"} " << FormatValue(samples[i]) << "\n";
+#ifdef LUX_COUNTERS
+			for (u_int e = 0; e < RenderCounters::EVENT_COUNT; ++e) {
+				const RenderCounters::Event event = static_cast<RenderCounters::Event>(e);
+				const string name(MetricName("lux_thread_",
+					RenderCounters::EventName(event)) + "_total");
+				vector<double> counts;
+				rs->getThreadCounters(event, counts);
+				if (!counts.empty())
+					ExportHeader(os, name, string("Number of ") +
+						RenderCounters::EventDescription(event) +
+						" by each local render thread", "counter");
+				for (u_int i = 0; i < counts.size(); ++i)
+					os << name << "{thread=\"" << i << "\"} " <<
+						FormatValue(counts[i]) << "\n";
+			}
+#endif
+		}
+	}
+	sourcesLock.unlock();
+
+	boost::mutex::scoped_lock lock(mutex);
+	for (map<string, Metric>::const_iterator it = metrics.begin();
+		it != metrics.end(); ++it) {
+		ExportHeader(os, it->first, "",
+			it->second.counter ? "counter" : "gauge");
+		for (map<string, double>::const_iterator v = it->second.values.begin();
+			v != it->second.values.end(); ++v) {
+			os << it->first;
+			if (!v->first.empty())
+				os << "{" << v->first << "}";
+			os << " " << FormatValue(v->second) << "\n";
+		}
+	}
+
+	return os.str();
+}
+
+namespace lux
+{
+
+// Send the metrics to a client of a listener, HTTP clients get the
+// metrics once their request has been read
+template <class Protocol> class MetricsConnection :
+	public boost::enable_shared_from_this<MetricsConnection<Protocol> > {
+public:
+	MetricsConnection(boost::asio::io_service &service, bool h) :
+		socket(service), http(h) { }
+
+	void Start() {
+		if (http)
+			boost::asio::async_read_until(socket, request, "\r\n\r\n",
+				boost::bind(&MetricsConnection::Read,
+				this->shared_from_this(),
+				boost::asio::placeholders::error));
+		else
+			Respond();
+	}
+
+	typename Protocol::socket socket;
+
+private:
+	void Read(const boost::system::error_code &error) {
+		if (!error)
+			Respond();
+	}
+	void Respond() {
+		const string body(Metrics::Export());
+		if (http) {
+			std::ostringstream header;
+			header << "HTTP/1.0 200 OK\r\n" <<
+				"Content-Type: text/plain; version=0.0.4\r\n" <<
+				"Content-Length: " << body.size() << "\r\n" <<
+				"Connection: close\r\n\r\n";
+			response = header.str() + body;
+		} else
+			response = body;
+		boost::asio::async_write(socket, boost::asio::buffer(response),
+			boost::bind(&MetricsConnection::Written,
+			this->shared_from_this(),
+			boost::asio::placeholders::error));
+	}
+	void Written(const boost::system::error_code &) {
+		boost::system::error_code ignored;
+		socket.shutdown(Protocol::socket::shutdown_both, ignored);
+	}
+
+	bool http;
+	boost::asio::streambuf request;
+	string response;
+};
+
+template <class Protocol> class MetricsListener {
+public:
+	MetricsListener(boost::asio::io_service &s,
+		const typename Protocol::endpoint &endpoint, bool h) :
+		service(s), acceptor(s, endpoint), http(h) {
+		Accept();
+	}
+
+private:
+	typedef MetricsConnection<Protocol> Connection;
+
+	void Accept() {
+		boost::shared_ptr<Connection> connection(new Connection(service,
+			http));
+		acceptor.async_accept(connection->socket,
+			boost::bind(&MetricsListener::Accepted, this, connection,
+			boost::asio::placeholders::error));
+	}
+	void Accepted(boost::shared_ptr<Connection> connection,
+		const boost::system::error_code &error) {
+		if (error == boost::asio::error::operation_aborted)
+			return;
+		if (!error)
+			connection->Start();
+		Accept();
+	}
+
+	boost::asio::io_service &service;
+	typename Protocol::acceptor acceptor;
+	bool http;
+};
+
+} // namespace lux
+
+// State of the running export, protected by exportMutex
+static boost::mutex exportMutex;
+static boost::thread *exportThread = NULL;
+static boost::asio::io_service *exportService = NULL;
+static boost::shared_ptr<void> exportListener;
+static string exportSocket;
+
+// Timing hook of the task pools
+static void RecordTask(const char *name, double seconds)
+{
+	const string labels(string("task=\"") + (name ? name : "unnamed") + "\"");
+	Metrics::AddCounter("lux_tasks_total", 1., labels);
+	Metrics::AddCounter("lux_task_seconds_total", seconds, labels);
+}
+
+static void RunMetricsService(boost::asio::io_service *service)
+{
+	service->run();
+}
+
+static void WriteMetricsFile(const string &filename, u_int interval)
+{
+	const string tmpName(filename + ".tmp");
+	while (true) {
+		std::ofstream out(tmpName.c_str(),
+			std::ios::out | std::ios::binary | std::ios::trunc);
+		out << Metrics::Export();
+		out.close();
+		// Replace the previous file at once so that readers never
+		// see a partial file
+		try {
+			if (!out.fail())
+				boost::filesystem::rename(tmpName, filename);
+			else
+				LOG(LUX_WARNING, LUX_SYSTEM) << "Unable to write the metrics to '" << tmpName << "'";
+		} catch (std::exception &e) {
+			LOG(LUX_WARNING, LUX_SYSTEM) << "Unable to write the metrics to '" << filename << "': " << e.what();
+		}
+
+		boost::this_thread::sleep(boost::posix_time::seconds(interval));
+	}
+}
+
+bool Metrics::Start(const string &target, u_int interval)
+{
+	Stop();
+
+	boost::mutex::scoped_lock lock(exportMutex);
+	try {
+		if (target.compare(0, 5, "http:") == 0) {
+			const unsigned short port =
+				boost::lexical_cast<unsigned short>(target.substr(5));
+			exportService = new boost::asio::io_service();
+			exportListener.reset(new MetricsListener<tcp>(*exportService,
+				tcp::endpoint(boost::asio::ip::address_v4::loopback(), port),
+				true));
+			exportThread = new boost::thread(boost::bind(RunMetricsService,
+				exportService));
+		} else if (target.compare(0, 5, "unix:") == 0) {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+			typedef boost::asio::local::stream_protocol unix_socket;
+			const string path(boost::filesystem::system_complete(
+				target.substr(5)).string());
+			// Only remove a stale socket, never a regular file
+			if (boost::filesystem::status(path).type() ==
+				boost::filesystem::socket_file)
+				boost::filesystem::remove(path);
+			exportService = new boost::asio::io_service();
+			exportListener.reset(new MetricsListener<unix_socket>(*exportService,
+				unix_socket::endpoint(path), false));
+			exportSocket = path;
+			exportThread = new boost::thread(boost::bind(RunMetricsService,
+				exportService));
+#else
+			LOG(LUX_ERROR, LUX_UNIMPLEMENT) << "Unix sockets aren't available on this platform, unable to export the metrics to '" << target << "'";
+			return false;
+#endif
+		} else {
+			// The working directory may change later on slave nodes
+			const string filename(boost::filesystem::system_complete(
+				target).string());
+			exportThread = new boost::thread(boost::bind(WriteMetricsFile,
+				filename, std::max(interval, 1U)));
+		}
+	} catch (std::exception &e) {
+		LOG(LUX_ERROR, LUX_SYSTEM) << "Unable to export the metrics to '" << target << "': " << e.what();
+		exportListener.reset();
+		delete exportService;
+		exportService = NULL;
+		exportSocket.clear();
+		return false;
+	}
+
+	TaskPool::SetTimingHook(boost::bind(RecordTask, _1, _2));
+
+	LOG(LUX_INFO, LUX_NOERROR) << "Exporting the metrics to '" << target << "'";
+	return true;
+}
+
+void Metrics::Stop()
+{
+	TaskPool::SetTimingHook(TaskPool::TimingHook());
+
+	boost::mutex::scoped_lock lock(exportMutex);
+	if (exportService)
+		exportService->stop();
+	if (exportThread) {
+		exportThread->interrupt();
+		exportThread->join();
+		delete exportThread;
+		exportThread = NULL;
+	}
+	exportListener.reset();
+	delete exportService;
+	exportService = NULL;
+	if (!exportSocket.empty()) {
+		boost::system::error_code error;
+		boost::filesystem::remove(exportSocket, error);
+		exportSocket.clear();
+	}
+}
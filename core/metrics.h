@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_METRICS_H
+#define LUX_METRICS_H
+// metrics.h*
+#include "lux.h"
+
+#include <map>
+using std::map;
+#include <boost/thread/mutex.hpp>
+
+namespace lux
+{
+
+/**
+   Process wide render telemetry in the Prometheus text exposition format.
+   Subsystems without a Queryable (network transfers, film merges, memory)
+   report counters and gauges here, the numeric attributes of the renderer
+   statistics, of the render farm and of the film are sampled when the
+   metrics are exported.
+   The export is disabled by default, Start() makes it available either
+   through a HTTP listener, a Unix socket or a periodically rewritten file.
+*/
+class Metrics {
+public:
+	/**
+	   Increase a monotonic counter
+	   @param name the metric name, should end with _total
+	   @param delta the amount to add
+	   @param labels optional labels, ie. direction="in"
+	*/
+	static void AddCounter(const string &name, double delta,
+		const string &labels = "");
+	/**
+	   Adjust a gauge by delta
+	*/
+	static void AddGauge(const string &name, double delta,
+		const string &labels = "");
+	/**
+	   Set a gauge to value
+	*/
+	static void SetGauge(const string &name, double value,
+		const string &labels = "");
+	/**
+	   Track the memory allocated or freed by a subsystem
+	*/
+	static void AddMemory(const string &subsystem, double delta) {
+		AddGauge("lux_memory_bytes", delta,
+			"subsystem=\"" + subsystem + "\"");
+	}
+
+	/**
+	   Format all the metrics
+	   @return the metrics in the text exposition format
+	*/
+	static string Export();
+
+	/**
+	   Start exporting the metrics, stops any previous export
+	   @param target "http:<port>" for a HTTP listener, "unix:<path>" for
+	   a Unix domain socket, anything else is a file name
+	   @param interval the delay in seconds between two rewrites of the
+	   file, not used by the listeners
+	   @return false if the listener couldn't be started
+	*/
+	static bool Start(const string &target, u_int interval);
+	/**
+	   Stop exporting the metrics
+	*/
+	static void Stop();
+
+	/**
+	   Held by the export while it reads the attributes of the renderer
+	   statistics, the film and the render farm, the context holds it
+	   while deleting them
+	*/
+	static boost::mutex sourcesMutex;
+
+private:
+	struct Metric {
+		Metric() : counter(false) { }
+		bool counter;
+		map<string, double> values; // By labels
+	};
+	static void Update(const string &name, bool counter,
+		const string &labels, double value, bool add);
+
+	static boost::mutex mutex;
+	static map<string, Metric> metrics;
+};
+
+} // namespace lux
+
+#endif // LUX_METRICS_H
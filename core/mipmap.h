@@ -29,6 +29,8 @@
 #include "luxrays/core/color/swcspectrum.h"
 #include "error.h"
 #include "queryable.h"
+#include "metrics.h"
+#include "numa.h"
 #include "luxrays/utils/memory.h"
 
 namespace lux
@@ -271,9 +273,10 @@ public:
 	}
 
 	virtual void DiscardMipmaps(u_int n) {
+		const u_int oldSize = GetMemoryUsed();
 		for (u_int i = 0; i < n; ++i) {
 			if (nLevels <= 1)
-				return;
+				break;
 
 			delete pyramid[0];
 
@@ -285,6 +288,7 @@ public:
 			delete[] pyramid;
 			pyramid = newPyramid;
 		}
+		Metrics::AddMemory("textures", static_cast<double>(GetMemoryUsed()) - oldSize);
 	}
 
 	virtual const luxrays::BlockedArray<T> *GetSingleMap() const {
@@ -379,6 +383,7 @@ template <class T>
 float MIPMapFastImpl<T>::LookupFloat(Channel channel, float s, float t,
 	float width) const
 {
+	LUX_COUNT(MIPMAP_LOOKUPS);
 	switch (filterType) {
 		case MIPMAP_TRILINEAR:
 		case MIPMAP_EWA: {
@@ -412,6 +417,7 @@ template <class T>
 SWCSpectrum MIPMapFastImpl<T>::LookupSpectrum(const SpectrumWavelengths &sw,
 	float s, float t, float width) const
 {
+	LUX_COUNT(MIPMAP_LOOKUPS);
 	switch (filterType) {
 		case MIPMAP_TRILINEAR:
 		case MIPMAP_EWA: {
@@ -444,6 +450,7 @@ template <class T>
 RGBAColor MIPMapFastImpl<T>::LookupRGBAColor(float s, float t,
 	float width) const
 {
+	LUX_COUNT(MIPMAP_LOOKUPS);
 	switch (filterType) {
 		case MIPMAP_TRILINEAR:
 		case MIPMAP_EWA: {
@@ -593,6 +600,7 @@ float MIPMapFastImpl<T>::LookupFloat(Channel channel, float s, float t,
 				2.f * max(max(fabsf(ds0), fabsf(dt0)),
 				max(fabsf(ds1), fabsf(dt1))));
 		case MIPMAP_EWA: {
+			LUX_COUNT(MIPMAP_LOOKUPS);
 			// Compute ellipse minor and major axes
 			if (ds0 * ds0 + dt0 * dt0 < ds1 * ds1 + dt1 * dt1) {
 				swap(ds0, ds1);
@@ -628,8 +636,10 @@ float MIPMapFastImpl<T>::LookupFloat(Channel channel, float s, float t,
 			}
 		}
 		case BILINEAR:
+			LUX_COUNT(MIPMAP_LOOKUPS);
 			return Triangle(channel, s, t);
 		case NEAREST:
+			LUX_COUNT(MIPMAP_LOOKUPS);
 			return Nearest(channel, s, t);
 	}
 	LOG(LUX_ERROR, LUX_SYSTEM) << "Internal error in MIPMapFastImpl::Lookup()";
@@ -645,6 +655,7 @@ SWCSpectrum MIPMapFastImpl<T>::LookupSpectrum(const SpectrumWavelengths &sw,
 				2.f * max(max(fabsf(ds0), fabsf(dt0)),
 				max(fabsf(ds1), fabsf(dt1))));
 		case MIPMAP_EWA: {
+			LUX_COUNT(MIPMAP_LOOKUPS);
 			// Compute ellipse minor and major axes
 			if (ds0 * ds0 + dt0 * dt0 < ds1 * ds1 + dt1 * dt1) {
 				swap(ds0, ds1);
@@ -680,8 +691,10 @@ SWCSpectrum MIPMapFastImpl<T>::LookupSpectrum(const SpectrumWavelengths &sw,
 			}
 		}
 		case BILINEAR:
+			LUX_COUNT(MIPMAP_LOOKUPS);
 			return Triangle(sw, s, t);
 		case NEAREST:
+			LUX_COUNT(MIPMAP_LOOKUPS);
 			return Nearest(sw, s, t);
 	}
 	LOG(LUX_ERROR, LUX_SYSTEM) << "Internal error in MIPMapFastImpl::Lookup()";
@@ -846,12 +859,14 @@ MIPMapFastImpl<T>::~MIPMapFastImpl()
 	switch (filterType) {
 		case MIPMAP_TRILINEAR:
 		case MIPMAP_EWA:
+			Metrics::AddMemory("textures", -static_cast<double>(GetMemoryUsed()));
 			for (u_int i = 0; i < nLevels; ++i)
 				delete pyramid[i];
 			delete[] pyramid;
 			break;
 		case BILINEAR:
 		case NEAREST:
+			Metrics::AddMemory("textures", -static_cast<double>(GetMemoryUsed()));
 			delete singleMap;
 			break;
 		default:
@@ -987,6 +1002,9 @@ MIPMapFastImpl<T>::MIPMapFastImpl(ImageTextureFilterType type, u_int sres, u_int
 		}
 		if (resampledImage)
 			delete[] resampledImage;
+		// The levels are read by all the render threads
+		for (u_int i = 0; i < nLevels; ++i)
+			NumaInterleave(*pyramid[i]);
 
 		// Initialize EWA filter weights if needed
 		if (!weightLut) {
@@ -1002,11 +1020,14 @@ MIPMapFastImpl<T>::MIPMapFastImpl(ImageTextureFilterType type, u_int sres, u_int
 	case BILINEAR:
 	case NEAREST:
 		singleMap = new luxrays::BlockedArray<T>(sres, tres, img);
+		NumaInterleave(*singleMap);
 		nLevels = 0;
 		break;
 	default:
 		LOG(LUX_ERROR, LUX_SYSTEM) << "Internal error in MIPMapFastImpl::MIPMapFastImpl(), unknown filter type";
+		return;
 	}
+	Metrics::AddMemory("textures", GetMemoryUsed());
 }
 
 template <class T>
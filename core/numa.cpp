@@ -0,0 +1,221 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// numa.cpp*
+#include "numa.h"
+#include "error.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/once.hpp>
+#include <boost/thread/tss.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#elif defined(WIN32)
+#include <windows.h>
+#endif
+
+using namespace lux;
+
+// Parse a Linux processor list like "0-7,16-23"
+static vector<u_int> ParseCpuList(const string &list)
+{
+	vector<u_int> cpus;
+	const char *s = list.c_str();
+	while (*s) {
+		unsigned int first, last;
+		int n = 0;
+		if (sscanf(s, "%u-%u%n", &first, &last, &n) == 2 && n > 0)
+			s += n;
+		else if (sscanf(s, "%u%n", &first, &n) == 1 && n > 0) {
+			last = first;
+			s += n;
+		} else
+			break;
+		for (u_int c = first; c <= last; ++c)
+			cpus.push_back(c);
+		if (*s != ',')
+			break;
+		++s;
+	}
+	return cpus;
+}
+
+NumaTopology::NumaTopology() : nCpus(0)
+{
+#if defined(__linux__)
+	namespace fs = boost::filesystem;
+	const fs::path nodesPath("/sys/devices/system/node");
+	boost::system::error_code ec;
+	if (fs::is_directory(nodesPath, ec)) {
+		for (fs::directory_iterator it(nodesPath, ec), end; it != end;
+			it.increment(ec)) {
+			const string name(it->path().filename().string());
+			unsigned int id;
+			if (name.compare(0, 4, "node") != 0 ||
+				sscanf(name.c_str() + 4, "%u", &id) != 1)
+				continue;
+			std::ifstream cpulist((it->path() / "cpulist").string().c_str());
+			string list;
+			std::getline(cpulist, list);
+			const vector<u_int> cpus(ParseCpuList(list));
+			// Memory only nodes can't run threads
+			if (cpus.empty())
+				continue;
+			nodeIds.push_back(id);
+			nodeCpus.push_back(cpus);
+			nCpus += cpus.size();
+		}
+	}
+#endif
+	if (nodeCpus.empty()) {
+		nCpus = max(1u, boost::thread::hardware_concurrency());
+		nodeIds.push_back(0);
+		nodeCpus.push_back(vector<u_int>());
+		for (u_int i = 0; i < nCpus; ++i)
+			nodeCpus.back().push_back(i);
+	}
+}
+
+static boost::once_flag topologyFlag = BOOST_ONCE_INIT;
+static NumaTopology *topology = NULL;
+
+const NumaTopology &NumaTopology::Get()
+{
+	struct Creator {
+		static void Create() {
+			topology = new NumaTopology();
+			std::stringstream ss;
+			for (u_int i = 0; i < topology->GetNodeCount(); ++i)
+				ss << (i > 0 ? ", " : "") <<
+					topology->GetNodeCpus(i).size();
+			LOG(LUX_DEBUG, LUX_NOERROR) << "NUMA nodes: " <<
+				topology->GetNodeCount() << " (processors " <<
+				ss.str() << ")";
+		}
+	};
+	boost::call_once(&Creator::Create, topologyFlag);
+	return *topology;
+}
+
+u_int NumaTopology::GetThreadCpu(u_int thread, u_int *node) const
+{
+	*node = thread % nodeCpus.size();
+	const vector<u_int> &cpus(nodeCpus[*node]);
+	return cpus[(thread / nodeCpus.size()) % cpus.size()];
+}
+
+u_int NumaTopology::GetNodeMask(vector<unsigned long> &mask) const
+{
+	const u_int bitsPerWord = 8 * sizeof(unsigned long);
+	const u_int maxId = *std::max_element(nodeIds.begin(), nodeIds.end());
+	mask.assign(maxId / bitsPerWord + 1, 0);
+	for (u_int i = 0; i < nodeIds.size(); ++i)
+		mask[nodeIds[i] / bitsPerWord] |= 1ul << (nodeIds[i] % bitsPerWord);
+	return mask.size() * bitsPerWord;
+}
+
+static bool numaPlacement = false;
+
+void lux::SetNumaPlacement(bool enable)
+{
+	numaPlacement = enable;
+	if (enable) {
+		const NumaTopology &numa(NumaTopology::Get());
+		LOG(LUX_INFO, LUX_NOERROR) << "NUMA placement enabled, " <<
+			numa.GetNodeCount() << " nodes, " << numa.GetCpuCount() <<
+			" processors";
+	}
+}
+
+bool lux::GetNumaPlacement()
+{
+	return numaPlacement;
+}
+
+static boost::thread_specific_ptr<int> currentNode;
+
+bool lux::PinCurrentThread(u_int cpu, u_int node)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		return false;
+#elif defined(WIN32)
+	if (cpu >= 8 * sizeof(DWORD_PTR) ||
+		!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu))
+		return false;
+#else
+	return false;
+#endif
+	currentNode.reset(new int(node));
+	return true;
+}
+
+int lux::GetCurrentNumaNode()
+{
+	const int *node = currentNode.get();
+	return node ? *node : -1;
+}
+
+void lux::NumaInterleave(const void *data, size_t size)
+{
+	if (!numaPlacement || !data ||
+		NumaTopology::Get().GetNodeCount() < 2)
+		return;
+#if defined(__linux__) && defined(SYS_mbind)
+	// Memory policies apply to whole pages, the partial pages at both
+	// ends stay where they are
+	const size_t pageSize = sysconf(_SC_PAGESIZE);
+	const size_t first = (reinterpret_cast<size_t>(data) + pageSize - 1) &
+		~(pageSize - 1);
+	const size_t last = (reinterpret_cast<size_t>(data) + size) &
+		~(pageSize - 1);
+	if (last <= first)
+		return;
+
+	// Values of the Linux memory policy interface
+	const int mpolInterleave = 3;
+	const unsigned int mpolMfMove = 1 << 1;
+	vector<unsigned long> mask;
+	const u_int nBits = NumaTopology::Get().GetNodeMask(mask);
+	if (syscall(SYS_mbind, first, last - first, mpolInterleave, &mask[0],
+		nBits + 1, mpolMfMove) != 0) {
+		static bool reported = false;
+		if (!reported) {
+			reported = true;
+			LOG(LUX_DEBUG, LUX_SYSTEM) <<
+				"Unable to interleave memory over the NUMA nodes";
+		}
+	}
+#endif
+}
@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_NUMA_H
+#define LUX_NUMA_H
+// numa.h*
+#include "lux.h"
+
+namespace lux
+{
+
+/**
+   NUMA topology of the machine. Systems that don't report one are seen as
+   a single node holding all the processors.
+*/
+class NumaTopology {
+public:
+	static const NumaTopology &Get();
+
+	u_int GetNodeCount() const { return nodeCpus.size(); }
+	u_int GetCpuCount() const { return nCpus; }
+	const vector<u_int> &GetNodeCpus(u_int node) const {
+		return nodeCpus[node];
+	}
+
+	/**
+	   Return the processor of a render thread, consecutive threads are
+	   spread over the nodes in turn so that all the memory controllers
+	   are used even with few threads
+	   @param thread the index of the render thread
+	   @param node filled with the node of the processor
+	*/
+	u_int GetThreadCpu(u_int thread, u_int *node) const;
+
+	/**
+	   Fill the system bit mask of all the nodes
+	   @return the number of bits of the mask
+	*/
+	u_int GetNodeMask(vector<unsigned long> &mask) const;
+
+private:
+	NumaTopology();
+
+	// System identifier and processors of each node
+	vector<u_int> nodeIds;
+	vector<vector<u_int> > nodeCpus;
+	u_int nCpus;
+};
+
+/**
+   Enable the NUMA aware placement of the render threads and of the scene
+   data, it has to be set before the scene is parsed
+*/
+void SetNumaPlacement(bool enable);
+bool GetNumaPlacement();
+
+/**
+   Pin the current thread on a processor
+   @param cpu the processor
+   @param node the NUMA node of the processor, returned afterwards by
+   GetCurrentNumaNode
+   @return false if the system can't pin threads
+*/
+bool PinCurrentThread(u_int cpu, u_int node);
+
+/**
+   Return the NUMA node the current thread is pinned on, -1 if it isn't
+*/
+int GetCurrentNumaNode();
+
+/**
+   Spread the pages of read mostly data over all the NUMA nodes so that
+   every processor gets the same bandwidth to it. The pages already touched
+   are moved. Nothing is done if NUMA placement is disabled, on single node
+   systems and on systems without memory policies.
+   @param data the first byte of the data
+   @param size the size of the data in bytes
+*/
+void NumaInterleave(const void *data, size_t size);
+
+template<class T> void NumaInterleaveArray(const T *data, size_t count)
+{
+	NumaInterleave(static_cast<const void *>(data), count * sizeof(T));
+}
+
+template<class T> void NumaInterleave(const luxrays::BlockedArray<T> &a)
+{
+	if (a.uSize() == 0 || a.vSize() == 0)
+		return;
+	// The blocks are stored contiguously from the first to the last texel
+	const char *first = reinterpret_cast<const char *>(&a(0, 0));
+	const char *last = reinterpret_cast<const char *>(&a(a.uSize() - 1,
+		a.vSize() - 1)) + sizeof(T);
+	NumaInterleave(first, last - first);
+}
+
+}//namespace lux
+
+#endif // LUX_NUMA_H
@@ -25,6 +25,7 @@
 #include "error.h"
 #include "context.h"
 #include "textures/constant.h"
+#include "osfunc.h"
 #include <sstream>
 #include <string>
 #include <vector>
@@ -1409,6 +1410,210 @@ boost::shared_ptr<Texture<FresnelGeneral> >
 	float val = FindOneFloat(n, def);
 	return boost::shared_ptr<Texture<FresnelGeneral> >(new ConstantFresnelTexture(val));
 }
+// Binary encoding helpers, arrays of float based types are written as is
+// on little endian hosts when they have no padding
+template <class T> struct BinaryComponents;
+template <> struct BinaryComponents<float> {
+	static const u_int count = 1;
+	static float *Get(float &v) { return &v; }
+	static const float *Get(const float &v) { return &v; }
+};
+template <> struct BinaryComponents<Point> {
+	static const u_int count = 3;
+	static float *Get(Point &v) { return &v.x; }
+	static const float *Get(const Point &v) { return &v.x; }
+};
+template <> struct BinaryComponents<Vector> {
+	static const u_int count = 3;
+	static float *Get(Vector &v) { return &v.x; }
+	static const float *Get(const Vector &v) { return &v.x; }
+};
+template <> struct BinaryComponents<Normal> {
+	static const u_int count = 3;
+	static float *Get(Normal &v) { return &v.x; }
+	static const float *Get(const Normal &v) { return &v.x; }
+};
+template <> struct BinaryComponents<RGBColor> {
+	static const u_int count = 3;
+	static float *Get(RGBColor &v) { return v.c; }
+	static const float *Get(const RGBColor &v) { return v.c; }
+};
+
+static void WriteBinaryString(std::ostream &os, const string &s)
+{
+	osWriteLittleEndianUInt(osIsLittleEndian(), os, static_cast<uint32_t>(s.size()));
+	os.write(s.data(), s.size());
+}
+// The sizes come from the network, they are checked before allocating
+static const uint32_t maxBinaryStringSize = 1u << 26;
+static const size_t maxBinaryArraySize = static_cast<size_t>(1u << 31);
+
+static bool ReadBinaryString(std::istream &is, string &s)
+{
+	const uint32_t size = osReadLittleEndianUInt(osIsLittleEndian(), is);
+	if (!is.good())
+		return false;
+	if (size > maxBinaryStringSize) {
+		LOG(LUX_ERROR, LUX_LIMIT) << "Binary parameter string too long (" << size << " bytes)";
+		return false;
+	}
+	s.resize(size);
+	if (size > 0)
+		is.read(&s[0], size);
+	return is.good();
+}
+
+template <class T> static void WriteBinaryData(std::ostream &os,
+	const T *data, u_int nItems)
+{
+	typedef BinaryComponents<T> C;
+	const bool isLittleEndian = osIsLittleEndian();
+	if (isLittleEndian && sizeof(T) == C::count * sizeof(float)) {
+		os.write(reinterpret_cast<const char *>(data),
+			static_cast<std::streamsize>(nItems) * sizeof(T));
+		return;
+	}
+	for (u_int i = 0; i < nItems; ++i)
+		for (u_int j = 0; j < C::count; ++j)
+			osWriteLittleEndianFloat(isLittleEndian, os, C::Get(data[i])[j]);
+}
+template <class T> static void ReadBinaryData(std::istream &is, T *data,
+	u_int nItems)
+{
+	typedef BinaryComponents<T> C;
+	const bool isLittleEndian = osIsLittleEndian();
+	if (isLittleEndian && sizeof(T) == C::count * sizeof(float)) {
+		is.read(reinterpret_cast<char *>(data),
+			static_cast<std::streamsize>(nItems) * sizeof(T));
+		return;
+	}
+	for (u_int i = 0; i < nItems; ++i)
+		for (u_int j = 0; j < C::count; ++j)
+			C::Get(data[i])[j] = osReadLittleEndianFloat(isLittleEndian, is);
+}
+template <> void WriteBinaryData<int>(std::ostream &os, const int *data,
+	u_int nItems)
+{
+	const bool isLittleEndian = osIsLittleEndian();
+	if (isLittleEndian && sizeof(int) == sizeof(int32_t)) {
+		os.write(reinterpret_cast<const char *>(data),
+			static_cast<std::streamsize>(nItems) * sizeof(int));
+		return;
+	}
+	for (u_int i = 0; i < nItems; ++i)
+		osWriteLittleEndianInt(isLittleEndian, os, data[i]);
+}
+template <> void ReadBinaryData<int>(std::istream &is, int *data,
+	u_int nItems)
+{
+	const bool isLittleEndian = osIsLittleEndian();
+	if (isLittleEndian && sizeof(int) == sizeof(int32_t)) {
+		is.read(reinterpret_cast<char *>(data),
+			static_cast<std::streamsize>(nItems) * sizeof(int));
+		return;
+	}
+	for (u_int i = 0; i < nItems; ++i)
+		data[i] = osReadLittleEndianInt(isLittleEndian, is);
+}
+template <> void WriteBinaryData<bool>(std::ostream &os, const bool *data,
+	u_int nItems)
+{
+	for (u_int i = 0; i < nItems; ++i)
+		os.put(data[i] ? 1 : 0);
+}
+template <> void ReadBinaryData<bool>(std::istream &is, bool *data,
+	u_int nItems)
+{
+	for (u_int i = 0; i < nItems; ++i)
+		data[i] = is.get() != 0;
+}
+template <> void WriteBinaryData<string>(std::ostream &os,
+	const string *data, u_int nItems)
+{
+	for (u_int i = 0; i < nItems; ++i)
+		WriteBinaryString(os, data[i]);
+}
+template <> void ReadBinaryData<string>(std::istream &is, string *data,
+	u_int nItems)
+{
+	for (u_int i = 0; i < nItems && is.good(); ++i)
+		ReadBinaryString(is, data[i]);
+}
+
+template <class T> static void WriteBinaryItems(std::ostream &os,
+	const vector<ParamSetItem<T> *> &vec)
+{
+	const bool isLittleEndian = osIsLittleEndian();
+	osWriteLittleEndianUInt(isLittleEndian, os, static_cast<uint32_t>(vec.size()));
+	for (u_int i = 0; i < vec.size(); ++i) {
+		WriteBinaryString(os, vec[i]->name);
+		os.put(vec[i]->lookedUp ? 1 : 0);
+		osWriteLittleEndianUInt(isLittleEndian, os, vec[i]->nItems);
+		WriteBinaryData(os, vec[i]->data, vec[i]->nItems);
+	}
+}
+template <class T> static bool ReadBinaryItems(std::istream &is,
+	vector<ParamSetItem<T> *> &vec)
+{
+	const bool isLittleEndian = osIsLittleEndian();
+	const uint32_t count = osReadLittleEndianUInt(isLittleEndian, is);
+	for (u_int i = 0; i < count && is.good(); ++i) {
+		string name;
+		if (!ReadBinaryString(is, name))
+			return false;
+		const bool lookedUp = is.get() != 0;
+		const uint32_t nItems = osReadLittleEndianUInt(isLittleEndian, is);
+		if (!is.good())
+			return false;
+		if (nItems > maxBinaryArraySize / sizeof(T)) {
+			LOG(LUX_ERROR, LUX_LIMIT) << "Binary parameter '" << name << "' too large (" << nItems << " items)";
+			return false;
+		}
+
+		EraseParamType(vec, name);
+		ParamSetItem<T> *item = new ParamSetItem<T>();
+		item->name = name;
+		item->nItems = nItems;
+		item->lookedUp = lookedUp;
+		item->data = new T[nItems];
+		vec.push_back(item);
+		ReadBinaryData(is, item->data, nItems);
+	}
+	return is.good();
+}
+
+void ParamSet::WriteBinary(std::ostream &os) const
+{
+	osWriteLittleEndianUInt(osIsLittleEndian(), os, binaryVersion);
+	WriteBinaryItems(os, ints);
+	WriteBinaryItems(os, bools);
+	WriteBinaryItems(os, floats);
+	WriteBinaryItems(os, points);
+	WriteBinaryItems(os, vectors);
+	WriteBinaryItems(os, normals);
+	WriteBinaryItems(os, spectra);
+	WriteBinaryItems(os, strings);
+	WriteBinaryItems(os, textures);
+}
+
+bool ParamSet::ReadBinary(std::istream &is)
+{
+	const uint32_t version = osReadLittleEndianUInt(osIsLittleEndian(), is);
+	if (version != binaryVersion) {
+		LOG(LUX_ERROR, LUX_BADFILE) << "Unknown binary parameters version " << version;
+		return false;
+	}
+	return ReadBinaryItems(is, ints) &&
+		ReadBinaryItems(is, bools) &&
+		ReadBinaryItems(is, floats) &&
+		ReadBinaryItems(is, points) &&
+		ReadBinaryItems(is, vectors) &&
+		ReadBinaryItems(is, normals) &&
+		ReadBinaryItems(is, spectra) &&
+		ReadBinaryItems(is, strings) &&
+		ReadBinaryItems(is, textures);
+}
+
 boost::shared_ptr<Material> ParamSet::GetMaterial(const string &n) const
 {
 	return Context::GetActive()->GetMaterial(FindOneString(n, ""));
@@ -159,6 +159,24 @@ public:
 	void Clear();
 	string ToString() const;
 
+	/**
+	   Write the parameters in the binary network encoding: a version
+	   followed by the little endian item arrays, each prefixed by its
+	   name and length
+	*/
+	void WriteBinary(std::ostream &os) const;
+	/**
+	   Read parameters written by WriteBinary, the arrays are decoded
+	   directly in the parameter storage
+	   @return false if the encoding version is unknown or the stream
+	   is truncated
+	*/
+	bool ReadBinary(std::istream &is);
+
+	// Marks binary parameters where a text archive size is expected
+	static const u_int binaryTag = 0xffffffffu;
+	static const u_int binaryVersion = 1;
+
 private:
 	// ParamSet Data
 	vector<ParamSetItem<int> *> ints;
@@ -30,6 +30,7 @@
 #include "error.h"
 #include "randomgen.h"
 #include "osfunc.h"
+#include "taskpool.h"
 
 #include "luxrays/utils/mc.h"
 #include "luxrays/utils/mcdistribution.h"
@@ -323,6 +324,70 @@ SWCSpectrum LightPhotonMap::LDiffusePhoton(const SpectrumWavelengths &sw,
 	return L;
 }
 
+// Computes the radiance of a range of radiance photons
+struct RadiancePhotonRange
+{
+	vector<RadiancePhoton> &radiancePhotons;
+	const vector<SWCSpectrum> &rpReflectances;
+	const vector<SWCSpectrum> &rpTransmittances;
+	const LightPhotonMap &directMap;
+	const LightPhotonMap &indirectMap;
+	const LightPhotonMap &causticMap;
+	const SpectrumWavelengths &swl;
+
+	RadiancePhotonRange(
+		vector<RadiancePhoton> &radiancePhotons_,
+		const vector<SWCSpectrum> &rpReflectances_,
+		const vector<SWCSpectrum> &rpTransmittances_,
+		const LightPhotonMap &directMap_,
+		const LightPhotonMap &indirectMap_,
+		const LightPhotonMap &causticMap_,
+		const SpectrumWavelengths &swl_
+	):
+		radiancePhotons(radiancePhotons_),
+		rpReflectances(rpReflectances_),
+		rpTransmittances(rpTransmittances_),
+		directMap(directMap_),
+		indirectMap(indirectMap_),
+		causticMap(causticMap_),
+		swl(swl_)
+	{}
+
+	void operator()(u_int first, u_int last) const
+	{
+		SpectrumWavelengths sw(swl);
+		for (u_int i = first; i < last; ++i) {
+			// Compute radiance for radiance photon _i_
+			RadiancePhoton &rp = radiancePhotons[i];
+			const SWCSpectrum &rho_r = rpReflectances[i];
+			const SWCSpectrum &rho_t = rpTransmittances[i];
+			const Point& p = rp.p;
+			const Normal& n = rp.n;
+			SWCSpectrum alpha(0.f);
+			for (u_int j = 0; j < WAVELENGTH_SAMPLES; ++j)
+				sw.w[j] = rp.w[j];
+
+			if (!rho_r.Black()) {
+				SWCSpectrum E = directMap.EPhoton(sw, p, n);
+				E += indirectMap.EPhoton(sw, p, n);
+				E += causticMap.EPhoton(sw, p, n);
+
+				alpha += E * INV_PI * rho_r;
+			}
+
+			if (!rho_t.Black()) {
+				SWCSpectrum E = directMap.EPhoton(sw, p, -n);
+				E += indirectMap.EPhoton(sw, p, -n);
+				E += causticMap.EPhoton(sw, p, -n);
+
+				alpha += E * INV_PI * rho_t;
+			}
+
+			rp.alpha = alpha;
+		}
+	}
+};
+
 static bool unsuccessful(u_int needed, u_int found, u_int shot)
 {
 	return (found < needed && (found == 0 || found < shot / 1024));
@@ -699,44 +764,12 @@ void PhotonMapPreprocess(const RandomGenerator &rng, const Scene &scene,
 		if (nDirectPhotons > 0)
 			directMap.init(nDirectPhotons, directPhotons);
 
-		for (u_int i = 0; i < radiancePhotons.size(); ++i) {
-			// Dade - print some progress info
-			boost::xtime currentTime;
-			boost::xtime_get(&currentTime, boost::TIME_UTC_);
-			if (currentTime.sec - lastUpdateTime.sec > 5) {
-				LOG(LUX_INFO,LUX_NOERROR) << "Radiance photon map computation progress: " << i << " (" << (100 * i / radiancePhotons.size()) << "%)";
-
-				lastUpdateTime = currentTime;
-			}
-
-			// Compute radiance for radiance photon _i_
-			RadiancePhoton &rp = radiancePhotons[i];
-			const SWCSpectrum &rho_r = rpReflectances[i];
-			const SWCSpectrum &rho_t = rpTransmittances[i];
-			const Point& p = rp.p;
-			const Normal& n = rp.n;
-			SWCSpectrum alpha(0.f);
-			for (u_int j = 0; j < WAVELENGTH_SAMPLES; ++j)
-				sw.w[j] = rp.w[j];
-
-			if (!rho_r.Black()) {
-				SWCSpectrum E = directMap.EPhoton(sw, p, n);
-				E += indirectMap->EPhoton(sw, p, n);
-				E += causticMap->EPhoton(sw, p, n);
-
-				alpha += E * INV_PI * rho_r;
-			}
-
-			if (!rho_t.Black()) {
-				SWCSpectrum E = directMap.EPhoton(sw, p, -n);
-				E += indirectMap->EPhoton(sw, p, -n);
-				E += causticMap->EPhoton(sw, p, -n);
-
-				alpha += E * INV_PI * rho_t;
-			}
-
-			rp.alpha = alpha;
-		}
+		// The photon maps are only read, the radiance photons are
+		// computed concurrently by the task pool
+		ParallelFor(0, radiancePhotons.size(), 0,
+			RadiancePhotonRange(radiancePhotons, rpReflectances,
+			rpTransmittances, directMap, *indirectMap, *causticMap, sw),
+			"radiance photons");
 
 		radianceMap->init(radiancePhotons);
 
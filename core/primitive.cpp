@@ -24,9 +24,12 @@
 #include "primitive.h"
 #include "light.h"
 #include "material.h"
+#include "rendercounters.h"
 
 #include "luxrays/core/geometry/motionsystem.h"
 
+#include <algorithm>
+
 using namespace luxrays;
 using namespace lux;
 
@@ -79,6 +82,7 @@ float Primitive::Sample(float u1, float u2, float u3,
 BSDF *Intersection::GetBSDF(MemoryArena &arena, const SpectrumWavelengths &sw,
 	const Ray &ray) const
 {
+	LUX_COUNT_TIMED(BSDFS);
 	DifferentialGeometry dgShading;
 	primitive->GetShadingGeometry(ObjectToWorld, dg,
 		&dgShading);
@@ -124,6 +128,12 @@ bool InstancePrimitive::Intersect(const Ray &r, Intersection *isect) const
 	if (!instance->Intersect(ray, isect))
 		return false;
 	r.maxt = ray.maxt;
+	TransformIntersection(isect);
+	return true;
+}
+
+void InstancePrimitive::TransformIntersection(Intersection *isect) const
+{
 	isect->ObjectToWorld = InstanceToWorld * isect->ObjectToWorld;
 	// Transform instance's differential geometry to world space
 	isect->dg *= InstanceToWorld;
@@ -135,7 +145,6 @@ bool InstancePrimitive::Intersect(const Ray &r, Intersection *isect) const
 		isect->exterior = exterior.get();
 	if (interior)
 		isect->interior = interior.get();
-	return true;
 }
 
 bool InstancePrimitive::IntersectP(const Ray &r) const {
@@ -208,3 +217,52 @@ BBox MotionPrimitive::WorldBound() const
 {
 	return motionPath.Bound(instance->WorldBound(), false);
 }
+
+BBox MotionPrimitive::WorldBound(float t0, float t1) const
+{
+	// Between 2 keyframes the motion path interpolates translation
+	// linearly while rotation and scale are applied around the instance
+	// origin. Between 2 samples not separated by a keyframe, every corner
+	// then stays within its largest distance to the origin from the
+	// linearly moving origin, whatever the rotation angle. The keyframes
+	// inside the segment are sampled too so that the origin path doesn't
+	// bend between 2 samples.
+	const BBox ibox(instance->WorldBound());
+	const u_int nSteps = 8;
+	vector<float> times;
+	for (u_int s = 0; s <= nSteps; ++s)
+		times.push_back(Lerp(static_cast<float>(s) / nSteps, t0, t1));
+	const vector<InterpolatedTransform> &keys(motionPath.interpolatedTransforms);
+	for (u_int i = 0; i < keys.size(); ++i) {
+		if (keys[i].startTime > t0 && keys[i].startTime < t1)
+			times.push_back(keys[i].startTime);
+		if (keys[i].endTime > t0 && keys[i].endTime < t1)
+			times.push_back(keys[i].endTime);
+	}
+	std::sort(times.begin(), times.end());
+	times.erase(std::unique(times.begin(), times.end()), times.end());
+
+	Point previous;
+	float previousRadius = 0.f;
+	BBox bound;
+	for (u_int s = 0; s < times.size(); ++s) {
+		const Transform InstanceToWorld(motionPath.Sample(times[s]));
+		const Point origin(InstanceToWorld * Point(0.f, 0.f, 0.f));
+		float radius = 0.f;
+		for (u_int c = 0; c < 8; ++c) {
+			const Point corner(InstanceToWorld * Point(
+				(c & 1) ? ibox.pMax.x : ibox.pMin.x,
+				(c & 2) ? ibox.pMax.y : ibox.pMin.y,
+				(c & 4) ? ibox.pMax.z : ibox.pMin.z));
+			radius = max(radius, Distance(corner, origin));
+		}
+		if (s > 0) {
+			BBox step(previous, origin);
+			step.Expand(max(radius, previousRadius));
+			bound = Union(bound, step);
+		}
+		previous = origin;
+		previousRadius = radius;
+	}
+	return bound;
+}
@@ -418,6 +418,17 @@ public:
 	const vector<boost::shared_ptr<Primitive> > &GetInstanceSources() const { return instanceSources; }
 	const Transform &GetTransform() const { return InstanceToWorld; }
 	Material *GetMaterial() const { return material.get(); }
+	// Shared accessors, used by accelerators storing instances in a compact form
+	const boost::shared_ptr<Primitive> &GetInstance() const { return instance; }
+	const boost::shared_ptr<Material> &GetInstanceMaterial() const { return material; }
+	const boost::shared_ptr<Volume> &GetInstanceExterior() const { return exterior; }
+	const boost::shared_ptr<Volume> &GetInstanceInterior() const { return interior; }
+	/**
+	 * Complete an intersection with the instanced primitive computed in
+	 * instance space, used by accelerators tracing the instances themselves
+	 * @param isect the intersection to transform to world space
+	 */
+	void TransformIntersection(Intersection *isect) const;
 
 private:
 	// InstancePrimitive Private Data
@@ -467,6 +478,13 @@ public:
 	virtual ~MotionPrimitive() { }
 
 	virtual BBox WorldBound() const;
+	/**
+	 * Returns a conservative world bound of the primitive over
+	 * the [t0, t1] time interval only.
+	 * @param t0 The start of the time interval.
+	 * @param t1 The end of the time interval.
+	 */
+	BBox WorldBound(float t0, float t1) const;
 	virtual const Volume *GetExterior() const {
 		return exterior ? exterior.get() : instance->GetExterior();
 	}
@@ -42,6 +42,7 @@ public:
 
 	Queryable* operator[] (const std::string &s)
 	{
+		boost::mutex::scoped_lock lock(classWideMutex);
 		std::map<std::string, Queryable*>::iterator it=queryableObjects.find(s);
 		if(it!=queryableObjects.end()) 
 			return((*it).second);
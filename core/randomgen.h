@@ -71,8 +71,13 @@ public:
 		// Repopulate buffer if necessary
 		const unsigned int offset = bufid; // for thread safety
 		if (offset >= RAN_BUFFER_AMOUNT) {
+			// Run the generator on local copies of the state:
+			// buf could alias the members otherwise and they would
+			// be reloaded and stored for each value
+			unsigned long s1 = z1, s2 = z2, s3 = z3, s4 = z4;
 			for(int i = 0; i < RAN_BUFFER_AMOUNT; ++i)
-				buf[i] = nobuf_generateUInt();
+				buf[i] = taus113(s1, s2, s3, s4);
+			z1 = s1; z2 = s2; z3 = s3; z4 = s4;
 			bufid = 1;
 			return buf[0];
 		}
@@ -111,6 +116,11 @@ private:
 	}
 
 	inline unsigned long nobuf_generateUInt() const {
+		return taus113(z1, z2, z3, z4);
+	}
+
+	static inline unsigned long taus113(unsigned long &z1,
+		unsigned long &z2, unsigned long &z3, unsigned long &z4) {
 		const unsigned long b1 = ((((z1 << 6UL) & MASK) ^ z1) >> 13UL);
 		z1 = ((((z1 & 4294967294UL) << 18UL) & MASK) ^ b1);
 
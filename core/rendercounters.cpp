@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// rendercounters.cpp*
+#include "rendercounters.h"
+
+#include <cstring>
+#include <new>
+#include <set>
+#include <boost/thread/mutex.hpp>
+
+using namespace lux;
+
+LUX_THREAD_LOCAL RenderCounters *RenderCounters::current = NULL;
+
+// The blocks in use and the sum of the destroyed ones
+static boost::mutex countersMutex;
+static std::set<RenderCounters *> activeCounters;
+static boost::uint64_t retiredCounts[RenderCounters::EVENT_COUNT];
+static boost::uint64_t retiredCycles[RenderCounters::EVENT_COUNT];
+
+static const char *eventNames[RenderCounters::EVENT_COUNT] = {
+	"rays",
+	"shadowRays",
+	"bsdfs",
+	"textureEvaluations",
+	"mipmapLookups",
+	"volumeScatters",
+	"volumeTaus"
+};
+
+static const char *eventDescriptions[RenderCounters::EVENT_COUNT] = {
+	"rays traced",
+	"shadow rays traced",
+	"BSDFs computed",
+	"texture evaluations",
+	"MIPMap lookups",
+	"volume scattering evaluations",
+	"volume optical thickness evaluations"
+};
+
+RenderCounters::RenderCounters()
+{
+	memset(counts, 0, sizeof(counts));
+	memset(cycles, 0, sizeof(cycles));
+}
+
+const char *RenderCounters::EventName(Event event)
+{
+	return eventNames[event];
+}
+
+const char *RenderCounters::EventDescription(Event event)
+{
+	return eventDescriptions[event];
+}
+
+RenderCounters *RenderCounters::Create()
+{
+	RenderCounters *counters = new (luxrays::AllocAligned<RenderCounters>(1))
+		RenderCounters();
+	boost::mutex::scoped_lock lock(countersMutex);
+	activeCounters.insert(counters);
+	return counters;
+}
+
+void RenderCounters::Destroy(RenderCounters *counters)
+{
+	if (!counters)
+		return;
+	boost::mutex::scoped_lock lock(countersMutex);
+	for (u_int i = 0; i < EVENT_COUNT; ++i) {
+		retiredCounts[i] += counters->counts[i];
+		retiredCycles[i] += counters->cycles[i];
+	}
+	activeCounters.erase(counters);
+	lock.unlock();
+	counters->~RenderCounters();
+	luxrays::FreeAligned(counters);
+}
+
+void RenderCounters::GetTotals(boost::uint64_t counts[EVENT_COUNT],
+	boost::uint64_t cycles[EVENT_COUNT])
+{
+	boost::mutex::scoped_lock lock(countersMutex);
+	for (u_int i = 0; i < EVENT_COUNT; ++i) {
+		counts[i] = retiredCounts[i];
+		cycles[i] = retiredCycles[i];
+	}
+	for (std::set<RenderCounters *>::const_iterator it = activeCounters.begin();
+		it != activeCounters.end(); ++it) {
+		for (u_int i = 0; i < EVENT_COUNT; ++i) {
+			counts[i] += (*it)->counts[i];
+			cycles[i] += (*it)->cycles[i];
+		}
+	}
+}
@@ -0,0 +1,186 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_RENDERCOUNTERS_H
+#define LUX_RENDERCOUNTERS_H
+// rendercounters.h*
+#include "lux.h"
+
+#include <boost/cstdint.hpp>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Thread local storage for plain pointers
+#if defined(_MSC_VER)
+#define LUX_THREAD_LOCAL __declspec(thread)
+#else
+#define LUX_THREAD_LOCAL __thread
+#endif
+
+namespace lux
+{
+
+/**
+   Per thread counters of the expensive rendering operations.
+   Each thread counts in its own block, padded to whole cache lines so
+   that the increments never cause false sharing, the blocks are only
+   summed when the statistics are queried. A thread without an attached
+   block doesn't count anything.
+   The hot path hooks are the LUX_COUNT and LUX_COUNT_TIMED macros which
+   are only compiled in when LUX_COUNTERS is defined, LUX_COUNTER_TIMERS
+   additionally accumulates the CPU cycles spent in the timed operations
+   (including the nested ones).
+*/
+class RenderCounters {
+public:
+	enum Event {
+		RAYS,
+		SHADOW_RAYS,
+		BSDFS,
+		TEXTURE_EVALUATIONS,
+		MIPMAP_LOOKUPS,
+		VOLUME_SCATTERS,
+		VOLUME_TAUS,
+		EVENT_COUNT
+	};
+
+	/**
+	   Name of an event, used for the statistics attributes
+	*/
+	static const char *EventName(Event event);
+	/**
+	   Description of an event, ie. "rays traced"
+	*/
+	static const char *EventDescription(Event event);
+
+	/**
+	   Allocate a new cache line aligned block of counters
+	*/
+	static RenderCounters *Create();
+	/**
+	   Free a block of counters, its counts are kept in the totals
+	*/
+	static void Destroy(RenderCounters *counters);
+
+	/**
+	   Select the block of counters of the calling thread
+	   @param counters the block to use, NULL to stop counting
+	*/
+	static void Attach(RenderCounters *counters) { current = counters; }
+
+	static void Count(Event event) {
+		RenderCounters *counters = current;
+		if (counters)
+			++(counters->counts[event]);
+	}
+
+	/**
+	   Sum the counters of all the blocks created so far, the blocks still
+	   in use are read without synchronization so the totals may lag a
+	   little behind
+	*/
+	static void GetTotals(boost::uint64_t counts[EVENT_COUNT],
+		boost::uint64_t cycles[EVENT_COUNT]);
+
+	boost::uint64_t GetCount(Event event) const { return counts[event]; }
+	boost::uint64_t GetCycles(Event event) const { return cycles[event]; }
+
+	static boost::uint64_t ReadCycles() {
+#if defined(_MSC_VER)
+		return __rdtsc();
+#elif defined(__i386__) || defined(__x86_64__)
+		return __builtin_ia32_rdtsc();
+#else
+		return 0;
+#endif
+	}
+
+	/**
+	   Count an event and accumulate the cycles until the end of the scope
+	*/
+	class ScopedTimer {
+	public:
+		ScopedTimer(Event e) : counters(current), event(e), start(0) {
+			if (counters) {
+				++(counters->counts[event]);
+				start = ReadCycles();
+			}
+		}
+		~ScopedTimer() {
+			if (counters)
+				counters->cycles[event] += ReadCycles() - start;
+		}
+	private:
+		RenderCounters *counters;
+		Event event;
+		boost::uint64_t start;
+	};
+
+	/**
+	   Attach a block of counters to the calling thread until the end of
+	   the scope, a block is created for the scope if none is given
+	*/
+	class ScopedAttach {
+	public:
+		ScopedAttach(RenderCounters *c = NULL) :
+			counters(c ? c : Create()), owned(!c) {
+			Attach(counters);
+		}
+		~ScopedAttach() {
+			Attach(NULL);
+			if (owned)
+				Destroy(counters);
+		}
+	private:
+		RenderCounters *counters;
+		bool owned;
+	};
+
+	static const size_t cacheLineSize = 64;
+
+private:
+	RenderCounters();
+
+	boost::uint64_t counts[EVENT_COUNT];
+	boost::uint64_t cycles[EVENT_COUNT];
+	char padding[cacheLineSize -
+		(2 * EVENT_COUNT * sizeof(boost::uint64_t)) % cacheLineSize];
+
+	static LUX_THREAD_LOCAL RenderCounters *current;
+};
+
+} // namespace lux
+
+#ifdef LUX_COUNTERS
+#define LUX_COUNT(event) lux::RenderCounters::Count(lux::RenderCounters::event)
+#ifdef LUX_COUNTER_TIMERS
+#define LUX_COUNT_TIMED(event) lux::RenderCounters::ScopedTimer luxCounterTimer(lux::RenderCounters::event)
+#else
+#define LUX_COUNT_TIMED(event) LUX_COUNT(event)
+#endif
+#else
+#define LUX_COUNT(event)
+#define LUX_COUNT_TIMED(event)
+#endif
+
+#endif // LUX_RENDERCOUNTERS_H
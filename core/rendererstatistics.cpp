@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <limits>
 
+#include <boost/bind.hpp>
 #include <boost/regex.hpp>
 #include <boost/format.hpp>
 #include <boost/thread/mutex.hpp>
@@ -57,6 +58,23 @@ RendererStatistics::RendererStatistics()
 
 	AddIntAttribute(*this, "threadCount", "Number of rendering threads on local node", &RendererStatistics::getThreadCount);
 	AddIntAttribute(*this, "slaveNodeCount", "Number of network slave nodes", &RendererStatistics::getSlaveNodeCount);
+
+	RenderCounters::GetTotals(countersStart, cyclesStart);
+#ifdef LUX_COUNTERS
+	for (u_int i = 0; i < RenderCounters::EVENT_COUNT; ++i) {
+		const RenderCounters::Event event = static_cast<RenderCounters::Event>(i);
+		const std::string name(RenderCounters::EventName(event));
+		const std::string description(RenderCounters::EventDescription(event));
+		AddDoubleAttribute(*this, name, "Number of " + description,
+			boost::function<double (void)>(boost::bind(&RendererStatistics::getCounterTotal, this, event)));
+		AddDoubleAttribute(*this, name + "PerSecond", "Average number of " + description + " per second",
+			boost::function<double (void)>(boost::bind(&RendererStatistics::getCounterRate, this, event)));
+#ifdef LUX_COUNTER_TIMERS
+		AddDoubleAttribute(*this, name + "Cycles", "Average CPU cycles for the " + description,
+			boost::function<double (void)>(boost::bind(&RendererStatistics::getCounterCycles, this, event)));
+#endif
+	}
+#endif
 }
 
 void RendererStatistics::reset() {
@@ -67,6 +85,7 @@ void RendererStatistics::reset() {
 	timer.Reset();
 	windowStartTime = 0.0;
 	windowCurrentTime = 0.0;
+	RenderCounters::GetTotals(countersStart, cyclesStart);
 }
 
 void RendererStatistics::start() {
@@ -145,6 +164,30 @@ u_int RendererStatistics::getSlaveNodeCount() {
 	return static_cast<u_int>(luxGetIntAttribute("render_farm", "slaveNodeCount"));
 }
 
+double RendererStatistics::getCounterTotal(RenderCounters::Event event) {
+	boost::uint64_t counts[RenderCounters::EVENT_COUNT];
+	boost::uint64_t cycles[RenderCounters::EVENT_COUNT];
+	RenderCounters::GetTotals(counts, cycles);
+
+	return static_cast<double>(counts[event] - countersStart[event]);
+}
+
+double RendererStatistics::getCounterRate(RenderCounters::Event event) {
+	const double elapsed = getElapsedTime();
+
+	return elapsed > 0.0 ? getCounterTotal(event) / elapsed : 0.0;
+}
+
+// Average CPU cycles spent per event, including the nested timed events
+double RendererStatistics::getCounterCycles(RenderCounters::Event event) {
+	boost::uint64_t counts[RenderCounters::EVENT_COUNT];
+	boost::uint64_t cycles[RenderCounters::EVENT_COUNT];
+	RenderCounters::GetTotals(counts, cycles);
+
+	const boost::uint64_t n = counts[event] - countersStart[event];
+	return n > 0 ? static_cast<double>(cycles[event] - cyclesStart[event]) / n : 0.0;
+}
+
 RendererStatistics::Formatted::Formatted(RendererStatistics* rs, const std::string& name)
 	: Queryable(name),
 	rs(rs)
@@ -27,8 +27,10 @@
 #include "lux.h"
 #include "queryable.h"
 #include "timer.h"
+#include "rendercounters.h"
 
 #include <string>
+#include <vector>
 
 #include <boost/thread/mutex.hpp>
 
@@ -54,6 +56,13 @@ public:
 	// multithread safe while in running state
 	double elapsedTime() const;
 
+	// Samples computed by each local render thread,
+	// left empty by renderers which don't track them
+	virtual void getThreadSamples(std::vector<double> &samples) { samples.clear(); }
+	// Count of an event for each local render thread,
+	// left empty by renderers which don't track them
+	virtual void getThreadCounters(RenderCounters::Event event, std::vector<double> &counts) { counts.clear(); }
+
 	class Formatted : public Queryable {
 	public:
 		virtual ~Formatted() {};
@@ -135,6 +144,13 @@ protected:
 	double getPercentConvergence();
 	u_int getSlaveNodeCount();
 
+	// Render counters since the last reset
+	double getCounterTotal(RenderCounters::Event event);
+	double getCounterRate(RenderCounters::Event event);
+	double getCounterCycles(RenderCounters::Event event);
+	boost::uint64_t countersStart[RenderCounters::EVENT_COUNT];
+	boost::uint64_t cyclesStart[RenderCounters::EVENT_COUNT];
+
 	// These methods must be overridden for renderers
 	// which provide alternative measurable halt conditions
 	virtual double getRemainingTime();
@@ -38,6 +38,9 @@
 #include "filedata.h"
 #include "tigerhash.h"
 #include "context.h"
+#include "filetransfer.h"
+#include "metrics.h"
+#include "timer.h"
 
 #include <algorithm>
 #include <fstream>
@@ -140,45 +143,79 @@ RenderFarm::CompiledFile::CompiledFile(const std::string &filename) : fname(file
 	fhash = digest_string(file_hash<tigerhash>(filename));
 }
 
-bool RenderFarm::CompiledFile::send(std::iostream &stream) const {
-	LOG(LUX_DEBUG,LUX_NOERROR) << "Sending file '" << filename() << "'";
+bool RenderFarm::CompiledFile::send(std::iostream &stream, int compression) const {
+	return FileTransfer::Send(stream, filename(), compression);
+}
 
-	std::ifstream in(filename().c_str(), std::ios::in | std::ios::binary);
+RenderFarm::FileHolders::FileHolders(const std::vector<ExtRenderingServerInfo> &serverList,
+		u_int relayFanout) : servers(serverList), fanout(relayFanout),
+		relays(serverList.size(), 0) {
+}
 
-	// Get length of file
-	in.seekg(0, std::ifstream::end);
-	uint64_t len = boost::iostreams::position_to_offset(in.tellg());
-	in.seekg(0, std::ifstream::beg);
+size_t RenderFarm::FileHolders::acquire(const filehash_t &hash, size_t server) {
+	if (fanout == 0)
+		return master();
 
-	if (in.fail()) {
-		// AdjustFilename should guarantee that file exists, if not return just normalized filename
-		LOG( LUX_ERROR,LUX_SYSTEM) << "There was an error while checking the size of file '" << filename() << "'";
+	boost::mutex::scoped_lock lock(mutex);
 
-		// Send an empty file ot the server
-		stream << "\n0\n";
-	} else {
-		// Send the file length
-		stream << filename() << "\n";
-		stream << len << "\n";
-
-		// Send the file
-		vector<char> buffer(1 * 1024 * 1024, 0);
-		while (len > 0) {
-			const std::streamsize rs = static_cast<std::streamsize>(min(static_cast<uint64_t>(buffer.size()), len));
-			in.read(&buffer[0], rs);
-			stream.write(&buffer[0], rs);
-			len -= rs;
+	while (true) {
+		// Use the least busy server holding the file
+		const std::vector<size_t> &h(holders[hash]);
+		size_t source = master();
+		for (size_t i = 0; i < h.size(); ++i) {
+			if (h[i] == server || relays[h[i]] >= fanout)
+				continue;
+			if (source == master() || relays[h[i]] < relays[source])
+				source = h[i];
+		}
+		if (source != master()) {
+			++relays[source];
+			return source;
 		}
 
-		if (in.bad()) {
-			LOG( LUX_ERROR,LUX_SYSTEM) << "There was an error sending file '" << filename() << "'";
-			return false;
+		if (directSends[hash] < fanout) {
+			++directSends[hash];
+			return master();
 		}
+
+		// Wait for a transfer of the file to end
+		changed.wait(lock);
 	}
+}
+
+void RenderFarm::FileHolders::release(const filehash_t &hash, size_t source) {
+	if (fanout == 0)
+		return;
 
-	in.close();
+	boost::mutex::scoped_lock lock(mutex);
 
-	return true;
+	if (source == master())
+		--directSends[hash];
+	else
+		--relays[source];
+	changed.notify_all();
+}
+
+void RenderFarm::FileHolders::add(const filehash_t &hash, size_t server) {
+	if (fanout == 0)
+		return;
+
+	boost::mutex::scoped_lock lock(mutex);
+
+	std::vector<size_t> &h(holders[hash]);
+	if (std::find(h.begin(), h.end(), server) == h.end())
+		h.push_back(server);
+	changed.notify_all();
+}
+
+void RenderFarm::FileHolders::remove(const filehash_t &hash, size_t server) {
+	if (fanout == 0)
+		return;
+
+	boost::mutex::scoped_lock lock(mutex);
+
+	std::vector<size_t> &h(holders[hash]);
+	h.erase(std::remove(h.begin(), h.end(), server), h.end());
 }
 
 RenderFarm::CompiledFile RenderFarm::CompiledFiles::add(const std::string &filename) {
@@ -211,7 +248,8 @@ const RenderFarm::CompiledFile& RenderFarm::CompiledFiles::fromHash(filehash_t h
 	return files[it->second];
 }
 
-bool RenderFarm::CompiledFiles::send(std::iostream &stream) const {
+bool RenderFarm::CompiledFiles::send(std::iostream &stream, FileHolders &holders,
+		size_t server, int compression) const {
 	LOG(LUX_DEBUG,LUX_NOERROR) << "Sending files";
 
 	stream << "BEGIN FILES" << "\n";
@@ -234,21 +272,42 @@ bool RenderFarm::CompiledFiles::send(std::iostream &stream) const {
 		// TODO - catch exception in case of invalid hash
 		const CompiledFile &cf(fromHash(hash));
 
-		if (!cf.send(stream))
-			return false;
+		const size_t source = holders.acquire(hash, server);
+		if (source == holders.master()) {
+			if (!cf.send(stream, compression)) {
+				holders.release(hash, source);
+				return false;
+			}
+		} else {
+			const ExtRenderingServerInfo &relay(holders.server(source));
+			FileTransfer::SendRelay(stream, cf.filename(),
+				relay.name, relay.port, compression);
+		}
 
 		std::string response = get_response(stream);
-		if (response == "FILE OK")
+		holders.release(hash, source);
+		if (response == "FILE OK") {
+			holders.add(hash, server);
 			continue;
+		}
 
 		if (response != "RESEND FILE") {
 			LOG( LUX_ERROR,LUX_SYSTEM) << "Invalid response '" << response << "', expected 'RESEND FILE'";
 			return false;
 		}
 
+		if (source != holders.master()) {
+			LOG( LUX_WARNING,LUX_SYSTEM) << "Relay of file '" << cf.filename() << "' failed, sending it directly";
+			holders.remove(hash, source);
+		}
+
 		// resend file once
-		if (!cf.send(stream))
+		if (!cf.send(stream, compression))
+			return false;
+
+		if (!read_response(stream, "FILE OK"))
 			return false;
+		holders.add(hash, server);
 	}
 
 	stream << "END FILES OK" << "\n";
@@ -290,28 +349,11 @@ std::ostream& RenderFarm::CompiledCommand::buffer() {
 }
 
 void RenderFarm::CompiledCommand::addParams(const ParamSet &params) {
-	// Serialize the parameters
-	stringstream zos(stringstream::in | stringstream::out | stringstream::binary);
-	std::streamsize size;
-	{
-		stringstream os(stringstream::in | stringstream::out | stringstream::binary);
-		{
-			// Serialize the parameters
-			boost::archive::text_oarchive oa(os);
-			oa << params;
-		}
-
-		// Compress the parameters
-		filtering_streambuf<input> in;
-		in.push(gzip_compressor(9));
-		in.push(os);
-		size = boost::iostreams::copy(in , zos);
-	}
-
-	// Write the size of the compressed chunk
-	osWriteLittleEndianUInt(osIsLittleEndian(), paramsBuf, size);
-	// Copy the compressed parameters to the newtwork buffer
-	paramsBuf << zos.str() << "\n";
+	// All the servers accepted by the protocol version decode the
+	// binary parameters
+	osWriteLittleEndianUInt(osIsLittleEndian(), paramsBuf, ParamSet::binaryTag);
+	params.WriteBinary(paramsBuf);
+	paramsBuf << "\n";
 	hasParams = true;
 }
 
@@ -321,8 +363,10 @@ void RenderFarm::CompiledCommand::addFile(const std::string &paramName, const Co
 
 bool RenderFarm::CompiledCommand::send(std::iostream &stream) const {
 	stream << command << "\n";
-	string buf = paramsBuf.str();
+	const string buf = paramsBuf.str();
 	stream << buf;
+	Metrics::AddCounter("lux_network_bytes_total",
+		command.size() + 1 + buf.size(), "direction=\"out\"");
 	string response;
 
 	// no params means no files
@@ -365,10 +409,13 @@ RenderFarm::CompiledCommand& RenderFarm::CompiledCommands::add(const std::string
 
 RenderFarm::RenderFarm(Context *c) : Queryable("render_farm"), ctx(c),
 		filmUpdateThread(NULL), flushThread(NULL), netBufferComplete(false), doneRendering(false),
-		isLittleEndian(osIsLittleEndian()), pollingInterval(3 * 60), defaultTcpPort(18018)
+		isLittleEndian(osIsLittleEndian()), pollingInterval(3 * 60), defaultTcpPort(18018),
+		fileCompression(0), relayFanout(0)
 {
 	AddIntAttribute(*this, "defaultTcpPort", "Default TCP port", &RenderFarm::defaultTcpPort, ReadWriteAccess);
 	AddIntAttribute(*this, "pollingInterval", "Polling interval", &RenderFarm::pollingInterval, ReadWriteAccess);
+	AddIntAttribute(*this, "fileCompression", "Compression level of the files sent to the servers (0 to disable)", &RenderFarm::fileCompression, ReadWriteAccess);
+	AddIntAttribute(*this, "relayFanout", "Number of servers a server can relay the scene files to at once (0 to disable)", &RenderFarm::relayFanout, ReadWriteAccess);
 	AddIntAttribute(*this, "slaveNodeCount", "Number of network slave nodes", &RenderFarm::getSlaveNodeCount);
 	AddDoubleAttribute(*this, "updateTimeRemaining", "Time remaining until next update", &RenderFarm::getUpdateTimeRemaining);
 }
@@ -584,6 +631,14 @@ RenderFarm::reconnect_status_t RenderFarm::reconnect(ExtRenderingServerInfo &ser
 			updateServerNoiseAwareMap(serverInfo, size, noiseMap);
 			delete[] noiseMap;
 		}
+
+		// Send also the mask of the converged tiles if some have been retired
+		u_int tileSize, tileCount;
+		const unsigned char *tileMask = ctx->luxCurrentScene->camera()->film->GetTileMask(&tileSize, &tileCount);
+		if (tileMask) {
+			updateServerTileMask(serverInfo, tileSize, tileCount, tileMask);
+			delete[] tileMask;
+		}
 	} catch (exception& e) {
 		LOG(LUX_ERROR,LUX_SYSTEM) << "Unable to reconnect server: " << serverName;
 		LOG(LUX_ERROR,LUX_SYSTEM)<< e.what();
@@ -775,45 +830,43 @@ void RenderFarm::flushImpl() {
 		(ctx->luxCurrentScene->camera()->film->GetNoiseAwareMap()) : NULL;
 	const u_int size = (userMap || noiseMap) ? (ctx->luxCurrentScene->camera()->film->GetXPixelCount() *
 			ctx->luxCurrentScene->camera()->film->GetYPixelCount()) : 0;
+	u_int tileSize = 0, tileCount = 0;
+	const unsigned char *tileMask = (ctx->luxCurrentScene && ctx->luxCurrentScene->camera() && ctx->luxCurrentScene->camera()->film) ?
+		(ctx->luxCurrentScene->camera()->film->GetTileMask(&tileSize, &tileCount)) : NULL;
+
+	// Servers flushed earlier already hold all the files
+	FileHolders holders(serverInfoList, static_cast<u_int>(max(relayFanout, 0)));
+	for (size_t i = 0; i < serverInfoList.size(); i++) {
+		if (serverInfoList[i].active && serverInfoList[i].flushed) {
+			for (size_t j = 0; j < compiledFiles.size(); j++)
+				holders.add(compiledFiles[j].hash(), i);
+		}
+	}
 
-	//flush network buffer
+	//flush network buffer, all servers at once
+	boost::thread_group flushThreads;
 	for (size_t i = 0; i < serverInfoList.size(); i++) {
 		if(serverInfoList[i].active && !serverInfoList[i].flushed) {
-			try {
-				LOG( LUX_INFO,LUX_NOERROR) << "Sending commands to server: " <<
-						serverInfoList[i].name << ":" << serverInfoList[i].port;
-
-				tcp::iostream stream(serverInfoList[i].name, serverInfoList[i].port);
-				stream.rdbuf()->set_option(tcp::no_delay(true));
-				//stream << commands << endl;
-				for (size_t j = 0; j < compiledCommands.size(); j++) {
-					// send command
-					if (!compiledCommands[j].send(stream))
-						break;
-
-					// and then send any requested files
-					if (!compiledCommands[j].sendFiles())
-						continue;
-
-					if (!compiledFiles.send(stream))
-						break;
-				}
-
-				serverInfoList[i].flushed = true;
-
-				// Send also an updated noise-aware map if there is one
-				if (noiseMap)
-					updateServerNoiseAwareMap(serverInfoList[i], size, noiseMap);
-				// Send also an updated user sampling map if there is one
-				if (userMap)
-					updateServerUserSamplingMap(serverInfoList[i], size, userMap);
-			} catch (exception& e) {
-				LOG(LUX_ERROR,LUX_SYSTEM)<< e.what();
-			}
+			flushThreads.create_thread(boost::bind(&RenderFarm::flushServer,
+				this, i, boost::ref(holders), userMap, noiseMap, size,
+				tileMask, tileSize, tileCount));
 		}
 	}
+	try {
+		flushThreads.join_all();
+	} catch (boost::thread_interrupted &) {
+		// The flush threads use the maps and the file holders
+		flushThreads.interrupt_all();
+		flushThreads.join_all();
+		delete[] userMap;
+		delete[] noiseMap;
+		delete[] tileMask;
+		throw;
+	}
 
 	delete[] userMap;
+	delete[] noiseMap;
+	delete[] tileMask;
 
 	// Dade - write info only if there was the communication with some server
 	if (serverInfoList.size() > 0) {
@@ -821,6 +874,53 @@ void RenderFarm::flushImpl() {
 	}
 }
 
+void RenderFarm::flushServer(size_t index, FileHolders &holders,
+		const float *userMap, const float *noiseMap, u_int size,
+		const unsigned char *tileMask, u_int tileSize, u_int tileCount) {
+	// NOTE - requires serverListMutex to be acquired by caller
+	ExtRenderingServerInfo &serverInfo(serverInfoList[index]);
+	try {
+		LOG( LUX_INFO,LUX_NOERROR) << "Sending commands to server: " <<
+				serverInfo.name << ":" << serverInfo.port;
+
+		tcp::iostream stream(serverInfo.name, serverInfo.port);
+		stream.rdbuf()->set_option(tcp::no_delay(true));
+		for (size_t j = 0; j < compiledCommands.size(); j++) {
+			// send command
+			if (!compiledCommands[j].send(stream))
+				break;
+
+			// and then send any requested files
+			if (!compiledCommands[j].sendFiles())
+				continue;
+
+			if (!compiledFiles.send(stream, holders, index, fileCompression))
+				break;
+
+			// the server now holds all the files of the command,
+			// including the ones it already had in its cache
+			const std::vector<std::pair<std::string, CompiledFile> > &files(compiledCommands[j].getFiles());
+			for (size_t k = 0; k < files.size(); ++k)
+				holders.add(files[k].second.hash(), index);
+		}
+
+		serverInfo.flushed = true;
+
+		// Send also an updated noise-aware map if there is one
+		if (noiseMap)
+			updateServerNoiseAwareMap(serverInfo, size, noiseMap);
+		// Send also an updated user sampling map if there is one
+		if (userMap)
+			updateServerUserSamplingMap(serverInfo, size, userMap);
+		// Send also the mask of the converged tiles, after the
+		// noise-aware map it applies to
+		if (tileMask)
+			updateServerTileMask(serverInfo, tileSize, tileCount, tileMask);
+	} catch (exception& e) {
+		LOG(LUX_ERROR,LUX_SYSTEM)<< e.what();
+	}
+}
+
 void RenderFarm::flush() {
 	boost::mutex::scoped_lock lock(serverListMutex);
 
@@ -923,8 +1023,16 @@ void RenderFarm::updateFilm(Scene *scene) {
 
 			compressedStream.seekg(0, BOOST_IOS::beg);
 
+			Metrics::AddCounter("lux_network_bytes_total",
+				static_cast<double>(compressedSize), "direction=\"in\"");
+
 			// Decopress and merge the film
+			Timer mergeTimer;
+			mergeTimer.Start();
 			const double sampleCount = film->MergeFilmFromStream(compressedStream);
+			Metrics::AddCounter("lux_film_merge_seconds_total",
+				mergeTimer.Time());
+			Metrics::AddCounter("lux_film_merges_total", 1.);
 			if (sampleCount == 0.)
 				throw string("Received 0 samples from server");
 			film->numberOfSamplesFromNetwork += sampleCount;
@@ -1151,6 +1259,79 @@ void RenderFarm::updateUserSamplingMap() {
 	delete[] map;
 }
 
+void RenderFarm::updateServerTileMask(ExtRenderingServerInfo &serverInfo, const u_int tileSize,
+		const u_int count, const unsigned char *mask) {
+	if (!serverInfo.active)
+		// skip servers which are still down
+		return;
+
+	try {
+		LOG(LUX_DEBUG, LUX_NOERROR) << "Sending tile mask to: " <<
+				serverInfo.name << ":" << serverInfo.port;
+
+		// Connect to the server
+		tcp::iostream stream;
+		stream.exceptions(tcp::iostream::failbit | tcp::iostream::badbit);
+
+		stream.connect(serverInfo.name, serverInfo.port);
+
+		LOG(LUX_DEBUG, LUX_NOERROR) << "Connected to: " << stream.rdbuf()->remote_endpoint();
+
+		// Send the command to update the mask
+		stream << "luxSetTileMask" << endl;
+		stream << serverInfo.sid << endl;
+		osWriteLittleEndianUInt(isLittleEndian, stream, tileSize);
+		osWriteLittleEndianUInt(isLittleEndian, stream, count);
+
+		// Compress the mask to send
+		filtering_stream<output> compressedStream;
+		compressedStream.push(gzip_compressor(4));
+		compressedStream.push(stream);
+
+		compressedStream.write(reinterpret_cast<const char *>(mask), count);
+
+		compressedStream.flush();
+
+		if (!compressedStream.good())
+			LOG(LUX_SEVERE,LUX_SYSTEM) << "Error while transmitting a tile mask";
+
+		serverInfo.timeLastContact = second_clock::local_time();
+	} catch (string s) {
+		LOG(LUX_ERROR,LUX_SYSTEM)<< s.c_str();
+		// Mark as failed (inactive)
+		serverInfo.active = false;
+	} catch (std::exception& e) {
+		LOG( LUX_ERROR,LUX_SYSTEM) << "Error while communicating with server: " <<
+				serverInfo.name << ":" << serverInfo.port << " ( " << e.what() << ")";
+		LOG(LUX_ERROR,LUX_SYSTEM)<< e.what();
+		// Mark as failed (inactive)
+		serverInfo.active = false;
+	}
+}
+
+void RenderFarm::updateTileMask() {
+	// Get the tile mask from the film
+	u_int tileSize, count;
+	const unsigned char *mask = ctx->luxCurrentScene->camera()->film->GetTileMask(&tileSize, &count);
+	if (!mask)
+		return;
+
+	// Using the mutex in order to not allow server disconnection while
+	// I'm downloading a film
+	boost::mutex::scoped_lock lock(serverListMutex);
+
+	// first try to reconnect to failed servers which may be up now
+	reconnectFailed();
+
+	for (u_int i = 0; i < serverInfoList.size(); i++)
+		updateServerTileMask(serverInfoList[i], tileSize, count, mask);
+
+	// attempt to reconnect
+	reconnectFailed();
+
+	delete[] mask;
+}
+
 void RenderFarm::updateNoiseAwareMap() {
 	// Get the user sampling map from the film
 	const float *map = ctx->luxCurrentScene->camera()->film->GetNoiseAwareMap();
@@ -123,6 +123,8 @@ public:
 	void updateNoiseAwareMap();
 	// Update the user sampling map of all servers
 	void updateUserSamplingMap();
+	// Send the mask of the converged tiles to all servers
+	void updateTileMask();
 
 	double getUpdateTimeRemaining();
 
@@ -156,6 +158,42 @@ private:
 
 	typedef std::string filehash_t;
 
+	// Tracks the servers holding each file during a flush, so that
+	// servers get files from each other instead of all from the master.
+	// Each source, the master included, serves at most fanout transfers
+	// of a file at once, with a fanout of 0 everything is sent directly.
+	class FileHolders : public boost::noncopyable {
+	public:
+		FileHolders(const std::vector<ExtRenderingServerInfo> &serverList,
+			u_int relayFanout);
+
+		// Returns the server to get the file from, or master(),
+		// waits until a source is available
+		size_t acquire(const filehash_t &hash, size_t server);
+		void release(const filehash_t &hash, size_t source);
+
+		void add(const filehash_t &hash, size_t server);
+		// The server failed to relay the file
+		void remove(const filehash_t &hash, size_t server);
+
+		size_t master() const {
+			return servers.size();
+		}
+
+		const ExtRenderingServerInfo& server(size_t index) const {
+			return servers[index];
+		}
+
+	private:
+		const std::vector<ExtRenderingServerInfo> &servers;
+		u_int fanout;
+		boost::mutex mutex;
+		boost::condition_variable changed;
+		std::map<filehash_t, std::vector<size_t> > holders;
+		std::map<filehash_t, u_int> directSends;
+		std::vector<u_int> relays;
+	};
+
 	class CompiledFile {
 	public:
 		CompiledFile() { }
@@ -169,7 +207,8 @@ private:
 			return fhash;
 		}
 
-		bool send(std::iostream &stream) const;
+		// compression is the gzip level, 0 to send the file as is
+		bool send(std::iostream &stream, int compression) const;
 
 		bool operator<(const CompiledFile& other) const {
 			return fhash < other.fhash;
@@ -188,7 +227,18 @@ private:
 		const CompiledFile& fromFilename(std::string filename) const;
 		const CompiledFile& fromHash(filehash_t hash) const;
 
-		bool send(std::iostream &stream) const;
+		size_t size() const {
+			return files.size();
+		}
+
+		const CompiledFile& operator[](size_t index) const {
+			return files[index];
+		}
+
+		// Sends the files requested by a server, relaying them from
+		// the other servers when possible
+		bool send(std::iostream &stream, FileHolders &holders,
+			size_t server, int compression) const;
 
 	private:
 		std::vector<CompiledFile> files;
@@ -217,6 +267,10 @@ private:
 			return hasParams && !files.empty();
 		}
 
+		const std::vector<std::pair<std::string, CompiledFile> >& getFiles() const {
+			return files;
+		}
+
 	private:
 		std::string command;
 		bool hasParams;
@@ -254,6 +308,9 @@ private:
 	bool connect(ExtRenderingServerInfo &serverInfo);
 	reconnect_status_t reconnect(ExtRenderingServerInfo &serverInfo);
 	void flushImpl();
+	void flushServer(size_t index, FileHolders &holders,
+		const float *userMap, const float *noiseMap, u_int size,
+		const unsigned char *tileMask, u_int tileSize, u_int tileCount);
 	void disconnect(const ExtRenderingServerInfo &serverInfo);
 	void reconnectFailed();
 	void stopImpl();
@@ -261,6 +318,8 @@ private:
 	u_int getSlaveNodeCount();
 	void updateServerNoiseAwareMap(ExtRenderingServerInfo &serverInfo, const u_int size, const float *map);
 	void updateServerUserSamplingMap(ExtRenderingServerInfo &serverInfo, const u_int size, const float *map);
+	void updateServerTileMask(ExtRenderingServerInfo &serverInfo, const u_int tileSize,
+		const u_int count, const unsigned char *mask);
 
 	// The context, this render farm, is associated with
 	Context *ctx;
@@ -284,6 +343,10 @@ private:
 	bool isLittleEndian;
 	int pollingInterval;
 	int defaultTcpPort;
+	// gzip level of the files sent to the servers, 0 to disable
+	int fileCompression;
+	// Number of servers a server can relay a file to at once, 0 to disable
+	int relayFanout;
 };
 
 }//namespace lux
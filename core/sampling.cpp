@@ -101,6 +101,51 @@ void Shuffle(const RandomGenerator &rng, u_int *samp, u_int count, u_int dims)
 			swap(samp[dims*i + j], samp[dims*other + j]);
 	}
 }
+// Going from index n to n + 1 flips the bits of n up to its lowest zero
+// bit k, the sequence values change by the XOR of the generators of
+// these bits: the top k + 1 bits for Van der Corput and the carry
+// table below for Sobol2
+static const float invTwoPow32 = 1.f / 4294967296.f;
+struct Sobol2Carries {
+	Sobol2Carries() {
+		u_int v = 1u << 31, c = 0;
+		for (u_int k = 0; k < 32; ++k, v ^= v >> 1) {
+			c ^= v;
+			carries[k] = c;
+		}
+	}
+	u_int carries[32];
+};
+static const Sobol2Carries sobol2Carries;
+
+static inline u_int LowestZeroBit(u_int n)
+{
+	u_int k = 0;
+	for (; (n & 1) && k < 31; n >>= 1)
+		++k;
+	return k;
+}
+
+void VanDerCorputSequence(u_int count, u_int scramble, float *samples,
+	u_int stride)
+{
+	u_int n = scramble;
+	for (u_int i = 0; i < count; ++i, samples += stride) {
+		// Same as the double precision division in VanDerCorput()
+		// since the scale is a power of 2
+		*samples = static_cast<float>(n) * invTwoPow32;
+		n ^= ~0u << (31 - LowestZeroBit(i));
+	}
+}
+void Sobol2Sequence(u_int count, u_int scramble, float *samples,
+	u_int stride)
+{
+	u_int n = scramble;
+	for (u_int i = 0; i < count; ++i, samples += stride) {
+		*samples = static_cast<float>(n) * invTwoPow32;
+		n ^= sobol2Carries.carries[LowestZeroBit(i)];
+	}
+}
 void LatinHypercube(const RandomGenerator &rng, float *samples,
 	u_int nSamples, u_int nDim)
 {
@@ -126,6 +126,13 @@ public:
 
 	virtual u_int GetTotalPixels() = 0;
 	virtual bool GetNextPixel(int *xPos, int *yPos, const u_int usePos) = 0;
+	/**
+	   Return the stride of the pixel grid that is completely rendered
+	   when the pixel at usePos is handed out, the film upsamples the
+	   display by this factor. Only progressive pixel samplers return
+	   something else than 1.
+	*/
+	virtual u_int GetPreviewStride(const u_int usePos) const { return 1; }
 
 	// Dade - used by sampler to store the renderingDone condition. Placed here
 	// because PixelSampler is shared among threads
@@ -138,6 +145,18 @@ void StratifiedSample2D(const RandomGenerator &rng, float *samples, u_int nx, u_
 void Shuffle(const RandomGenerator &rng, float *samp, u_int count, u_int dims);
 void Shuffle(const RandomGenerator &rng, u_int *samp, u_int count, u_int dims);
 void LatinHypercube(const RandomGenerator &rng, float *samples, u_int nSamples, u_int nDim);
+/**
+   Fill samples[0], samples[stride], ... with VanDerCorput(i, scramble)
+   for i in [0, count), updating the value from one index to the next
+   instead of reversing the bits of each index
+*/
+void VanDerCorputSequence(u_int count, u_int scramble, float *samples,
+	u_int stride = 1);
+/**
+   Same as VanDerCorputSequence() for Sobol2(i, scramble)
+*/
+void Sobol2Sequence(u_int count, u_int scramble, float *samples,
+	u_int stride = 1);
 
 // Sampling Inline Functions
 inline double RadicalInverse(u_int n, u_int base)
@@ -219,8 +238,7 @@ inline void LDShuffleScrambled1D(const RandomGenerator &rng, u_int nSamples,
 	u_int nPixel, float *samples)
 {
 	u_int scramble = rng.uintValue();
-	for (u_int i = 0; i < nSamples * nPixel; ++i)
-		samples[i] = VanDerCorput(i, scramble);
+	VanDerCorputSequence(nSamples * nPixel, scramble, samples);
 	for (u_int i = 0; i < nPixel; ++i)
 		Shuffle(rng, samples + i * nSamples, nSamples, 1);
 	Shuffle(rng, samples, nPixel, nSamples);
@@ -229,8 +247,8 @@ inline void LDShuffleScrambled2D(const RandomGenerator &rng, u_int nSamples,
 	u_int nPixel, float *samples)
 {
 	u_int scramble[2] = { (u_int) rng.uintValue(), (u_int) rng.uintValue() };
-	for (u_int i = 0; i < nSamples * nPixel; ++i)
-		Sample02(i, scramble, &samples[2*i]);
+	VanDerCorputSequence(nSamples * nPixel, scramble[0], samples, 2);
+	Sobol2Sequence(nSamples * nPixel, scramble[1], samples + 1, 2);
 	for (u_int i = 0; i < nPixel; ++i)
 		Shuffle(rng, samples + 2 * i * nSamples, nSamples, 2);
 	Shuffle(rng, samples, nPixel, 2 * nSamples);
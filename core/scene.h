@@ -28,6 +28,7 @@
 #include "primitive.h"
 #include "transport.h"
 #include "camera.h"
+#include "rendercounters.h"
 
 #include <boost/thread/thread.hpp>
 #include <boost/noncopyable.hpp>
@@ -49,9 +50,12 @@ public:
 	Scene(Camera *c);
 	~Scene();
 	bool Intersect(const Ray &ray, Intersection *isect) const {
+		LUX_COUNT_TIMED(RAYS);
 		return aggregate->Intersect(ray, isect);
 	}
 	bool Intersect(const luxrays::RayHit &rayHit, Intersection *isect) const {
+		// The ray itself has been traced by LuxRays
+		LUX_COUNT(RAYS);
 		if (rayHit.Miss())
 			return false;
 		else {
@@ -95,6 +99,7 @@ public:
 			pdfR);
 	}
 	bool IntersectP(const Ray &ray) const {
+		LUX_COUNT_TIMED(SHADOW_RAYS);
 		return aggregate->IntersectP(ray);
 	}
 	const BBox &WorldBound() const { return bound; }
@@ -1,4 +1,5 @@
 #include "scheduler.h"
+#include "rendercounters.h"
 #include <iostream>
 
 namespace scheduling
@@ -12,6 +13,7 @@ Range::Range(Scheduler *sched, Thread *thread_data)
 
 void Thread::Body(Thread* thread, Scheduler *scheduler)
 {
+	lux::RenderCounters::ScopedAttach attachCounters;
 	thread->Init();
 
 	TaskType task;
@@ -77,12 +79,22 @@ void Scheduler::Launch(TaskType new_task, unsigned b_min, unsigned b_max, unsign
 
 void Scheduler::Pause()
 {
+	boost::unique_lock<boost::mutex> lock(pause_mutex);
 	state = PAUSED;
 }
 
 void Scheduler::Resume()
 {
+	boost::unique_lock<boost::mutex> lock(pause_mutex);
 	state = RUNNING;
+	pause_condition.notify_all();
+}
+
+void Scheduler::WaitWhilePaused()
+{
+	boost::unique_lock<boost::mutex> lock(pause_mutex);
+	while (state == PAUSED)
+		pause_condition.wait(lock);
 }
 
 void Scheduler::Done()
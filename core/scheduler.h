@@ -24,7 +24,6 @@ using boost::interprocess::ipcdetail::atomic_inc32;
  *   - by mean of Done function
  *   - by DelThread
  * - Pause/Resume function
- *   - use a barrier instead of a crappy sleep
  *   - should this code move at the end of each blocks ?
 */
 
@@ -80,10 +79,15 @@ friend class Thread;
 friend class Range;
 
 private:
-	enum {PAUSED, RUNNING} state;
+	volatile enum {PAUSED, RUNNING} state;
+	boost::mutex pause_mutex;
+	boost::condition_variable pause_condition;
 
 	TaskType GetTask();
 
+	// block the calling thread until Resume
+	void WaitWhilePaused();
+
 	bool EndTask(Thread* thread);
 
 	std::vector<Thread*> threads;
@@ -121,10 +125,8 @@ public:
 			return current;
 		
 		// handle pause
-		while (scheduler->state == Scheduler::PAUSED)
-		{
-			boost::this_thread::sleep(boost::posix_time::seconds(1));
-		}
+		if (scheduler->state == Scheduler::PAUSED)
+			scheduler->WaitWhilePaused();
 
 		return atomic_init();
 	}
@@ -61,6 +61,14 @@ public:
 		boost::shared_ptr<Volume> v(vol);
 		interior = v;
 	}
+	/**
+	   Use the material and the volumes of another shape
+	*/
+	void CopyBindings(const Shape &s) {
+		SetMaterial(s.material);
+		SetExterior(s.exterior);
+		SetInterior(s.interior);
+	}
 	Material *GetMaterial() const { return material.get(); }
 	virtual const Volume *GetExterior() const { return exterior.get(); }
 	virtual const Volume *GetInterior() const { return interior.get(); }
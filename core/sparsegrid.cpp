@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// sparsegrid.cpp*
+#include "sparsegrid.h"
+#include "osfunc.h"
+#include "error.h"
+
+#include <fstream>
+#include <cstring>
+
+using namespace lux;
+
+// Size in 32 bits words of the file header
+static const u_int headerSize = 10;
+static const u_int sparseGridVersion = 1;
+
+SparseGrid::SparseGrid() : index(NULL), bricks(NULL),
+	nx(0), ny(0), nz(0), bnx(0), bny(0), bnz(0),
+	background(0.f), minValue(0.f), maxValue(0.f), meanValue(0.f)
+{
+}
+
+SparseGrid::~SparseGrid()
+{
+	if (file.is_open())
+		file.close();
+}
+
+bool SparseGrid::Load(const string &filename)
+{
+	// The voxels are used in place so the file has to be in host order
+	if (!osIsLittleEndian()) {
+		LOG(LUX_ERROR, LUX_SYSTEM) << "Sparse grid files can't be mapped on big endian hosts";
+		return false;
+	}
+	try {
+		file.open(filename);
+	} catch (std::exception &e) {
+		LOG(LUX_ERROR, LUX_NOFILE) << "Unable to map sparse grid file '" << filename << "': " << e.what();
+		return false;
+	}
+	if (!file.is_open()) {
+		LOG(LUX_ERROR, LUX_NOFILE) << "Unable to map sparse grid file '" << filename << "'";
+		return false;
+	}
+
+	const size_t size = file.size();
+	const char *data = file.data();
+	if (size < headerSize * sizeof(u_int) ||
+		std::memcmp(data, "LXSG", 4) != 0) {
+		LOG(LUX_ERROR, LUX_BADFILE) << "'" << filename << "' is not a sparse grid file";
+		file.close();
+		return false;
+	}
+	const u_int *header = reinterpret_cast<const u_int *>(data);
+	if (header[1] != sparseGridVersion) {
+		LOG(LUX_ERROR, LUX_BADFILE) << "Unsupported sparse grid version " << header[1] << " in '" << filename << "'";
+		file.close();
+		return false;
+	}
+	nx = static_cast<int>(header[2]);
+	ny = static_cast<int>(header[3]);
+	nz = static_cast<int>(header[4]);
+	const u_int nBricks = header[5];
+	const float *values = reinterpret_cast<const float *>(header + 6);
+	background = values[0];
+	minValue = values[1];
+	maxValue = values[2];
+	meanValue = values[3];
+	bnx = (nx + BRICK_MASK) >> BRICK_SHIFT;
+	bny = (ny + BRICK_MASK) >> BRICK_SHIFT;
+	bnz = (nz + BRICK_MASK) >> BRICK_SHIFT;
+
+	const size_t indexSize = static_cast<size_t>(bnx) * bny * bnz;
+	const size_t expected = (headerSize + indexSize +
+		static_cast<size_t>(nBricks) * BRICK_VOXELS) * sizeof(u_int);
+	if (nx <= 0 || ny <= 0 || nz <= 0 || size < expected) {
+		LOG(LUX_ERROR, LUX_BADFILE) << "Truncated or corrupted sparse grid file '" << filename << "'";
+		file.close();
+		return false;
+	}
+	index = header + headerSize;
+	bricks = reinterpret_cast<const float *>(index + indexSize);
+	for (size_t i = 0; i < indexSize; ++i) {
+		if (index[i] != EMPTY_BRICK && index[i] >= nBricks) {
+			LOG(LUX_ERROR, LUX_BADFILE) << "Invalid brick index in sparse grid file '" << filename << "'";
+			file.close();
+			return false;
+		}
+	}
+
+	LOG(LUX_INFO, LUX_NOERROR) << "Sparse grid '" << filename << "': " <<
+		nx << "x" << ny << "x" << nz << " voxels, " << nBricks <<
+		"/" << indexSize << " bricks stored";
+	return true;
+}
+
+int SparseGrid::Write(const string &filename, int nx, int ny, int nz,
+	const float *data, float background, float tolerance)
+{
+	if (nx <= 0 || ny <= 0 || nz <= 0)
+		return -1;
+	const int bnx = (nx + BRICK_MASK) >> BRICK_SHIFT;
+	const int bny = (ny + BRICK_MASK) >> BRICK_SHIFT;
+	const int bnz = (nz + BRICK_MASK) >> BRICK_SHIFT;
+
+	// Gather the non empty bricks, voxels outside the grid replicate
+	// the border so that they never matter
+	vector<u_int> index(static_cast<size_t>(bnx) * bny * bnz, EMPTY_BRICK);
+	vector<float> bricks;
+	vector<float> brick(BRICK_VOXELS);
+	float minValue = INFINITY, maxValue = -INFINITY;
+	double sum = 0.;
+	for (int bz = 0; bz < bnz; ++bz) {
+		for (int by = 0; by < bny; ++by) {
+			for (int bx = 0; bx < bnx; ++bx) {
+				bool empty = true;
+				for (u_int z = 0; z < BRICK_SIZE; ++z) {
+					const int vz = min<int>(bz * BRICK_SIZE + z, nz - 1);
+					for (u_int y = 0; y < BRICK_SIZE; ++y) {
+						const int vy = min<int>(by * BRICK_SIZE + y, ny - 1);
+						for (u_int x = 0; x < BRICK_SIZE; ++x) {
+							const int vx = min<int>(bx * BRICK_SIZE + x, nx - 1);
+							const float v = data[(static_cast<size_t>(vz) * ny + vy) * nx + vx];
+							brick[(z * BRICK_SIZE + y) * BRICK_SIZE + x] = v;
+							if (fabsf(v - background) > tolerance)
+								empty = false;
+						}
+					}
+				}
+				if (empty)
+					continue;
+				index[(static_cast<size_t>(bz) * bny + by) * bnx + bx] =
+					static_cast<u_int>(bricks.size() / BRICK_VOXELS);
+				bricks.insert(bricks.end(), brick.begin(), brick.end());
+			}
+		}
+	}
+	const size_t nVoxels = static_cast<size_t>(nx) * ny * nz;
+	for (size_t i = 0; i < nVoxels; ++i) {
+		minValue = min(minValue, data[i]);
+		maxValue = max(maxValue, data[i]);
+		sum += data[i];
+	}
+
+	std::ofstream out(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+	if (!out) {
+		LOG(LUX_ERROR, LUX_NOFILE) << "Unable to create sparse grid file '" << filename << "'";
+		return -1;
+	}
+	const bool isLittleEndian = osIsLittleEndian();
+	out.write("LXSG", 4);
+	osWriteLittleEndianUInt(isLittleEndian, out, sparseGridVersion);
+	osWriteLittleEndianUInt(isLittleEndian, out, nx);
+	osWriteLittleEndianUInt(isLittleEndian, out, ny);
+	osWriteLittleEndianUInt(isLittleEndian, out, nz);
+	osWriteLittleEndianUInt(isLittleEndian, out, bricks.size() / BRICK_VOXELS);
+	osWriteLittleEndianFloat(isLittleEndian, out, background);
+	osWriteLittleEndianFloat(isLittleEndian, out, minValue);
+	osWriteLittleEndianFloat(isLittleEndian, out, maxValue);
+	osWriteLittleEndianFloat(isLittleEndian, out, static_cast<float>(sum / nVoxels));
+	for (size_t i = 0; i < index.size(); ++i)
+		osWriteLittleEndianUInt(isLittleEndian, out, index[i]);
+	for (size_t i = 0; i < bricks.size(); ++i)
+		osWriteLittleEndianFloat(isLittleEndian, out, bricks[i]);
+	if (!out.good()) {
+		LOG(LUX_ERROR, LUX_SYSTEM) << "Error while writing sparse grid file '" << filename << "'";
+		return -1;
+	}
+	return static_cast<int>(bricks.size() / BRICK_VOXELS);
+}
+
+float SparseGrid::Interpolate(int vx, int vy, int vz,
+	float dx, float dy, float dz) const
+{
+	const int x0 = luxrays::Clamp(vx, 0, nx - 1);
+	const int x1 = luxrays::Clamp(vx + 1, 0, nx - 1);
+	const int y0 = luxrays::Clamp(vy, 0, ny - 1);
+	const int y1 = luxrays::Clamp(vy + 1, 0, ny - 1);
+	const int z0 = luxrays::Clamp(vz, 0, nz - 1);
+	const int z1 = luxrays::Clamp(vz + 1, 0, nz - 1);
+	const int bx = x0 >> BRICK_SHIFT, by = y0 >> BRICK_SHIFT,
+		bz = z0 >> BRICK_SHIFT;
+
+	// Most lookups have all 8 voxels in the same brick, only one index
+	// access is then needed and empty bricks are resolved immediately
+	if (bx == (x1 >> BRICK_SHIFT) && by == (y1 >> BRICK_SHIFT) &&
+		bz == (z1 >> BRICK_SHIFT)) {
+		const u_int b = Brick(bx, by, bz);
+		if (b == EMPTY_BRICK)
+			return background;
+		const float *v = bricks + static_cast<size_t>(b) * BRICK_VOXELS;
+		const u_int i000 = Voxel(x0, y0, z0);
+		const u_int ox = x1 - x0;
+		const u_int oy = (y1 - y0) * BRICK_SIZE;
+		const u_int oz = (z1 - z0) * BRICK_SIZE * BRICK_SIZE;
+		const float d00 = luxrays::Lerp(dx, v[i000], v[i000 + ox]);
+		const float d10 = luxrays::Lerp(dx, v[i000 + oy], v[i000 + oy + ox]);
+		const float d01 = luxrays::Lerp(dx, v[i000 + oz], v[i000 + oz + ox]);
+		const float d11 = luxrays::Lerp(dx, v[i000 + oz + oy],
+			v[i000 + oz + oy + ox]);
+		return luxrays::Lerp(dz, luxrays::Lerp(dy, d00, d10),
+			luxrays::Lerp(dy, d01, d11));
+	}
+
+	const float d00 = luxrays::Lerp(dx, D(x0, y0, z0), D(x1, y0, z0));
+	const float d10 = luxrays::Lerp(dx, D(x0, y1, z0), D(x1, y1, z0));
+	const float d01 = luxrays::Lerp(dx, D(x0, y0, z1), D(x1, y0, z1));
+	const float d11 = luxrays::Lerp(dx, D(x0, y1, z1), D(x1, y1, z1));
+	return luxrays::Lerp(dz, luxrays::Lerp(dy, d00, d10),
+		luxrays::Lerp(dy, d01, d11));
+}
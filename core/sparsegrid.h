@@ -0,0 +1,124 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_SPARSEGRID_H
+#define LUX_SPARSEGRID_H
+// sparsegrid.h*
+#include "lux.h"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace lux
+{
+
+/**
+   Read only sparse voxel grid, memory mapped from a file.
+   The grid is split in bricks of 8x8x8 voxels, bricks where every voxel
+   has the background value are not stored. The file layout, all values
+   being 32 bits little endian, is:
+   - the "LXSG" magic and the format version
+   - nx, ny, nz, the number of stored bricks
+   - the background, minimum, maximum and mean values
+   - the brick index, one entry per brick position in x, y, z order,
+     holding the number of the stored brick or 0xffffffff for empty bricks
+   - the stored bricks, 512 floats each in x, y, z order
+*/
+class SparseGrid {
+public:
+	SparseGrid();
+	~SparseGrid();
+
+	/**
+	   Map a grid file
+	   @param filename the path of the file
+	   @return false if the file can't be mapped or is invalid
+	*/
+	bool Load(const string &filename);
+
+	/**
+	   Convert a dense grid to a sparse grid file
+	   @param filename the path of the file to write
+	   @param nx, ny, nz the dimensions of the grid
+	   @param data the voxel values, x varying fastest
+	   @param background the value of the voxels that aren't stored
+	   @param tolerance the maximum difference with the background value
+	   for a voxel to be considered empty
+	   @return the number of stored bricks or -1 on failure
+	*/
+	static int Write(const string &filename, int nx, int ny, int nz,
+		const float *data, float background = 0.f,
+		float tolerance = 0.f);
+
+	int Nx() const { return nx; }
+	int Ny() const { return ny; }
+	int Nz() const { return nz; }
+	float MinValue() const { return minValue; }
+	float MaxValue() const { return maxValue; }
+	float MeanValue() const { return meanValue; }
+
+	/**
+	   Return the value of a voxel, coordinates are clamped to the grid
+	*/
+	float D(int x, int y, int z) const {
+		x = luxrays::Clamp(x, 0, nx - 1);
+		y = luxrays::Clamp(y, 0, ny - 1);
+		z = luxrays::Clamp(z, 0, nz - 1);
+		const u_int b = Brick(x >> BRICK_SHIFT, y >> BRICK_SHIFT,
+			z >> BRICK_SHIFT);
+		if (b == EMPTY_BRICK)
+			return background;
+		return bricks[static_cast<size_t>(b) * BRICK_VOXELS + Voxel(x, y, z)];
+	}
+
+	/**
+	   Trilinearly interpolate between voxel (vx, vy, vz) and
+	   voxel (vx + 1, vy + 1, vz + 1), coordinates are clamped to the grid.
+	   Lookups falling inside an empty brick don't touch the voxel data.
+	*/
+	float Interpolate(int vx, int vy, int vz,
+		float dx, float dy, float dz) const;
+
+	static const u_int BRICK_SHIFT = 3;
+	static const u_int BRICK_SIZE = 1 << BRICK_SHIFT;
+	static const u_int BRICK_MASK = BRICK_SIZE - 1;
+	static const u_int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+	static const u_int EMPTY_BRICK = 0xffffffffu;
+
+private:
+	u_int Brick(int bx, int by, int bz) const {
+		return index[(static_cast<size_t>(bz) * bny + by) * bnx + bx];
+	}
+	static u_int Voxel(int x, int y, int z) {
+		return (((z & BRICK_MASK) << BRICK_SHIFT) +
+			(y & BRICK_MASK)) * BRICK_SIZE + (x & BRICK_MASK);
+	}
+
+	boost::iostreams::mapped_file_source file;
+	const u_int *index;
+	const float *bricks;
+	int nx, ny, nz, bnx, bny, bnz;
+	float background, minValue, maxValue, meanValue;
+};
+
+}//namespace lux
+
+#endif // LUX_SPARSEGRID_H
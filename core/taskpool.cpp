@@ -0,0 +1,396 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// taskpool.cpp*
+#include "taskpool.h"
+#include "timer.h"
+#include "error.h"
+#include "osfunc.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/once.hpp>
+
+using namespace lux;
+
+static TaskPool *globalPool = NULL;
+static u_int globalThreadCount = 0;
+static boost::once_flag globalPoolFlag = BOOST_ONCE_INIT;
+static boost::mutex globalPoolMutex;
+static boost::mutex globalResizeMutex;
+
+boost::mutex TaskPool::timingMutex;
+boost::shared_ptr<TaskPool::TimingHook> TaskPool::timingHook;
+u_int TaskPool::timingVersion = 0;
+u_int TaskPool::timingEnabled = 0;
+
+void TaskPool::CreateGlobal()
+{
+	boost::mutex::scoped_lock lock(globalPoolMutex);
+	// The pool is never deleted, its workers may still be waiting for
+	// tasks when the process exits
+	globalPool = new TaskPool(globalThreadCount);
+}
+
+TaskPool &TaskPool::Global()
+{
+	boost::call_once(&TaskPool::CreateGlobal, globalPoolFlag);
+	return *globalPool;
+}
+
+void TaskPool::SetThreadCount(u_int count)
+{
+	{
+		boost::mutex::scoped_lock lock(globalPoolMutex);
+		globalThreadCount = count;
+		if (!globalPool)
+			return;
+	}
+	boost::mutex::scoped_lock resizeLock(globalResizeMutex);
+	TaskPool &pool(Global());
+	const u_int nThreads = count > 0 ? count :
+		max(1u, boost::thread::hardware_concurrency());
+	if (nThreads == pool.GetThreadCount())
+		return;
+	pool.Stop();
+	pool.Start(count);
+}
+
+TaskPool::TaskPool(u_int count) : threadCount(0),
+	currentWorker(&TaskPool::NoCleanup), nQueued(0), paused(false),
+	stopping(false)
+{
+	Start(count);
+}
+
+TaskPool::~TaskPool()
+{
+	Stop();
+}
+
+void TaskPool::Start(u_int count)
+{
+	const u_int nThreads = count > 0 ? count :
+		max(1u, boost::thread::hardware_concurrency());
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		stopping = false;
+	}
+	{
+		boost::unique_lock<boost::shared_mutex> lock(workersMutex);
+		for (u_int i = 0; i < nThreads; ++i)
+			workers.push_back(new Worker(this));
+	}
+	threadCount = nThreads;
+	for (u_int i = 0; i < nThreads; ++i)
+		threads.push_back(new boost::thread(boost::bind(
+			&TaskPool::WorkerLoop, this, workers[i])));
+	LOG(LUX_DEBUG, LUX_NOERROR) << "Task pool started with " <<
+		nThreads << " threads";
+}
+
+void TaskPool::Stop()
+{
+	// The workers only leave once all the queued tasks have been run,
+	// the tasks submitted afterwards wait in the shared queue
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		stopping = true;
+		wakeup.notify_all();
+	}
+	for (u_int i = 0; i < threads.size(); ++i) {
+		threads[i]->join();
+		delete threads[i];
+	}
+	threads.clear();
+	// Threads helping a TaskGroup may still be looking for tasks to steal
+	boost::unique_lock<boost::shared_mutex> lock(workersMutex);
+	for (u_int i = 0; i < workers.size(); ++i)
+		delete workers[i];
+	workers.clear();
+}
+
+void TaskPool::Pause()
+{
+	boost::mutex::scoped_lock lock(mutex);
+	paused = true;
+}
+
+void TaskPool::Resume()
+{
+	boost::mutex::scoped_lock lock(mutex);
+	paused = false;
+	for (u_int i = 0; i < waiting.size(); ++i) {
+		boost::mutex::scoped_lock groupLock(waiting[i]->mutex);
+		waiting[i]->resumed = true;
+		waiting[i]->condition.notify_all();
+	}
+	waiting.clear();
+	wakeup.notify_all();
+}
+
+bool TaskPool::IsPaused()
+{
+	boost::mutex::scoped_lock lock(mutex);
+	return paused;
+}
+
+void TaskPool::SetTimingHook(const TimingHook &hook)
+{
+	boost::shared_ptr<TimingHook> newHook;
+	if (hook)
+		newHook.reset(new TimingHook(hook));
+	boost::mutex::scoped_lock lock(timingMutex);
+	timingHook = newHook;
+	osAtomicWrite(&timingEnabled, newHook ? 1 : 0);
+	osAtomicInc(&timingVersion);
+}
+
+void TaskPool::Push(const Entry &entry)
+{
+	Worker *worker = currentWorker.get();
+	if (worker && worker->pool == this) {
+		boost::mutex::scoped_lock lock(worker->mutex);
+		worker->tasks.push_back(entry);
+	}
+	boost::mutex::scoped_lock lock(mutex);
+	if (!worker || worker->pool != this)
+		shared.push_back(entry);
+	++nQueued;
+	wakeup.notify_one();
+}
+
+bool TaskPool::Pop(Entry &entry)
+{
+	// Most recent task of the current worker first, it is the most likely
+	// to still have its data in cache
+	Worker *own = currentWorker.get();
+	if (own && own->pool == this) {
+		boost::mutex::scoped_lock lock(own->mutex);
+		if (!own->tasks.empty()) {
+			entry = own->tasks.back();
+			own->tasks.pop_back();
+			boost::mutex::scoped_lock poolLock(mutex);
+			--nQueued;
+			return true;
+		}
+	}
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		if (!shared.empty()) {
+			entry = shared.front();
+			shared.pop_front();
+			--nQueued;
+			return true;
+		}
+		if (nQueued <= 0)
+			return false;
+	}
+	// Steal the oldest task of another worker, it is the most likely to
+	// spawn many other tasks
+	boost::shared_lock<boost::shared_mutex> workersLock(workersMutex);
+	const u_int nWorkers = workers.size();
+	const u_int first = own ? std::find(workers.begin(), workers.end(),
+		own) - workers.begin() : 0;
+	for (u_int i = 1; i <= nWorkers; ++i) {
+		Worker *victim = workers[(first + i) % nWorkers];
+		if (victim == own)
+			continue;
+		boost::mutex::scoped_lock lock(victim->mutex);
+		if (!victim->tasks.empty()) {
+			entry = victim->tasks.front();
+			victim->tasks.pop_front();
+			boost::mutex::scoped_lock poolLock(mutex);
+			--nQueued;
+			return true;
+		}
+	}
+	return false;
+}
+
+const TaskPool::TimingHook *TaskPool::GetTimingHook(
+	boost::shared_ptr<TimingHook> &hook)
+{
+	// Workers keep their own copy so that the tasks don't all contend
+	// for the timing mutex
+	Worker *worker = currentWorker.get();
+	if (worker && worker->pool == this) {
+		if (worker->timingVersion != osAtomicRead(&timingVersion)) {
+			boost::mutex::scoped_lock lock(timingMutex);
+			worker->timingHook = timingHook;
+			worker->timingVersion = timingVersion;
+		}
+		return worker->timingHook.get();
+	}
+	if (!osAtomicRead(&timingEnabled))
+		return NULL;
+	boost::mutex::scoped_lock lock(timingMutex);
+	hook = timingHook;
+	return hook.get();
+}
+
+void TaskPool::Execute(Entry &entry)
+{
+	// The hook may be changed while the task runs
+	boost::shared_ptr<TimingHook> sharedHook;
+	const TimingHook *hook = GetTimingHook(sharedHook);
+	// The group must be told even if the task fails
+	try {
+		if (hook) {
+			Timer timer;
+			timer.Start();
+			entry.task();
+			timer.Stop();
+			(*hook)(entry.name, timer.Time());
+		} else
+			entry.task();
+	} catch (...) {
+		entry.group->Fail(boost::current_exception());
+	}
+	entry.group->Done();
+}
+
+void TaskPool::WorkerLoop(Worker *worker)
+{
+	currentWorker.reset(worker);
+	for (;;) {
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			// The queued tasks are still run when stopping, even if
+			// the pool is paused, so that no group is left waiting
+			while (!stopping && (paused || nQueued <= 0))
+				wakeup.wait(lock);
+			if (stopping && nQueued <= 0)
+				break;
+		}
+		Entry entry;
+		if (Pop(entry))
+			Execute(entry);
+	}
+	currentWorker.reset();
+}
+
+void TaskGroup::Run(const TaskPool::Task &task, const char *name)
+{
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		++pending;
+	}
+	TaskPool::Entry entry;
+	entry.task = task;
+	entry.group = this;
+	entry.name = name;
+	pool.Push(entry);
+}
+
+void TaskGroup::Wait()
+{
+	Join();
+	boost::exception_ptr e;
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		e = error;
+		error = boost::exception_ptr();
+	}
+	if (e)
+		boost::rethrow_exception(e);
+}
+
+void TaskGroup::Join()
+{
+	for (;;) {
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			if (pending == 0)
+				return;
+		}
+		// A paused pool doesn't run tasks on waiting threads either,
+		// Resume() wakes up the groups it finds registered
+		bool paused;
+		{
+			boost::mutex::scoped_lock lock(pool.mutex);
+			paused = pool.paused;
+			if (paused)
+				pool.waiting.push_back(this);
+		}
+		if (paused) {
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				while (pending > 0 && !resumed)
+					condition.wait(lock);
+				resumed = false;
+			}
+			boost::mutex::scoped_lock lock(pool.mutex);
+			pool.waiting.erase(std::remove(pool.waiting.begin(),
+				pool.waiting.end(), this), pool.waiting.end());
+			continue;
+		}
+		// Help with the pending tasks, they may be the ones of this group
+		TaskPool::Entry entry;
+		if (pool.Pop(entry)) {
+			pool.Execute(entry);
+			continue;
+		}
+		// The remaining tasks of the group are running on other threads
+		boost::mutex::scoped_lock lock(mutex);
+		while (pending > 0)
+			condition.wait(lock);
+		return;
+	}
+}
+
+void TaskGroup::Fail(const boost::exception_ptr &e)
+{
+	// Only the first failure is reported
+	boost::mutex::scoped_lock lock(mutex);
+	if (!error)
+		error = e;
+}
+
+void TaskGroup::Done()
+{
+	boost::mutex::scoped_lock lock(mutex);
+	if (--pending == 0)
+		condition.notify_all();
+}
+
+void lux::ParallelFor(u_int begin, u_int end, u_int grain,
+	const boost::function<void (u_int, u_int)> &body, const char *name)
+{
+	if (begin >= end)
+		return;
+	TaskPool &pool(TaskPool::Global());
+	const u_int count = end - begin;
+	if (grain == 0)
+		grain = max(1u, count / (4 * pool.GetThreadCount()));
+	if (count <= grain || pool.GetThreadCount() <= 1 || pool.IsPaused()) {
+		body(begin, end);
+		return;
+	}
+	TaskGroup group(pool);
+	for (u_int first = begin; first < end; ) {
+		const u_int last = first + min(grain, end - first);
+		group.Run(boost::bind(body, first, last), name);
+		first = last;
+	}
+	group.Wait();
+}
@@ -0,0 +1,207 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_TASKPOOL_H
+#define LUX_TASKPOOL_H
+// taskpool.h*
+#include "lux.h"
+
+#include <deque>
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace lux
+{
+
+class TaskGroup;
+
+/**
+   Process wide pool of worker threads running short tasks.
+   Each worker owns a deque of tasks: it pushes and pops its own tasks at
+   the back while the idle workers steal the oldest tasks at the front of
+   the other deques. The tasks submitted from threads outside of the pool
+   go to a shared queue.
+   Waiting on a TaskGroup runs the pending tasks instead of blocking so
+   task groups and parallel loops can be nested.
+   A paused pool doesn't start any task, its workers and the threads
+   waiting on a TaskGroup sleep until it is resumed.
+   Long running loops like the render threads don't belong in the pool,
+   they would keep workers away from the other tasks.
+*/
+class TaskPool : public boost::noncopyable {
+public:
+	typedef boost::function<void ()> Task;
+	/**
+	   Called after each task with the name it was given and its run time
+	   in seconds
+	*/
+	typedef boost::function<void (const char *, double)> TimingHook;
+
+	/**
+	   Return the pool shared by the whole process, its workers are
+	   started on first use
+	*/
+	static TaskPool &Global();
+	/**
+	   Set the number of workers of the global pool, 0 for one per core.
+	   The queued tasks are run by the old workers before they are
+	   replaced.
+	*/
+	static void SetThreadCount(u_int count);
+
+	u_int GetThreadCount() const { return threadCount; }
+
+	/**
+	   Stop starting tasks, the running tasks complete normally
+	*/
+	void Pause();
+	void Resume();
+	bool IsPaused();
+
+	/**
+	   Set the hook called after each task of all the pools, an empty
+	   hook disables the timing
+	*/
+	static void SetTimingHook(const TimingHook &hook);
+
+private:
+	friend class TaskGroup;
+
+	struct Entry {
+		Task task;
+		TaskGroup *group;
+		const char *name;
+	};
+	struct Worker {
+		Worker(TaskPool *p) : pool(p), timingVersion(0) { }
+
+		TaskPool *pool;
+		boost::mutex mutex;
+		std::deque<Entry> tasks;
+		// Copy of the timing hook, refreshed when its version changes
+		u_int timingVersion;
+		boost::shared_ptr<TimingHook> timingHook;
+	};
+
+	TaskPool(u_int count);
+	~TaskPool();
+
+	static void CreateGlobal();
+
+	void Start(u_int count);
+	void Stop();
+	void Push(const Entry &entry);
+	bool Pop(Entry &entry);
+	void Execute(Entry &entry);
+	const TimingHook *GetTimingHook(boost::shared_ptr<TimingHook> &hook);
+	void WorkerLoop(Worker *worker);
+
+	static void NoCleanup(Worker *) { }
+
+	// The workers are only replaced while holding workersMutex exclusively
+	boost::shared_mutex workersMutex;
+	vector<Worker *> workers;
+	vector<boost::thread *> threads;
+	u_int threadCount;
+	// The worker of the current thread, NULL outside of the pools
+	boost::thread_specific_ptr<Worker> currentWorker;
+
+	// Protects the shared queue, the queued count, the state flags and
+	// the groups waiting for the pool to be resumed
+	boost::mutex mutex;
+	boost::condition_variable wakeup;
+	std::deque<Entry> shared;
+	int nQueued;
+	bool paused, stopping;
+	vector<TaskGroup *> waiting;
+
+	// The hook is only read under timingMutex when its version changes
+	static boost::mutex timingMutex;
+	static boost::shared_ptr<TimingHook> timingHook;
+	static u_int timingVersion, timingEnabled;
+};
+
+/**
+   A set of tasks run by a TaskPool that can be waited for.
+   The tasks can themselves run task groups.
+*/
+class TaskGroup : public boost::noncopyable {
+public:
+	TaskGroup(TaskPool &p = TaskPool::Global()) : pool(p), pending(0),
+		resumed(false) { }
+	~TaskGroup() { Join(); }
+
+	/**
+	   Queue a task in the pool
+	   @param task the task to run
+	   @param name the name given to the timing hook, it must outlive the
+	   task
+	*/
+	void Run(const TaskPool::Task &task, const char *name = NULL);
+	/**
+	   Run pending tasks of the pool until all the tasks of the group are
+	   done. The first exception thrown by a task of the group is thrown
+	   again once all the tasks are done.
+	*/
+	void Wait();
+
+private:
+	friend class TaskPool;
+
+	void Join();
+	void Fail(const boost::exception_ptr &e);
+	void Done();
+
+	TaskPool &pool;
+	boost::mutex mutex;
+	boost::condition_variable condition;
+	u_int pending;
+	// Set by TaskPool::Resume() to wake up a group waiting on a paused pool
+	bool resumed;
+	boost::exception_ptr error;
+};
+
+/**
+   Run body over [begin, end) split in ranges of grain items, the ranges
+   are run concurrently by the global pool
+   @param begin the first item
+   @param end the item after the last one
+   @param grain the number of items of each range, 0 to split the items
+   in a few ranges per worker
+   @param body called with the first and last + 1 items of each range
+   @param name the name given to the timing hook
+   The ranges are run by the calling thread when the pool is paused.
+*/
+void ParallelFor(u_int begin, u_int end, u_int grain,
+	const boost::function<void (u_int, u_int)> &body,
+	const char *name = NULL);
+
+}//namespace lux
+
+#endif // LUX_TASKPOOL_H
@@ -27,6 +27,7 @@
 #include "geometry/transform.h"
 #include "error.h"
 #include "queryable.h"
+#include "rendercounters.h"
 
 namespace lux
 {
@@ -31,7 +31,7 @@
 #define LUX_VERSION 1.5
 #define LUX_VERSION_POSTFIX "dev"
 
-#define LUX_SERVER_PROTOCOL_VERSION 1011
+#define LUX_SERVER_PROTOCOL_VERSION 1016
 
 
 #define LUX_VERSION_STRING    VERSION_STR(LUX_VERSION) LUX_VERSION_POSTFIX
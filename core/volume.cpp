@@ -55,6 +55,7 @@ bool RGBVolume::Scatter(const Sample &sample, bool scatteredStart,
 	const Ray &ray, float u, Intersection *isect, float *pdf,
 	float *pdfBack, SWCSpectrum *L) const
 {
+	LUX_COUNT_TIMED(VOLUME_SCATTERS);
 	// Determine scattering distance
 	const float k = sigS.Filter();
 	const float d = logf(1 - u) / k; //the real distance is ray.mint-d
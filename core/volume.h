@@ -34,6 +34,7 @@ using luxrays::BBox;
 #include "luxrays/core/color/color.h"
 #include "materials/scattermaterial.h"
 #include "queryable.h"
+#include "rendercounters.h"
 
 namespace lux
 {
@@ -98,6 +99,7 @@ public:
 	}
 	virtual SWCSpectrum Tau(const SpectrumWavelengths &sw, const Ray &ray,
 		float step = 1.f, float offset = 0.5f) const {
+		LUX_COUNT_TIMED(VOLUME_TAUS);
 		DifferentialGeometry dg;
 		dg.p = ray.o;
 		dg.nn = Normal(-ray.d);
@@ -236,6 +238,7 @@ public:
 	}
 	virtual SWCSpectrum Tau(const SpectrumWavelengths &sw, const Ray &r,
 		float stepSize, float offset) const {
+		LUX_COUNT_TIMED(VOLUME_TAUS);
 		const float length = r.d.Length();
 		if (!(length > 0.f))
 			return SWCSpectrum(0.f);
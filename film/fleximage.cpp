@@ -60,15 +60,17 @@ FlexImageFilm::FlexImageFilm(u_int xres, u_int yres, Filter *filt, u_int filtRes
 	float p_ReinhardBurn, float p_LinearSensitivity, float p_LinearExposure, float p_LinearFStop, float p_LinearGamma,
 	float p_ContrastYwa, int p_FalseMethod, int p_FalseColorScale, float p_FalseMaxSat, float p_FalseMinSat, const string &p_response, float p_Gamma,
 	const float cs_red[2], const float cs_green[2], const float cs_blue[2], const float whitepoint[2],
-	bool debugmode, int outlierk, int tilec, const double convstep, const string &samplingmapfilename, const bool disableNoiseMapUpd, 
+	bool debugmode, int outlierk, int tilec, const double convstep, float tilehaltthreshold, const string &samplingmapfilename, const bool disableNoiseMapUpd, 
 	bool bloomEnabled, float bloomRadius, float bloomWeight, bool vignettingEnabled, float vignettingScale, bool abberationEnabled, float abberationAmount, 
-	bool glareEnabled, float glareAmount, float glareRadius, int glareBlades, float glareThreshold, const string &pupilmap, const string &lashesmap) :
+	bool glareEnabled, float glareAmount, float glareRadius, int glareBlades, float glareThreshold, const string &pupilmap, const string &lashesmap,
+	const DenoiserParams &denoiser) :
 	Film(xres, yres, filt, filtRes, crop, filename1, premult, cw_EXR_ZBuf || cw_PNG_ZBuf || cw_TGA_ZBuf, w_resume_FLM, 
 		restart_resume_FLM, write_FLM_direct, haltspp, halttime, haltthreshold, debugmode, outlierk, tilec, samplingmapfilename), 
 	framebuffer(NULL), float_framebuffer(NULL), alpha_buffer(NULL), z_buffer(NULL),
 	writeInterval(wI), flmWriteInterval(fwI), displayInterval(dI), convUpdateThread(NULL), convUpdateStep(convstep), disableNoiseMapUpdate(disableNoiseMapUpd)
 {
 	colorSpace = ColorSystem(cs_red[0], cs_red[1], cs_green[0], cs_green[1], cs_blue[0], cs_blue[1], whitepoint[0], whitepoint[1], 1.f);
+	tileHaltThreshold = tilehaltthreshold;
 
 	// Set Image Output parameters
 	clampMethod = d_clampMethod = cM;
@@ -212,6 +214,23 @@ FlexImageFilm::FlexImageFilm(u_int xres, u_int yres, Filter *filt, u_int filtRes
 	m_chiuParams.Reset();
 	d_chiuParams.Reset();
 
+	m_DenoiserEnabled = denoiser.enabled;
+	AddBoolAttribute(*this, "DenoiserEnabled", "Feature guided denoiser enabled", m_DenoiserEnabled, &FlexImageFilm::m_DenoiserEnabled, Queryable::ReadWriteAccess);
+	m_DenoiserRadius = denoiser.radius;
+	AddIntAttribute(*this, "DenoiserRadius", "Denoiser window half size in pixels", &FlexImageFilm::m_DenoiserRadius, Queryable::ReadWriteAccess);
+	m_DenoiserSigmaColor = denoiser.sigmaColor;
+	AddFloatAttribute(*this, "DenoiserSigmaColor", "Denoiser color tolerance relative to the pixel noise", &FlexImageFilm::m_DenoiserSigmaColor, Queryable::ReadWriteAccess);
+	m_DenoiserSigmaAlbedo = denoiser.sigmaAlbedo;
+	AddFloatAttribute(*this, "DenoiserSigmaAlbedo", "Denoiser albedo tolerance", &FlexImageFilm::m_DenoiserSigmaAlbedo, Queryable::ReadWriteAccess);
+	m_DenoiserSigmaNormal = denoiser.sigmaNormal;
+	AddFloatAttribute(*this, "DenoiserSigmaNormal", "Denoiser normal tolerance", &FlexImageFilm::m_DenoiserSigmaNormal, Queryable::ReadWriteAccess);
+	m_DenoiserSigmaDepth = denoiser.sigmaDepth;
+	AddFloatAttribute(*this, "DenoiserSigmaDepth", "Denoiser relative depth tolerance", &FlexImageFilm::m_DenoiserSigmaDepth, Queryable::ReadWriteAccess);
+	// The features are only recorded when the denoiser is enabled at
+	// creation time, otherwise it only uses the pixel colors
+	if (m_DenoiserEnabled)
+		EnableFeatureBuffer();
+
 	m_CameraResponseFile = d_CameraResponseFile = p_response;
 	AddStringAttribute(*this, "CameraResponse", "Path to camera response data file", "", &FlexImageFilm::m_CameraResponseFile, Queryable::ReadWriteAccess);
 	m_CameraResponseEnabled = d_CameraResponseEnabled = m_CameraResponseFile != "";
@@ -223,8 +242,16 @@ FlexImageFilm::FlexImageFilm(u_int xres, u_int yres, Filter *filt, u_int filtRes
 
 void FlexImageFilm::CreateBuffers() {
 	Film::CreateBuffers();
-		
-	if ((haltThreshold >= 0.f) || (noiseAwareMap && !disableNoiseMapUpdate)) {
+
+	// Retired tiles are only skipped by the noise-aware samplers, the
+	// other ones would keep sampling them
+	if ((tileHaltThreshold > 0.f) && !noiseAwareMap) {
+		LOG(LUX_WARNING, LUX_CONSISTENCY) << "'tilehaltthreshold' requires a noise-aware sampler, parameter ignored";
+		tileHaltThreshold = -1.f;
+	}
+
+	if ((haltThreshold >= 0.f) || (noiseAwareMap && !disableNoiseMapUpdate) ||
+		(tileHaltThreshold > 0.f)) {
 		// Start the convergence test/noise-aware map update thread
 		convUpdateThread = new boost::thread(boost::bind(FlexImageFilm::ConvUpdateThreadImpl, this, Context::GetActive()));
 	}
@@ -993,13 +1020,13 @@ void FlexImageFilm::CheckWriteOuputInterval()
 	if (!framebuffer) 
 		createFrameBuffer();
 
-	ImageType output = IMAGE_NONE;
-	if (timeToWriteImage)
-		output = static_cast<ImageType>(output | IMAGE_FILEOUTPUT);
-	if (timeToWriteFLM)
-		output = static_cast<ImageType>(output | IMAGE_FLMOUTPUT);
+	// The resume film is compressed and written by a background thread,
+	// the splatting is only locked while the film is copied
+	if (timeToWriteFLM && writeResumeFlm)
+		WriteFilmToFileAsync(filename + ".flm");
 
-	WriteImage(output);
+	if (timeToWriteImage)
+		WriteImage(IMAGE_FILEOUTPUT);
 
 	// WriteImage can take a very long time to be executed (i.e. by saving
 	// the film. It is better to refresh timestamps after the
@@ -1101,6 +1128,19 @@ vector<RGBColor>& FlexImageFilm::ApplyPipeline(const ColorSystem &colorSpace, ve
 		crf = cameraResponse;
 	}
 
+	// Denoise before tonemapping, while the colors are still linear
+	if (m_DenoiserEnabled) {
+		DenoiserParams denoiser;
+		denoiser.enabled = true;
+		denoiser.radius = max(0, m_DenoiserRadius);
+		denoiser.sigmaColor = m_DenoiserSigmaColor;
+		denoiser.sigmaAlbedo = m_DenoiserSigmaAlbedo;
+		denoiser.sigmaNormal = m_DenoiserSigmaNormal;
+		denoiser.sigmaDepth = m_DenoiserSigmaDepth;
+		DenoiseImage(xyzcolor, xPixelCount, yPixelCount, denoiser,
+			featureBuffer, varianceBuffer);
+	}
+
 	// Apply chosen tonemapper
 	ApplyImagingPipeline(xyzcolor, xPixelCount, yPixelCount, m_GREYCStorationParams, m_chiuParams,
 		colorSpace, histogram, m_HistogramEnabled, m_HaveBloomImage, m_bloomImage, m_BloomUpdateLayer,
@@ -1223,13 +1263,18 @@ bool FlexImageFilm::WriteImage2(ImageType type, vector<XYZColor> &xyzcolor, vect
 
 			// Copy to framebuffer pixels
 			if ((type & IMAGE_FRAMEBUFFER) && framebuffer) {
+				// While a progressive preview renders its coarse passes
+				// the display is upsampled from the complete grid, the
+				// float framebuffer is kept as is for the convergence test
+				const u_int stride = previewStride;
 				u_int i = 0;
 				for (u_int y = yPixelStart; y < yPixelStart + yPixelCount; ++y) {
 					for (u_int x = xPixelStart; x < xPixelStart + xPixelCount; ++x) {
 						const u_int offset = 3 * (y * xResolution + x);
-						framebuffer[offset] = static_cast<unsigned char>(Clamp(256 * rgbcolor[i].c[0], 0.f, 255.f));
-						framebuffer[offset + 1] = static_cast<unsigned char>(Clamp(256 * rgbcolor[i].c[1], 0.f, 255.f));
-						framebuffer[offset + 2] = static_cast<unsigned char>(Clamp(256 * rgbcolor[i].c[2], 0.f, 255.f));
+						const RGBColor &c(rgbcolor[stride > 1 ? PreviewPixel(x, y, stride) : i]);
+						framebuffer[offset] = static_cast<unsigned char>(Clamp(256 * c.c[0], 0.f, 255.f));
+						framebuffer[offset + 1] = static_cast<unsigned char>(Clamp(256 * c.c[1], 0.f, 255.f));
+						framebuffer[offset + 2] = static_cast<unsigned char>(Clamp(256 * c.c[2], 0.f, 255.f));
 
 						// Some debug code used to show the convergence map
 						/*if (convergenceDiff.size() > 0)
@@ -1388,6 +1433,7 @@ bool FlexImageFilm::WriteImage(ImageType type)
 		createFrameBuffer();
 
 	ScopedPoolLock poolLock(contribPool);
+	const double lockStart = WallClockTime();
 
 	const u_int nPix = xPixelCount * yPixelCount;
 	vector<XYZColor> pixels(nPix);
@@ -1396,7 +1442,11 @@ bool FlexImageFilm::WriteImage(ImageType type)
 	// NOTE - lordcrc - separated buffer loop into two separate loops
 	// in order to eliminate one of the framebuffer copies
 
-	// write stand-alone buffers
+	// copy stand-alone buffers, they are written once the pool lock
+	// is released
+	vector<vector<XYZColor> > standalonePixels;
+	vector<vector<float> > standaloneAlpha;
+	vector<string> standalonePostfix;
 	for(u_int j = 0; j < bufferGroups.size(); ++j) {
 		if (!bufferGroups[j].enable)
 			continue;
@@ -1407,8 +1457,10 @@ bool FlexImageFilm::WriteImage(ImageType type)
 			if (!(bufferConfigs[i].output & BUF_STANDALONE))
 				continue;
 
-			buffer.GetData(&(pixels[0]), &(alpha[0]));
-			result &= WriteImage2(type, pixels, alpha, bufferConfigs[i].postfix);
+			standalonePixels.push_back(vector<XYZColor>(nPix));
+			standaloneAlpha.push_back(vector<float>(nPix));
+			standalonePostfix.push_back(bufferConfigs[i].postfix);
+			buffer.GetData(&(standalonePixels.back()[0]), &(standaloneAlpha.back()[0]));
 		}
 	}
 
@@ -1477,8 +1529,12 @@ bool FlexImageFilm::WriteImage(ImageType type)
 	}
 
 	// release pool lock before writing output
+	AddWriteLockTime(WallClockTime() - lockStart);
 	poolLock.unlock();
 
+	for (u_int i = 0; i < standalonePixels.size(); ++i)
+		result &= WriteImage2(type, standalonePixels[i], standaloneAlpha[i], standalonePostfix[i]);
+
 	// Update false colors data
 	m_FalseMax = maxVal;
 	m_FalseMin = minVal;
@@ -1747,6 +1803,20 @@ bool FlexImageFilm::WriteEXRImage(vector<RGBColor> &rgb, vector<float> &alpha, c
 		xPixelStart, yPixelStart, zbuf);
 }
 
+u_int FlexImageFilm::PreviewPixel(u_int x, u_int y, u_int stride) const
+{
+	// Snap (x, y) on the preview grid which is aligned on the image
+	// origin, use the next grid line when the crop window starts
+	// in the middle of a grid cell
+	u_int px = x & ~(stride - 1);
+	if (px < xPixelStart)
+		px = min(px + stride, xPixelStart + xPixelCount - 1);
+	u_int py = y & ~(stride - 1);
+	if (py < yPixelStart)
+		py = min(py + stride, yPixelStart + yPixelCount - 1);
+	return (py - yPixelStart) * xPixelCount + px - xPixelStart;
+}
+
 void FlexImageFilm::GetColorspaceParam(const ParamSet &params, const string name, float values[2]) {
 	u_int i;
 	const float *v = params.FindFloat(name, &i);
@@ -1776,6 +1846,7 @@ void FlexImageFilm::ConvUpdateThreadImpl(FlexImageFilm *film, Context *ctx) {
 			film->updateFrameBuffer();
 
 			bool noiseAwareMapUpdated = false;
+			bool tileMaskUpdated = false;
 			{
 				// Lock the frame buffer
 				boost::mutex::scoped_lock(film->write_mutex);
@@ -1788,6 +1859,10 @@ void FlexImageFilm::ConvUpdateThreadImpl(FlexImageFilm *film, Context *ctx) {
 					convergenceInfoUpdated = true;
 				}
 
+				// Retire the converged tiles
+				if (film->tileHaltThreshold > 0.f)
+					tileMaskUpdated = film->UpdateTileConvergence(film->float_framebuffer);
+
 				// Than generate the noise-aware map if required
 				if (film->noiseAwareMap && !film->disableNoiseMapUpdate) {
 					const double sppNoiseAwareDelta = (totalSamplesCount - lastCheckNoiseAwarwSamplesCount) / nPix;
@@ -1811,6 +1886,8 @@ void FlexImageFilm::ConvUpdateThreadImpl(FlexImageFilm *film, Context *ctx) {
 			// Outside the film lock, send the new map to all network slaves
 			if (noiseAwareMapUpdated)
 				ctx->UpdateNetworkNoiseAwareMap();
+			if (tileMaskUpdated)
+				ctx->UpdateNetworkTileMask();
 		}
 	}
 }
@@ -1990,6 +2067,8 @@ Film* FlexImageFilm::CreateFilm(const ParamSet &params, Filter *filter)
 	const int halttime = params.FindOneInt("halttime", -1);
 	const float haltthreshold = params.FindOneFloat("haltthreshold", -1.f);
 	const double convUpdateStep = max(4.0, (double)params.FindOneFloat("convergencestep", 32.f));
+	// Retire the tiles changing less than this between two convergence steps
+	const float tileHaltThreshold = params.FindOneFloat("tilehaltthreshold", -1.f);
 	// This flag is used by network slaves and it is not intended to be used directly in .lxs files
 	const bool disableNoiseMapUpdate = params.FindOneBool("disable_noisemap_update", false);
 
@@ -2096,6 +2175,15 @@ Film* FlexImageFilm::CreateFilm(const ParamSet &params, Filter *filter)
 	string s_GlareLashesFilename = params.FindOneString("glarelashesfilename", "");
 	string s_GlarePupilFilename = params.FindOneString("glarepupilfilename", "");
 
+	// Feature guided denoiser
+	DenoiserParams denoiser;
+	denoiser.enabled = params.FindOneBool("denoiser_enabled", false);
+	denoiser.radius = max(0, params.FindOneInt("denoiser_radius", denoiser.radius));
+	denoiser.sigmaColor = params.FindOneFloat("denoiser_sigma_color", denoiser.sigmaColor);
+	denoiser.sigmaAlbedo = params.FindOneFloat("denoiser_sigma_albedo", denoiser.sigmaAlbedo);
+	denoiser.sigmaNormal = params.FindOneFloat("denoiser_sigma_normal", denoiser.sigmaNormal);
+	denoiser.sigmaDepth = params.FindOneFloat("denoiser_sigma_depth", denoiser.sigmaDepth);
+
 	return new FlexImageFilm(xres, yres, filter, filtRes, crop,
 		filename, premultiplyAlpha, writeInterval, flmWriteInterval, displayInterval, clampMethod, 
 		w_EXR, w_EXR_channels, w_EXR_halftype, w_EXR_compressiontype, w_EXR_applyimaging, w_EXR_gamutclamp, w_EXR_ZBuf, w_EXR_ZBuf_normalizationtype, w_EXR_straightcolors,
@@ -2104,13 +2192,14 @@ Film* FlexImageFilm::CreateFilm(const ParamSet &params, Filter *filter)
 		w_resume_FLM, restart_resume_FLM, w_FLM_direct, haltspp, halttime, haltthreshold,
 		s_TonemapKernel, s_ReinhardPreScale, s_ReinhardPostScale, s_ReinhardBurn, s_LinearSensitivity,
 		s_LinearExposure, s_LinearFStop, s_LinearGamma, s_ContrastYwa, s_FalseMethod, s_FalseScalecolor, s_FalseMaxSat, s_FalseMinSat, response, s_Gamma,
-		red, green, blue, white, debug_mode, outlierrejection_k, tilecount, convUpdateStep, samplingmapfilename, disableNoiseMapUpdate,
+		red, green, blue, white, debug_mode, outlierrejection_k, tilecount, convUpdateStep, tileHaltThreshold, samplingmapfilename, disableNoiseMapUpdate,
 		bloomEnabled, bloomRadius, bloomWeight, vignettingEnabled, vignettingScale, abberationEnabled, abberationAmount, 
-		glareEnabled, glareAmount, glareRadius, glareBlades, glareThreshold, s_GlarePupilFilename, s_GlareLashesFilename);
+		glareEnabled, glareAmount, glareRadius, glareBlades, glareThreshold, s_GlarePupilFilename, s_GlareLashesFilename,
+		denoiser);
 }
 
 
-Film *FlexImageFilm::CreateFilmFromFLM(const string& flmFileName) {
+Film *FlexImageFilm::CreateFilmFromFLM(const string& flmFileName, bool loadData) {
 
 	// NOTE - lordcrc - FlexImageFilm takes ownership of filter
 	ParamSet dummyParams;
@@ -2124,7 +2213,8 @@ Film *FlexImageFilm::CreateFilmFromFLM(const string& flmFileName) {
 	filmParams.AddString("filename", &filename );
 	//filmParams.AddInt("xresolution", 1);
 	//filmParams.AddInt("yresolution", 1);
-	filmParams.AddBool("write_resume_flm", &boolTrue);
+	// The buffers are only loaded when the resume film is enabled
+	filmParams.AddBool("write_resume_flm", loadData ? &boolTrue : &boolFalse);
 	filmParams.AddBool("restart_resume_flm", &boolFalse);
 	filmParams.AddBool("write_flm_direct", &boolFalse);
 	filmParams.AddBool("write_exr", &boolFalse);
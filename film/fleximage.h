@@ -53,9 +53,10 @@ public:
 		float p_ReinhardBurn, float p_LinearSensitivity, float p_LinearExposure, float p_LinearFStop, float p_LinearGamma,
 		float p_ContrastDisplayAdaptionY, int p_FalseMethod, int p_FalseColorScale, float p_FalseMaxSat, float p_FalseMinSat, const string &response, float p_Gamma,
 		const float cs_red[2], const float cs_green[2], const float cs_blue[2], const float whitepoint[2],
-		bool debugmode, int outlierk, int tilecount, const double convstep, const string &samplingmapfilename, const bool disableNoiseMapUpd,
+		bool debugmode, int outlierk, int tilecount, const double convstep, float tilehaltthreshold, const string &samplingmapfilename, const bool disableNoiseMapUpd,
 		bool bloomEnabled, float bloomRadius, float bloomWeight, bool vignettingEnabled, float vignettingScale, bool abberationEnabled, float abberationAmount, 
-		bool glareEnabled, float glareAmount, float glareRadius, int glareBlades, float glareThreshold, const string &pupilmap, const string &lashesmap);
+		bool glareEnabled, float glareAmount, float glareRadius, int glareBlades, float glareThreshold, const string &pupilmap, const string &lashesmap,
+		const DenoiserParams &denoiser);
 
 	virtual ~FlexImageFilm() {
 		if (convUpdateThread) {
@@ -82,7 +83,11 @@ public:
 	virtual float* getAlphaBuffer();
 	virtual float* getZBuffer();
 	virtual void createFrameBuffer();
-	virtual int getldrDisplayInterval() { return displayInterval; }
+	// Refresh the display at least every second while the coarse passes
+	// of a progressive preview are rendered
+	virtual int getldrDisplayInterval() {
+		return previewStride > 1 ? min(displayInterval, 1) : displayInterval;
+	}
 
 	// Parameter Access functions
 	virtual void SetParameterValue(luxComponentParameters param, double value, u_int index);
@@ -96,8 +101,9 @@ public:
 	/**
 	 * Constructs an image film that loads its data from the give FLM file. This film is already initialized with
 	 * the necessary buffers. This is currently only used for loading and tonemapping an existing FLM file.
+	 * If loadData is false, only the header is read and the buffers are left empty.
 	 */
-	static Film *CreateFilmFromFLM(const string &flmFileName);
+	static Film *CreateFilmFromFLM(const string &flmFileName, bool loadData = true);
 
 private:
 	static void GetColorspaceParam(const ParamSet &params, const string name, float values[2]);
@@ -108,6 +114,7 @@ private:
 	bool WriteTGAImage(vector<RGBColor> &rgb, vector<float> &alpha, const string &filename);
 	bool WritePNGImage(vector<RGBColor> &rgb, vector<float> &alpha, const string &filename);
 	bool WriteEXRImage(vector<RGBColor> &rgb, vector<float> &alpha, const string &filename, vector<float> &zbuf);
+	u_int PreviewPixel(u_int x, u_int y, u_int stride) const;
 
 	// FlexImageFilm Private Data
 	// mutex is used for protecting the framebuffer pointer
@@ -167,6 +174,12 @@ private:
 	GREYCStorationParams m_GREYCStorationParams, d_GREYCStorationParams;
 	ChiuParams m_chiuParams, d_chiuParams;
 
+	// Feature guided denoiser, flattened for the Queryable attributes
+	bool m_DenoiserEnabled;
+	int m_DenoiserRadius;
+	float m_DenoiserSigmaColor, m_DenoiserSigmaAlbedo;
+	float m_DenoiserSigmaNormal, m_DenoiserSigmaDepth;
+
 	bool m_CameraResponseEnabled, d_CameraResponseEnabled;
 	string m_CameraResponseFile, d_CameraResponseFile; // Path to the data file
 	boost::shared_ptr<CameraResponse> cameraResponse; // Actual data processor
@@ -26,6 +26,7 @@
 #include "bxdf.h"
 #include "light.h"
 #include "camera.h"
+#include "film.h"
 #include "paramset.h"
 #include "dynload.h"
 #include "path.h"
@@ -39,6 +40,24 @@ using namespace lux;
 
 static const u_int passThroughLimit = 10000;
 
+// Records the first hit albedo, shading normal and depth used to guide the
+// film denoiser, a NULL bsdf records a miss
+static void AddFirstHitFeatures(const Sample &sample, float xi, float yi,
+	const BSDF *bsdf, const Vector &wo, float distance)
+{
+	Film *film = sample.camera->film;
+	if (!film->HasFeatureBuffer())
+		return;
+
+	if (bsdf)
+		film->AddFeatures(xi, yi,
+			XYZColor(sample.swl, bsdf->rho(sample.swl, wo)),
+			bsdf->dgShading.nn, distance);
+	else
+		film->AddFeatures(xi, yi, XYZColor(0.f),
+			Normal(0.f, 0.f, 0.f), 0.f);
+}
+
 // PathIntegrator Method Definitions
 void PathIntegrator::RequestSamples(Sampler *sampler, const Scene &scene)
 {
@@ -128,6 +147,8 @@ u_int PathIntegrator::Li(const Scene &scene, const Sample &sample) const
 		if (!scene.Intersect(sample, volume, scattered, ray, data[3], &isect,
 			&bsdf, &spdf, NULL, &pathThroughput)) {
 			pathThroughput /= spdf;
+			if (pathLength == 0)
+				AddFirstHitFeatures(sample, xi, yi, NULL, -ray.d, 0.f);
 			// Dade - now I know ray.maxt and I can call volumeIntegrator
 			SWCSpectrum Lv;
 			u_int g = scene.volumeIntegrator->Li(scene, ray, sample,
@@ -163,6 +184,9 @@ u_int PathIntegrator::Li(const Scene &scene, const Sample &sample) const
 		if (vertexIndex == 0) {
 			distance = ray.maxt * ray.d.Length();
 		}
+		if (pathLength == 0)
+			AddFirstHitFeatures(sample, xi, yi, bsdf, -ray.d,
+				ray.maxt * ray.d.Length());
 
 		SWCSpectrum Lv;
 		const u_int g = scene.volumeIntegrator->Li(scene, ray, sample,
@@ -585,6 +609,10 @@ bool PathIntegrator::NextState(const Scene &scene, SurfaceIntegratorState *s, lu
 	if (!scene.Intersect(pathState->sample, pathState->volume, pathState->GetScattered(),
 		pathState->pathRay, *rayHit, data[3], &isect, &bsdf, &spdf, NULL,
 		&pathState->pathThroughput)) {
+		if (pathState->pathLength == 0)
+			AddFirstHitFeatures(pathState->sample, pathState->xi,
+				pathState->yi, NULL, -pathState->pathRay.d, 0.f);
+
 		// Stop path sampling since no intersection was found
 		// Possibly add horizon in render & reflections
 		if ((includeEnvironment || pathState->vertexIndex > 0)) {
@@ -624,6 +652,10 @@ bool PathIntegrator::NextState(const Scene &scene, SurfaceIntegratorState *s, lu
 	pathState->bouncePdf *= spdf;
 	if (pathState->vertexIndex == 0)
 		pathState->distance = pathState->pathRay.maxt * pathState->pathRay.d.Length();
+	if (pathState->pathLength == 0)
+		AddFirstHitFeatures(pathState->sample, pathState->xi, pathState->yi,
+			bsdf, -pathState->pathRay.d,
+			pathState->pathRay.maxt * pathState->pathRay.d.Length());
 
 	// Possibly add emitted light at path vertex
 	Vector wo(-pathState->pathRay.d);
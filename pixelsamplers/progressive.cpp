@@ -0,0 +1,82 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// progressive.cpp*
+#include "progressive.h"
+#include "error.h"
+#include "dynload.h"
+
+using namespace lux;
+
+// ProgressivePixelSampler Method Definitions
+ProgressivePixelSampler::ProgressivePixelSampler(int xstart, int xend,
+		int ystart, int yend) : previewDone(false) {
+	// fill Pxa array pass by pass, each pass in film pixel order
+	// The coordinates can be negative because of the filter border,
+	// the masks still select the grid aligned on the image origin
+	for (u_int pass = 0; pass < 3; ++pass) {
+		for (int y = ystart; y < yend; ++y) {
+			for (int x = xstart; x < xend; ++x) {
+				const bool coarse = !(x & 3) && !(y & 3);
+				const bool half = !(x & 1) && !(y & 1);
+				if ((pass == 0 && !coarse) ||
+					(pass == 1 && (coarse || !half)) ||
+					(pass == 2 && half))
+					continue;
+				PxLoc px;
+				px.x = x; px.y = y;
+				Pxa.push_back(px);
+			}
+		}
+		if (pass < 2)
+			passEnd[pass] = Pxa.size();
+	}
+	TotalPx = Pxa.size();
+}
+
+u_int ProgressivePixelSampler::GetTotalPixels() {
+	return TotalPx;
+}
+
+bool ProgressivePixelSampler::GetNextPixel(int *xPos, int *yPos, const u_int use_pos) {
+	bool hasMorePixel = true;
+	if(use_pos == TotalPx - 1) {
+		hasMorePixel = false;
+		previewDone = true;
+	}
+
+	*xPos = Pxa[use_pos].x;
+	*yPos = Pxa[use_pos].y;
+
+	return hasMorePixel;
+}
+
+u_int ProgressivePixelSampler::GetPreviewStride(const u_int use_pos) const {
+	// The display resolution is the one of the last complete pass:
+	// the 1/4 pass is shown with the 1/16 grid and the full
+	// resolution pass with the 1/4 grid
+	if (previewDone)
+		return 1;
+	return use_pos < passEnd[1] ? 4 : 2;
+}
+
+static DynamicLoader::RegisterPixelSampler<ProgressivePixelSampler> r("progressive");
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// progressive.h*
+#ifndef LUX_PROGRESSIVEPX_H
+#define LUX_PROGRESSIVEPX_H
+
+#include "sampling.h"
+#include "paramset.h"
+#include "film.h"
+
+namespace lux
+{
+
+/**
+   Pixel sampler for interactive previews: the first pass over the image
+   visits one pixel out of 16 (every 4th pixel of every 4th line), the
+   second one the remaining pixels of the 1/4 grid and the last one all
+   the other pixels. The grids are aligned on the image origin so that the
+   film can upsample the coarse passes for display.
+   Once the first pass over the image is complete all the pixels are
+   sampled uniformly like with the linear pixel sampler.
+*/
+class ProgressivePixelSampler : public PixelSampler {
+public:
+	// ProgressivePixelSampler Public Methods
+	ProgressivePixelSampler(int xstart, int xend,
+	          int ystart, int yend);
+	virtual ~ProgressivePixelSampler() { }
+
+	virtual u_int GetTotalPixels();
+	virtual bool GetNextPixel(int *xPos, int *yPos, const u_int usePos);
+	virtual u_int GetPreviewStride(const u_int usePos) const;
+
+	static PixelSampler *CreatePixelSampler(int xstart, int xend, int ystart, int yend) {
+		return new ProgressivePixelSampler(xstart, xend, ystart, yend);
+	}
+
+private:
+	// ProgressivePixelSampler Private Data
+	u_int TotalPx;
+	// End of the 1/16 and 1/4 passes in the pixel cache
+	u_int passEnd[2];
+	// Set once the last pixel of the first pass has been handed out,
+	// shared among threads like renderingDone
+	bool previewDone;
+
+	vector<PxLoc> Pxa; // pixel coordinate cache
+};
+
+}//namespace lux
+
+#endif // LUX_PROGRESSIVEPX_H
@@ -23,10 +23,12 @@
 #ifndef LUX_PYCONTEXT_H
 #define LUX_PYCONTEXT_H
 
+#include <algorithm>
 #include <vector>
 
 #include <boost/assert.hpp>
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/pool/pool.hpp>
 #include <boost/thread.hpp>
 #include <boost/shared_array.hpp>
@@ -40,7 +42,8 @@
 #define	EXTRACT_PARAMETERS(_params) \
 	std::vector<LuxToken> aTokens; \
 	std::vector<LuxPointer> aValues; \
-	int count = getParametersFromPython(_params, aTokens, aValues);
+	PythonBufferViews aBuffers; \
+	int count = getParametersFromPython(_params, aTokens, aValues, aBuffers);
 
 #define PASS_PARAMETERS \
 	count, aTokens.size()>0?&aTokens[0]:0, aValues.size()>0?&aValues[0]:0
@@ -55,8 +58,110 @@ boost::once_flag luxInitFlag = BOOST_ONCE_INIT;
 //The memory pool handles temporary allocations and is freed after each C API Call
 boost::pool<> memoryPool(sizeof(char));
 
+//Holds the views of the parameters passed with the buffer protocol,
+//they are released at the end of the C API call, like the memory pool
+class PythonBufferViews : boost::noncopyable {
+public:
+	PythonBufferViews() { }
+	~PythonBufferViews() {
+		for (size_t i = 0; i < views.size(); ++i) {
+			PyBuffer_Release(views[i]);
+			delete views[i];
+		}
+	}
+
+	Py_buffer *acquire(PyObject *obj) {
+		Py_buffer *view = new Py_buffer;
+		if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+			PyErr_Clear();
+			delete view;
+			return NULL;
+		}
+		views.push_back(view);
+		return view;
+	}
+
+private:
+	std::vector<Py_buffer *> views;
+};
+
+//Converts a buffer of S items to a pool allocated array of D items
+template <class D, class S> D *convertBufferItems(const Py_buffer &view)
+{
+	if (view.itemsize != sizeof(S))
+		return NULL;
+	const Py_ssize_t data_length = view.len / view.itemsize;
+	D *pData = (D *)memoryPool.ordered_malloc(sizeof(D) * std::max<Py_ssize_t>(data_length, 1));
+	const S *pSource = static_cast<const S *>(view.buf);
+	for (Py_ssize_t j = 0; j < data_length; ++j)
+		pData[j] = static_cast<D>(pSource[j]);
+	return pData;
+}
+
+template <class D> D *convertBuffer(const Py_buffer &view, char format)
+{
+	switch (format) {
+		case 'f': return convertBufferItems<D, float>(view);
+		case 'd': return convertBufferItems<D, double>(view);
+		case '?': return convertBufferItems<D, bool>(view);
+		case 'b': return convertBufferItems<D, signed char>(view);
+		case 'B': return convertBufferItems<D, unsigned char>(view);
+		case 'h': return convertBufferItems<D, short>(view);
+		case 'H': return convertBufferItems<D, unsigned short>(view);
+		case 'i': return convertBufferItems<D, int>(view);
+		case 'I': return convertBufferItems<D, unsigned int>(view);
+		case 'l': return convertBufferItems<D, long>(view);
+		case 'L': return convertBufferItems<D, unsigned long>(view);
+		case 'q': return convertBufferItems<D, long long>(view);
+		case 'Q': return convertBufferItems<D, unsigned long long>(view);
+		default: return NULL;
+	}
+}
+
+//Here we pass an object supporting the buffer protocol (numpy arrays, array.array, memoryview...)
+//The data is used in place when it already has the type expected by the token,
+//otherwise it is converted in a single pass without going through python objects
+LuxPointer getBufferParameterFromPython(PyObject *obj, const std::string &tokenString, PythonBufferViews &aBuffers)
+{
+	Py_buffer *view = aBuffers.acquire(obj);
+	if (!view) {
+		LOG(LUX_SEVERE, LUX_CONSISTENCY) << "Passing non contiguous buffer to Python API for '" << tokenString << "' token.";
+		return NULL;
+	}
+
+	// only native and standard single item formats are supported
+	const char *format = view->format ? view->format : "B";
+	if (*format == '@' || *format == '=')
+		++format;
+	if (format[0] == '\0' || format[1] != '\0') {
+		LOG(LUX_SEVERE, LUX_CONSISTENCY) << "Passing unrecognised buffer format '" << view->format << "' to Python API for '" << tokenString << "' token.";
+		return NULL;
+	}
+
+	// the expected item type is given by the token type
+	const std::string typeName(tokenString.substr(0, tokenString.find(' ')));
+	LuxPointer pData;
+	if (typeName == "integer") {
+		if ((*format == 'i' || *format == 'I' || *format == 'l' || *format == 'L') && view->itemsize == sizeof(int))
+			return (LuxPointer)view->buf;
+		pData = (LuxPointer)convertBuffer<int>(*view, *format);
+	} else if (typeName == "bool") {
+		if (*format == '?' && view->itemsize == sizeof(bool))
+			return (LuxPointer)view->buf;
+		pData = (LuxPointer)convertBuffer<bool>(*view, *format);
+	} else {
+		if (*format == 'f' && view->itemsize == sizeof(float))
+			return (LuxPointer)view->buf;
+		pData = (LuxPointer)convertBuffer<float>(*view, *format);
+	}
+
+	if (!pData)
+		LOG(LUX_SEVERE, LUX_CONSISTENCY) << "Passing unrecognised buffer format '" << view->format << "' to Python API for '" << tokenString << "' token.";
+	return pData;
+}
+
 //Here we transform a python list to lux C API parameter lists
-int getParametersFromPython(boost::python::list& pList, std::vector<LuxToken>& aTokens, std::vector<LuxPointer>& aValues )
+int getParametersFromPython(boost::python::list& pList, std::vector<LuxToken>& aTokens, std::vector<LuxPointer>& aValues, PythonBufferViews& aBuffers)
 {
 	boost::python::ssize_t n = boost::python::len(pList);
 
@@ -212,6 +317,14 @@ int getParametersFromPython(boost::python::list& pList, std::vector<LuxToken>& a
 				LOG( LUX_SEVERE,LUX_CONSISTENCY)<< "Passing unrecognised data type '"<<first_item_classname<<"' in list to Python API for '"<<tokenString<<"' token.";
 			}
 		}
+		else if(PyObject_CheckBuffer(parameter_value.ptr()))
+		{
+			LuxPointer pData = getBufferParameterFromPython(parameter_value.ptr(), tokenString, aBuffers);
+			if (pData)
+				aValues.push_back(pData);
+			else
+				aTokens.pop_back();
+		}
 		else
 		{
 			//Unrecognised parameter type : we throw an error
@@ -219,7 +332,7 @@ int getParametersFromPython(boost::python::list& pList, std::vector<LuxToken>& a
 		}
 
 	}
-	return(n);
+	return static_cast<int>(aTokens.size());
 }
 
 int framebuffer_getbuffer(PyObject *exporter, Py_buffer *view, int flags) {
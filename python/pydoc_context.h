@@ -326,7 +326,11 @@ const char * ds_pylux_Context_shape =
 "- plymesh\n"
 "- sphere\n"
 "- trianglemesh\n"
-"- mesh";
+"- mesh\n"
+"Array parameters (P, N, uv, indices...) can be given as lists, tuples or any"
+" contiguous object supporting the buffer protocol (numpy arrays, array.array,"
+" memoryview). float32 and int32 buffers are used without any copy, other"
+" numeric types are converted in a single pass.";
 
 const char * ds_pylux_Context_start =
 "(+) Re-start local rendering threads after a pause()";
@@ -957,7 +957,9 @@ void MainWindow::resumeRender()
 		renderView->reload();
 		histogramwidget->Update();
 
-		m_renderTimer->start(1000*luxGetIntAttribute("film", "displayInterval"));
+		// The first update comes early to show the coarse passes of a
+		// progressive preview, renderTimeout() then adjusts the interval
+		m_renderTimer->start(min(1000*luxGetIntAttribute("film", "displayInterval"), 1000));
 		m_statsTimer->start(1000);
 		m_netTimer->start(10000);
 
@@ -2357,6 +2359,13 @@ void MainWindow::renderTimeout()
 		m_updateThread = new UpdateThread(this);
 		m_updateThread->start();
 	}
+
+	// Refresh the display faster while a progressive preview
+	// renders its coarse passes
+	const int interval = luxGetIntAttribute("film", "previewStride") > 1 ?
+		250 : 1000*luxGetIntAttribute("film", "displayInterval");
+	if (m_renderTimer->isActive() && m_renderTimer->interval() != interval)
+		m_renderTimer->setInterval(interval);
 }
 
 void MainWindow::statsTimeout()
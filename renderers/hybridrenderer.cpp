@@ -114,13 +114,12 @@ static void PreprocessPrimitive(const Primitive *prim, Scene *scene,
 	prim->Tessellate(meshList, primitiveList);
 }
 
-luxrays::DataSet *HybridRenderer::PreprocessGeometry(luxrays::Context *ctx, Scene *scene,
+void HybridRenderer::TessellateGeometry(Scene *scene, vector<luxrays::Mesh *> &meshList,
 			vector<HybridInstancePrimitive *> &allocatedPrims, vector<luxrays::Mesh *> &allocatedMeshes) {
 	// Compile the scene geometries in a LuxRays compatible format
 
 	LOG(LUX_INFO,LUX_NOERROR) << "Tessellating " << scene->primitives.size() << " primitives";
 
-	vector<luxrays::Mesh *> meshList;
 	// To keep track of all primitive mesh lists
 	map<const Primitive *, vector<luxrays::TriangleMesh *> > primMeshLists;
 	map<const Primitive *, vector<const Primitive *> > primTessellatedLists;
@@ -201,6 +200,12 @@ luxrays::DataSet *HybridRenderer::PreprocessGeometry(luxrays::Context *ctx, Scen
 			}
 		}
 	}
+}
+
+luxrays::DataSet *HybridRenderer::PreprocessGeometry(luxrays::Context *ctx, Scene *scene,
+			vector<HybridInstancePrimitive *> &allocatedPrims, vector<luxrays::Mesh *> &allocatedMeshes) {
+	vector<luxrays::Mesh *> meshList;
+	TessellateGeometry(scene, meshList, allocatedPrims, allocatedMeshes);
 
 	if (meshList.empty())
 		return NULL;
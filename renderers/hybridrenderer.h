@@ -177,6 +177,11 @@ private:
 
 class HybridRenderer : public Renderer {
 public:
+	// Tessellates the scene primitives, meshList[i] is the geometry of
+	// scene->tessellatedPrimitives[i]
+	static void TessellateGeometry(Scene *scene, vector<luxrays::Mesh *> &meshList,
+			// Used later to free allocated memory
+			vector<HybridInstancePrimitive *> &allocatedPrims, vector<luxrays::Mesh *> &allocatedMeshes);
 	static luxrays::DataSet *PreprocessGeometry(luxrays::Context *ctx, Scene *scene,
 			// Used later to free allocated memory
 			vector<HybridInstancePrimitive *> &allocatedPrims, vector<luxrays::Mesh *> &allocatedMeshes);
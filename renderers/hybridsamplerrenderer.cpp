@@ -20,6 +20,7 @@
  *   Lux Renderer website : http://www.luxrender.net                       *
  ***************************************************************************/
 
+#include <algorithm>
 #include <boost/foreach.hpp>
 
 #include "api.h"
@@ -49,10 +50,11 @@ using namespace lux;
 SurfaceIntegratorStateBuffer::SurfaceIntegratorStateBuffer(
 		const Scene &scn, ContributionBuffer *contribBuf,
 		RandomGenerator *rngGen, luxrays::RayBuffer *rayBuf) :
-		scene(scn), integratorState(128) {
+		scene(scn), integratorState(128), firstRayIndex(128, 0) {
 	contribBuffer = contribBuf;
 	rng = rngGen;
 	rayBuffer = rayBuf;
+	nextOrderIndex = 0;
 
 	// Initialize the first set SurfaceIntegratorState
 	for (size_t i = 0; i < integratorState.size(); ++i) {
@@ -81,6 +83,7 @@ void SurfaceIntegratorStateBuffer::GenerateRays() {
 	bool usedAllStates = false;
 	lastStateIndex = firstStateIndex;
 	while (rayBuffer->LeftSpace() > 0) {
+		firstRayIndex[lastStateIndex] = rayBuffer->GetRayCount();
 		if (!scene.surfaceIntegrator->GenerateRays(scene, integratorState[lastStateIndex], rayBuffer)) {
 			// The RayBuffer is full
 			break;
@@ -109,6 +112,7 @@ void SurfaceIntegratorStateBuffer::GenerateRays() {
 			SurfaceIntegratorState *s = scene.surfaceIntegrator->NewState(scene, contribBuffer, rng);
 			s->Init(scene);
 			integratorState.push_back(s);
+			firstRayIndex.push_back(rayBuffer->GetRayCount());
 			newStateCount++;
 
 			if (!scene.surfaceIntegrator->GenerateRays(scene, s, rayBuffer)) {
@@ -132,26 +136,63 @@ void SurfaceIntegratorStateBuffer::GenerateRays() {
 	}
 }
 
+void SurfaceIntegratorStateBuffer::SortStates() {
+	// Group the states by the mesh hit by their first ray: the states
+	// hitting the same mesh use the same material and textures. Misses
+	// have the largest mesh index and end up last.
+	stateOrder.clear();
+	const size_t rayCount = rayBuffer->GetRayCount();
+	for (size_t i = firstStateIndex; i != lastStateIndex; i = (i + 1) % integratorState.size()) {
+		const u_int meshIndex = (firstRayIndex[i] < rayCount) ?
+			rayBuffer->GetRayHit(firstRayIndex[i])->meshIndex : 0xffffffffu;
+		stateOrder.push_back(std::make_pair(meshIndex, i));
+	}
+	std::sort(stateOrder.begin(), stateOrder.end());
+	nextOrderIndex = 0;
+}
+
+bool SurfaceIntegratorStateBuffer::AdvanceState(size_t i, u_int &nrContribs, u_int &nrSamples) {
+	u_int count;
+	if (scene.surfaceIntegrator->NextState(scene, integratorState[i], rayBuffer, &count)) {
+		// The sample is finished
+		++(nrSamples);
+		nrContribs += count;
+
+		if (!integratorState[i]->Init(scene)) {
+			// We have done
+			return true;
+		}
+	}
+
+	nrContribs += count;
+
+	return false;
+}
+
 bool SurfaceIntegratorStateBuffer::NextState(u_int &nrContribs, u_int &nrSamples) {
 	//----------------------------------------------------------------------
 	// Advance the next step
 	//----------------------------------------------------------------------
 
-	for (size_t i = firstStateIndex; i != lastStateIndex; i = (i + 1) % integratorState.size()) {
-		u_int count;
-		if (scene.surfaceIntegrator->NextState(scene, integratorState[i], rayBuffer, &count)) {
-			// The sample is finished
-			++(nrSamples);
-			nrContribs += count;
-
-			if (!integratorState[i]->Init(scene)) {
-				// We have done
-				firstStateIndex = (i + 1) % integratorState.size();
+	if (!stateOrder.empty()) {
+		// Use the order computed by SortStates()
+		while (nextOrderIndex < stateOrder.size()) {
+			const size_t i = stateOrder[nextOrderIndex++].second;
+			if (AdvanceState(i, nrContribs, nrSamples))
 				return true;
-			}
 		}
 
-		nrContribs += count;
+		stateOrder.clear();
+		firstStateIndex = (lastStateIndex + 1) % integratorState.size();
+
+		return false;
+	}
+
+	for (size_t i = firstStateIndex; i != lastStateIndex; i = (i + 1) % integratorState.size()) {
+		if (AdvanceState(i, nrContribs, nrSamples)) {
+			firstStateIndex = (i + 1) % integratorState.size();
+			return true;
+		}
 	}
 
 	firstStateIndex = (lastStateIndex + 1) % integratorState.size();
@@ -166,7 +207,7 @@ bool SurfaceIntegratorStateBuffer::NextState(u_int &nrContribs, u_int &nrSamples
 HybridSamplerRenderer::HybridSamplerRenderer(const int oclPlatformIndex, bool useGPUs,
 		const u_int forceGPUWorkGroupSize, const string &deviceSelection,
 		const u_int rayBufSize, const u_int stateBufCount,
-		const u_int qbvhStackSize) : HybridRenderer() {
+		const u_int qbvhStackSize, const bool wavefrontMode) : HybridRenderer() {
 	state = INIT;
 
 	if (!IsPowerOf2(rayBufSize)) {
@@ -177,100 +218,111 @@ HybridSamplerRenderer::HybridSamplerRenderer(const int oclPlatformIndex, bool us
 
 	stateBufferCount = stateBufCount;
 
-	// Create the LuxRays context
-	ctx = new luxrays::Context(LuxRaysDebugHandler, oclPlatformIndex);
+	wavefront = wavefrontMode;
+	ctx = NULL;
+	intersectionDevice = NULL;
+	tracer = NULL;
 
 	// Create the device descriptions
 	HRHostDescription *host = new HRHostDescription(this, "Localhost");
 	hosts.push_back(host);
 
-	// Add one virtual device to feed all the OpenCL devices
-	host->AddDevice(new HRVirtualDeviceDescription(host, "VirtualGPU"));
+	if (wavefront) {
+		// The render threads trace their own rays
+		host->AddDevice(new HRVirtualDeviceDescription(host, "CPU"));
+		LOG(LUX_INFO, LUX_NOERROR) << "Wavefront mode, rays are traced by the render threads";
+	} else {
+		// Create the LuxRays context
+		ctx = new luxrays::Context(LuxRaysDebugHandler, oclPlatformIndex);
 
-	// Get the list of devices available
-	std::vector<luxrays::DeviceDescription *> deviceDescs = ctx->GetAvailableDeviceDescriptions();
+		// Add one virtual device to feed all the OpenCL devices
+		host->AddDevice(new HRVirtualDeviceDescription(host, "VirtualGPU"));
 
-	// Add all the OpenCL devices
-	for (size_t i = 0; i < deviceDescs.size(); ++i)
-		host->AddDevice(new HRHardwareDeviceDescription(host, deviceDescs[i]));
+		// Get the list of devices available
+		std::vector<luxrays::DeviceDescription *> deviceDescs = ctx->GetAvailableDeviceDescriptions();
 
-	bool useNative = false;
+		// Add all the OpenCL devices
+		for (size_t i = 0; i < deviceDescs.size(); ++i)
+			host->AddDevice(new HRHardwareDeviceDescription(host, deviceDescs[i]));
 
-	std::vector<luxrays::DeviceDescription *> hwDeviceDescs;
+		bool useNative = false;
 
-	if (useGPUs) {
-		// Find OpenCL GPU devices
-		hwDeviceDescs = deviceDescs;
-		luxrays::DeviceDescription::Filter(luxrays::DEVICE_TYPE_OPENCL_GPU, hwDeviceDescs);
+		std::vector<luxrays::DeviceDescription *> hwDeviceDescs;
+
+		if (useGPUs) {
+			// Find OpenCL GPU devices
+			hwDeviceDescs = deviceDescs;
+			luxrays::DeviceDescription::Filter(luxrays::DEVICE_TYPE_OPENCL_GPU, hwDeviceDescs);
 
 #if !defined(LUXRAYS_DISABLE_OPENCL)
-		if (forceGPUWorkGroupSize > 0) {
-			for (u_int i = 0; i < hwDeviceDescs.size(); ++i) {
-				luxrays::OpenCLDeviceDescription *desc = static_cast<luxrays::OpenCLDeviceDescription *>(hwDeviceDescs[i]);
-				desc->SetForceWorkGroupSize(forceGPUWorkGroupSize);
+			if (forceGPUWorkGroupSize > 0) {
+				for (u_int i = 0; i < hwDeviceDescs.size(); ++i) {
+					luxrays::OpenCLDeviceDescription *desc = static_cast<luxrays::OpenCLDeviceDescription *>(hwDeviceDescs[i]);
+					desc->SetForceWorkGroupSize(forceGPUWorkGroupSize);
+				}
 			}
-		}
 #endif
-	}
-	if (!useGPUs || hwDeviceDescs.size() == 0)
-		useNative = true;
-
-	if (useNative) {
-		if (useGPUs)
-			LOG(LUX_WARNING, LUX_SYSTEM) << "Unable to find an OpenCL GPU device, falling back to CPU";
-
-		// Find native devices
-		hwDeviceDescs = deviceDescs;
-		luxrays::DeviceDescription::Filter(luxrays::DEVICE_TYPE_NATIVE_THREAD, hwDeviceDescs);
-	}
+		}
+		if (!useGPUs || hwDeviceDescs.size() == 0)
+			useNative = true;
 
-	// Create the virtual device to feed all hardware devices
-	if (hwDeviceDescs.size() >= 1) {
-		if (hwDeviceDescs.size() == 1) {
-			// Only one device available
-			intersectionDevice = ctx->AddIntersectionDevices(hwDeviceDescs)[0];
-		} else {
-			// Multiple devices available
+		if (useNative) {
+			if (useGPUs)
+				LOG(LUX_WARNING, LUX_SYSTEM) << "Unable to find an OpenCL GPU device, falling back to CPU";
 
-			// Select the devices to use
-			std::vector<luxrays::DeviceDescription *> selectedDescs;
-			bool haveSelectionString = (deviceSelection.length() > 0);
-			if (haveSelectionString) {
-				if (deviceSelection.length() != hwDeviceDescs.size()) {
-					LOG(LUX_WARNING, LUX_MISSINGDATA) << "Device selection string has the wrong length, must be " <<
-							hwDeviceDescs.size() << " instead of " << deviceSelection.length() << ", ignored";
+			// Find native devices
+			hwDeviceDescs = deviceDescs;
+			luxrays::DeviceDescription::Filter(luxrays::DEVICE_TYPE_NATIVE_THREAD, hwDeviceDescs);
+		}
 
+		// Create the virtual device to feed all hardware devices
+		if (hwDeviceDescs.size() >= 1) {
+			if (hwDeviceDescs.size() == 1) {
+				// Only one device available
+				intersectionDevice = ctx->AddIntersectionDevices(hwDeviceDescs)[0];
+			} else {
+				// Multiple devices available
+
+				// Select the devices to use
+				std::vector<luxrays::DeviceDescription *> selectedDescs;
+				bool haveSelectionString = (deviceSelection.length() > 0);
+				if (haveSelectionString) {
+					if (deviceSelection.length() != hwDeviceDescs.size()) {
+						LOG(LUX_WARNING, LUX_MISSINGDATA) << "Device selection string has the wrong length, must be " <<
+								hwDeviceDescs.size() << " instead of " << deviceSelection.length() << ", ignored";
+
+						selectedDescs = hwDeviceDescs;
+					} else {
+						for (size_t i = 0; i < hwDeviceDescs.size(); ++i) {
+							if (deviceSelection.at(i) == '1')
+								selectedDescs.push_back(hwDeviceDescs[i]);
+						}
+					}
+				} else
 					selectedDescs = hwDeviceDescs;
+
+				if (selectedDescs.size() == 1) {
+					// Multiple devices are available but only one is selected
+					intersectionDevice = ctx->AddIntersectionDevices(selectedDescs)[0];
 				} else {
-					for (size_t i = 0; i < hwDeviceDescs.size(); ++i) {
-						if (deviceSelection.at(i) == '1')
-							selectedDescs.push_back(hwDeviceDescs[i]);
-					}
+					ctx->AddVirtualIntersectionDevice(selectedDescs);
+					intersectionDevice = ctx->GetIntersectionDevices()[0];
 				}
-			} else
-				selectedDescs = hwDeviceDescs;
-
-			if (selectedDescs.size() == 1) {
-				// Multiple devices are available but only one is selected
-				intersectionDevice = ctx->AddIntersectionDevices(selectedDescs)[0];
-			} else {
-				ctx->AddVirtualIntersectionDevice(selectedDescs);
-				intersectionDevice = ctx->GetIntersectionDevices()[0];
 			}
+
+			LOG(LUX_INFO, LUX_NOERROR) << "Devices used:";
+			luxrays::VirtualIntersectionDevice *vdevice = dynamic_cast<luxrays::VirtualIntersectionDevice *>(intersectionDevice);
+			if (vdevice) {
+				const vector<luxrays::IntersectionDevice *> &realDevices = vdevice->GetRealDevices();
+				BOOST_FOREACH(luxrays::IntersectionDevice *rd, realDevices)
+						LOG(LUX_INFO, LUX_NOERROR) << " [" << rd->GetName() << "]";
+			} else
+				LOG(LUX_INFO, LUX_NOERROR) << " [" << intersectionDevice->GetName() << "]";
 		}
 
-		LOG(LUX_INFO, LUX_NOERROR) << "Devices used:";
-		luxrays::VirtualIntersectionDevice *vdevice = dynamic_cast<luxrays::VirtualIntersectionDevice *>(intersectionDevice);
-		if (vdevice) {
-			const vector<luxrays::IntersectionDevice *> &realDevices = vdevice->GetRealDevices();
-			BOOST_FOREACH(luxrays::IntersectionDevice *rd, realDevices)
-					LOG(LUX_INFO, LUX_NOERROR) << " [" << rd->GetName() << "]";
-		} else
-			LOG(LUX_INFO, LUX_NOERROR) << " [" << intersectionDevice->GetName() << "]";
+		intersectionDevice->SetMaxStackSize(qbvhStackSize);
 	}
 
-	intersectionDevice->SetMaxStackSize(qbvhStackSize);
-
 	preprocessDone = false;
 	suspendThreadsWhenDone = false;
 
@@ -333,7 +385,7 @@ static void writeIntervalCheck(Film *film) {
 }
 
 void HybridSamplerRenderer::Render(Scene *s) {
-	luxrays::DataSet *dataSet;
+	luxrays::DataSet *dataSet = NULL;
 	vector<HybridInstancePrimitive *> allocatedPrims;
 	vector<luxrays::Mesh *> allocatedMeshes;
 
@@ -391,16 +443,25 @@ void HybridSamplerRenderer::Render(Scene *s) {
 		// Compile the scene geometries in a LuxRays compatible format
 		//----------------------------------------------------------------------
 
-		dataSet = HybridRenderer::PreprocessGeometry(ctx, scene, allocatedPrims, allocatedMeshes);
-		if (!dataSet)
-			return;
-		((HSRStatistics *)rendererStatistics)->triangleCount = dataSet->GetTotalTriangleCount();
+		if (wavefront) {
+			vector<luxrays::Mesh *> meshList;
+			HybridRenderer::TessellateGeometry(scene, meshList, allocatedPrims, allocatedMeshes);
+			if (meshList.empty())
+				return;
+			tracer = new WavefrontTracer(meshList);
+			((HSRStatistics *)rendererStatistics)->triangleCount = tracer->GetTriangleCount();
+		} else {
+			dataSet = HybridRenderer::PreprocessGeometry(ctx, scene, allocatedPrims, allocatedMeshes);
+			if (!dataSet)
+				return;
+			((HSRStatistics *)rendererStatistics)->triangleCount = dataSet->GetTotalTriangleCount();
 
-		// Create enough queues to handle the maximum thread count
-		intersectionDevice->SetQueueCount(boost::thread::hardware_concurrency());
-		intersectionDevice->SetBufferCount(stateBufferCount);
+			// Create enough queues to handle the maximum thread count
+			intersectionDevice->SetQueueCount(boost::thread::hardware_concurrency());
+			intersectionDevice->SetBufferCount(stateBufferCount);
 
-		ctx->Start();
+			ctx->Start();
+		}
 
 		// start the timer
 		rendererStatistics->start();
@@ -452,9 +513,14 @@ void HybridSamplerRenderer::Render(Scene *s) {
 		scene->camera()->film->contribPool->Delete();
 	}
 
-	ctx->Stop();
-	delete dataSet;
-	scene->dataSet = NULL;
+	if (wavefront) {
+		delete tracer;
+		tracer = NULL;
+	} else {
+		ctx->Stop();
+		delete dataSet;
+		scene->dataSet = NULL;
+	}
 
 	// Free memory allocated inside HybridRenderer::PreprocessGeometry()
 	for (u_int i = 0; i < allocatedPrims.size(); ++i)
@@ -493,7 +559,7 @@ void HybridSamplerRenderer::CreateRenderThread() {
 	if ((state == RUN) || (state == PAUSE)) {
 		// Check if I have already used all available queues. I can not create
 		// another thread in that case.
-		if (renderThreads.size() < intersectionDevice->GetQueueCount()) {
+		if (wavefront || renderThreads.size() < intersectionDevice->GetQueueCount()) {
 			RenderThread *rt = new  RenderThread(renderThreads.size(), this);
 
 			renderThreads.push_back(rt);
@@ -520,11 +586,13 @@ void HybridSamplerRenderer::RemoveRenderThread() {
 //------------------------------------------------------------------------------
 
 HybridSamplerRenderer::RenderThread::RenderThread(u_int index, HybridSamplerRenderer *r) :
-	n(index), thread(NULL), renderer(r), samples(0.), blackSamples(0.), blackSamplePaths(0.) {
+	n(index), thread(NULL), renderer(r), samples(0.), blackSamples(0.), blackSamplePaths(0.),
+	counters(RenderCounters::Create()) {
 }
 
 HybridSamplerRenderer::RenderThread::~RenderThread() {
 	delete thread;
+	RenderCounters::Destroy(counters);
 }
 
 void HybridSamplerRenderer::RenderThread::RenderImpl(RenderThread *renderThread) {
@@ -537,6 +605,8 @@ void HybridSamplerRenderer::RenderThread::RenderImpl(RenderThread *renderThread)
 		// To avoid interrupt exception
 		boost::this_thread::disable_interruption di;
 
+		RenderCounters::ScopedAttach attachCounters(renderThread->counters);
+
 		// Dade - wait the end of the preprocessing phase
 		while (!renderer->preprocessDone) {
 			boost::this_thread::sleep(boost::posix_time::seconds(1));
@@ -563,14 +633,22 @@ void HybridSamplerRenderer::RenderThread::RenderImpl(RenderThread *renderThread)
 		const double t0 = luxrays::WallClockTime();
 
 		luxrays::IntersectionDevice *intersectionDevice = renderThread->renderer->intersectionDevice;
+		// In wavefront mode the buffers are traced in turn by this thread
+		const WavefrontTracer *tracer = renderer->tracer;
+		WavefrontRayQueue rayQueue;
+		size_t nextBuffer = 0;
+
 		vector<SurfaceIntegratorStateBuffer *> stateBuffers(renderer->stateBufferCount);
 		for (size_t i = 0; i < stateBuffers.size(); ++i) {
-			luxrays::RayBuffer *rayBuffer = intersectionDevice->NewRayBuffer(renderer->rayBufferSize);
+			luxrays::RayBuffer *rayBuffer = tracer ?
+				new luxrays::RayBuffer(renderer->rayBufferSize) :
+				intersectionDevice->NewRayBuffer(renderer->rayBufferSize);
 			rayBuffer->PushUserData(i);
 
 			stateBuffers[i] = new SurfaceIntegratorStateBuffer(scene, contribBuffer, &rng, rayBuffer);
 			stateBuffers[i]->GenerateRays();
-			intersectionDevice->PushRayBuffer(rayBuffer, threadIndex);
+			if (!tracer)
+				intersectionDevice->PushRayBuffer(rayBuffer, threadIndex);
 		}
 
 		LOG(LUX_DEBUG, LUX_NOERROR) << "Thread " << threadIndex << " initialization time: " <<
@@ -583,13 +661,25 @@ void HybridSamplerRenderer::RenderThread::RenderImpl(RenderThread *renderThread)
 			}
 			if ((renderer->state == TERMINATE) || boost::this_thread::interruption_requested()) {
 				// Pop left rayBuffers
-				for (size_t i = 0; i < stateBuffers.size(); ++i)
+				for (size_t i = 0; !tracer && i < stateBuffers.size(); ++i)
 					intersectionDevice->PopRayBuffer(threadIndex);
 				break;
 			}
 
-			luxrays::RayBuffer *rayBuffer = intersectionDevice->PopRayBuffer(threadIndex);
-			SurfaceIntegratorStateBuffer *stateBuffer = stateBuffers[rayBuffer->GetUserData()];
+			luxrays::RayBuffer *rayBuffer;
+			SurfaceIntegratorStateBuffer *stateBuffer;
+			if (tracer) {
+				stateBuffer = stateBuffers[nextBuffer];
+				nextBuffer = (nextBuffer + 1) % stateBuffers.size();
+				rayBuffer = stateBuffer->GetRayBuffer();
+
+				// Trace the whole wavefront, then shade it grouped by mesh
+				tracer->Trace(rayBuffer, rayQueue);
+				stateBuffer->SortStates();
+			} else {
+				rayBuffer = intersectionDevice->PopRayBuffer(threadIndex);
+				stateBuffer = stateBuffers[rayBuffer->GetUserData()];
+			}
 
 			//----------------------------------------------------------------------
 			// Advance the next step
@@ -633,7 +723,7 @@ void HybridSamplerRenderer::RenderThread::RenderImpl(RenderThread *renderThread)
 
 			if (renderIsOver) {
 				// Pop left rayBuffers (one has already been pop)
-				for (size_t i = 0; i < stateBuffers.size()- 1; ++i)
+				for (size_t i = 0; !tracer && i < stateBuffers.size()- 1; ++i)
 					intersectionDevice->PopRayBuffer(threadIndex);
 				break;
 			}
@@ -649,7 +739,8 @@ void HybridSamplerRenderer::RenderThread::RenderImpl(RenderThread *renderThread)
 			// Trace the RayBuffer
 			//----------------------------------------------------------------------
 
-			intersectionDevice->PushRayBuffer(rayBuffer, threadIndex);
+			if (!tracer)
+				intersectionDevice->PushRayBuffer(rayBuffer, threadIndex);
 		}
 
 		scene.camera()->film->contribPool->End(contribBuffer);
@@ -696,11 +787,30 @@ Renderer *HybridSamplerRenderer::CreateRenderer(const ParamSet &params) {
 	// hidden with hybrid rendering.
 	const u_int qbvhStackSize = max(16, configParams.FindOneInt("accelerator.qbvh.stacksize.max", 48));
 
+	// Trace and shade large batches of paths on the CPU threads
+	// without any LuxRays device
+	const bool wavefront = params.FindOneBool("wavefront", false);
+
 	params.MarkUsed(configParams);
 	return new HybridSamplerRenderer(platformIndex, useGPUs,
 			forceGPUWorkGroupSize, deviceSelection, rayBufferSize,
-			stateBufferCount, qbvhStackSize);
+			stateBufferCount, qbvhStackSize, wavefront);
+}
+
+Renderer *WavefrontRenderer::CreateRenderer(const ParamSet &params) {
+	ParamSet wavefrontParams(params);
+	const bool wavefront = true;
+	wavefrontParams.AddBool("wavefront", &wavefront);
+	// Bigger wavefronts for more coherence when tracing on the CPU
+	if (!params.FindOneInt("raybuffersize", 0)) {
+		const int rayBufferSize = 65536;
+		wavefrontParams.AddInt("raybuffersize", &rayBufferSize);
+	}
+	Renderer *renderer = HybridSamplerRenderer::CreateRenderer(wavefrontParams);
+	params.MarkUsed(wavefrontParams);
+	return renderer;
 }
 
 static DynamicLoader::RegisterRenderer<HybridSamplerRenderer> r("hybrid");
 static DynamicLoader::RegisterRenderer<HybridSamplerRenderer> r2("hybridsampler");
+static DynamicLoader::RegisterRenderer<WavefrontRenderer> r3("wavefront");
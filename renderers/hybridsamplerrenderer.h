@@ -31,8 +31,10 @@
 #include "fastmutex.h"
 #include "timer.h"
 #include "dynload.h"
+#include "rendercounters.h"
 #include "transport.h"
 #include "hybridrenderer.h"
+#include "wavefronttracer.h"
 
 #include "luxrays/luxrays.h"
 #include "luxrays/core/device.h"
@@ -52,19 +54,30 @@ public:
 	~SurfaceIntegratorStateBuffer();
 
 	void GenerateRays();
+	// Order the next NextState() call by the meshes hit, the rays must
+	// have been traced
+	void SortStates();
 	bool NextState(u_int &nrContribs, u_int &nrSamples);
 
 	luxrays::RayBuffer *GetRayBuffer() { return rayBuffer; }
 
 private:
+	bool AdvanceState(size_t i, u_int &nrContribs, u_int &nrSamples);
+
 	const Scene &scene;
 	ContributionBuffer *contribBuffer;
 	RandomGenerator *rng;
 	luxrays::RayBuffer *rayBuffer;
 
 	vector<SurfaceIntegratorState *> integratorState;
+	// Index in the RayBuffer of the first ray of each state
+	vector<size_t> firstRayIndex;
 	size_t firstStateIndex;
 	size_t lastStateIndex;
+
+	// Mesh index of the first hit and state index, sorted
+	vector<std::pair<u_int, size_t> > stateOrder;
+	size_t nextOrderIndex;
 };
 
 //------------------------------------------------------------------------------
@@ -76,7 +89,7 @@ public:
 	HybridSamplerRenderer(const int oclPlatformIndex, bool useGPUs,
 			const u_int forceGPUWorkGroupSize, const string &deviceSelection,
 			const u_int rayBufferSize, const u_int stateBufferCount,
-			const u_int qbvhStackSize);
+			const u_int qbvhStackSize, const bool wavefrontMode);
 	~HybridSamplerRenderer();
 
 	RendererType GetType() const;
@@ -114,6 +127,7 @@ private:
 		// Rendering statistics
 		fast_mutex statLock;
 		double samples, blackSamples, blackSamplePaths;
+		RenderCounters *counters;
 	};
 
 	void CreateRenderThread();
@@ -125,7 +139,11 @@ private:
 	luxrays::Context *ctx;
 
 	RendererState state;
+	// NULL in wavefront mode
 	luxrays::IntersectionDevice *intersectionDevice;
+	// Only used in wavefront mode, the render threads trace their own
+	// RayBuffers instead of feeding the intersection device
+	WavefrontTracer *tracer;
 
 	u_int rayBufferSize;
 	u_int stateBufferCount;
@@ -137,6 +155,13 @@ private:
 	// used to suspend render threads until the preprocessing phase is done
 	bool preprocessDone;
 	bool suspendThreadsWhenDone;
+	bool wavefront;
+};
+
+// Registers the wavefront mode of HybridSamplerRenderer as a renderer
+class WavefrontRenderer {
+public:
+	static Renderer *CreateRenderer(const ParamSet &params);
 };
 
 }//namespace lux
@@ -28,6 +28,7 @@
 #include "samplerrenderer.h"
 #include "randomgen.h"
 #include "context.h"
+#include "numa.h"
 #include "renderers/statistics/samplerstatistics.h"
 
 using namespace lux;
@@ -283,11 +284,13 @@ void SamplerRenderer::RemoveRenderThread() {
 
 
 SamplerRenderer::RenderThread::RenderThread(u_int index, SamplerRenderer *r) :
-	n(index), renderer(r), thread(NULL), samples(0.), blackSamples(0.), blackSamplePaths(0.) {
+	n(index), renderer(r), thread(NULL), samples(0.), blackSamples(0.), blackSamplePaths(0.),
+	counters(RenderCounters::Create()) {
 }
 
 SamplerRenderer::RenderThread::~RenderThread() {
 	delete thread;
+	RenderCounters::Destroy(counters);
 }
 
 void SamplerRenderer::RenderThread::RenderImpl(RenderThread *myThread) {
@@ -299,6 +302,18 @@ void SamplerRenderer::RenderThread::RenderImpl(RenderThread *myThread) {
 	// To avoid interrupt exception
 	boost::this_thread::disable_interruption di;
 
+	RenderCounters::ScopedAttach attachCounters(myThread->counters);
+
+	// Pin the thread before it allocates its buffers so that they are
+	// first touched on its NUMA node
+	if (GetNumaPlacement()) {
+		u_int node;
+		const u_int cpu = NumaTopology::Get().GetThreadCpu(myThread->n, &node);
+		if (PinCurrentThread(cpu, node))
+			LOG(LUX_DEBUG,LUX_NOERROR) << "Thread " << myThread->n <<
+				" pinned on processor " << cpu << " of NUMA node " << node;
+	}
+
 	// Initialize the thread's rangen
 	u_long seed = scene.seedBase + myThread->n;
 	LOG( LUX_DEBUG,LUX_NOERROR) << "Thread " << myThread->n << " uses seed: " << seed;
@@ -31,6 +31,7 @@
 #include "fastmutex.h"
 #include "timer.h"
 #include "dynload.h"
+#include "rendercounters.h"
 
 namespace lux
 {
@@ -130,6 +131,7 @@ private:
 		boost::thread *thread; // keep pointer to delete the thread object
 		double samples, blackSamples, blackSamplePaths;
 		fast_mutex statLock;
+		RenderCounters *counters;
 	};
 
 	void CreateRenderThread();
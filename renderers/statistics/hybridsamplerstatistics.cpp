@@ -187,6 +187,22 @@ double HSRStatistics::getPercentHaltSppComplete() {
 	return (getTotalAverageSamplesPerPixel() / getHaltSpp()) * 100.0;
 }
 
+void HSRStatistics::getThreadSamples(std::vector<double> &samples) {
+	boost::mutex::scoped_lock lock(renderer->classWideMutex);
+	samples.resize(renderer->renderThreads.size());
+	for (u_int i = 0; i < renderer->renderThreads.size(); ++i) {
+		fast_mutex::scoped_lock lockStats(renderer->renderThreads[i]->statLock);
+		samples[i] = renderer->renderThreads[i]->samples;
+	}
+}
+
+void HSRStatistics::getThreadCounters(RenderCounters::Event event, std::vector<double> &counts) {
+	boost::mutex::scoped_lock lock(renderer->classWideMutex);
+	counts.resize(renderer->renderThreads.size());
+	for (u_int i = 0; i < renderer->renderThreads.size(); ++i)
+		counts[i] = static_cast<double>(renderer->renderThreads[i]->counters->GetCount(event));
+}
+
 double HSRStatistics::getEfficiency() {
 	double sampleCount = 0.0;
 	double blackSampleCount = 0.0;
@@ -259,6 +275,8 @@ double HSRStatistics::getPathEfficiencyWindow() {
 
 // Returns percent of GPU efficiency, zero if no GPUs
 double HSRStatistics::getAverageGpuEfficiency() {
+	if (!renderer->intersectionDevice)
+		return 0.;
 	return 100.0 * renderer->intersectionDevice->GetLoad();
 }
 
@@ -41,6 +41,9 @@ public:
 	HSRStatistics(HybridSamplerRenderer* renderer);
 	~HSRStatistics();
 
+	virtual void getThreadSamples(std::vector<double> &samples);
+	virtual void getThreadCounters(RenderCounters::Event event, std::vector<double> &counts);
+
 	class FormattedLong : public RendererStatistics::FormattedLong {
 	public:
 		FormattedLong(HSRStatistics* rs);
@@ -147,6 +150,9 @@ private:
 	double getNetworkSampleCount(bool estimate = true);
 	
 	u_int getDeviceCount() {
+		// No device in wavefront mode
+		if (!renderer->intersectionDevice)
+			return 0;
 		luxrays::VirtualIntersectionDevice *vdev = dynamic_cast<luxrays::VirtualIntersectionDevice *>(renderer->intersectionDevice);
 		if (vdev)
 			return vdev->GetRealDevices().size();
@@ -155,6 +161,8 @@ private:
 	}
 	double getAverageGpuEfficiency();
 	string getDeviceNames() {
+		if (!renderer->intersectionDevice)
+			return "";
 		vector<luxrays::IntersectionDevice *> realDevices;
 
 		luxrays::VirtualIntersectionDevice *vdev = dynamic_cast<luxrays::VirtualIntersectionDevice *>(renderer->intersectionDevice);
@@ -181,6 +189,8 @@ private:
 	double getTriangleCount() { return triangleCount; }
 
 	double getDeviceMemoryUsed(const u_int deviceIndex) {
+		if (!renderer->intersectionDevice)
+			return 0.;
 		luxrays::VirtualIntersectionDevice *vdev = dynamic_cast<luxrays::VirtualIntersectionDevice *>(renderer->intersectionDevice);
 		if (vdev)
 			return vdev->GetRealDevices()[deviceIndex]->GetUsedMemory();
@@ -206,6 +216,8 @@ private:
 	double getDevice15MemoryUsed() { return getDeviceMemoryUsed(15); }
 
 	double getDeviceMaxMemory(const u_int deviceIndex) {
+		if (!renderer->intersectionDevice)
+			return 0.;
 		luxrays::VirtualIntersectionDevice *vdev = dynamic_cast<luxrays::VirtualIntersectionDevice *>(renderer->intersectionDevice);
 		if (vdev)
 			return vdev->GetRealDevices()[deviceIndex]->GetMaxMemory();
@@ -231,6 +243,8 @@ private:
 	double getDevice15MaxMemory() { return getDeviceMaxMemory(15); }
 
 	double getDeviceRaySecs(const u_int deviceIndex) {
+		if (!renderer->intersectionDevice)
+			return 0.;
 		luxrays::VirtualIntersectionDevice *vdev = dynamic_cast<luxrays::VirtualIntersectionDevice *>(renderer->intersectionDevice);
 		if (vdev)
 			return vdev->GetRealDevices()[deviceIndex]->GetSerialPerformance() +
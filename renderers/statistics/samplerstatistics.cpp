@@ -122,6 +122,22 @@ double SRStatistics::getPercentHaltSppComplete() {
 	return (getTotalAverageSamplesPerPixel() / getHaltSpp()) * 100.0;
 }
 
+void SRStatistics::getThreadSamples(std::vector<double> &samples) {
+	boost::mutex::scoped_lock lock(renderer->renderThreadsMutex);
+	samples.resize(renderer->renderThreads.size());
+	for (u_int i = 0; i < renderer->renderThreads.size(); ++i) {
+		fast_mutex::scoped_lock lockStats(renderer->renderThreads[i]->statLock);
+		samples[i] = renderer->renderThreads[i]->samples;
+	}
+}
+
+void SRStatistics::getThreadCounters(RenderCounters::Event event, std::vector<double> &counts) {
+	boost::mutex::scoped_lock lock(renderer->renderThreadsMutex);
+	counts.resize(renderer->renderThreads.size());
+	for (u_int i = 0; i < renderer->renderThreads.size(); ++i)
+		counts[i] = static_cast<double>(renderer->renderThreads[i]->counters->GetCount(event));
+}
+
 double SRStatistics::getEfficiency() {
 	double sampleCount = 0.0;
 	double blackSampleCount = 0.0;
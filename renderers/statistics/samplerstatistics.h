@@ -36,6 +36,9 @@ public:
 	SRStatistics(SamplerRenderer* renderer);
 	~SRStatistics();
 
+	virtual void getThreadSamples(std::vector<double> &samples);
+	virtual void getThreadCounters(RenderCounters::Event event, std::vector<double> &counts);
+
 	class FormattedLong : public RendererStatistics::FormattedLong {
 	public:
 		FormattedLong(SRStatistics* rs);
@@ -0,0 +1,186 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#include <algorithm>
+
+#include "wavefronttracer.h"
+#include "error.h"
+
+using namespace luxrays;
+using namespace lux;
+
+//------------------------------------------------------------------------------
+// WavefrontTracer
+//------------------------------------------------------------------------------
+
+const u_int WavefrontTracer::packetSize;
+
+// Spread the 10 lower bits of v so that there are 2 zero bits between them
+static inline u_int SpreadBits(u_int v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+WavefrontTracer::WavefrontTracer(const vector<luxrays::Mesh *> &meshes) {
+	size_t nTriangles = 0;
+	for (size_t i = 0; i < meshes.size(); ++i)
+		nTriangles += meshes[i]->GetTotalTriangleCount();
+
+	vector<Triangle> tris;
+	vector<BBox> bboxes;
+	tris.reserve(nTriangles);
+	bboxes.reserve(nTriangles);
+	for (size_t m = 0; m < meshes.size(); ++m) {
+		const luxrays::Mesh *mesh = meshes[m];
+		const luxrays::Triangle *meshTris = mesh->GetTriangles();
+		const u_int n = mesh->GetTotalTriangleCount();
+		for (u_int i = 0; i < n; ++i) {
+			const Point p0(mesh->GetVertex(meshTris[i].v[0]));
+			const Point p1(mesh->GetVertex(meshTris[i].v[1]));
+			const Point p2(mesh->GetVertex(meshTris[i].v[2]));
+
+			Triangle tri;
+			tri.p0 = p0;
+			tri.e1 = p1 - p0;
+			tri.e2 = p2 - p0;
+			tri.meshIndex = m;
+			tri.triangleIndex = i;
+			tris.push_back(tri);
+
+			const BBox bbox(Union(BBox(p0, p1), p2));
+			bboxes.push_back(bbox);
+			worldBound = Union(worldBound, bbox);
+		}
+	}
+
+	if (tris.empty())
+		return;
+
+	// Store the triangles in leaf order so that leaves reference
+	// contiguous ranges
+	vector<u_int> order;
+	tree.Build(tris.size(), &bboxes[0], 4, order);
+	triangles.resize(tris.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		triangles[i] = tris[order[i]];
+
+	const Vector extent(worldBound.pMax - worldBound.pMin);
+	invExtent = Vector(extent.x > 0.f ? 1.f / extent.x : 0.f,
+		extent.y > 0.f ? 1.f / extent.y : 0.f,
+		extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+	LOG(LUX_INFO, LUX_NOERROR) << "Wavefront tracer built over " <<
+		triangles.size() << " triangles (" <<
+		(tree.GetMemorySize() + triangles.size() * sizeof(Triangle)) / 1024 << "kbytes)";
+}
+
+u_int WavefrontTracer::RayKey(const Ray &ray) const {
+	const u_int octant = (ray.d.x < 0.f ? 1 : 0) |
+		(ray.d.y < 0.f ? 2 : 0) | (ray.d.z < 0.f ? 4 : 0);
+
+	// 9 bits per axis, the octant takes the 3 upper bits
+	const Vector o(ray.o - worldBound.pMin);
+	const u_int x = static_cast<u_int>(Clamp(o.x * invExtent.x, 0.f, 1.f) * 511.f);
+	const u_int y = static_cast<u_int>(Clamp(o.y * invExtent.y, 0.f, 1.f) * 511.f);
+	const u_int z = static_cast<u_int>(Clamp(o.z * invExtent.z, 0.f, 1.f) * 511.f);
+
+	return (octant << 27) | (SpreadBits(x) << 2) | (SpreadBits(y) << 1) |
+		SpreadBits(z);
+}
+
+void WavefrontTracer::Trace(luxrays::RayBuffer *rayBuffer,
+		WavefrontRayQueue &queue) const {
+	const u_int nRays = rayBuffer->GetRayCount();
+	if (nRays == 0)
+		return;
+
+	// Sort the rays so that consecutive rays start close to each other
+	// with the same direction signs
+	const Ray *rays = rayBuffer->GetRayBuffer();
+	queue.keys.resize(nRays);
+	for (u_int i = 0; i < nRays; ++i)
+		queue.keys[i] = std::make_pair(RayKey(rays[i]), i);
+	std::sort(queue.keys.begin(), queue.keys.end());
+
+	queue.rays.resize(nRays);
+	for (u_int i = 0; i < nRays; ++i)
+		queue.rays[i] = rays[queue.keys[i].second];
+
+	luxrays::RayHit hits[packetSize];
+	const TriangleLeaves leaves(triangles.empty() ? NULL : &triangles[0], hits);
+	for (u_int start = 0; start < nRays; ) {
+		// A packet only gathers rays of the same direction octant
+		const u_int octant = queue.keys[start].first >> 27;
+		u_int end = start + 1;
+		while (end < nRays && end - start < packetSize &&
+			(queue.keys[end].first >> 27) == octant)
+			++end;
+
+		for (u_int r = 0; r < end - start; ++r)
+			hits[r].SetMiss();
+		tree.IntersectPacket(leaves, &queue.rays[start], end - start);
+		for (u_int r = 0; r < end - start; ++r)
+			*(rayBuffer->GetRayHit(queue.keys[start + r].second)) = hits[r];
+
+		start = end;
+	}
+}
+
+bool WavefrontTracer::TriangleLeaves::Intersect(u_int index, u_int rayIndex,
+		const Ray &ray) const {
+	const Triangle &tri = triangles[index];
+
+	// Moller-Trumbore test, using the same barycentric coordinates
+	// than the LuxRays devices
+	const Vector s1(Cross(ray.d, tri.e2));
+	const float divisor = Dot(s1, tri.e1);
+	if (divisor == 0.f)
+		return false;
+	const float invDivisor = 1.f / divisor;
+
+	const Vector d(ray.o - tri.p0);
+	const float b1 = Dot(d, s1) * invDivisor;
+	if (b1 < 0.f)
+		return false;
+
+	const Vector s2(Cross(d, tri.e1));
+	const float b2 = Dot(ray.d, s2) * invDivisor;
+	if (b2 < 0.f || b1 + b2 > 1.f)
+		return false;
+
+	const float t = Dot(tri.e2, s2) * invDivisor;
+	if (t < ray.mint || t > ray.maxt)
+		return false;
+
+	ray.maxt = t;
+	luxrays::RayHit &hit = hits[rayIndex];
+	hit.t = t;
+	hit.b1 = b1;
+	hit.b2 = b2;
+	hit.meshIndex = tri.meshIndex;
+	hit.triangleIndex = tri.triangleIndex;
+	return true;
+}
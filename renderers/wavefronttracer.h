@@ -0,0 +1,119 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_WAVEFRONTTRACER_H
+#define LUX_WAVEFRONTTRACER_H
+
+#include <vector>
+
+#include "lux.h"
+#include "accelerators/recordqbvh.h"
+
+#include "luxrays/luxrays.h"
+#include "luxrays/core/trianglemesh.h"
+#include "luxrays/core/geometry/raybuffer.h"
+
+namespace lux
+{
+
+//------------------------------------------------------------------------------
+// WavefrontTracer
+//------------------------------------------------------------------------------
+
+/**
+   Per thread scratch storage of WavefrontTracer::Trace(), kept between
+   calls to avoid allocations
+*/
+class WavefrontRayQueue {
+public:
+	WavefrontRayQueue() { }
+
+	friend class WavefrontTracer;
+
+private:
+	// Sort key and index in the RayBuffer of each ray
+	vector<std::pair<u_int, u_int> > keys;
+	// The rays in sorted order
+	vector<luxrays::Ray> rays;
+};
+
+/**
+   Traces whole RayBuffers on the calling thread. The rays are sorted by
+   direction octant and origin location and traced by packets of coherent
+   rays through a QBVH built over the tessellated scene, the hits are
+   reported in the luxrays format (mesh index, triangle index and
+   barycentric coordinates).
+*/
+class WavefrontTracer {
+public:
+	/**
+	   Build the tracer
+	   @param meshes the tessellated meshes, the index in this vector is
+	   the mesh index of the hits
+	*/
+	WavefrontTracer(const vector<luxrays::Mesh *> &meshes);
+	~WavefrontTracer() { }
+
+	/**
+	   Intersect all the rays of the buffer and fill its hits
+	   @param rayBuffer the rays to trace
+	   @param queue scratch storage of the calling thread
+	*/
+	void Trace(luxrays::RayBuffer *rayBuffer, WavefrontRayQueue &queue) const;
+
+	u_int GetTriangleCount() const { return triangles.size(); }
+
+	// Max number of rays traced together through the tree
+	static const u_int packetSize = 8;
+
+private:
+	// Precomputed triangle for the Moller-Trumbore test
+	struct Triangle {
+		Point p0;
+		Vector e1, e2;
+		u_int meshIndex, triangleIndex;
+	};
+
+	// Leaf intersector of the RecordQBVH
+	class TriangleLeaves {
+	public:
+		TriangleLeaves(const Triangle *t, luxrays::RayHit *h) :
+			triangles(t), hits(h) { }
+		bool Intersect(u_int index, u_int rayIndex, const Ray &ray) const;
+	private:
+		const Triangle *triangles;
+		luxrays::RayHit *hits;
+	};
+
+	// Sort key: direction octant then Morton code of the origin
+	u_int RayKey(const Ray &ray) const;
+
+	// Sorted in the leaf order of the tree
+	vector<Triangle> triangles;
+	RecordQBVH tree;
+	BBox worldBound;
+	Vector invExtent;
+};
+
+}//namespace lux
+
+#endif // LUX_WAVEFRONTTRACER_H
@@ -137,7 +137,9 @@ bool RandomSampler::GetNextSample(Sample *sample)
 			}
 
 			// fetch next pixel from pixelsampler
-			if(!pixelSampler->GetNextPixel(&data->xPos, &data->yPos, sampPixelPosToUse)) {
+			const bool hasMorePixel = pixelSampler->GetNextPixel(&data->xPos, &data->yPos, sampPixelPosToUse);
+			film->previewStride = pixelSampler->GetPreviewStride(sampPixelPosToUse);
+			if(!hasMorePixel) {
 				// Dade - we are at a valid checkpoint where we can stop the
 				// rendering. Check if we have enough samples per pixel in the film.
 				if (film->enoughSamplesPerPixel) {
@@ -20,8 +20,12 @@
  *   Lux Renderer website : http://www.luxrender.net                       *
  ***************************************************************************/
 
+#include <emmintrin.h>
+
 #include <boost/foreach.hpp>
 
+#include "luxrays/utils/memory.h"
+
 #include "slg/samplers/sobol.h"
 
 #include "sobol.h"
@@ -31,9 +35,16 @@
 
 using namespace lux;
 
-SobolSampler::SobolData::SobolData(const Sampler &sampler, const Sample &sample) :
+SobolSampler::SobolData::SobolData(const SobolSampler &sampler, const Sample &sample) :
 		rng0(sample.rng->floatValue()), rng1(sample.rng->floatValue()), pass(SOBOL_STARTOFFSET),
 		noiseAwareMapVersion(0), userSamplingMapVersion(0) {
+	// The first pass is computed bit by bit, the following ones
+	// are incremental
+	values = AllocAligned<u_int>(sampler.nPaddedDimensions);
+	for (u_int i = 0; i < sampler.nPaddedDimensions; ++i)
+		values[i] = i < sampler.nDimensions ?
+			SobolDimension(sampler, pass, i) : 0;
+
 	nxD = sampler.nxD.size();
 	xD = new float *[nxD];
 	for (u_int i = 0; i < nxD; ++i)
@@ -41,6 +52,7 @@ SobolSampler::SobolData::SobolData(const Sampler &sampler, const Sample &sample)
 }
 
 SobolSampler::SobolData::~SobolData() {
+	FreeAligned(values);
 	for (u_int i = 0; i < nxD; ++i)
 		delete[] xD[i];
 	delete[] xD;
@@ -60,8 +72,25 @@ u_int SobolSampler::SobolData::SobolDimension(const SobolSampler &sampler,
 	return result;
 }
 
+void SobolSampler::SobolData::NextPass(const SobolSampler &sampler) {
+	// Going from pass to pass + 1 flips the trailing ones of pass and
+	// the following zero bit, the changes of all dimensions are in the
+	// cumulated directions of the new lowest set bit. The values stay
+	// the same as the ones computed bit by bit.
+	++pass;
+	u_int bit = 0;
+	for (u_int i = pass; !(i & 1) && bit < SOBOL_BITS - 1; i >>= 1)
+		++bit;
+
+	const __m128i *delta = reinterpret_cast<const __m128i *>(sampler.passDirections + bit * sampler.nPaddedDimensions);
+	__m128i *v = reinterpret_cast<__m128i *>(values);
+	for (u_int i = 0; i < sampler.nPaddedDimensions / 4; ++i)
+		_mm_store_si128(v + i, _mm_xor_si128(_mm_load_si128(v + i),
+			_mm_load_si128(delta + i)));
+}
+
 float SobolSampler::SobolData::GetSample(const SobolSampler &sampler, const u_int index) const {
-	const u_int result = SobolDimension(sampler, pass, index);
+	const u_int result = values[index];
 	const float r = result * (1.f / 0xffffffffu);
 
 	// Cranley-Patterson rotation to reduce visible regular patterns
@@ -72,7 +101,8 @@ float SobolSampler::SobolData::GetSample(const SobolSampler &sampler, const u_in
 
 SobolSampler::SobolSampler(int xstart, int xend, int ystart, int yend,
 		bool useNoise) : Sampler(xstart, xend, ystart, yend, 1, useNoise),
-		directions(NULL) {
+		directions(NULL), nDimensions(0), nPaddedDimensions(0),
+		passDirections(NULL) {
 	totalPixels = (xPixelEnd - xPixelStart) * (yPixelEnd - yPixelStart);
 
 	AddStringConstant(*this, "name", "Name of current sampler", "sobol");
@@ -80,6 +110,7 @@ SobolSampler::SobolSampler(int xstart, int xend, int ystart, int yend,
 
 SobolSampler::~SobolSampler() {
 	delete[] directions;
+	FreeAligned(passDirections);
 }
 
 void SobolSampler::InitSample(Sample *sample) const {
@@ -113,8 +144,26 @@ void SobolSampler::InitSample(Sample *sample) const {
 			LOG(LUX_DEBUG, LUX_NOERROR) << "Total sample count: " << sampleCount;
 
 			// Initialize Sobol data
-			directions = new u_int[sampleCount * SOBOL_BITS];
-			slg::SobolGenerateDirectionVectors(directions, sampleCount);
+			u_int *dirs = new u_int[sampleCount * SOBOL_BITS];
+			slg::SobolGenerateDirectionVectors(dirs, sampleCount);
+
+			// Transpose and cumulate the directions for the pass
+			// updates, the padding dimensions stay at 0
+			nDimensions = sampleCount;
+			nPaddedDimensions = (sampleCount + 3) & ~3u;
+			passDirections = AllocAligned<u_int>(SOBOL_BITS * nPaddedDimensions);
+			for (u_int i = 0; i < nPaddedDimensions; ++i) {
+				u_int d = 0;
+				for (u_int j = 0; j < SOBOL_BITS; ++j) {
+					if (i < sampleCount)
+						d ^= dirs[i * SOBOL_BITS + j];
+					passDirections[j * nPaddedDimensions + i] = d;
+				}
+			}
+
+			// Publish the directions last since their pointer
+			// is checked without the lock
+			directions = dirs;
 		}
 	}
 
@@ -181,7 +230,7 @@ bool SobolSampler::GetNextSample(Sample *sample) {
 	sample->time = data->GetSample(*this, 4);
 	sample->wavelengths = data->GetSample(*this, 5);
 
-	++(data->pass);
+	data->NextPass(*this);
 
 	return haveMoreSamples;
 }
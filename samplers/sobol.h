@@ -32,15 +32,22 @@ class SobolSampler : public Sampler
 public:
 	class SobolData {
 	public:
-		SobolData(const Sampler &sampler, const Sample &sample);
+		SobolData(const SobolSampler &sampler, const Sample &sample);
 		~SobolData();
 
 		u_int SobolDimension(const SobolSampler &sampler,
 			const u_int index, const u_int dimension) const;
 		float GetSample(const SobolSampler &sampler, const u_int index) const;
+		/**
+		   Move to the next pass, updating the Sobol values of all the
+		   dimensions at once
+		*/
+		void NextPass(const SobolSampler &sampler);
 
 		float rng0, rng1;
 		u_int pass;
+		// Sobol values of all the dimensions for the current pass
+		u_int *values;
 
 		u_int nxD;
 		float **xD;
@@ -73,6 +80,16 @@ private:
 	// SobolSampler Private Data
 	mutable fast_mutex initDirectionsMutex;
 	mutable u_int *directions;
+	// Number of dimensions, also rounded up to a multiple of 4 for the
+	// vectorized pass update
+	mutable u_int nDimensions, nPaddedDimensions;
+	/**
+	   Directions transposed by bit and cumulated: row j is the XOR of
+	   the directions of bits 0 to j for each dimension, that is what
+	   changes in the Sobol values when j is the lowest zero bit
+	   of the pass index
+	*/
+	mutable u_int *passDirections;
 	mutable vector<u_int> offset1D, offset2D, offsetxD;
 
 	u_int totalPixels;
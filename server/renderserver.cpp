@@ -34,10 +34,13 @@
 #include "tigerhash.h"
 #include "streamio.h"
 #include "asyncstream.h"
+#include "filetransfer.h"
+#include "metrics.h"
 
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <fstream>
+#include <list>
 #include <boost/asio.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
@@ -50,6 +53,7 @@
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/lexical_cast.hpp>
@@ -223,7 +227,9 @@ static void writeTransmitFilm(socket_stream_t &stream, const string &filename)
 	LOG( LUX_DEBUG,LUX_NOERROR) << "Transmitting film samples from file '" << file << "'";
 	std::ifstream in(file.c_str(), ios::in | ios::binary);
 
-	boost::iostreams::copy(in, stream);
+	Metrics::AddCounter("lux_network_bytes_total",
+		static_cast<double>(boost::iostreams::copy(in, stream)),
+		"direction=\"out\"");
 
 	if (in.fail())
 		LOG(LUX_ERROR, LUX_SYSTEM) << "There was an error while transmitting from file '" << file << "'";
@@ -233,11 +239,22 @@ static void writeTransmitFilm(socket_stream_t &stream, const string &filename)
 
 static void processCommandParams(bool isLittleEndian,
 		ParamSet &params, socket_stream_t &stream) {
+	// Read the size of the compressed chunk
+	uint32_t size = osReadLittleEndianUInt(isLittleEndian, stream);
+
+	if (size == ParamSet::binaryTag) {
+		// Binary parameters are decoded straight from the stream
+		if (!params.ReadBinary(stream))
+			throw std::runtime_error("Error reading binary parameters");
+		string s;
+		getline(stream, s);
+		if (s != "")
+			LOG( LUX_ERROR,LUX_SYSTEM) << "Error processing paramset, got '" << s << "'";
+		return;
+	}
+
 	stringstream uzos(stringstream::in | stringstream::out | stringstream::binary);
 	{
-		// Read the size of the compressed chunk
-		uint32_t size = osReadLittleEndianUInt(isLittleEndian, stream);
-
 		// Uncompress the chunk
 		filtering_stream<input> in;
 		in.push(gzip_decompressor());
@@ -254,68 +271,6 @@ static void processCommandParams(bool isLittleEndian,
 		LOG( LUX_ERROR,LUX_SYSTEM) << "Error processing paramset, got '" << s << "'";
 }
 
-static bool receiveFile(const std::string &filename, const std::string &filehash, socket_stream_t &stream) {
-	string fname;
-	getline(stream, fname);
-
-	string slen;
-	getline(stream, slen);
-
-	uint64_t len = boost::lexical_cast<uint64_t>(slen);
-
-	LOG( LUX_INFO,LUX_NOERROR) << "Receiving file: '" << fname << "' as '" << filename << "', size: " << (len / 1000) << " Kbytes";
-
-	// Dade - fix for bug 514: avoid to create the file if it is empty
-	if (len > 0) {
-		std::ofstream out(filename.c_str(), ios::out | ios::binary);
-
-		//std::streamsize written = boost::iostreams::copy(
-		//	boost::iostreams::restrict(stream, 0, len), out);
-
-		tigerhash h;
-
-		uint64_t source_len = len;
-
-		vector<char> buffer(1 * 1024 * 1024, 0);
-		while (len > 0 && !stream.bad()) {
-			const std::streamsize rs = static_cast<std::streamsize>(min(static_cast<uint64_t>(buffer.size()), len));
-
-			stream.read(&buffer[0], rs);
-			h.update(&buffer[0], rs);
-			out.write(&buffer[0], rs);
-
-			len -= rs;
-		}
-
-		out.flush();
-
-		string hash = digest_string(h.end_message());
-		
-		uint64_t written = source_len - len;
-
-		if (out.fail() || written != source_len || hash != filehash) {
-			bool output_error = out.fail();
-			out.close();
-
-			LOG( LUX_ERROR,LUX_SYSTEM) << "There was an error while receiving file '" << filename << "', received " << written 
-				<< " bytes, source size " << source_len << " bytes, received file hash " << hash << ", source hash " << filehash;
-			LOG( LUX_INFO,LUX_SYSTEM) << "Removing incomplete file '" << filename << "'";
-
-			boost::system::error_code ec;
-			if (!boost::filesystem::remove(filename, ec)) {
-				LOG( LUX_ERROR,LUX_SYSTEM) << "Error removing file '" << filename << "', error code: '" << ec << "'";
-			}
-
-			if (output_error)
-				// throw exception so the connection is terminated
-				throw std::runtime_error("Error writing file '" + filename + "'");
-			
-			return false;
-		}
-	}
-	return true;
-}
-
 //static void processFiles(ParamSet &params, std::set<string> &tmpFiles, std::iostream &stream) {
 static void processFiles(ParamSet &params, socket_stream_t &stream) {
 	LOG(LUX_DEBUG,LUX_NOERROR) << "Receiving file index";
@@ -357,10 +312,7 @@ static void processFiles(ParamSet &params, socket_stream_t &stream) {
 
 		LOG(LUX_DEBUG,LUX_NOERROR) << "File param '" << paramName << "', filename '" << filename << "', hash '" << hash << "'";
 
-		boost::filesystem::path fname(filename);
-
-		boost::filesystem::path tfile("tmp_" + hash);
-		tfile.replace_extension(fname.extension());
+		boost::filesystem::path tfile(FileTransfer::LocalName(filename, hash));
 
 		//if (tmpFiles.find(tfile.string()) == tmpFiles.end()) {
 		boost::system::error_code ec;
@@ -386,9 +338,9 @@ static void processFiles(ParamSet &params, socket_stream_t &stream) {
 		const string& hash(neededFiles[i].first);
 		const string& fname(neededFiles[i].second);
 		stream << hash << endl << flush;
-		if (!receiveFile(fname, hash, stream)) {
+		if (!FileTransfer::Receive(stream, fname, hash)) {
 			stream << "RESEND FILE" << endl << flush;
-			if (!receiveFile(fname, hash, stream))
+			if (!FileTransfer::Receive(stream, fname, hash))
 				throw std::runtime_error("Error receiving file '" + fname + "'");
 		}
 		stream << "FILE OK" << "\n";
@@ -443,6 +395,9 @@ static void processCommandFilm(bool isLittleEndian,
 	params.EraseInt("haltspp");
 	params.EraseInt("halttime");
 	params.EraseFloat("haltthreshold");
+	// The converged tiles are retired by the master too, the mask is sent
+	// to all slaves
+	params.EraseFloat("tilehaltthreshold");
 
 	// Disable the noise-aware map update. The map is updated by the master and
 	// sent to all slaves.
@@ -1052,7 +1007,191 @@ void cmd_luxSetUserSamplingMap(bool isLittleEndian, NetworkRenderServerThread *s
 	}
 }
 
+void cmd_luxSetTileMask(bool isLittleEndian, NetworkRenderServerThread *serverThread, socket_stream_t &stream, vector<string> &tmpFileList) {
+//case CMD_LUXSETTILEMASK:
+	if (serverThread->renderServer->getServerState() == RenderServer::BUSY) {
+		if (!serverThread->renderServer->validateAccess(stream)) {
+			LOG( LUX_ERROR,LUX_SYSTEM)<< "Unknown session ID";
+			stream.close();
+			return;
+		}
+
+		LOG( LUX_DEBUG,LUX_NOERROR)<< "Receiving tile mask";
+
+		{
+			u_int tileSize = osReadLittleEndianUInt(isLittleEndian, stream);
+			u_int count = osReadLittleEndianUInt(isLittleEndian, stream);
+
+			// The mask has one entry per tile of the film
+			const u_int xPixelCount = max(luxGetIntAttribute("film", "xPixelCount"), 0);
+			const u_int yPixelCount = max(luxGetIntAttribute("film", "yPixelCount"), 0);
+			if (tileSize == 0 || count == 0 || count !=
+				((xPixelCount + tileSize - 1) / tileSize) * ((yPixelCount + tileSize - 1) / tileSize)) {
+				LOG( LUX_ERROR,LUX_CONSISTENCY)<< "Tile mask doesn't match the film size";
+				stream.close();
+				return;
+			}
+
+			filtering_stream<input> compressedStream;
+			compressedStream.push(gzip_decompressor());
+			compressedStream.push(stream);
+
+			vector<unsigned char> mask(count);
+			compressedStream.read(reinterpret_cast<char *>(&mask[0]), count);
+
+			if (!stream.good()) {
+				LOG( LUX_DEBUG,LUX_NOERROR)<< "Error while receiving tile mask";
+			} else
+				Context::GetActive()->SetTileMask(tileSize, count, &mask[0]);
+
+			stream.close();
+		}
+
+		LOG( LUX_DEBUG,LUX_NOERROR)<< "Finished receiving tile mask";
+	} else {
+		LOG( LUX_ERROR,LUX_SYSTEM)<< "Received a SetTileMask command after a ServerDisconnect";
+		stream.close();
+	}
+}
+
 // Dade - TODO: support signals
+typedef boost::function<void (socket_stream_t&)> cmdfunc_t;
+typedef map<string, cmdfunc_t> cmdmap_t;
+
+unsigned long NetworkRenderServerThread::takeTicket()
+{
+	boost::mutex::scoped_lock lock(ticketMutex);
+	return nextTicket++;
+}
+
+void NetworkRenderServerThread::waitTurn(unsigned long ticket)
+{
+	boost::mutex::scoped_lock lock(ticketMutex);
+	while (currentTicket != ticket)
+		ticketCondition.wait(lock);
+}
+
+void NetworkRenderServerThread::releaseTicket(unsigned long ticket)
+{
+	boost::mutex::scoped_lock lock(ticketMutex);
+	if (ticket < currentTicket)
+		return;
+	if (ticket != currentTicket) {
+		releasedTickets.insert(ticket);
+		return;
+	}
+	// Skip the connections that already gave up their turn
+	++currentTicket;
+	while (releasedTickets.erase(currentTicket))
+		++currentTicket;
+	ticketCondition.notify_all();
+}
+
+// Idle connections are dropped after 30 seconds, the timeout only covers
+// the wait for the next command, not the command itself
+static const int connectionTimeout = 30;
+
+#ifdef USE_SOCKET_DEVICE
+// The socket device already has a per operation timeout
+static void armTimeout(socket_stream_t &stream) { }
+static void disarmTimeout(socket_stream_t &stream) { }
+#else
+static void armTimeout(socket_stream_t &stream)
+{
+#if (BOOST_VERSION >= 106600)
+	stream.expires_after(boost::asio::chrono::seconds(connectionTimeout));
+#elif (BOOST_VERSION >= 104700)
+	stream.expires_from_now(boost::posix_time::seconds(connectionTimeout));
+#endif
+}
+static void disarmTimeout(socket_stream_t &stream)
+{
+#if (BOOST_VERSION >= 106600)
+	stream.expires_at((socket_stream_t::time_point::max)());
+#elif (BOOST_VERSION >= 104700)
+	stream.expires_at(boost::posix_time::pos_infin);
+#endif
+}
+#endif
+
+static void processConnection(NetworkRenderServerThread *serverThread,
+	socket_stream_t &stream, const cmdmap_t &cmds, unsigned long ticket)
+{
+	// Commands are processed one connection at a time, the turn is only
+	// waited for once the connection is known not to be a peer file
+	// request, so that those are served while a session is processed
+	bool hasTurn = false;
+
+	//reading the command
+	string command;
+	LOG( LUX_DEBUG,LUX_NOERROR) << "Server receiving commands...";
+	try {
+		armTimeout(stream);
+		while (getline(stream, command)) {
+			disarmTimeout(stream);
+
+			if ((command != "") && (command != " ")) {
+				LOG(LUX_DEBUG,LUX_NOERROR) << "... processing command: '" << command << "'";
+			}
+
+			if (command == "GetFile" && !hasTurn) {
+				// Another server fetches a file it has been told we hold,
+				// this may happen while we are receiving our own scene
+				serverThread->releaseTicket(ticket);
+				try {
+					FileTransfer::Serve(stream);
+				} catch (std::exception &e) {
+					LOG(LUX_WARNING,LUX_SYSTEM) << "Error serving file to peer: " << e.what();
+				}
+				return;
+			}
+
+			if (!hasTurn) {
+				serverThread->waitTurn(ticket);
+				hasTurn = true;
+			}
+
+			cmdmap_t::const_iterator cmd = cmds.find(command);
+			if (cmd != cmds.end()) {
+				cmdfunc_t cmdhandler = cmd->second;
+				cmdhandler(stream);
+			} else {
+				throw std::runtime_error("Unknown command");
+			}
+
+			//END OF COMMAND PROCESSING
+			armTimeout(stream);
+		}
+	} catch (std::runtime_error& e) {
+		LOG(LUX_SEVERE,LUX_BUG) << "Exception processing command '" << command << "': " << e.what();
+		LOG(LUX_INFO,LUX_NOERROR) << "Ending session, cleaning up";
+
+		if (!hasTurn) {
+			serverThread->waitTurn(ticket);
+			hasTurn = true;
+		}
+		cleanupSession(serverThread, serverThread->tmpFileList);
+	}
+
+	serverThread->releaseTicket(ticket);
+}
+
+#ifndef USE_SOCKET_DEVICE
+static void connectionThread(NetworkRenderServerThread *serverThread,
+	boost::shared_ptr<socket_stream_t> stream, const cmdmap_t &cmds,
+	unsigned long ticket)
+{
+	try {
+		processConnection(serverThread, *stream, cmds, ticket);
+	} catch (std::exception &e) {
+		LOG(LUX_SEVERE,LUX_BUG) << "Internal error: " << e.what();
+		// Give the turn to the next connection anyway, releasing an
+		// already released ticket is harmless
+		serverThread->releaseTicket(ticket);
+	}
+}
+#endif
+
 void NetworkRenderServerThread::run(int ipversion, NetworkRenderServerThread *serverThread)
 {
 	boost::mutex::scoped_lock initLock(serverThread->initMutex);
@@ -1060,12 +1199,11 @@ void NetworkRenderServerThread::run(int ipversion, NetworkRenderServerThread *se
 	const int listenPort = serverThread->renderServer->tcpPort;
 	const bool isLittleEndian = osIsLittleEndian();
 
-	vector<string> tmpFileList;
+	vector<string> &tmpFileList(serverThread->tmpFileList);
 
-	typedef boost::function<void (socket_stream_t&)> cmdfunc_t;
 	#define INSERT_CMD(CmdName) cmds.insert(std::pair<string, cmdfunc_t>(#CmdName, boost::bind(cmd_##CmdName, isLittleEndian, serverThread, _1, boost::ref(tmpFileList))))
 
-	map<string, cmdfunc_t> cmds;
+	cmdmap_t cmds;
 
 	// Insert command handlers
 
@@ -1128,9 +1266,14 @@ void NetworkRenderServerThread::run(int ipversion, NetworkRenderServerThread *se
 	INSERT_CMD(luxRenderer);
 	INSERT_CMD(luxSetUserSamplingMap);
 	INSERT_CMD(luxSetNoiseAwareMap);
+	INSERT_CMD(luxSetTileMask);
 
 	#undef INSERT_CMD
 
+	// The connection threads use the command handlers above, they are
+	// joined before leaving
+	list<boost::shared_ptr<boost::thread> > connectionThreads;
+
 	try {
 		const bool reuse_addr = true;
 
@@ -1163,41 +1306,42 @@ void NetworkRenderServerThread::run(int ipversion, NetworkRenderServerThread *se
 			//device_streambuf<socket_device> dsb(sd, 1 << 16);
 			socket_stream_t stream(sd, 1 << 16);
 
-			stream->timeout(boost::posix_time::seconds(30));
+			stream->timeout(boost::posix_time::seconds(connectionTimeout));
 			stream->get_socket().set_option(boost::asio::ip::tcp::no_delay(true));
-#else
-			tcp::iostream stream;
-			acceptor.accept(*stream.rdbuf());
-			stream.rdbuf()->set_option(boost::asio::ip::tcp::no_delay(true));
-#endif
 			stream.setf(ios::scientific, ios::floatfield);
 			stream.precision(16);
 
-			//reading the command
-			string command;
-			LOG( LUX_DEBUG,LUX_NOERROR) << "Server receiving commands...";
+			const unsigned long ticket = serverThread->takeTicket();
 			try {
-				while (getline(stream, command)) {
-
-					if ((command != "") && (command != " ")) {
-						LOG(LUX_DEBUG,LUX_NOERROR) << "... processing command: '" << command << "'";
-					}
-
-					if (cmds.find(command) != cmds.end()) {
-						cmdfunc_t cmdhandler = cmds.find(command)->second;
-						cmdhandler(stream);
-					} else {
-						throw std::runtime_error("Unknown command");
-					}
-
-					//END OF COMMAND PROCESSING
-				}
-			} catch (std::runtime_error& e) {
-				LOG(LUX_SEVERE,LUX_BUG) << "Exception processing command '" << command << "': " << e.what();
-				LOG(LUX_INFO,LUX_NOERROR) << "Ending session, cleaning up";
-
-				cleanupSession(serverThread, tmpFileList);
+				processConnection(serverThread, stream, cmds, ticket);
+			} catch (std::exception &e) {
+				LOG(LUX_SEVERE,LUX_BUG) << "Internal error: " << e.what();
+				serverThread->releaseTicket(ticket);
+			}
+#else
+			// Each connection has its own thread so that peer file
+			// requests are served while a session is being processed
+			boost::shared_ptr<socket_stream_t> stream(new socket_stream_t());
+			acceptor.accept(*stream->rdbuf());
+			stream->rdbuf()->set_option(boost::asio::ip::tcp::no_delay(true));
+			stream->setf(ios::scientific, ios::floatfield);
+			stream->precision(16);
+
+			// Forget about the connections that are over
+			for (list<boost::shared_ptr<boost::thread> >::iterator t = connectionThreads.begin(); t != connectionThreads.end(); ) {
+				if ((*t)->timed_join(boost::posix_time::seconds(0)))
+					t = connectionThreads.erase(t);
+				else
+					++t;
 			}
+
+			// The ticket is taken in accept order, the commands of
+			// successive connections are executed in that order
+			connectionThreads.push_back(boost::shared_ptr<boost::thread>(
+				new boost::thread(boost::bind(connectionThread,
+				serverThread, stream, boost::cref(cmds),
+				serverThread->takeTicket()))));
+#endif
 		}
 	} catch (boost::system::system_error& e) {
 		if (e.code() != boost::asio::error::address_family_not_supported)
@@ -1207,4 +1351,7 @@ void NetworkRenderServerThread::run(int ipversion, NetworkRenderServerThread *se
 	} catch (exception& e) {
 		LOG(LUX_SEVERE,LUX_BUG) << "Internal error: " << e.what();
 	}
+
+	for (list<boost::shared_ptr<boost::thread> >::iterator t = connectionThreads.begin(); t != connectionThreads.end(); ++t)
+		(*t)->join();
 }
@@ -35,6 +35,10 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <set>
+#include <string>
+#include <vector>
 
 namespace lux
 {
@@ -45,7 +49,8 @@ class NetworkRenderServerThread : public boost::noncopyable {
 public:
 	NetworkRenderServerThread(RenderServer *server) :
 		renderServer(server), serverThread4(NULL), serverThread6(NULL), engineThread(NULL),
-		infoThread(NULL), signal(SIG_NONE) { }
+		infoThread(NULL), nextTicket(0), currentTicket(0),
+		signal(SIG_NONE) { }
 
 	~NetworkRenderServerThread() {
 		if (engineThread)
@@ -73,6 +78,12 @@ public:
 	static void run(int ipversion, NetworkRenderServerThread *serverThread);
 	friend class RenderServer;
 
+	// Commands are executed one connection at a time, in the order the
+	// connections have been accepted by either listening thread
+	unsigned long takeTicket();
+	void waitTurn(unsigned long ticket);
+	void releaseTicket(unsigned long ticket);
+
 	RenderServer *renderServer;
 	boost::thread *serverThread4;
 	boost::thread *serverThread6;
@@ -81,6 +92,14 @@ public:
 	// used to prevent simultaneous initialization
 	boost::mutex initMutex;
 
+	// temporary files of the current session
+	std::vector<std::string> tmpFileList;
+
+	boost::mutex ticketMutex;
+	boost::condition_variable ticketCondition;
+	unsigned long nextTicket, currentTicket;
+	// tickets released before their turn came (peer file requests)
+	std::set<unsigned long> releasedTickets;
 
 	// Dade - used to send signals to the thread
 	enum ThreadSignal { SIG_NONE, SIG_EXIT };
@@ -24,6 +24,11 @@
 #include "dynload.h"
 #include "context.h"
 #include "loopsubdiv.h"
+#include "microdisplacementcache.h"
+#include "accelerators/recordqbvh.h"
+#include "metrics.h"
+#include "timer.h"
+#include "numa.h"
 
 #include "./mikktspace/mikktspace.h"
 #include "./mikktspace/weldmesh.h"
@@ -54,6 +59,8 @@ Mesh::Mesh(const Transform &o2w, bool ro, const string &name,
 	displacementMapSharpBoundary = dmSharpBoundary;
 	normalSplit = normalsplit;
 	mustSubdivide = nSubdivLevels > 0;
+	displacementCacheSize = 64 * 1024 * 1024;
+	displacementCache = NULL;
 
 	// TODO: use AllocAligned
 
@@ -226,10 +233,21 @@ Mesh::Mesh(const Transform &o2w, bool ro, const string &name,
 			}
 		}
 	}
+
+	// Spread the data read by all the render threads over the NUMA nodes
+	NumaInterleaveArray(p, nverts);
+	NumaInterleaveArray(n, nverts);
+	NumaInterleaveArray(uvs, 2 * nverts);
+	NumaInterleaveArray(triVertexIndex, 3 * ntris);
+
+	memoryUsed = 0;
+	UpdateMemoryUsed();
 }
 
 Mesh::~Mesh()
 {
+	Metrics::AddMemory("meshes", -static_cast<double>(memoryUsed));
+	delete displacementCache;
 	delete[] triVertexIndex;
 	delete[] quadVertexIndex;
 	delete[] p;
@@ -241,8 +259,34 @@ Mesh::~Mesh()
 	delete[] btsign;
 }
 
+void Mesh::UpdateMemoryUsed()
+{
+	size_t vertexSize = sizeof(Point);
+	if (n)
+		vertexSize += sizeof(Normal);
+	if (uvs)
+		vertexSize += 2 * sizeof(float);
+	if (cols)
+		vertexSize += 3 * sizeof(float);
+	if (alphas)
+		vertexSize += sizeof(float);
+	if (t)
+		vertexSize += sizeof(Vector) + sizeof(bool);
+	// The vertex data is released once the mesh is compressed
+	const size_t size = (p ? nverts * vertexSize : 0) +
+		(triVertexIndex ? 3 * ntris * sizeof(int) : 0) +
+		4 * nquads * sizeof(int);
+	Metrics::AddMemory("meshes", static_cast<double>(size) -
+		static_cast<double>(memoryUsed));
+	memoryUsed = size;
+}
+
 BBox Mesh::ObjectBound() const
 {
+	if (!p) {
+		boost::shared_ptr<Primitive> compressed(compressedMesh.lock());
+		return compressed ? compressed->ObjectBound() : BBox();
+	}
 	BBox bobj;
 	for (u_int i = 0; i < nverts; ++i)
 		bobj = Union(bobj, Inverse(ObjectToWorld) * p[i]);
@@ -251,6 +295,10 @@ BBox Mesh::ObjectBound() const
 
 BBox Mesh::WorldBound() const
 {
+	if (!p) {
+		boost::shared_ptr<Primitive> compressed(compressedMesh.lock());
+		return compressed ? compressed->WorldBound() : BBox();
+	}
 	BBox worldBounds;
 	for (u_int i = 0; i < nverts; ++i)
 		worldBounds = Union(worldBounds, p[i]);
@@ -272,6 +320,13 @@ void Mesh::Refine(vector<boost::shared_ptr<Primitive> > &refined,
 	const PrimitiveRefinementHints &refineHints,
 	const boost::shared_ptr<Primitive> &thisPtr)
 {
+	// The triangles have already been compressed, reuse them
+	boost::shared_ptr<Primitive> compressed(compressedMesh.lock());
+	if (compressed) {
+		refined.push_back(compressed);
+		return;
+	}
+
 	if (ntris + nquads == 0)
 		return;
 
@@ -333,6 +388,7 @@ void Mesh::Refine(vector<boost::shared_ptr<Primitive> > &refined,
 					memcpy(alphas, res->alphas, nverts * sizeof(float));
 				} else
 					alphas = NULL;
+				UpdateMemoryUsed();
 				break;
 			}
 			case SUBDIV_MICRODISPLACEMENT:
@@ -347,6 +403,14 @@ void Mesh::Refine(vector<boost::shared_ptr<Primitive> > &refined,
 							<< displacementMapMin << "," << displacementMapMax << "), actual displacement values will be clamped to [-1,1]";
 
 					triType = TRI_MICRODISPLACEMENT;
+
+					if (displacementCacheSize > 0) {
+						if (MicroDisplacementCache::CanCache(nSubdivLevels, displacementCacheSize))
+							displacementCache = new MicroDisplacementCache(name, nSubdivLevels, displacementCacheSize);
+						else
+							SHAPE_LOG(name, LUX_WARNING, LUX_LIMIT) << "Displaced grids of " << nSubdivLevels <<
+								" subdivisions are too large for the displacement cache, increase \"dmcachesize\"";
+					}
 				} else {
 					SHAPE_LOG(name, LUX_WARNING, LUX_CONSISTENCY) << "No displacement map for microdisplacement, disabling";
 					triType = TRI_AUTO;
@@ -364,8 +428,46 @@ void Mesh::Refine(vector<boost::shared_ptr<Primitive> > &refined,
 
 	if (generateTangents) {
 		GenerateTangentSpace();
+		UpdateMemoryUsed();
 	}
 
+	if (triType == TRI_COMPRESSED) {
+		if (refineHints.forSampling) {
+			SHAPE_LOG(name, LUX_INFO, LUX_NOERROR) << "Compressed meshes can't be sampled, keeping uncompressed triangles";
+			triType = TRI_AUTO;
+		} else if (nquads > 0) {
+			SHAPE_LOG(name, LUX_WARNING, LUX_UNIMPLEMENT) << "Compressed meshes can't hold quads, keeping uncompressed triangles";
+			triType = TRI_AUTO;
+		} else if (ntris > RecordQBVH::maxRecords) {
+			SHAPE_LOG(name, LUX_WARNING, LUX_LIMIT) << "Compressed meshes can't hold more than " << RecordQBVH::maxRecords << " triangles, keeping uncompressed triangles";
+			triType = TRI_AUTO;
+		} else {
+			compressed.reset(new MeshCompressed(this, thisPtr));
+			compressedMesh = compressed;
+			refined.push_back(compressed);
+
+			// Only the compressed copy is used from now on
+			delete[] triVertexIndex;
+			delete[] p;
+			delete[] n;
+			delete[] uvs;
+			delete[] cols;
+			delete[] alphas;
+			delete[] t;
+			delete[] btsign;
+			triVertexIndex = NULL;
+			p = NULL;
+			n = NULL;
+			uvs = NULL;
+			cols = NULL;
+			alphas = NULL;
+			t = NULL;
+			btsign = NULL;
+			generateTangents = false;
+			UpdateMemoryUsed();
+			return;
+		}
+	}
 
 
 	vector<boost::shared_ptr<Primitive> > refinedPrims;
@@ -542,6 +644,8 @@ void Mesh::Refine(vector<boost::shared_ptr<Primitive> > &refined,
 			concreteAccelType = ACCEL_KDTREE;
 		ParamSet paramset;
 		boost::shared_ptr<Aggregate> accel;
+		Timer buildTimer;
+		buildTimer.Start();
 		switch (concreteAccelType) {
 			case ACCEL_KDTREE:
 				accel = MakeAccelerator("kdtree", refinedPrims, paramset);
@@ -558,6 +662,9 @@ void Mesh::Refine(vector<boost::shared_ptr<Primitive> > &refined,
 			default:
 				SHAPE_LOG(name, LUX_ERROR,LUX_CONSISTENCY) << "Unknown accel type: " << concreteAccelType;
 		}
+		buildTimer.Stop();
+		SHAPE_LOG(name, LUX_INFO,LUX_NOERROR) << "Mesh: accel built in " <<
+			buildTimer.Time() << "s";
 		if (refineHints.forSampling)
 			// Lotus - create primitive set to allow sampling
 			refined.push_back(boost::shared_ptr<Primitive>(new PrimitiveSet(accel)));
@@ -567,6 +674,10 @@ void Mesh::Refine(vector<boost::shared_ptr<Primitive> > &refined,
 }
 
 void Mesh::Tessellate(vector<luxrays::TriangleMesh *> *meshList, vector<const Primitive *> *primitiveList) const {
+	if (!p) {
+		SHAPE_LOG(name, LUX_ERROR, LUX_UNIMPLEMENT) << "Compressed meshes can't be tessellated";
+		return;
+	}
 	// A little hack with pointers
 	luxrays::TriangleMesh *tm = new luxrays::TriangleMesh(
 			nverts, ntris, p, (luxrays::Triangle *)triVertexIndex);
@@ -576,6 +687,10 @@ void Mesh::Tessellate(vector<luxrays::TriangleMesh *> *meshList, vector<const Pr
 }
 
 void Mesh::ExtTessellate(vector<luxrays::ExtTriangleMesh *> *meshList, vector<const Primitive *> *primitiveList) const {
+	if (!p) {
+		SHAPE_LOG(name, LUX_ERROR, LUX_UNIMPLEMENT) << "Compressed meshes can't be tessellated";
+		return;
+	}
 	// A little hack with pointers
 	luxrays::ExtTriangleMesh *tm = new luxrays::ExtTriangleMesh(
 			nverts, ntris, p, (luxrays::Triangle *)triVertexIndex,
@@ -1020,6 +1135,8 @@ static Shape *CreateShape(const Transform &o2w, bool reverseOrientation, const P
 		triType = Mesh::TRI_WALD;
 	else if (triTypeStr == "bary")
 		triType = Mesh::TRI_BARY;
+	else if (triTypeStr == "compressed")
+		triType = Mesh::TRI_COMPRESSED;
 	else if (triTypeStr == "auto")
 		triType = Mesh::TRI_AUTO;
 	else {
@@ -1101,7 +1218,10 @@ static Shape *CreateShape(const Transform &o2w, bool reverseOrientation, const P
 
 	const float colorGamma = params.FindOneFloat("gamma", 1.f);
 
-	return new Mesh(o2w, reverseOrientation, name,
+	// Memory of the displaced grids cache in MB
+	const int displacementCacheSize = max(0, params.FindOneInt("dmcachesize", 64));
+
+	Mesh *mesh = new Mesh(o2w, reverseOrientation, name,
 		accelType,
 		npi, P, N, UV, cols, alphas, colorGamma,
 		triType, triIndicesCount, triIndices,
@@ -1110,6 +1230,8 @@ static Shape *CreateShape(const Transform &o2w, bool reverseOrientation, const P
 		displacementMapScale, displacementMapOffset,
 		displacementMapNormalSmooth, displacementMapSharpBoundary,
 		normalSplit, genTangents);
+	mesh->SetDisplacementCacheSize(static_cast<size_t>(displacementCacheSize) * 1024 * 1024);
+	return mesh;
 }
 
 static Shape *CreateShape( const Transform &o2w, bool reverseOrientation, const ParamSet &params,
@@ -25,12 +25,16 @@
 
 #include "luxrays/luxrays.h"
 
+#include <boost/weak_ptr.hpp>
+
 namespace lux
 {
 
+class MicroDisplacementCache;
+
 class Mesh : public Shape {
 public:
-	enum MeshTriangleType { TRI_WALD, TRI_BARY, TRI_MICRODISPLACEMENT, TRI_AUTO };
+	enum MeshTriangleType { TRI_WALD, TRI_BARY, TRI_MICRODISPLACEMENT, TRI_COMPRESSED, TRI_AUTO };
 	enum MeshQuadType { QUAD_QUADRILATERAL };
 	enum MeshAccelType { ACCEL_KDTREE, ACCEL_QBVH, ACCEL_NONE, ACCEL_GRID, ACCEL_BRUTEFORCE, ACCEL_AUTO };
 	enum MeshSubdivType { SUBDIV_LOOP, SUBDIV_MICRODISPLACEMENT };
@@ -69,10 +73,30 @@ public:
 	virtual void GetShadingInformation(const DifferentialGeometry &dgShading,
 		RGBColor *color, float *alpha) const;
 
+	/**
+	   Set the memory budget of the displaced grids cache of the
+	   micro-displacement triangles, 0 disables the cache
+	*/
+	void SetDisplacementCacheSize(size_t bytes) {
+		displacementCacheSize = bytes;
+	}
+
+	/**
+	   Check whether the mesh is only made of world space triangles,
+	   the ones handled by Tessellate and GetIntersection
+	*/
+	bool IsTriangleMesh() const {
+		return p && triVertexIndex && ntris > 0 && nquads == 0 &&
+			!mustSubdivide && nSubdivLevels == 0 &&
+			triType != TRI_COMPRESSED && triType != TRI_MICRODISPLACEMENT;
+	}
+
 	friend class MeshWaldTriangle;
 	friend class MeshBaryTriangle;
 	friend class MeshMicroDisplacementTriangle;
 	friend class MeshQuadrilateral;
+	friend class MeshCompressed;
+	friend class EmbreeAccel;
 
 	static Shape* CreateShape(const Transform &o2w, bool reverseOrientation,
 		const ParamSet &params);
@@ -85,6 +109,8 @@ public:
 
 protected:
 	void GenerateTangentSpace();
+	// Report the change of size of the mesh data to the metrics
+	void UpdateMemoryUsed();
 
 	// Lotus - refinement data
 	MeshAccelType accelType;
@@ -120,12 +146,22 @@ protected:
 	float displacementMapMin, displacementMapMax;
 	bool displacementMapNormalSmooth, displacementMapSharpBoundary;
 	bool normalSplit;
+	// displaced grids of the micro-displacement triangles
+	size_t displacementCacheSize;
+	MicroDisplacementCache *displacementCache;
 
 	// Generate tangent space for mesh
 	bool generateTangents;
 
 	// for error reporting
 	mutable u_int inconsistentShadingTris;
+
+	// Size of the mesh data reported to the metrics
+	size_t memoryUsed;
+
+	// Compressed copy of the triangles, the vertex data of the mesh
+	// is released once it exists
+	boost::weak_ptr<Primitive> compressedMesh;
 };
 
 //------------------------------------------------------------------------------
@@ -276,6 +312,11 @@ public:
 	const Point &GetP(u_int i) const { return mesh->p[v[i]]; }
 	Point GetDisplacedP(const Point &pbase, const Vector &n, const float u, const float v, const float w) const;
 	Vector GetN(u_int i) const;
+	// Fill the intersection for a hit at pp on a micro triangle of
+	// edges e1 and e2, v and w are the barycentric coordinates in this
+	// triangle
+	void SetIntersection(const Point &pp, const Vector &e1,
+		const Vector &e2, float v, float w, Intersection *isect) const;
 
 	// BaryTriangle Data
 	const Mesh *mesh;
@@ -285,6 +326,90 @@ public:
 	bool is_Degenerate;
 };
 
+//------------------------------------------------------------------------------
+// Compressed triangles
+//------------------------------------------------------------------------------
+
+class RecordQBVH;
+
+/**
+   Quantized copy of all the triangles of a mesh, intersected as a single
+   primitive through a QBVH over triangle indices instead of one
+   primitive per triangle.
+   Triangles are stored in the leaf order of the tree and grouped in
+   clusters of 2^CLUSTER_SHIFT triangles. Each cluster has its own range
+   of vertices so that the vertex indices fit in 16 bits, vertices shared
+   between clusters are duplicated. Normals and tangents are oct-encoded
+   in 2x16 bits and uvs are stored as half floats.
+*/
+class MeshCompressed : public Primitive {
+public:
+	MeshCompressed(const Mesh *m, const boost::shared_ptr<Primitive> &mPtr);
+	virtual ~MeshCompressed();
+
+	virtual BBox ObjectBound() const;
+	virtual BBox WorldBound() const { return worldBound; }
+	virtual const Volume *GetExterior() const { return mesh->GetExterior(); }
+	virtual const Volume *GetInterior() const { return mesh->GetInterior(); }
+
+	virtual bool CanIntersect() const { return true; }
+	virtual bool Intersect(const Ray &ray, Intersection *isect) const;
+	virtual bool IntersectP(const Ray &ray) const;
+
+	virtual void GetShadingGeometry(const Transform &obj2world,
+		const DifferentialGeometry &dg,
+		DifferentialGeometry *dgShading) const;
+	virtual void GetShadingInformation(const DifferentialGeometry &dgShading,
+		RGBColor *color, float *alpha) const;
+
+	virtual bool CanSample() const { return false; }
+	virtual Transform GetLocalToWorld(float time) const {
+		return mesh->GetLocalToWorld(time);
+	}
+
+	/**
+	   Intersect a single triangle, used by the leaves of the tree
+	   @param tri the index of the triangle in leaf order
+	*/
+	bool IntersectTriangle(u_int tri, const Ray &ray,
+		Intersection *isect) const;
+	bool IntersectPTriangle(u_int tri, const Ray &ray) const;
+
+	u_int GetTriangleCount() const { return ntris; }
+	u_int GetVertexCount() const { return nverts; }
+
+	static const u_int CLUSTER_SHIFT = 14;
+
+private:
+	void GetVertices(u_int tri, u_int v[3]) const {
+		const u_int base = clusterBase[tri >> CLUSTER_SHIFT];
+		v[0] = base + indices[3 * tri];
+		v[1] = base + indices[3 * tri + 1];
+		v[2] = base + indices[3 * tri + 2];
+	}
+	void GetUVs(const u_int v[3], float uv[3][2]) const;
+	void ReportMemory();
+
+	const Mesh *mesh;
+	// Keeps the mesh material and volumes alive
+	boost::shared_ptr<Primitive> meshPtr;
+
+	u_int nverts, ntris;
+	Point *p;
+	u_int *n; // oct-encoded
+	u_short *uvs; // half floats
+	float *cols;
+	float *alphas;
+	u_int *t; // oct-encoded
+	vector<bool> btsign;
+	u_short *indices; // relative to the cluster base vertex
+	vector<u_int> clusterBase;
+
+	RecordQBVH *tree;
+	BBox worldBound;
+	size_t memoryUsed;
+};
+
 //------------------------------------------------------------------------------
 // Quad shapes
 //------------------------------------------------------------------------------
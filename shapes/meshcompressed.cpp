@@ -0,0 +1,518 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#include "mesh.h"
+#include "accelerators/recordqbvh.h"
+#include "metrics.h"
+#include "luxrays/core/color/color.h"
+
+#include <half.h>
+
+using namespace luxrays;
+using namespace lux;
+
+// Octahedral encoding of a direction in two 16 bits signed normalized values
+static u_int OctEncode(const Vector &v)
+{
+	const float l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+	float x = 0.f, y = 0.f;
+	if (l1 > 0.f) {
+		x = v.x / l1;
+		y = v.y / l1;
+		// Fold the lower hemisphere on the outer triangles
+		if (v.z < 0.f) {
+			const float ox = x;
+			x = (1.f - fabsf(y)) * (ox >= 0.f ? 1.f : -1.f);
+			y = (1.f - fabsf(ox)) * (y >= 0.f ? 1.f : -1.f);
+		}
+	}
+	const int qx = static_cast<int>(floorf(Clamp(x, -1.f, 1.f) * 32767.f + .5f));
+	const int qy = static_cast<int>(floorf(Clamp(y, -1.f, 1.f) * 32767.f + .5f));
+	return static_cast<u_int>(static_cast<u_short>(qx)) |
+		(static_cast<u_int>(static_cast<u_short>(qy)) << 16);
+}
+
+static Vector OctDecode(u_int e)
+{
+	float x = static_cast<short>(e & 0xffffu) / 32767.f;
+	float y = static_cast<short>(e >> 16) / 32767.f;
+	const float z = 1.f - fabsf(x) - fabsf(y);
+	if (z < 0.f) {
+		const float ox = x;
+		x = (1.f - fabsf(y)) * (ox >= 0.f ? 1.f : -1.f);
+		y = (1.f - fabsf(ox)) * (y >= 0.f ? 1.f : -1.f);
+	}
+	return Normalize(Vector(x, y, z));
+}
+
+static u_short HalfEncode(float f)
+{
+	return half(f).bits();
+}
+
+static float HalfDecode(u_short bits)
+{
+	half h;
+	h.setBits(bits);
+	return h;
+}
+
+// Leaf intersector, the tree indices are the triangle indices since the
+// triangles are stored in leaf order
+class CompressedLeaves {
+public:
+	CompressedLeaves(const MeshCompressed &m) : mesh(m) { }
+	bool Intersect(u_int index, const Ray &ray, Intersection *isect) const {
+		return mesh.IntersectTriangle(index, ray, isect);
+	}
+	bool IntersectP(u_int index, const Ray &ray) const {
+		return mesh.IntersectPTriangle(index, ray);
+	}
+private:
+	const MeshCompressed &mesh;
+};
+
+MeshCompressed::MeshCompressed(const Mesh *m,
+	const boost::shared_ptr<Primitive> &mPtr) : mesh(m), meshPtr(mPtr),
+	nverts(0), ntris(0), p(NULL), n(NULL), uvs(NULL), cols(NULL),
+	alphas(NULL), t(NULL), indices(NULL), tree(new RecordQBVH()),
+	memoryUsed(0)
+{
+	// Same orientation and consistency rules as the bary triangles,
+	// degenerate triangles are dropped
+	vector<u_int> triVerts;
+	vector<BBox> bboxes;
+	triVerts.reserve(3 * m->ntris);
+	bboxes.reserve(m->ntris);
+	u_int inconsistentShadingTris = 0;
+	for (u_int i = 0; i < m->ntris; ++i) {
+		u_int v[3];
+		v[0] = m->triVertexIndex[3 * i];
+		v[1] = m->triVertexIndex[3 * i + 1];
+		v[2] = m->triVertexIndex[3 * i + 2];
+		if (m->reverseOrientation ^ m->transformSwapsHandedness)
+			swap(v[1], v[2]);
+
+		const Point &v0 = m->p[v[0]];
+		const Point &v1 = m->p[v[1]];
+		const Point &v2 = m->p[v[2]];
+		const Normal normalizedNormal(Normalize(Cross(v1 - v0, v2 - v0)));
+		if (isnan(normalizedNormal.x) ||
+			isnan(normalizedNormal.y) ||
+			isnan(normalizedNormal.z))
+			continue;
+
+		// Reorder vertices if geometric normal doesn't match shading normal
+		if (m->n) {
+			const float cos0 = Dot(normalizedNormal, m->n[v[0]]);
+			if (cos0 < 0.f) {
+				if (Dot(normalizedNormal, m->n[v[1]]) < 0.f &&
+					Dot(normalizedNormal, m->n[v[2]]) < 0.f)
+					swap(v[1], v[2]);
+				else
+					++inconsistentShadingTris;
+			} else if (cos0 > 0.f) {
+				if (!(Dot(normalizedNormal, m->n[v[1]]) > 0.f &&
+					Dot(normalizedNormal, m->n[v[2]]) > 0.f))
+					++inconsistentShadingTris;
+			}
+		}
+
+		triVerts.push_back(v[0]);
+		triVerts.push_back(v[1]);
+		triVerts.push_back(v[2]);
+		bboxes.push_back(Union(BBox(v0, v1), v2));
+		worldBound = Union(worldBound, bboxes.back());
+	}
+	if (inconsistentShadingTris > 0) {
+		SHAPE_LOG(m->name, LUX_DEBUG, LUX_CONSISTENCY) <<
+			"Inconsistent shading normals in " <<
+			inconsistentShadingTris << " triangle" << (inconsistentShadingTris > 1 ? "s" : "");
+	}
+
+	ntris = bboxes.size();
+	if (ntris == 0) {
+		ReportMemory();
+		return;
+	}
+
+	vector<u_int> order;
+	if (!tree->Build(ntris, &bboxes[0], 4, order)) {
+		ntris = 0;
+		ReportMemory();
+		return;
+	}
+
+	// Split the triangles in leaf order into clusters, each cluster
+	// gets its own contiguous range of vertices
+	const u_int nClusters = (ntris + (1U << CLUSTER_SHIFT) - 1) >> CLUSTER_SHIFT;
+	clusterBase.resize(nClusters);
+	indices = new u_short[3 * ntris];
+	vector<u_int> stamp(m->nverts, nClusters);
+	vector<u_int> local(m->nverts);
+	vector<u_int> remap;
+	remap.reserve(m->nverts);
+	for (u_int c = 0; c < nClusters; ++c) {
+		const u_int base = remap.size();
+		clusterBase[c] = base;
+		const u_int end = min(ntris, (c + 1) << CLUSTER_SHIFT);
+		for (u_int i = c << CLUSTER_SHIFT; i < end; ++i) {
+			for (u_int j = 0; j < 3; ++j) {
+				const u_int v = triVerts[3 * order[i] + j];
+				if (stamp[v] != c) {
+					stamp[v] = c;
+					local[v] = remap.size() - base;
+					remap.push_back(v);
+				}
+				// At most 3 * 2^CLUSTER_SHIFT vertices per cluster
+				indices[3 * i + j] = static_cast<u_short>(local[v]);
+			}
+		}
+	}
+
+	// Quantize the vertex data
+	nverts = remap.size();
+	p = new Point[nverts];
+	for (u_int i = 0; i < nverts; ++i)
+		p[i] = m->p[remap[i]];
+	if (m->n) {
+		n = new u_int[nverts];
+		for (u_int i = 0; i < nverts; ++i)
+			n[i] = OctEncode(Vector(m->n[remap[i]]));
+	}
+	if (m->uvs) {
+		uvs = new u_short[2 * nverts];
+		for (u_int i = 0; i < nverts; ++i) {
+			uvs[2 * i] = HalfEncode(m->uvs[2 * remap[i]]);
+			uvs[2 * i + 1] = HalfEncode(m->uvs[2 * remap[i] + 1]);
+		}
+	}
+	if (m->cols) {
+		cols = new float[3 * nverts];
+		for (u_int i = 0; i < nverts; ++i) {
+			cols[3 * i] = m->cols[3 * remap[i]];
+			cols[3 * i + 1] = m->cols[3 * remap[i] + 1];
+			cols[3 * i + 2] = m->cols[3 * remap[i] + 2];
+		}
+	}
+	if (m->alphas) {
+		alphas = new float[nverts];
+		for (u_int i = 0; i < nverts; ++i)
+			alphas[i] = m->alphas[remap[i]];
+	}
+	if (m->t) {
+		t = new u_int[nverts];
+		btsign.resize(nverts);
+		for (u_int i = 0; i < nverts; ++i) {
+			t[i] = OctEncode(m->t[remap[i]]);
+			btsign[i] = m->btsign[remap[i]];
+		}
+	}
+
+	ReportMemory();
+}
+
+MeshCompressed::~MeshCompressed()
+{
+	Metrics::AddMemory("meshes", -static_cast<double>(memoryUsed));
+	delete tree;
+	delete[] p;
+	delete[] n;
+	delete[] uvs;
+	delete[] cols;
+	delete[] alphas;
+	delete[] t;
+	delete[] indices;
+}
+
+void MeshCompressed::ReportMemory()
+{
+	const size_t positions = nverts * sizeof(Point);
+	const size_t normals = n ? nverts * sizeof(u_int) : 0;
+	const size_t uvSize = uvs ? 2 * nverts * sizeof(u_short) : 0;
+	const size_t colors = (cols ? 3 * nverts * sizeof(float) : 0) +
+		(alphas ? nverts * sizeof(float) : 0);
+	const size_t tangents = t ? nverts * sizeof(u_int) + nverts / 8 : 0;
+	const size_t indexSize = 3 * ntris * sizeof(u_short);
+	const size_t clusters = clusterBase.size() * sizeof(u_int);
+	const size_t treeSize = tree->GetMemorySize();
+	const size_t total = positions + normals + uvSize + colors +
+		tangents + indexSize + clusters + treeSize;
+
+	SHAPE_LOG(mesh->name, LUX_INFO, LUX_NOERROR) << "Compressed " <<
+		ntris << " triangles and " << nverts << " vertices in " <<
+		total << " bytes (positions " << positions << ", normals " <<
+		normals << ", uvs " << uvSize << ", colors " << colors <<
+		", tangents " << tangents << ", indices " << indexSize <<
+		", clusters " << clusters << ", tree " << treeSize << ")";
+
+	Metrics::AddMemory("meshes", static_cast<double>(total) -
+		static_cast<double>(memoryUsed));
+	memoryUsed = total;
+}
+
+BBox MeshCompressed::ObjectBound() const
+{
+	const Transform WorldToObject(Inverse(mesh->ObjectToWorld));
+	BBox bobj;
+	for (u_int i = 0; i < nverts; ++i)
+		bobj = Union(bobj, WorldToObject * p[i]);
+	return bobj;
+}
+
+void MeshCompressed::GetUVs(const u_int v[3], float uv[3][2]) const
+{
+	if (uvs) {
+		for (u_int i = 0; i < 3; ++i) {
+			uv[i][0] = HalfDecode(uvs[2 * v[i]]);
+			uv[i][1] = HalfDecode(uvs[2 * v[i] + 1]);
+		}
+	} else {
+		for (u_int i = 0; i < 3; ++i) {
+			uv[i][0] = .5f;
+			uv[i][1] = .5f;
+		}
+	}
+}
+
+bool MeshCompressed::Intersect(const Ray &ray, Intersection *isect) const
+{
+	if (ntris == 0)
+		return false;
+	return tree->Intersect(CompressedLeaves(*this), ray, isect);
+}
+
+bool MeshCompressed::IntersectP(const Ray &ray) const
+{
+	if (ntris == 0)
+		return false;
+	return tree->IntersectP(CompressedLeaves(*this), ray);
+}
+
+bool MeshCompressed::IntersectTriangle(u_int tri, const Ray &ray,
+	Intersection *isect) const
+{
+	u_int v[3];
+	GetVertices(tri, v);
+	const Point &p1 = p[v[0]];
+	const Point &p2 = p[v[1]];
+	const Point &p3 = p[v[2]];
+	const Vector e1 = p2 - p1;
+	const Vector e2 = p3 - p1;
+	const Vector s1 = Cross(ray.d, e2);
+	const float divisor = Dot(s1, e1);
+	if (divisor == 0.f)
+		return false;
+	const float invDivisor = 1.f / divisor;
+	// Compute first barycentric coordinate
+	const Vector d = ray.o - p1;
+	const float b1 = Dot(d, s1) * invDivisor;
+	if (b1 < 0.f)
+		return false;
+	// Compute second barycentric coordinate
+	const Vector s2 = Cross(d, e1);
+	const float b2 = Dot(ray.d, s2) * invDivisor;
+	if (b2 < 0.f)
+		return false;
+	const float b0 = 1.f - b1 - b2;
+	if (b0 < 0.f)
+		return false;
+	// Compute _t_ to intersection point
+	const float tHit = Dot(e2, s2) * invDivisor;
+	if (tHit < ray.mint || tHit > ray.maxt)
+		return false;
+
+	// Compute triangle partial derivatives
+	Vector dpdu, dpdv;
+	float uv[3][2];
+	GetUVs(v, uv);
+	const float du1 = uv[0][0] - uv[2][0];
+	const float du2 = uv[1][0] - uv[2][0];
+	const float dv1 = uv[0][1] - uv[2][1];
+	const float dv2 = uv[1][1] - uv[2][1];
+	const Vector dp1 = p1 - p3, dp2 = p2 - p3;
+	const float determinant = du1 * dv2 - dv1 * du2;
+	if (determinant == 0.f) {
+		// Handle 0 determinant for triangle partial derivative matrix
+		CoordinateSystem(Normalize(Cross(e1, e2)), &dpdu, &dpdv);
+	} else {
+		const float invdet = 1.f / determinant;
+		dpdu = ( dv2 * dp1 - dv1 * dp2) * invdet;
+		dpdv = (-du2 * dp1 + du1 * dp2) * invdet;
+	}
+
+	// Interpolate $(u,v)$ triangle parametric coordinates
+	const float tu = b0 * uv[0][0] + b1 * uv[1][0] + b2 * uv[2][0];
+	const float tv = b0 * uv[0][1] + b1 * uv[1][1] + b2 * uv[2][1];
+
+	const Normal nn = Normal(Normalize(Cross(e1, e2)));
+	const Point pp(p1 + b1 * e1 + b2 * e2);
+
+	isect->dg = DifferentialGeometry(pp, nn, dpdu, dpdv,
+		Normal(0, 0, 0), Normal(0, 0, 0), tu, tv, this);
+
+	isect->Set(mesh->ObjectToWorld, this, mesh->GetMaterial(),
+		mesh->GetExterior(), mesh->GetInterior());
+	isect->dg.iData.mesh.coords[0] = b0;
+	isect->dg.iData.mesh.coords[1] = b1;
+	isect->dg.iData.mesh.coords[2] = b2;
+	isect->dg.iData.mesh.triIndex = tri;
+	ray.maxt = tHit;
+
+	return true;
+}
+
+bool MeshCompressed::IntersectPTriangle(u_int tri, const Ray &ray) const
+{
+	u_int v[3];
+	GetVertices(tri, v);
+	const Point &p1 = p[v[0]];
+	const Point &p2 = p[v[1]];
+	const Point &p3 = p[v[2]];
+	const Vector e1 = p2 - p1;
+	const Vector e2 = p3 - p1;
+	const Vector s1 = Cross(ray.d, e2);
+	const float divisor = Dot(s1, e1);
+	if (divisor == 0.f)
+		return false;
+	const float invDivisor = 1.f / divisor;
+	// Compute first barycentric coordinate
+	const Vector d = ray.o - p1;
+	const float b1 = Dot(d, s1) * invDivisor;
+	if (b1 < 0.f)
+		return false;
+	// Compute second barycentric coordinate
+	const Vector s2 = Cross(d, e1);
+	const float b2 = Dot(ray.d, s2) * invDivisor;
+	if (b2 < 0.f)
+		return false;
+	if (b1 + b2 > 1.f)
+		return false;
+	// Compute _t_ to intersection point
+	const float tHit = Dot(e2, s2) * invDivisor;
+	if (tHit < ray.mint || tHit > ray.maxt)
+		return false;
+
+	return true;
+}
+
+void MeshCompressed::GetShadingGeometry(const Transform &obj2world,
+	const DifferentialGeometry &dg, DifferentialGeometry *dgShading) const
+{
+	if (!n) {
+		*dgShading = dg;
+		return;
+	}
+
+	u_int v[3];
+	GetVertices(dg.iData.mesh.triIndex, v);
+	const float b0 = dg.iData.mesh.coords[0];
+	const float b1 = dg.iData.mesh.coords[1];
+	const float b2 = dg.iData.mesh.coords[2];
+	const Normal n0(OctDecode(n[v[0]]));
+	const Normal n1(OctDecode(n[v[1]]));
+	const Normal n2(OctDecode(n[v[2]]));
+
+	// Use _n_ to compute shading tangents for triangle, _ss_ and _ts_
+	const Normal nsi = b0 * n0 + b1 * n1 + b2 * n2;
+	const Normal ns = Normalize(nsi);
+
+	Vector ss, ts;
+	Vector tangent, bitangent;
+	float sign;
+	// if we got a generated tangent space, use that
+	if (t) {
+		tangent = b0 * OctDecode(t[v[0]]) + b1 * OctDecode(t[v[1]]) +
+			b2 * OctDecode(t[v[2]]);
+		// only degenerate triangles will have different vertex signs
+		bitangent = Cross(nsi, tangent);
+		// store sign, and also magnitude of interpolated normal so we can recover it
+		sign = (btsign[v[0]] ? 1.f : -1.f) * nsi.Length();
+
+		ss = Normalize(tangent);
+		ts = Normalize(bitangent);
+	} else {
+		ts = Normalize(Cross(ns, dg.dpdu));
+		ss = Cross(ts, ns);
+
+		ts *= Dot(dg.dpdv, ts) > 0.f ? 1.f : -1.f;
+
+		tangent = ss;
+		bitangent = ts;
+
+		sign = (Dot(ts, ns) > 0.f ? 1.f : -1.f);
+	}
+
+	// the length of dpdu/dpdv can be important for bumpmapping
+	ss *= dg.dpdu.Length();
+	ts *= dg.dpdv.Length();
+
+	Normal dndu, dndv;
+	// Compute \dndu and \dndv for triangle shading geometry
+	float uv[3][2];
+	GetUVs(v, uv);
+
+	// Compute deltas for triangle partial derivatives of normal
+	const float du1 = uv[0][0] - uv[2][0];
+	const float du2 = uv[1][0] - uv[2][0];
+	const float dv1 = uv[0][1] - uv[2][1];
+	const float dv2 = uv[1][1] - uv[2][1];
+	const Normal dn1 = n0 - n2;
+	const Normal dn2 = n1 - n2;
+	const float determinant = du1 * dv2 - dv1 * du2;
+
+	if (determinant == 0.f)
+		dndu = dndv = Normal(0, 0, 0);
+	else {
+		const float invdet = 1.f / determinant;
+		dndu = ( dv2 * dn1 - dv1 * dn2) * invdet;
+		dndv = (-du2 * dn1 + du1 * dn2) * invdet;
+	}
+
+	*dgShading = DifferentialGeometry(dg.p, ns, ss, ts,
+		dndu, dndv, tangent, bitangent, sign, dg.u, dg.v, this);
+	dgShading->iData = dg.iData;
+}
+
+void MeshCompressed::GetShadingInformation(const DifferentialGeometry &dgShading,
+	RGBColor *color, float *alpha) const
+{
+	u_int v[3];
+	GetVertices(dgShading.iData.mesh.triIndex, v);
+	const float b0 = dgShading.iData.mesh.coords[0];
+	const float b1 = dgShading.iData.mesh.coords[1];
+	const float b2 = dgShading.iData.mesh.coords[2];
+
+	if (cols) {
+		const RGBColor *c0 = (const RGBColor *)(&cols[v[0] * 3]);
+		const RGBColor *c1 = (const RGBColor *)(&cols[v[1] * 3]);
+		const RGBColor *c2 = (const RGBColor *)(&cols[v[2] * 3]);
+
+		*color = b0 * (*c0) + b1 * (*c1) + b2 * (*c2);
+	} else
+		*color = RGBColor(1.f);
+
+	if (alphas)
+		*alpha = b0 * alphas[v[0]] + b1 * alphas[v[1]] + b2 * alphas[v[2]];
+	else
+		*alpha = 1.f;
+}
@@ -26,6 +26,7 @@
 
 
 #include "mesh.h"
+#include "microdisplacementcache.h"
 #include "texture.h"
 #include "luxrays/core/color/spectrumwavelengths.h"
 #include <algorithm>
@@ -235,10 +236,50 @@ static bool intersectPlane(const Ray &ray, const Point &p, const Vector &n, floa
 	return true;
 }
 
+void MeshMicroDisplacementTriangle::SetIntersection(const Point &pp,
+	const Vector &e1, const Vector &e2, float v, float w,
+	Intersection *isect) const
+{
+	const float b0 = 1.f - v - w;
+	const float b1 = v;
+	const float b2 = w;
+
+	Normal nn(Normalize(Cross(e1, e2)));
+	Vector ts(Normalize(Cross(nn, dpdu)));
+	Vector ss(Cross(ts, nn));
+	// Lotus - the length of dpdu/dpdv can be important for bumpmapping
+	ss *= dpdu.Length();
+	if (Dot(dpdv, ts) < 0.f)
+		ts *= -dpdv.Length();
+	else
+		ts *= dpdv.Length();
+
+	// Interpolate $(u,v)$ triangle parametric coordinates
+	const float tu = b0 * uvs[0][0] + b1 * uvs[1][0] + b2 * uvs[2][0];
+	const float tv = b0 * uvs[0][1] + b1 * uvs[1][1] + b2 * uvs[2][1];
+
+	isect->dg = DifferentialGeometry(pp, nn, ss, ts,
+		Normal(0, 0, 0), Normal(0, 0, 0), tu, tv, this);
+
+	isect->Set(mesh->ObjectToWorld, this, mesh->GetMaterial(),
+		mesh->GetExterior(), mesh->GetInterior());
+	isect->dg.iData.baryTriangle.coords[0] = b0;
+	isect->dg.iData.baryTriangle.coords[1] = b1;
+	isect->dg.iData.baryTriangle.coords[2] = b2;
+}
+
 enum LastChange { iplus, jminus, kplus, iminus, jplus, kminus };
 
 bool MeshMicroDisplacementTriangle::Intersect(const Ray &ray, Intersection* isect) const
 {
+	// Reuse the displaced grid of the triangle when it is cached
+	if (mesh->displacementCache) {
+		if (!WorldBound().IntersectP(ray))
+			return false;
+		return mesh->displacementCache->Get(*this,
+			(v - mesh->triVertexIndex) / 3)->Intersect(*this, ray, isect);
+	}
+
 	// Compute $\VEC{s}_1$
 	// Get triangle vertices in _p1_, _p2_, and _p3_
 	const Point &p1 = mesh->p[v[0]];
@@ -589,32 +630,7 @@ bool MeshMicroDisplacementTriangle::Intersect(const Ray &ray, Intersection* isec
 				// recover barycentric coordinates in macrotriangle
 				const float v = va * b0 + vb * b1 + vc * b2;
 				const float w = wa * b0 + wb * b1 + wc * b2;
-				b0 = 1.f - v - w;
-				b1 = v;
-				b2 = w;
-
-				Normal nn(Normalize(Cross(e1, e2)));
-				Vector ts(Normalize(Cross(nn, dpdu)));
-				Vector ss(Cross(ts, nn));
-				// Lotus - the length of dpdu/dpdv can be important for bumpmapping
-				ss *= dpdu.Length();
-				if (Dot(dpdv, ts) < 0.f)
-					ts *= -dpdv.Length();
-				else
-					ts *= dpdv.Length();
-
-				// Interpolate $(u,v)$ triangle parametric coordinates
-				const float tu = b0 * uvs[0][0] + b1 * uvs[1][0] + b2 * uvs[2][0];
-				const float tv = b0 * uvs[0][1] + b1 * uvs[1][1] + b2 * uvs[2][1];
-
-				isect->dg = DifferentialGeometry(pp, nn, ss, ts,
-					Normal(0, 0, 0), Normal(0, 0, 0), tu, tv, this);
-
-				isect->Set(mesh->ObjectToWorld, this, mesh->GetMaterial(),
-					mesh->GetExterior(), mesh->GetInterior());
-				isect->dg.iData.baryTriangle.coords[0] = b0;
-				isect->dg.iData.baryTriangle.coords[1] = b1;
-				isect->dg.iData.baryTriangle.coords[2] = b2;
+				SetIntersection(pp, e1, e2, v, w, isect);
 				ray.maxt = t;
 
 				return true;
@@ -699,7 +715,12 @@ bool MeshMicroDisplacementTriangle::Intersect(const Ray &ray, Intersection* isec
 
 bool MeshMicroDisplacementTriangle::IntersectP(const Ray &ray) const
 {
-	// TODO - optimized implementation
+	if (mesh->displacementCache) {
+		if (!WorldBound().IntersectP(ray))
+			return false;
+		return mesh->displacementCache->Get(*this,
+			(v - mesh->triVertexIndex) / 3)->IntersectP(ray);
+	}
 
 	Intersection isect;
 	return Intersect(ray, &isect);
@@ -0,0 +1,281 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#include "microdisplacementcache.h"
+#include "mesh.h"
+#include "metrics.h"
+
+using namespace luxrays;
+using namespace lux;
+
+// Leaf intersectors of the micro triangles, the closest hit is only
+// resolved into a differential geometry once the traversal is done
+class GridLeaves {
+public:
+	GridLeaves(const MicroDisplacementGrid &g, u_int *h, float *bb1,
+		float *bb2) : grid(g), hit(h), b1(bb1), b2(bb2) { }
+	bool Intersect(u_int index, const Ray &ray, Intersection *) const {
+		float u, v, t;
+		if (!grid.IntersectTriangle(index, ray, &u, &v, &t))
+			return false;
+		*hit = index;
+		*b1 = u;
+		*b2 = v;
+		ray.maxt = t;
+		return true;
+	}
+	bool IntersectP(u_int index, const Ray &ray) const {
+		float u, v, t;
+		return grid.IntersectTriangle(index, ray, &u, &v, &t);
+	}
+private:
+	const MicroDisplacementGrid &grid;
+	u_int *hit;
+	float *b1, *b2;
+};
+
+MicroDisplacementGrid::MicroDisplacementGrid(
+	const MeshMicroDisplacementTriangle &tri, u_int n)
+{
+	const Point &p1 = tri.GetP(0);
+	const Point &p2 = tri.GetP(1);
+	const Point &p3 = tri.GetP(2);
+	const Vector n1(tri.GetN(0));
+	const Vector n2(tri.GetN(1));
+	const Vector n3(tri.GetN(2));
+	const float delta = 1.f / n;
+
+	// Vertex (j, k) has the barycentric coordinates
+	// ((n - j - k) / n, j / n, k / n), rows of constant k are contiguous
+	const u_int nVertices = (n + 1) * (n + 2) / 2;
+	p.reserve(nVertices);
+	vw.reserve(2 * nVertices);
+	vector<u_int> rowStart(n + 1);
+	for (u_int k = 0; k <= n; ++k) {
+		rowStart[k] = p.size();
+		for (u_int j = 0; j <= n - k; ++j) {
+			const float u = (n - j - k) * delta;
+			const float v = j * delta;
+			const float w = k * delta;
+			const Point pbase(p1 * u + p2 * v + p3 * w);
+			const Vector nn(Normalize(n1 * u + n2 * v + n3 * w));
+			p.push_back(tri.GetDisplacedP(pbase, nn, u, v, w));
+			vw.push_back(v);
+			vw.push_back(w);
+		}
+	}
+
+	// Micro triangles with the same orientation as the base triangle
+	vector<u_int> tris;
+	tris.reserve(3 * n * n);
+	for (u_int k = 0; k < n; ++k) {
+		for (u_int j = 0; j < n - k; ++j) {
+			tris.push_back(rowStart[k] + j);
+			tris.push_back(rowStart[k] + j + 1);
+			tris.push_back(rowStart[k + 1] + j);
+			if (j + k + 2 <= n) {
+				tris.push_back(rowStart[k + 1] + j);
+				tris.push_back(rowStart[k] + j + 1);
+				tris.push_back(rowStart[k + 1] + j + 1);
+			}
+		}
+	}
+
+	const u_int nTris = tris.size() / 3;
+	vector<BBox> bboxes(nTris);
+	for (u_int i = 0; i < nTris; ++i)
+		bboxes[i] = Union(BBox(p[tris[3 * i]], p[tris[3 * i + 1]]),
+			p[tris[3 * i + 2]]);
+	vector<u_int> order;
+	tree.Build(nTris, &bboxes[0], 4, order);
+
+	indices.resize(3 * nTris);
+	for (u_int i = 0; i < nTris; ++i) {
+		indices[3 * i] = tris[3 * order[i]];
+		indices[3 * i + 1] = tris[3 * order[i] + 1];
+		indices[3 * i + 2] = tris[3 * order[i] + 2];
+	}
+
+	memorySize = sizeof(*this) + p.size() * sizeof(Point) +
+		vw.size() * sizeof(float) + indices.size() * sizeof(u_int) +
+		tree.GetMemorySize();
+}
+
+size_t MicroDisplacementGrid::EstimateMemorySize(u_int n)
+{
+	const size_t nVertices = (n + 1) * (n + 2) / 2;
+	const size_t nTris = n * n;
+	// Generous bound of the QBVH nodes with 4 records per leaf
+	const size_t nNodes = (nTris + 2) / 3;
+	return sizeof(MicroDisplacementGrid) +
+		nVertices * (sizeof(Point) + 2 * sizeof(float)) +
+		3 * nTris * sizeof(u_int) + nNodes * sizeof(QBVHNode);
+}
+
+bool MicroDisplacementGrid::IntersectTriangle(u_int index, const Ray &ray,
+	float *b1, float *b2, float *t) const
+{
+	const Point &p1 = p[indices[3 * index]];
+	const Point &p2 = p[indices[3 * index + 1]];
+	const Point &p3 = p[indices[3 * index + 2]];
+	const Vector e1(p2 - p1);
+	const Vector e2(p3 - p1);
+	const Vector s1(Cross(ray.d, e2));
+	const float divisor = Dot(s1, e1);
+	if (divisor == 0.f)
+		return false;
+	const float invDivisor = 1.f / divisor;
+	// Compute first barycentric coordinate
+	const Vector d(ray.o - p1);
+	*b1 = Dot(d, s1) * invDivisor;
+	if (*b1 < 0.f)
+		return false;
+	// Compute second barycentric coordinate
+	const Vector s2(Cross(d, e1));
+	*b2 = Dot(ray.d, s2) * invDivisor;
+	if (*b2 < 0.f || *b1 + *b2 > 1.f)
+		return false;
+	// Compute _t_ to intersection point
+	*t = Dot(e2, s2) * invDivisor;
+	return *t >= ray.mint && *t <= ray.maxt;
+}
+
+bool MicroDisplacementGrid::Intersect(const MeshMicroDisplacementTriangle &tri,
+	const Ray &ray, Intersection *isect) const
+{
+	u_int hit;
+	float b1, b2;
+	if (!tree.Intersect(GridLeaves(*this, &hit, &b1, &b2), ray, isect))
+		return false;
+
+	const u_int ia = indices[3 * hit];
+	const u_int ib = indices[3 * hit + 1];
+	const u_int ic = indices[3 * hit + 2];
+	const float b0 = 1.f - b1 - b2;
+	// Recover the barycentric coordinates in the base triangle
+	const float v = b0 * vw[2 * ia] + b1 * vw[2 * ib] + b2 * vw[2 * ic];
+	const float w = b0 * vw[2 * ia + 1] + b1 * vw[2 * ib + 1] +
+		b2 * vw[2 * ic + 1];
+	tri.SetIntersection(p[ia] * b0 + p[ib] * b1 + p[ic] * b2,
+		p[ib] - p[ia], p[ic] - p[ia], v, w, isect);
+	return true;
+}
+
+bool MicroDisplacementGrid::IntersectP(const Ray &ray) const
+{
+	u_int hit;
+	float b1, b2;
+	return tree.IntersectP(GridLeaves(*this, &hit, &b1, &b2), ray);
+}
+
+MicroDisplacementCache::MicroDisplacementCache(const string &n,
+	u_int subdiv, size_t maxBytes) : name(n), nSubdiv(subdiv),
+	maxShardBytes(maxBytes / SHARD_COUNT)
+{
+}
+
+MicroDisplacementCache::~MicroDisplacementCache()
+{
+	unsigned long long hits = 0, misses = 0, evictions = 0;
+	size_t memory = 0;
+	for (u_int i = 0; i < SHARD_COUNT; ++i) {
+		Shard &shard(shards[i]);
+		hits += shard.hits;
+		misses += shard.misses;
+		evictions += shard.evictions;
+		memory += shard.memory;
+		if (shard.pendingHits > 0)
+			Metrics::AddCounter("lux_displacement_cache_hits_total",
+				shard.pendingHits);
+	}
+	Metrics::AddMemory("displacement", -static_cast<double>(memory));
+
+	if (hits + misses > 0) {
+		SHAPE_LOG(name, LUX_INFO, LUX_NOERROR) <<
+			"Micro-displacement cache: " << hits << " hits, " <<
+			misses << " misses (" <<
+			(100.0 * hits / (hits + misses)) << "% hit rate), " <<
+			evictions << " evictions";
+	}
+}
+
+boost::shared_ptr<const MicroDisplacementGrid> MicroDisplacementCache::Get(
+	const MeshMicroDisplacementTriangle &tri, u_int index)
+{
+	Shard &shard(shards[index % SHARD_COUNT]);
+	boost::mutex::scoped_lock lock(shard.mutex);
+
+	std::map<u_int, LRUList::iterator>::iterator it = shard.entries.find(index);
+	if (it != shard.entries.end()) {
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+		++shard.hits;
+		// Batch the hits to keep the metrics lock out of the way
+		if (++shard.pendingHits == 4096) {
+			Metrics::AddCounter("lux_displacement_cache_hits_total",
+				shard.pendingHits);
+			shard.pendingHits = 0;
+		}
+		return it->second->second;
+	}
+
+	// Build the grid without holding the lock, another thread may build
+	// the same grid meanwhile, only one of them is kept
+	lock.unlock();
+	boost::shared_ptr<const MicroDisplacementGrid> grid(
+		new MicroDisplacementGrid(tri, nSubdiv));
+	lock.lock();
+
+	it = shard.entries.find(index);
+	if (it != shard.entries.end()) {
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+		return it->second->second;
+	}
+
+	++shard.misses;
+	Metrics::AddCounter("lux_displacement_cache_misses_total", 1.);
+
+	// Evict the least recently used grids
+	const size_t size = grid->GetMemorySize();
+	size_t freed = 0;
+	u_int evicted = 0;
+	while (!shard.lru.empty() && shard.memory + size > maxShardBytes) {
+		const size_t s = shard.lru.back().second->GetMemorySize();
+		shard.memory -= s;
+		freed += s;
+		shard.entries.erase(shard.lru.back().first);
+		shard.lru.pop_back();
+		++evicted;
+	}
+	if (evicted > 0) {
+		shard.evictions += evicted;
+		Metrics::AddCounter("lux_displacement_cache_evictions_total",
+			evicted);
+	}
+
+	shard.lru.push_front(std::make_pair(index, grid));
+	shard.entries[index] = shard.lru.begin();
+	shard.memory += size;
+	Metrics::AddMemory("displacement", static_cast<double>(size) -
+		static_cast<double>(freed));
+
+	return grid;
+}
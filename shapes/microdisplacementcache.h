@@ -0,0 +1,146 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+#ifndef LUX_MICRODISPLACEMENTCACHE_H
+#define LUX_MICRODISPLACEMENTCACHE_H
+// microdisplacementcache.h*
+#include "lux.h"
+#include "accelerators/recordqbvh.h"
+
+#include <list>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace lux
+{
+
+class MeshMicroDisplacementTriangle;
+
+/**
+   Displaced tessellation of a micro-displacement triangle: the
+   N x N micro triangles of the subdivided base triangle with their
+   displaced vertices, and a QBVH over them.
+*/
+class MicroDisplacementGrid {
+public:
+	/**
+	   Tessellate and displace a base triangle
+	   @param tri the base triangle
+	   @param n the number of subdivisions of each edge
+	*/
+	MicroDisplacementGrid(const MeshMicroDisplacementTriangle &tri,
+		u_int n);
+
+	/**
+	   Find the closest micro triangle hit and fill the intersection
+	   through the base triangle
+	*/
+	bool Intersect(const MeshMicroDisplacementTriangle &tri,
+		const Ray &ray, Intersection *isect) const;
+	bool IntersectP(const Ray &ray) const;
+
+	bool IntersectTriangle(u_int index, const Ray &ray, float *b1,
+		float *b2, float *t) const;
+
+	size_t GetMemorySize() const { return memorySize; }
+
+	/**
+	   Estimate of the memory used by a grid, without building it
+	   @param n the number of subdivisions of each edge
+	*/
+	static size_t EstimateMemorySize(u_int n);
+
+	// Displaced vertices
+	vector<Point> p;
+	// Barycentric coordinates of the vertices for the 2nd and 3rd
+	// vertices of the base triangle
+	vector<float> vw;
+	// Vertex indices of the micro triangles in leaf order
+	vector<u_int> indices;
+	RecordQBVH tree;
+	size_t memorySize;
+};
+
+/**
+   Thread safe LRU cache of the displaced grids of the triangles of a mesh.
+   The cache is split in shards selected by the triangle index, each with
+   its own lock and an equal share of the memory budget, to limit the
+   contention between the render threads. Grids are reference counted so
+   that an evicted grid stays valid for the threads still using it.
+   Hits, misses and evictions are reported to the metrics as
+   lux_displacement_cache_*_total counters and the memory as the
+   "displacement" subsystem.
+*/
+class MicroDisplacementCache {
+public:
+	/**
+	   @param name the name of the mesh, for the statistics
+	   @param n the number of subdivisions of each triangle edge
+	   @param maxBytes the maximum memory used by the grids
+	*/
+	MicroDisplacementCache(const string &name, u_int n, size_t maxBytes);
+	~MicroDisplacementCache();
+
+	/**
+	   Return the displaced grid of a triangle, building it on a miss
+	   @param tri the triangle
+	   @param index the index of the triangle in the mesh
+	*/
+	boost::shared_ptr<const MicroDisplacementGrid> Get(
+		const MeshMicroDisplacementTriangle &tri, u_int index);
+
+	/**
+	   Check that a single grid fits in the share of a shard
+	*/
+	static bool CanCache(u_int n, size_t maxBytes) {
+		return MicroDisplacementGrid::EstimateMemorySize(n) <=
+			maxBytes / SHARD_COUNT;
+	}
+
+	static const u_int SHARD_COUNT = 16;
+
+private:
+	typedef std::list<std::pair<u_int, boost::shared_ptr<const MicroDisplacementGrid> > > LRUList;
+
+	struct Shard {
+		Shard() : memory(0), hits(0), misses(0), evictions(0),
+			pendingHits(0) { }
+		boost::mutex mutex;
+		// Most recently used first
+		LRUList lru;
+		std::map<u_int, LRUList::iterator> entries;
+		size_t memory;
+		unsigned long long hits, misses, evictions;
+		// Hits not yet reported to the metrics
+		u_int pendingHits;
+	};
+
+	string name;
+	u_int nSubdiv;
+	size_t maxShardBytes;
+	Shard shards[SHARD_COUNT];
+};
+
+} // namespace lux
+
+#endif // LUX_MICRODISPLACEMENTCACHE_H
@@ -26,6 +26,7 @@
 #include "dynload.h"
 
 #include "mesh.h"
+#include "assetcache.h"
 #include "./plymesh/rply.h"
 
 namespace lux
@@ -228,12 +229,29 @@ static void ErrorCB(const char *message)
 	LOG(LUX_ERROR, LUX_SYSTEM) << "PLY loader error: " << message;
 }
 
-Shape* PlyMesh::CreateShape(const Transform &o2w,
-		bool reverseOrientation, const ParamSet &params) {
-	string name = params.FindOneString("name", "'plymesh'");
-	const string filename = AdjustFilename(params.FindOneString("filename", "none"));
-	bool smooth = params.FindOneBool("smooth", false);
+// Decoded content of a PLY file, shared between jobs by the asset cache
+class PlyData {
+public:
+	PlyData() : nVerts(0), p(NULL), n(NULL), uv(NULL), cols(NULL),
+		alphas(NULL) { }
+	~PlyData() {
+		delete[] p;
+		delete[] n;
+		delete[] uv;
+		delete[] cols;
+		delete[] alphas;
+	}
 
+	int nVerts;
+	Point *p;
+	Normal *n;
+	float *uv, *cols, *alphas;
+	FaceData faceData;
+};
+
+static PlyData *ReadPlyFile(const string &name, const string &filename,
+	bool smooth)
+{
 	SHAPE_LOG(name, LUX_INFO,LUX_NOERROR) << "Loading PLY mesh file: '" << filename << "'...";
 
 	p_ply plyfile = ply_open(filename.c_str(), ErrorCB);
@@ -257,11 +275,13 @@ Shape* PlyMesh::CreateShape(const Transform &o2w,
 		return NULL;
 	}
 
-	FaceData faceData;
+	PlyData *data = new PlyData();
+	FaceData &faceData(data->faceData);
 	long plyNbFaces = ply_set_read_cb(plyfile, "face", "vertex_indices",
 		FaceCB, &faceData, 0);
 	if (plyNbFaces <= 0) {
 		SHAPE_LOG(name, LUX_ERROR,LUX_BADFILE) << "No faces found in '" << filename << "'";
+		delete data;
 		return NULL;
 	}
 
@@ -322,6 +342,7 @@ Shape* PlyMesh::CreateShape(const Transform &o2w,
 		delete[] uv;
 		delete[] cols;
 		delete[] alphas;
+		delete data;
 		return NULL;
 	}
 
@@ -422,8 +443,38 @@ Shape* PlyMesh::CreateShape(const Transform &o2w,
 		alphas = NULL;
 	}
 
-	const int *triVerts = plyNbTris > 0 ? &faceData.triVerts[0] : NULL;
-	const int *quadVerts = plyNbQuads > 0 ? &faceData.quadVerts[0] : NULL;
+	data->nVerts = plyNbVerts;
+	data->p = p;
+	data->n = n;
+	data->uv = uv;
+	data->cols = cols;
+	data->alphas = alphas;
+	return data;
+}
+
+Shape* PlyMesh::CreateShape(const Transform &o2w,
+		bool reverseOrientation, const ParamSet &params) {
+	string name = params.FindOneString("name", "'plymesh'");
+	const string filename = AdjustFilename(params.FindOneString("filename", "none"));
+	bool smooth = params.FindOneBool("smooth", false);
+
+	// The decoded file may be kept from a previous job
+	const string assetParams(smooth ? "smooth" : "");
+	boost::shared_ptr<PlyData> data(AssetCache::Find<PlyData>("plymesh",
+		filename, assetParams));
+	if (data)
+		SHAPE_LOG(name, LUX_INFO,LUX_NOERROR) << "Reusing cached PLY mesh file: '" << filename << "'";
+	else {
+		data.reset(ReadPlyFile(name, filename, smooth));
+		if (!data)
+			return NULL;
+		AssetCache::Insert("plymesh", filename, assetParams, data);
+	}
+
+	const int plyNbTris = data->faceData.triVerts.size() / 3;
+	const int plyNbQuads = data->faceData.quadVerts.size() / 4;
+	const int *triVerts = plyNbTris > 0 ? &data->faceData.triVerts[0] : NULL;
+	const int *quadVerts = plyNbQuads > 0 ? &data->faceData.quadVerts[0] : NULL;
 
 	// subdiv and displacement params
 	string displacementMapName = params.FindOneString("displacementmap", "");
@@ -465,19 +516,19 @@ Shape* PlyMesh::CreateShape(const Transform &o2w,
 
 	const float colorGamma = params.FindOneFloat("gamma", 1.f);
 
+	// Memory of the displaced grids cache in MB
+	const int displacementCacheSize = max(0, params.FindOneInt("dmcachesize", 64));
+
 	boost::shared_ptr<Texture<float> > dummytex;
 	Mesh *mesh = new Mesh(o2w, reverseOrientation, name, Mesh::ACCEL_AUTO,
-		plyNbVerts, p, n, uv, cols, alphas, colorGamma,
+		data->nVerts, data->p, data->n, data->uv, data->cols,
+		data->alphas, colorGamma,
 		Mesh::TRI_AUTO, plyNbTris, triVerts,
 		Mesh::QUAD_QUADRILATERAL, plyNbQuads, quadVerts, subdivType,
 		nsubdivlevels, displacementMap, displacementMapScale,
 		displacementMapOffset, displacementMapNormalSmooth,
 		displacementMapSharpBoundary, normalSplit, genTangents);
-	delete[] p;
-	delete[] n;
-	delete[] uv;
-	delete[] cols;
-	delete[] alphas;
+	mesh->SetDisplacementCacheSize(static_cast<size_t>(displacementCacheSize) * 1024 * 1024);
 	return mesh;
 }
 
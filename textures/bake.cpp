@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// bake.cpp*
+#include "bake.h"
+#include "dynload.h"
+
+using namespace lux;
+
+BakeSpace lux::ParseBakeParams(const ParamSet &tp, BBox *b, u_int *x,
+	u_int *y, u_int *z, ImageTextureFilterType *filter)
+{
+	const string sFilterType = tp.FindOneString("filtertype", "bilinear");
+	*filter = BILINEAR;
+	if (sFilterType == "mipmap_trilinear")
+		*filter = MIPMAP_TRILINEAR;
+	else if (sFilterType == "mipmap_ewa")
+		*filter = MIPMAP_EWA;
+	else if (sFilterType == "nearest")
+		*filter = NEAREST;
+
+	const string space = tp.FindOneString("space", "uv");
+	if (space == "global") {
+		*b = BBox(tp.FindOnePoint("p0", Point(0.f, 0.f, 0.f)),
+			tp.FindOnePoint("p1", Point(1.f, 1.f, 1.f)));
+		*x = max(tp.FindOneInt("nx", 64), 2);
+		*y = max(tp.FindOneInt("ny", 64), 2);
+		*z = max(tp.FindOneInt("nz", 64), 2);
+		return BAKE_GLOBAL;
+	}
+	if (space != "uv")
+		LOG(LUX_WARNING, LUX_BADTOKEN) << "Unknown bake space '" <<
+			space << "', using 'uv'";
+	u_int nItems;
+	const float *uv = tp.FindFloat("uvbounds", &nItems);
+	if (uv && nItems == 4)
+		*b = BBox(Point(uv[0], uv[1], 0.f), Point(uv[2], uv[3], 0.f));
+	else
+		*b = BBox(Point(0.f, 0.f, 0.f), Point(1.f, 1.f, 0.f));
+	*x = max(tp.FindOneInt("xresolution", 512), 2);
+	*y = max(tp.FindOneInt("yresolution", 512), 2);
+	*z = 1;
+	return BAKE_UV;
+}
+
+const ColorSystem &lux::BakeColorSystem()
+{
+	// sRGB primaries and D65 white point
+	static const ColorSystem cs(0.64f, 0.33f, 0.30f, 0.60f, 0.15f, 0.06f,
+		0.3127f, 0.3290f);
+	return cs;
+}
+
+static DynamicLoader::RegisterFloatTexture<BakedTexture<float> > r1("bake");
+static DynamicLoader::RegisterSWCSpectrumTexture<BakedTexture<SWCSpectrum> > r2("bake");
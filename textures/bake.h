@@ -0,0 +1,397 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.org                       *
+ ***************************************************************************/
+
+// bake.h*
+#include "lux.h"
+#include "luxrays/core/color/swcspectrum.h"
+#include "luxrays/core/color/spectrumwavelengths.h"
+#include "luxrays/core/color/color.h"
+#include "texture.h"
+#include "mipmap.h"
+#include "sparsegrid.h"
+#include "metrics.h"
+#include "geometry/raydifferential.h"
+#include "paramset.h"
+#include "error.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace lux
+{
+
+/**
+   Dense voxel grid stored in bricks of 8x8x8 voxels (the same layout as
+   SparseGrid) so that interpolated lookups stay in a few cache lines.
+   Each voxel holds a fixed number of float channels.
+*/
+class BrickCache {
+public:
+	BrickCache(u_int x, u_int y, u_int z, u_int ch) : nx(x), ny(y), nz(z),
+		bnx((x + SparseGrid::BRICK_MASK) >> SparseGrid::BRICK_SHIFT),
+		bny((y + SparseGrid::BRICK_MASK) >> SparseGrid::BRICK_SHIFT),
+		bnz((z + SparseGrid::BRICK_MASK) >> SparseGrid::BRICK_SHIFT),
+		channels(ch), data(bnx * bny * bnz * SparseGrid::BRICK_VOXELS * ch, 0.f) {
+		Metrics::AddMemory("textures", static_cast<double>(GetMemoryUsed()));
+	}
+	~BrickCache() {
+		Metrics::AddMemory("textures", -static_cast<double>(GetMemoryUsed()));
+	}
+
+	u_int Nx() const { return nx; }
+	u_int Ny() const { return ny; }
+	u_int Nz() const { return nz; }
+	size_t GetMemoryUsed() const { return data.size() * sizeof(float); }
+
+	float *Voxel(u_int x, u_int y, u_int z) {
+		return &data[Offset(x, y, z)];
+	}
+	/**
+	   Trilinearly interpolate the channels at (x, y, z) in voxel units,
+	   coordinates are clamped to the grid
+	*/
+	void Interpolate(float x, float y, float z, float *c) const {
+		x = luxrays::Clamp(x, 0.f, static_cast<float>(nx - 1));
+		y = luxrays::Clamp(y, 0.f, static_cast<float>(ny - 1));
+		z = luxrays::Clamp(z, 0.f, static_cast<float>(nz - 1));
+		const u_int x0 = luxrays::Floor2UInt(x), y0 = luxrays::Floor2UInt(y),
+			z0 = luxrays::Floor2UInt(z);
+		const u_int x1 = min(x0 + 1, nx - 1), y1 = min(y0 + 1, ny - 1),
+			z1 = min(z0 + 1, nz - 1);
+		const float dx = x - x0, dy = y - y0, dz = z - z0;
+		const float *v000 = &data[Offset(x0, y0, z0)];
+		const float *v100 = &data[Offset(x1, y0, z0)];
+		const float *v010 = &data[Offset(x0, y1, z0)];
+		const float *v110 = &data[Offset(x1, y1, z0)];
+		const float *v001 = &data[Offset(x0, y0, z1)];
+		const float *v101 = &data[Offset(x1, y0, z1)];
+		const float *v011 = &data[Offset(x0, y1, z1)];
+		const float *v111 = &data[Offset(x1, y1, z1)];
+		for (u_int i = 0; i < channels; ++i) {
+			const float v00 = luxrays::Lerp(dx, v000[i], v100[i]);
+			const float v10 = luxrays::Lerp(dx, v010[i], v110[i]);
+			const float v01 = luxrays::Lerp(dx, v001[i], v101[i]);
+			const float v11 = luxrays::Lerp(dx, v011[i], v111[i]);
+			c[i] = luxrays::Lerp(dz, luxrays::Lerp(dy, v00, v10),
+				luxrays::Lerp(dy, v01, v11));
+		}
+	}
+
+private:
+	size_t Offset(u_int x, u_int y, u_int z) const {
+		const size_t brick = ((z >> SparseGrid::BRICK_SHIFT) * bny +
+			(y >> SparseGrid::BRICK_SHIFT)) * bnx +
+			(x >> SparseGrid::BRICK_SHIFT);
+		const size_t voxel = (((z & SparseGrid::BRICK_MASK) <<
+			SparseGrid::BRICK_SHIFT) + (y & SparseGrid::BRICK_MASK)) *
+			SparseGrid::BRICK_SIZE + (x & SparseGrid::BRICK_MASK);
+		return (brick * SparseGrid::BRICK_VOXELS + voxel) * channels;
+	}
+
+	u_int nx, ny, nz, bnx, bny, bnz, channels;
+	vector<float> data;
+};
+
+enum BakeSpace { BAKE_UV, BAKE_GLOBAL };
+
+/**
+   Read the baked domain and resolution of a bake texture
+   @param tp the texture parameters
+   @param b filled with the baked domain, the x and y ranges are the
+   (u, v) ranges in uv space
+   @param x, y, z filled with the resolution, z is 1 in uv space
+   @param filter filled with the MIPMap filter used in uv space
+   @return the space of the baked domain
+*/
+BakeSpace ParseBakeParams(const ParamSet &tp, BBox *b, u_int *x, u_int *y,
+	u_int *z, ImageTextureFilterType *filter);
+
+// Color system used to bake spectra, the one of SWCSpectrum(sw, RGBColor)
+const ColorSystem &BakeColorSystem();
+
+/**
+   Procedural texture network evaluated once at scene creation and
+   replaced by a lookup at render time.
+   In "uv" space the subtree is sampled over a rectangle of the surface
+   (u, v) coordinates and stored in a MIPMap, in "global" space it is
+   sampled over a world space box and stored in a BrickCache. The subtree
+   must only depend on the coordinates of the chosen space: uv mappings
+   for "uv", global 3D mappings for "global". Points outside of the baked
+   domain, and illuminant textures, still evaluate the subtree.
+   Spectra are baked as RGB.
+*/
+template <class T> class BakedTexture : public Texture<T> {
+public:
+	BakedTexture(boost::shared_ptr<Texture<T> > &t, BakeSpace s,
+		u_int x, u_int y, u_int z, const BBox &b,
+		ImageTextureFilterType filter) :
+		Texture<T>("BakedTexture-" + boost::lexical_cast<string>(this)),
+		tex(t), space(s), nx(max(x, 2U)), ny(max(y, 2U)),
+		nz(max(z, 1U)), bounds(b), offset(0.f) {
+		Bake(filter);
+	}
+	virtual ~BakedTexture() { }
+
+	virtual T Evaluate(const SpectrumWavelengths &sw,
+		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
+		float c[3];
+		if (space == BAKE_UV) {
+			const float s = (dg.u - bounds.pMin.x) /
+				(bounds.pMax.x - bounds.pMin.x);
+			const float t = (dg.v - bounds.pMin.y) /
+				(bounds.pMax.y - bounds.pMin.y);
+			if (!mipmap || !(s >= 0.f && s <= 1.f && t >= 0.f && t <= 1.f))
+				return tex->Evaluate(sw, dg);
+			// Texel i is at i / nx in the MIPMap
+			return Lookup(sw, s * (nx - 1) / nx, t * (ny - 1) / ny);
+		}
+		if (!bricks || !bounds.Inside(dg.p))
+			return tex->Evaluate(sw, dg);
+		const Vector d(bounds.pMax - bounds.pMin);
+		bricks->Interpolate((dg.p.x - bounds.pMin.x) / d.x * (nx - 1),
+			(dg.p.y - bounds.pMin.y) / d.y * (ny - 1),
+			(dg.p.z - bounds.pMin.z) / d.z * (nz - 1), c);
+		return FromChannels(sw, c);
+	}
+	virtual float Y() const { return tex->Y(); }
+	virtual float Filter() const { return tex->Filter(); }
+	virtual void GetDuv(const SpectrumWavelengths &sw,
+		const DifferentialGeometry &dg, float delta,
+		float *du, float *dv) const {
+		// Generic derivative computation on the baked values
+		DifferentialGeometry dgTemp = dg;
+		const float base = this->EvalFloat(sw, dg);
+
+		const float uu = delta / dg.dpdu.Length();
+		dgTemp.p = dg.p + uu * dg.dpdu;
+		dgTemp.u = dg.u + uu;
+		*du = (this->EvalFloat(sw, dgTemp) - base) / uu;
+
+		const float vv = delta / dg.dpdv.Length();
+		dgTemp.p = dg.p + vv * dg.dpdv;
+		dgTemp.u = dg.u;
+		dgTemp.v = dg.v + vv;
+		*dv = (this->EvalFloat(sw, dgTemp) - base) / vv;
+	}
+	virtual void GetMinMaxFloat(float *minValue, float *maxValue) const {
+		tex->GetMinMaxFloat(minValue, maxValue);
+	}
+	virtual void SetIlluminant() {
+		// The baked values are reflectances, drop them
+		tex->SetIlluminant();
+		if (mipmap || bricks)
+			LOG(LUX_WARNING, LUX_UNIMPLEMENT) << "Illuminant textures are not baked";
+		mipmap.reset();
+		bricks.reset();
+	}
+
+	const Texture<T> *GetTex() const { return tex.get(); }
+
+	static Texture<float> *CreateFloatTexture(const Transform &tex2world, const ParamSet &tp);
+	static Texture<SWCSpectrum> *CreateSWCSpectrumTexture(const Transform &tex2world, const ParamSet &tp);
+
+private:
+	static u_int Channels();
+	void ToChannels(const DifferentialGeometry &dg, float *c) const;
+	T FromChannels(const SpectrumWavelengths &sw, const float *c) const;
+	T Lookup(const SpectrumWavelengths &sw, float s, float t) const;
+	MIPMap *CreateMIPMap(const vector<float> &texels,
+		ImageTextureFilterType filter);
+
+	void Bake(ImageTextureFilterType filter);
+	void BakeRows(vector<float> *texels, u_int first, u_int step);
+
+	boost::shared_ptr<Texture<T> > tex;
+	BakeSpace space;
+	u_int nx, ny, nz;
+	// Baked domain, the x and y ranges are the (u, v) ranges in uv space
+	BBox bounds;
+	// Added to the MIPMap values since texels can't be negative
+	float offset;
+	boost::scoped_ptr<MIPMap> mipmap;
+	boost::scoped_ptr<BrickCache> bricks;
+};
+
+template<> inline u_int BakedTexture<float>::Channels() { return 1; }
+template<> inline u_int BakedTexture<SWCSpectrum>::Channels() { return 3; }
+
+template<> inline void BakedTexture<float>::ToChannels(const DifferentialGeometry &dg,
+	float *c) const
+{
+	SpectrumWavelengths sw;
+	sw.Sample(.5f);
+	c[0] = tex->Evaluate(sw, dg);
+}
+template<> inline void BakedTexture<SWCSpectrum>::ToChannels(const DifferentialGeometry &dg,
+	float *c) const
+{
+	// Integrate over stratified wavelength sets and
+	// normalize against a white spectrum
+	const u_int nSets = 8;
+	XYZColor xyz(0.f), white(0.f);
+	SpectrumWavelengths sw;
+	for (u_int i = 0; i < nSets; ++i) {
+		sw.Sample((i + .5f) / nSets);
+		xyz += XYZColor(sw, tex->Evaluate(sw, dg));
+		white += XYZColor(sw, SWCSpectrum(1.f));
+	}
+	const RGBColor rgb(BakeColorSystem().ToRGBConstrained(xyz));
+	const RGBColor rgbWhite(BakeColorSystem().ToRGBConstrained(white));
+	for (u_int i = 0; i < 3; ++i)
+		c[i] = rgbWhite.c[i] > 0.f ? rgb.c[i] / rgbWhite.c[i] : 0.f;
+}
+
+template<> inline float BakedTexture<float>::FromChannels(const SpectrumWavelengths &sw,
+	const float *c) const
+{
+	return c[0];
+}
+template<> inline SWCSpectrum BakedTexture<SWCSpectrum>::FromChannels(const SpectrumWavelengths &sw,
+	const float *c) const
+{
+	return SWCSpectrum(sw, RGBColor(c[0], c[1], c[2]));
+}
+
+template<> inline float BakedTexture<float>::Lookup(const SpectrumWavelengths &sw,
+	float s, float t) const
+{
+	return mipmap->LookupFloat(CHANNEL_MEAN, s, t) - offset;
+}
+template<> inline SWCSpectrum BakedTexture<SWCSpectrum>::Lookup(const SpectrumWavelengths &sw,
+	float s, float t) const
+{
+	return mipmap->LookupSpectrum(sw, s, t);
+}
+
+template <class T> void BakedTexture<T>::BakeRows(vector<float> *texels,
+	u_int first, u_int step)
+{
+	const u_int channels = Channels();
+	const Vector d(bounds.pMax - bounds.pMin);
+	// In uv space the rows are the texel rows,
+	// in global space the rows are the (y, z) voxel rows
+	const u_int rows = space == BAKE_UV ? ny : ny * nz;
+	for (u_int row = first; row < rows; row += step) {
+		const u_int y = row % ny, z = row / ny;
+		for (u_int x = 0; x < nx; ++x) {
+			DifferentialGeometry dg;
+			dg.nn = Normal(0.f, 0.f, 1.f);
+			dg.dndu = dg.dndv = Normal(0.f, 0.f, 0.f);
+			dg.time = 0.f;
+			float *c;
+			if (space == BAKE_UV) {
+				dg.u = bounds.pMin.x + d.x * x / (nx - 1);
+				dg.v = bounds.pMin.y + d.y * y / (ny - 1);
+				dg.p = Point(dg.u, dg.v, 0.f);
+				dg.dpdu = Vector(1.f, 0.f, 0.f);
+				dg.dpdv = Vector(0.f, 1.f, 0.f);
+				c = &(*texels)[(y * nx + x) * channels];
+			} else {
+				dg.p = bounds.pMin + Vector(d.x * x / (nx - 1),
+					d.y * y / (ny - 1), d.z * z / (nz - 1));
+				dg.dpdu = Vector(d.x / (nx - 1), 0.f, 0.f);
+				dg.dpdv = Vector(0.f, d.y / (ny - 1), 0.f);
+				// Each voxel is written by a single thread
+				c = bricks->Voxel(x, y, z);
+			}
+			ToChannels(dg, c);
+		}
+	}
+}
+
+template <class T> void BakedTexture<T>::Bake(ImageTextureFilterType filter)
+{
+	vector<float> texels;
+	if (space == BAKE_UV)
+		texels.resize(nx * ny * Channels());
+	else
+		bricks.reset(new BrickCache(nx, ny, nz, Channels()));
+
+	// Texture evaluation is thread safe, spread the rows on all cores
+	const u_int nThreads = max(1U, boost::thread::hardware_concurrency());
+	boost::thread_group threads;
+	for (u_int i = 0; i < nThreads; ++i)
+		threads.create_thread(boost::bind(&BakedTexture<T>::BakeRows,
+			this, &texels, i, nThreads));
+	threads.join_all();
+
+	if (space == BAKE_UV) {
+		mipmap.reset(CreateMIPMap(texels, filter));
+		LOG(LUX_INFO, LUX_NOERROR) << "Baked texture to " << nx << "x" <<
+			ny << " texels, " << (mipmap->GetMemoryUsed() / 1024) <<
+			"KBytes";
+	} else
+		LOG(LUX_INFO, LUX_NOERROR) << "Baked texture to " << nx << "x" <<
+			ny << "x" << nz << " voxels, " <<
+			(bricks->GetMemoryUsed() / 1024) << "KBytes";
+}
+
+template<> inline MIPMap *BakedTexture<float>::CreateMIPMap(const vector<float> &texels,
+	ImageTextureFilterType filter)
+{
+	// Shift the values so that they are all positive
+	offset = -min(0.f, *std::min_element(texels.begin(), texels.end()));
+	vector<TextureColor<float, 1> > img(texels.size());
+	for (u_int i = 0; i < texels.size(); ++i)
+		img[i] = TextureColor<float, 1>(texels[i] + offset);
+	return new MIPMapFastImpl<TextureColor<float, 1> >(filter, nx, ny,
+		&img[0], 8.f, TEXTURE_CLAMP);
+}
+template<> inline MIPMap *BakedTexture<SWCSpectrum>::CreateMIPMap(const vector<float> &texels,
+	ImageTextureFilterType filter)
+{
+	vector<TextureColor<float, 3> > img(nx * ny);
+	for (u_int i = 0; i < img.size(); ++i) {
+		for (u_int j = 0; j < 3; ++j)
+			img[i].c[j] = texels[i * 3 + j];
+	}
+	return new MIPMapFastImpl<TextureColor<float, 3> >(filter, nx, ny,
+		&img[0], 8.f, TEXTURE_CLAMP);
+}
+
+// BakedTexture Method Definitions
+template <class T> Texture<float> *BakedTexture<T>::CreateFloatTexture(const Transform &tex2world,
+	const ParamSet &tp)
+{
+	boost::shared_ptr<Texture<float> > tex(tp.GetFloatTexture("tex", 1.f));
+	BBox b;
+	u_int x, y, z;
+	ImageTextureFilterType filter;
+	const BakeSpace space = ParseBakeParams(tp, &b, &x, &y, &z, &filter);
+	return new BakedTexture<float>(tex, space, x, y, z, b, filter);
+}
+
+template <class T> Texture<SWCSpectrum> *BakedTexture<T>::CreateSWCSpectrumTexture(const Transform &tex2world,
+	const ParamSet &tp)
+{
+	boost::shared_ptr<Texture<SWCSpectrum> > tex(tp.GetSWCSpectrumTexture("tex", RGBColor(1.f)));
+	BBox b;
+	u_int x, y, z;
+	ImageTextureFilterType filter;
+	const BakeSpace space = ParseBakeParams(tp, &b, &x, &y, &z, &filter);
+	return new BakedTexture<SWCSpectrum>(tex, space, x, y, z, b, filter);
+}
+
+}//namespace lux
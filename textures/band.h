@@ -49,6 +49,7 @@ public:
 	virtual ~BandTexture() { }
 	virtual T Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const float a = amount->Evaluate(sw, dg);
 		if (a < offsets.front())
 			return tex.front()->Evaluate(sw, dg);
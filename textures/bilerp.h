@@ -51,6 +51,7 @@ public:
 	virtual ~BilerpFloatTexture() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		float s, t;
 		mapping->Map(dg, &s, &t);
 		s -= luxrays::Floor2Int(s);
@@ -100,6 +101,7 @@ public:
 	virtual ~BilerpSpectrumTexture() { delete mapping; }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		float s, t;
 		mapping->Map(dg, &s, &t);
 		s -= luxrays::Floor2Int(s);
@@ -157,6 +159,7 @@ public:
 	virtual ~BilerpFresnelTexture() { delete mapping; }
 	virtual FresnelGeneral Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		float s, t;
 		mapping->Map(dg, &s, &t);
 		s -= luxrays::Floor2Int(s);
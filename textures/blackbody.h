@@ -40,6 +40,7 @@ public:
 	virtual ~BlackBodyTexture() { }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return SWCSpectrum(sw, BBSPD);
 	}
 	virtual float Y() const { return BBSPD.Y(); }
@@ -52,6 +52,7 @@ public:
 
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const Point P = mapping->Map(dg);
 		const float t1 = tex1->Evaluate(sw, dg);
 		const float t2 = tex2->Evaluate(sw, dg);
@@ -86,6 +86,7 @@ public:
 
 	virtual T Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const Point P(mapping->Map(dg));
 
 		const float offs = BRICK_EPSILON + mortarsize;
@@ -41,6 +41,7 @@ public:
 	virtual ~CauchyTexture() { }
 	virtual FresnelGeneral Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		SWCSpectrum e, k;
 		fresnel.ComplexEvaluate(sw, &e, &k);
 		return FresnelGeneral(DIELECTRIC_FRESNEL, e, k);
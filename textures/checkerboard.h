@@ -67,6 +67,7 @@ public:
 	}
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		switch (aaMethod) {
 /*			case CLOSEDFORM: {
 				float s, t, dsdx, dtdx, dsdy, dtdy;
@@ -231,6 +232,7 @@ public:
 	virtual ~Checkerboard3D() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const Point p(mapping->Map(dg));
 		if ((Floor2Int(p.x) + Floor2Int(p.y) + Floor2Int(p.z)) % 2 == 0)
 			return tex1->Evaluate(sw, dg);
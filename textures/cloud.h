@@ -87,6 +87,7 @@ public:
 	}
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const Point P(mapping->Map(dg));
 		const float amount = CloudShape(P +
 			turbulenceAmount * Turbulence(P, firstNoiseScale, numOctaves));
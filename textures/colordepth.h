@@ -39,6 +39,7 @@ public:
 	virtual ~ColorDepthTexture() { }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return Ln(color->Evaluate(sw, dg).Clamp(1e-9f, 1.f)) / d;
 	}
 	virtual float Y() const { return Filter(); }
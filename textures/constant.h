@@ -44,6 +44,7 @@ public:
 	virtual ~ConstantFloatTexture() { }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return value;
 	}
 	virtual float Y() const { return value; }
@@ -76,6 +77,7 @@ public:
 	virtual ~ConstantRGBColorTexture() { delete RGBSPD; }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return SWCSpectrum(sw, *RGBSPD);
 	}
 	virtual float Y() const { return RGBSPD->Y(); }
@@ -112,6 +114,7 @@ public:
 	virtual ~ConstantFresnelTexture() { }
 	virtual FresnelGeneral Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return value;
 	}
 	virtual float Y() const { return val; }
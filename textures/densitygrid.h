@@ -26,6 +26,7 @@
 #include "texture.h"
 #include "geometry/raydifferential.h"
 #include "paramset.h"
+#include "sparsegrid.h"
 #include <algorithm>
 #include <numeric>
 
@@ -47,9 +48,16 @@ public:
 		dMean = std::accumulate(density.begin(), density.end(), 0.f) /
 			density.size();
 	}
+	DensityGridTexture(const boost::shared_ptr<SparseGrid> &g,
+		enum WrapMode w, TextureMapping3D *map) :
+		Texture("DensityGridTexture-" + boost::lexical_cast<string>(this)),
+		nx(g->Nx()), ny(g->Ny()), nz(g->Nz()), wrapMode(w), grid(g),
+		mapping(map), dMin(g->MinValue()), dMax(g->MaxValue()),
+		dMean(g->MeanValue()) { }
 	virtual ~DensityGridTexture() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const Point P(mapping->Map(dg));
 		float x, y, z;
 		int vx, vy, vz;
@@ -113,6 +121,8 @@ public:
 			return 0.f;
 		}
 		// Trilinear interpolation of the grid element
+		if (grid)
+			return grid->Interpolate(vx, vy, vz, x, y, z);
 		return luxrays::Lerp(z,
 			luxrays::Lerp(y, luxrays::Lerp(x, D(vx, vy, vz), D(vx + 1, vy, vz)),
 			luxrays::Lerp(x, D(vx, vy + 1, vz), D(vx + 1, vy + 1, vz))),
@@ -158,12 +168,16 @@ public:
 	static Texture<float> * CreateFloatTexture(const Transform &tex2world, const ParamSet &tp);
 private:
 	float D(int x, int y, int z) const {
+		if (grid)
+			return grid->D(x, y, z);
 		return density[((luxrays::Clamp(z, 0, nz - 1) * ny) + luxrays::Clamp(y, 0, ny - 1)) * nx + luxrays::Clamp(x, 0, nx - 1)];
 	}
 	// DensityGridTexture Private Data
 	int nx, ny, nz;
 	enum WrapMode wrapMode;
 	vector<float> density;
+	// Memory mapped sparse voxels used instead of density if set
+	boost::shared_ptr<SparseGrid> grid;
 	TextureMapping3D *mapping;
 	float dMin, dMax, dMean;
 };
@@ -173,21 +187,32 @@ private:
 inline Texture<float> * DensityGridTexture::CreateFloatTexture(const Transform &tex2world,
 	const ParamSet &tp)
 {
-	// Read density values
-	u_int nItems;
-	const float *data = tp.FindFloat("density", &nItems);
-	if (!data) {
-		LOG(LUX_ERROR, LUX_MISSINGDATA) << "No \"density\" values provided for density grid?";
-		return NULL;
-	}
-	int nx = tp.FindOneInt("nx", 1);
-	int ny = tp.FindOneInt("ny", 1);
-	int nz = tp.FindOneInt("nz", 1);
-	if (nItems != static_cast<u_int>(nx * ny * nz)) {
-		LOG(LUX_ERROR, LUX_CONSISTENCY) <<
-			"DensityGrid has " << nItems <<
-			" density values but nx*ny*nz = " << nx * ny * nz;
-		return NULL;
+	// Read density values, a sparse grid file takes precedence over
+	// inline values
+	boost::shared_ptr<SparseGrid> grid;
+	const string filename = AdjustFilename(tp.FindOneString("filename", ""));
+	u_int nItems = 0;
+	const float *data = NULL;
+	int nx = 1, ny = 1, nz = 1;
+	if (filename != "") {
+		grid.reset(new SparseGrid());
+		if (!grid->Load(filename))
+			return NULL;
+	} else {
+		data = tp.FindFloat("density", &nItems);
+		if (!data) {
+			LOG(LUX_ERROR, LUX_MISSINGDATA) << "No \"density\" values or \"filename\" provided for density grid?";
+			return NULL;
+		}
+		nx = tp.FindOneInt("nx", 1);
+		ny = tp.FindOneInt("ny", 1);
+		nz = tp.FindOneInt("nz", 1);
+		if (nItems != static_cast<u_int>(nx * ny * nz)) {
+			LOG(LUX_ERROR, LUX_CONSISTENCY) <<
+				"DensityGrid has " << nItems <<
+				" density values but nx*ny*nz = " << nx * ny * nz;
+			return NULL;
+		}
 	}
 	// Read wrap mode
 	enum WrapMode wrapMode = WRAP_REPEAT;
@@ -202,6 +227,8 @@ inline Texture<float> * DensityGridTexture::CreateFloatTexture(const Transform &
 		wrapMode = WRAP_WHITE;
 	// Read mapping coordinates
 	TextureMapping3D *imap = TextureMapping3D::Create(tex2world, tp);
+	if (grid)
+		return new DensityGridTexture(grid, wrapMode, imap);
 	return new DensityGridTexture(nx, ny, nz, data, wrapMode, imap);
 }
 
@@ -42,6 +42,7 @@ public:
 	virtual ~DotsTexture() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		// Compute cell indices for dots
 		float s, t;
 		mapping->Map(dg, &s, &t);
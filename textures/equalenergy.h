@@ -40,6 +40,7 @@ public:
 	virtual ~EqualEnergyTexture() { }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return SWCSpectrum(e);
 	}
 	virtual float Y() const { return EqualSPD(e).Y(); }
@@ -41,6 +41,7 @@ public:
 	virtual ~ExponentialTexture() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const Point P(mapping->Map(dg));
 		return luxrays::Clamp(expf(-decay * Dot(P - origin, upDir)), 0.f, 1.f);
 	}
@@ -45,6 +45,7 @@ public:
 	virtual ~FBmTexture() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const Point P(mapping->Map(dg));
 		return FBm(P, 0.f, 0.f, omega, octaves);
 	}
@@ -41,6 +41,7 @@ public:
 	virtual ~FrequencyTexture() { }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return SWCSpectrum(sw, FSPD);
 	}
 	virtual float Y() const { return FSPD.Y(); }
@@ -39,6 +39,7 @@ public:
 	virtual ~FresnelColorTexture() { }
 	virtual FresnelGeneral Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		SWCSpectrum c(color->Evaluate(sw, dg));
 		return FresnelGeneral(FULL_FRESNEL,
 			FresnelApproxEta(c), FresnelApproxK(c));
@@ -41,6 +41,7 @@ public:
 	virtual ~GaussianTexture() { }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return SWCSpectrum(sw, GSPD);
 	}
 	virtual float Y() const { return GSPD.Y(); }
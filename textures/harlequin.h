@@ -54,6 +54,7 @@ public:
 
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		// Dade - I assume object are 8 bytes aligned
 		u_long lookupIndex = (((u_long)dg.handle) &
 				((HARLEQUIN_TEXTURE_PALETTE_SIZE-1) << 3)) >> 3;
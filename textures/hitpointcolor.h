@@ -35,6 +35,7 @@ public:
 	virtual ~HitPointAlphaTexture() { }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dgs) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		RGBColor color;
 		float alpha;
 		dgs.handle->GetShadingInformation(dgs, &color, &alpha);
@@ -59,6 +60,7 @@ public:
 	virtual ~HitPointRGBColorTexture() { }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dgs) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		RGBColor color;
 		float alpha;
 		dgs.handle->GetShadingInformation(dgs, &color, &alpha);
@@ -84,6 +86,7 @@ public:
 	virtual ~HitPointGreyTexture() { }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dgs) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		RGBColor color;
 		float alpha;
 		dgs.handle->GetShadingInformation(dgs, &color, &alpha);
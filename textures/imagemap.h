@@ -30,8 +30,10 @@ using luxrays::RGBIllumSPD;
 #include "imagereader.h"
 #include "paramset.h"
 #include "error.h"
+#include "assetcache.h"
 #include <map>
 using std::map;
+#include <sstream>
 
 // TODO - radiance - add methods for Power and Illuminant propagation
 
@@ -81,9 +83,11 @@ public:
 		// If the map isn't used anymore, remove it from the cache
 		// The last user still has 2 references:
 		// 1 from the texture and 1 from the dictionary
+		// plus 1 if the asset cache keeps it for the next jobs
+		const long lastUse = AssetCache::IsCached(mipmap.get()) ? 3 : 2;
 		for (map<TexInfo, boost::shared_ptr<MIPMap> >::iterator t = textures.begin(); t != textures.end(); ++t) {
 			if ((*t).second.get() == mipmap.get() &&
-				(*t).second.use_count() == 2) {
+				(*t).second.use_count() == lastUse) {
 				textures.erase(t);
 				break;
 			}
@@ -120,6 +124,7 @@ public:
 
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		float s, t;
 		mapping->Map(dg, &s, &t);
 		return mipmap->LookupFloat(channel, s, t);
@@ -162,6 +167,7 @@ public:
 
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		float s, t;
 		mapping->Map(dg, &s, &t);
 		if (isIlluminant)
@@ -210,6 +216,7 @@ public:
 
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return 0.f;
 	}
 	virtual float Y() const {
@@ -238,8 +245,21 @@ inline boost::shared_ptr<MIPMap> ImageTexture::GetTexture(const TexInfo &texInfo
 			texInfo.filename << "'";
 		return textures[texInfo];
 	}
+	// Look for texture from a previous job in the asset cache
+	std::ostringstream assetParams;
+	assetParams << texInfo.filterType << " " << texInfo.discardmm << " " <<
+		texInfo.maxAniso << " " << texInfo.wrapMode << " " <<
+		texInfo.gain << " " << texInfo.gamma;
+	boost::shared_ptr<MIPMap> ret(AssetCache::Find<MIPMap>("mipmap",
+		texInfo.filename, assetParams.str()));
+	if (ret) {
+		LOG(LUX_INFO, LUX_NOERROR) << "Reusing cached data for imagemap '" <<
+			texInfo.filename << "'";
+		textures[texInfo] = ret;
+		return ret;
+	}
 	std::auto_ptr<ImageData> imgdata(ReadImage(texInfo.filename));
-	boost::shared_ptr<MIPMap> ret;
+	const bool cacheable = imgdata.get() != NULL;
 	if (imgdata.get() != NULL) {
 		ret = boost::shared_ptr<MIPMap>(imgdata->createMIPMap(
 				texInfo.filterType, texInfo.maxAniso, texInfo.wrapMode, texInfo.gain, texInfo.gamma));
@@ -264,6 +284,9 @@ inline boost::shared_ptr<MIPMap> ImageTexture::GetTexture(const TexInfo &texInfo
 			"KBytes";
 
 		textures[texInfo] = ret;
+		if (cacheable)
+			AssetCache::Insert("mipmap", texInfo.filename,
+				assetParams.str(), ret);
 		return textures[texInfo];
 	}
 	LOG(LUX_ERROR, LUX_SYSTEM) << "Creation of imagemap '" << texInfo.filename <<
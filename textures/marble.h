@@ -48,6 +48,7 @@ public:
 	}
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		Point P(mapping->Map(dg));
 		P *= scale;
 		float marble = P.y + variation * FBm(P, 0.f, 0.f, omega,
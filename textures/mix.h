@@ -44,6 +44,7 @@ public:
 	virtual ~MixTexture() { }
 	virtual T Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		T t1 = tex1->Evaluate(sw, dg), t2 = tex2->Evaluate(sw, dg);
 		float amt = amount->Evaluate(sw, dg);
 		return luxrays::Lerp(amt, t1, t2);
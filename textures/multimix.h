@@ -49,6 +49,7 @@ public:
 	virtual T Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const
 	{
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		T ret = 0.f;
 		for (u_int i = 0; i < tex.size(); ++i)
 		{
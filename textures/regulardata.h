@@ -41,6 +41,7 @@ public:
 	virtual ~RegularDataTexture() { }
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return SWCSpectrum(sw, SPD);
 	}
 	virtual float Y() const { return SPD.Y(); }
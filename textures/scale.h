@@ -47,6 +47,7 @@ public:
 	virtual ~ScaleTexture() { }
 	virtual T2 Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return tex1->Evaluate(sw, dg) * tex2->Evaluate(sw, dg);
 	}
 	// In Y() one of the textures must use Filter to avoid double W->lm conv
@@ -54,6 +54,7 @@ public:
 	virtual ~SellmeierTexture() { }
 	virtual FresnelGeneral Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		const SWCSpectrum w(sw.w);
 		const SWCSpectrum w2(w * w);
 		SWCSpectrum ior2(a);
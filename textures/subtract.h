@@ -52,6 +52,7 @@ public:
 	}
 
 	virtual T2 Evaluate(const SpectrumWavelengths &sw, const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		return tex1->Evaluate(sw, dg) - tex2->Evaluate(sw, dg);
 	}
 	
@@ -44,6 +44,7 @@ public:
 	virtual ~TabulatedFresnel() { }
 	virtual FresnelGeneral Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		// FIXME - Try to detect the best model to use
 		// FIXME - FresnelGeneral should take a float index for accurate
 		// non dispersive behaviour
@@ -44,6 +44,7 @@ public:
 	}
 	virtual SWCSpectrum Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		float s, t;
 		mapping->Map(dg, &s, &t);
 		const float cs[COLOR_SAMPLES] = { s - luxrays::Floor2Int(s), t - luxrays::Floor2Int(t), 0.f };
@@ -47,6 +47,7 @@ public:
 
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		float s, t;
 		mapping->Map(dg, &s, &t);
 		if (s < 0.f || s > 1.f || t < 0.f || t > 1.f)
@@ -41,6 +41,7 @@ public:
 	virtual ~WindyTexture() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		Point P(mapping->Map(dg));
 		float windStrength = FBm(.1f * P, 0.f, 0.f, .5f, 3);
 		float waveHeight = FBm(P, 0.f, 0.f, .5f, 6);
@@ -45,6 +45,7 @@ public:
 	virtual ~WrinkledTexture() { delete mapping; }
 	virtual float Evaluate(const SpectrumWavelengths &sw,
 		const DifferentialGeometry &dg) const {
+		LUX_COUNT(TEXTURE_EVALUATIONS);
 		Point P(mapping->Map(dg));
 		return Turbulence(P, 0.f, 0.f, omega, octaves);
 	}
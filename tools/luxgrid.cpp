@@ -0,0 +1,170 @@
+/***************************************************************************
+ *   Copyright (C) 1998-2013 by authors (see AUTHORS.txt)                  *
+ *                                                                         *
+ *   This file is part of LuxRender.                                       *
+ *                                                                         *
+ *   Lux Renderer is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 3 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   Lux Renderer is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                         *
+ *   This project is based on PBRT ; see http://www.pbrt.org               *
+ *   Lux Renderer website : http://www.luxrender.net                       *
+ ***************************************************************************/
+
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "api.h"
+#include "error.h"
+#include "osfunc.h"
+#include "sparsegrid.h"
+
+#include <boost/program_options.hpp>
+
+using namespace lux;
+namespace po = boost::program_options;
+
+// Read a dense grid of nx * ny * nz little endian 32 bit floats, x varies
+// fastest like the "density" parameter of the volume grid
+static bool ReadDenseGrid(const std::string &fileName, int nx, int ny, int nz,
+	std::vector<float> &data) {
+	std::ifstream in(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+	if (!in) {
+		LOG(LUX_SEVERE,LUX_NOFILE) << "Unable to open file '" << fileName << "'";
+		return false;
+	}
+	const size_t count = static_cast<size_t>(nx) * ny * nz;
+	in.seekg(0, std::ios_base::end);
+	const std::streamoff size = in.tellg();
+	in.seekg(0, std::ios_base::beg);
+	if (size < 0 || static_cast<size_t>(size) != count * sizeof(float)) {
+		LOG(LUX_SEVERE,LUX_BADFILE) << "'" << fileName << "' holds " << size <<
+			" bytes, " << count * sizeof(float) << " were expected for a " <<
+			nx << "x" << ny << "x" << nz << " grid";
+		return false;
+	}
+
+	data.resize(count);
+	const bool isLittleEndian = osIsLittleEndian();
+	for (size_t i = 0; i < count; ++i)
+		data[i] = osReadLittleEndianFloat(isLittleEndian, in);
+	if (!in.good()) {
+		LOG(LUX_SEVERE,LUX_SYSTEM) << "Error while reading '" << fileName << "'";
+		return false;
+	}
+	return true;
+}
+
+int main(int ac, char *av[]) {
+
+	try {
+		// Declare a group of options that will be
+		// allowed only on command line
+		po::options_description generic("Generic options");
+		generic.add_options()
+				("version,v", "Print version string")
+				("help,h", "Produce help message")
+				("verbose,V", "Increase output verbosity (show DEBUG messages)")
+				("quiet,q", "Reduce output verbosity (hide INFO messages)")
+				("nx,x", po::value< int >(), "Number of voxels along x")
+				("ny,y", po::value< int >(), "Number of voxels along y")
+				("nz,z", po::value< int >(), "Number of voxels along z")
+				("background,b", po::value< float >()->default_value(0.f), "Value of the voxels that are not stored")
+				("tolerance,t", po::value< float >()->default_value(0.f), "Largest difference to the background for a voxel to be considered empty")
+				;
+
+		// Hidden options, will be allowed both on command line and
+		// in config file, but will not be shown to the user.
+		po::options_description hidden("Hidden options");
+		hidden.add_options()
+				("input-file", po::value< vector<string> >(), "input file")
+				;
+
+		po::options_description cmdline_options;
+		cmdline_options.add(generic).add(hidden);
+
+		po::options_description visible("Allowed options");
+		visible.add(generic);
+
+		po::positional_options_description p;
+
+		p.add("input-file", -1);
+
+		po::variables_map vm;
+		store(po::command_line_parser(ac, av).
+				options(cmdline_options).positional(p).run(), vm);
+
+		if (vm.count("help")) {
+			LOG( LUX_ERROR,LUX_SYSTEM) << "Usage: luxgrid [options] --nx <x> --ny <y> --nz <z> <raw float file> <sparse grid file>\n" << visible;
+			return 0;
+		}
+
+		LOG(LUX_INFO,LUX_NOERROR) << "Lux version " << luxVersion() << " of " << __DATE__ << " at " << __TIME__;
+
+		if (vm.count("version"))
+			return 0;
+
+		if (vm.count("verbose")) {
+			luxErrorFilter(LUX_DEBUG);
+		}
+
+		if (vm.count("quiet")) {
+			luxErrorFilter(LUX_WARNING);
+		}
+
+		if (!vm.count("nx") || !vm.count("ny") || !vm.count("nz")) {
+			LOG( LUX_ERROR,LUX_SYSTEM) << "luxgrid: missing grid resolution";
+			return 1;
+		}
+		const int nx = vm["nx"].as<int>();
+		const int ny = vm["ny"].as<int>();
+		const int nz = vm["nz"].as<int>();
+		if (nx <= 0 || ny <= 0 || nz <= 0) {
+			LOG( LUX_ERROR,LUX_SYSTEM) << "luxgrid: invalid grid resolution " << nx << "x" << ny << "x" << nz;
+			return 1;
+		}
+
+		if (!vm.count("input-file")) {
+			LOG( LUX_ERROR,LUX_SYSTEM) << "luxgrid: missing input files";
+			return 1;
+		}
+		const std::vector<std::string> &v = vm["input-file"].as < vector<string> > ();
+		if (v.size() != 2) {
+			LOG( LUX_ERROR,LUX_SYSTEM) << "luxgrid: wrong input files count";
+			return 1;
+		}
+
+		std::vector<float> data;
+		if (!ReadDenseGrid(v[0], nx, ny, nz, data))
+			return 2;
+
+		const int nBricks = SparseGrid::Write(v[1], nx, ny, nz, &data[0],
+			vm["background"].as<float>(), vm["tolerance"].as<float>());
+		if (nBricks < 0)
+			return 3;
+
+		const int bnx = (nx + SparseGrid::BRICK_MASK) >> SparseGrid::BRICK_SHIFT;
+		const int bny = (ny + SparseGrid::BRICK_MASK) >> SparseGrid::BRICK_SHIFT;
+		const int bnz = (nz + SparseGrid::BRICK_MASK) >> SparseGrid::BRICK_SHIFT;
+		LOG( LUX_INFO,LUX_NOERROR) << "Sparse grid '" << v[1] << "': " <<
+			nBricks << "/" << static_cast<size_t>(bnx) * bny * bnz << " bricks stored";
+	} catch (std::exception & e) {
+		LOG(LUX_SEVERE,LUX_SYNTAX) << "Command line argument parsing failed with error '" << e.what() << "', please use the --help option to view the allowed syntax.";
+		return 1;
+	}
+
+	return 0;
+}
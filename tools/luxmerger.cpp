@@ -34,6 +34,7 @@
 
 #include <boost/program_options.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -46,6 +47,144 @@
 using namespace lux;
 namespace po = boost::program_options;
 
+// Pairwise reduction of FLM files: the workers load the files and merge the
+// loaded films two by two as soon as possible, so that several loads and
+// merges run concurrently while at most maxFilms films are in memory.
+// The base film always receives the merges so that its unselected light
+// groups and pixels are kept.
+class FilmReduction {
+public:
+	FilmReduction(Film *baseFilm, const vector<string> &fileNames,
+		const FlmSelection &sel, u_int max) : base(baseFilm),
+		files(fileNames), selection(sel), nextFile(0), inFlight(1),
+		busy(0), maxFilms(std::max(max, 2U)), mergedCount(0),
+		mergedBytes(0.), mergedPixels(0.) {
+		ready.push_back(base);
+	}
+
+	void Run(u_int nThreads) {
+		boost::thread_group threads;
+		for (u_int i = 0; i < nThreads; ++i)
+			threads.create_thread(boost::bind(&FilmReduction::Worker, this));
+		threads.join_all();
+	}
+
+	u_int GetMergedCount() const { return mergedCount; }
+	double GetMergedBytes() const { return mergedBytes; }
+	double GetMergedPixels() const { return mergedPixels; }
+
+private:
+	void Worker() {
+		boost::mutex::scoped_lock lock(mutex);
+		for (;;) {
+			if (ready.size() >= 2) {
+				Film *film = ready.back();
+				ready.pop_back();
+				Film *other = ready.back();
+				ready.pop_back();
+				if (other == base)
+					std::swap(film, other);
+				++busy;
+				lock.unlock();
+
+				if (film->MergeFilm(*other, selection) <= 0.)
+					LOG(LUX_SEVERE, LUX_SYSTEM) << "Error merging films";
+				delete other;
+
+				lock.lock();
+				--busy;
+				--inFlight;
+				ready.push_back(film);
+				condition.notify_all();
+			} else if (nextFile < files.size() && inFlight < maxFilms) {
+				const string &fileName(files[nextFile++]);
+				++inFlight;
+				++busy;
+				lock.unlock();
+
+				Film *film = Load(fileName);
+				boost::uintmax_t fileSize = 0;
+				if (film) {
+					boost::system::error_code ec;
+					fileSize = boost::filesystem::file_size(fileName, ec);
+					if (ec) {
+						LOG( LUX_SEVERE,LUX_NOFILE) << "Error checking the size of FLM file '" << fileName << "': " << ec.message() << ", skipping it";
+						delete film;
+						film = NULL;
+					}
+				}
+
+				lock.lock();
+				--busy;
+				if (film) {
+					ready.push_back(film);
+					++mergedCount;
+					mergedBytes += fileSize;
+					mergedPixels += static_cast<double>(film->GetXPixelCount()) *
+						film->GetYPixelCount() * film->GetNumBufferGroups();
+				} else
+					--inFlight;
+				condition.notify_all();
+			} else if (nextFile >= files.size() && busy == 0) {
+				// Nothing left to load and nobody to produce
+				// another film to merge
+				return;
+			} else
+				condition.wait(lock);
+		}
+	}
+
+	Film *Load(const string &fileName) {
+		// Only the selected part of the file is read in an empty film
+		Film *film = FlexImageFilm::CreateFilmFromFLM(fileName, false);
+		if (!film) {
+			LOG( LUX_SEVERE,LUX_NOFILE) << "Error reading FLM file '" << fileName << "'";
+			return NULL;
+		}
+
+		LOG( LUX_INFO,LUX_NOERROR)<< "Merging FLM file " << fileName;
+		const double newSamples = film->MergeFilmFromFile(fileName, selection);
+		if (newSamples <= 0.) {
+			LOG( LUX_SEVERE,LUX_NOFILE) << "Error reading FLM file '" << fileName << "'";
+			delete film;
+			return NULL;
+		}
+		LOG( LUX_DEBUG,LUX_NOERROR) << "Merged " << newSamples << " samples from FLM file";
+		return film;
+	}
+
+	Film *base;
+	const vector<string> &files;
+	const FlmSelection &selection;
+	// All the members below are protected by the mutex
+	boost::mutex mutex;
+	boost::condition_variable condition;
+	vector<Film *> ready;
+	size_t nextFile;
+	// Number of films in memory, including the ones being loaded or merged
+	u_int inFlight;
+	// Number of workers loading or merging a film
+	u_int busy;
+	u_int maxFilms;
+	u_int mergedCount;
+	double mergedBytes, mergedPixels;
+};
+
+// Parse a comma separated list of unsigned integers
+static bool ParseList(const string &s, vector<u_int> &values)
+{
+	std::stringstream ss(s);
+	string item;
+	while (std::getline(ss, item, ',')) {
+		std::stringstream is(item);
+		u_int value;
+		if (!(is >> value))
+			return false;
+		values.push_back(value);
+	}
+	return !values.empty();
+}
+
 int main(int ac, char *av[]) {
 
 	try {
@@ -59,6 +198,10 @@ int main(int ac, char *av[]) {
 				("help,h", "Produce help message")
 				("debug,d", "Enable debug mode")
 				("output,o", po::value< std::string >()->default_value("merged.flm"), "Output file")
+				("threads,t", po::value< unsigned int >()->default_value(0), "Number of merging threads (0 for one per core)")
+				("max-films,m", po::value< unsigned int >()->default_value(0), "Maximum number of films in memory (0 for twice the number of threads)")
+				("light-groups,l", po::value< std::string >(), "Comma separated indices of the light groups to merge from the additional files")
+				("region,r", po::value< std::string >(), "Pixel region to merge from the additional files, as xstart,xend,ystart,yend with end excluded")
 				("save-png,s", "Output PNG tone-mapped image")
 				("verbose,V", "Increase output verbosity (show DEBUG messages)")
 				("quiet,q", "Reduce output verbosity (hide INFO messages)") // (give once for WARNING only, twice for ERROR only)")
@@ -115,7 +258,34 @@ int main(int ac, char *av[]) {
 		luxInit();
 
 		if (vm.count("input-file")) {
+			// Optional selection of what is merged from the additional files
+			FlmSelection selection;
+			if (vm.count("light-groups")) {
+				vector<u_int> groups;
+				if (!ParseList(vm["light-groups"].as<string>(), groups)) {
+					LOG( LUX_SEVERE,LUX_SYNTAX) << "Invalid light group list '" << vm["light-groups"].as<string>() << "'";
+					return 1;
+				}
+				for (u_int i = 0; i < groups.size(); ++i) {
+					if (groups[i] >= selection.groups.size())
+						selection.groups.resize(groups[i] + 1, false);
+					selection.groups[groups[i]] = true;
+				}
+			}
+			if (vm.count("region")) {
+				vector<u_int> region;
+				if (!ParseList(vm["region"].as<string>(), region) || region.size() != 4) {
+					LOG( LUX_SEVERE,LUX_SYNTAX) << "Invalid region '" << vm["region"].as<string>() << "'";
+					return 1;
+				}
+				selection.xStart = region[0];
+				selection.xEnd = region[1];
+				selection.yStart = region[2];
+				selection.yEnd = region[3];
+			}
+
 			const std::vector<std::string> &v = vm["input-file"].as < vector<string> > ();
+			vector<string> fileNames;
 			for (unsigned int i = 0; i < v.size(); i++) {
 				boost::filesystem::path fullPath(boost::filesystem::system_complete(v[i]));
 
@@ -133,27 +303,34 @@ int main(int ac, char *av[]) {
 						LOG( LUX_SEVERE,LUX_NOFILE) << "Error reading FLM file '" << flmFileName << "'";
 						continue;
 					}
+					mergedCount++;
 				} else {
 					// additional flm file
-					std::ifstream ifs(flmFileName.c_str(), std::ios_base::in | std::ios_base::binary);
-
-					if(ifs.good()) {
-						// read the data
-						LOG( LUX_INFO,LUX_NOERROR)<< "Merging FLM file " << flmFileName;
-						float newSamples = film->MergeFilmFromStream(ifs);
-						if (newSamples <= 0) {
-							LOG( LUX_SEVERE,LUX_NOFILE) << "Error reading FLM file '" << flmFileName << "'";
-							ifs.close();
-							continue;
-						} else {
-							LOG( LUX_DEBUG,LUX_NOERROR) << "Merged " << newSamples << " samples from FLM file";
-						}
-					}
-
-					ifs.close();
+					fileNames.push_back(flmFileName);
 				}
+			}
 
-				mergedCount++;
+			if (film && !fileNames.empty()) {
+				u_int nThreads = vm["threads"].as<unsigned int>();
+				if (nThreads == 0)
+					nThreads = std::max(1U, boost::thread::hardware_concurrency());
+				u_int maxFilms = vm["max-films"].as<unsigned int>();
+				if (maxFilms == 0)
+					maxFilms = 2 * nThreads;
+
+				LOG( LUX_INFO,LUX_NOERROR) << "Merging " << fileNames.size() << " FLM files with " <<
+					nThreads << " threads and at most " << maxFilms << " films in memory";
+
+				const boost::posix_time::ptime start(boost::posix_time::microsec_clock::universal_time());
+				FilmReduction reduction(film.get(), fileNames, selection, maxFilms);
+				reduction.Run(nThreads);
+				const double elapsed = std::max(1e-3, (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6);
+
+				mergedCount += reduction.GetMergedCount();
+				LOG( LUX_INFO,LUX_NOERROR) << "Merged " << reduction.GetMergedCount() << " FLM files in " <<
+					std::fixed << std::setprecision(1) << elapsed << "s (" <<
+					reduction.GetMergedBytes() / (1024. * 1024. * elapsed) << " MB/s, " <<
+					reduction.GetMergedPixels() / elapsed << " pixels/s)";
 			}
 
 			luxCleanup();
@@ -61,6 +61,7 @@ public:
 	}
 	virtual SWCSpectrum Tau(const SpectrumWavelengths &sw, const Ray &ray,
 		float step = 1.f, float offset = .5f) const {
+		LUX_COUNT_TIMED(VOLUME_TAUS);
 		DifferentialGeometry dg;
 		dg.p = ray.o;
 		dg.nn = Normal(-ray.d);
@@ -82,6 +83,7 @@ public:
 	bool Scatter(const Sample &sample, bool scatteredStart, const Ray &ray,
 		float u, Intersection *isect, float *pdf, float *pdfBack,
 		SWCSpectrum *L) const {
+		LUX_COUNT_TIMED(VOLUME_SCATTERS);
 		if (L)
 			*L *= Exp(-Tau(sample.swl, ray));
 		if (pdf)
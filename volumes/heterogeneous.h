@@ -64,6 +64,7 @@ public:
 	}
 	virtual SWCSpectrum Tau(const SpectrumWavelengths &sw, const Ray &ray,
 		float step = 1.f, float offset = .5f) const {
+		LUX_COUNT_TIMED(VOLUME_TAUS);
 		// Evaluate the scattering at the path origin
 		DifferentialGeometry dg;
 		dg.p = ray(ray.mint);
@@ -102,6 +103,7 @@ public:
 	bool Scatter(const Sample &sample, bool scatteredStart, const Ray &ray,
 		float u, Intersection *isect, float *pdf, float *pdfBack,
 		SWCSpectrum *L) const {
+		LUX_COUNT_TIMED(VOLUME_SCATTERS);
 		const SpectrumWavelengths &sw = sample.swl;
 		// Evaluate the scattering at the path origin
 		DifferentialGeometry dg;
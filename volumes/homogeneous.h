@@ -61,6 +61,7 @@ public:
 	}
 	virtual SWCSpectrum Tau(const SpectrumWavelengths &sw, const Ray &ray,
 		float step = 1.f, float offset = .5f) const {
+		LUX_COUNT_TIMED(VOLUME_TAUS);
 		DifferentialGeometry dg;
 		dg.p = ray.o;
 		dg.nn = Normal(-ray.d);
@@ -83,6 +84,7 @@ public:
 	bool Scatter(const Sample &sample, bool scatteredStart, const Ray &ray,
 		float u, Intersection *isect, float *pdf, float *pdfBack,
 		SWCSpectrum *L) const {
+		LUX_COUNT_TIMED(VOLUME_SCATTERS);
 		// Determine scattering distance
 		const float k = sigmaS->Filter();
 		const float d = logf(1 - u) / k; //the real distance is ray.mint-d
@@ -41,6 +41,15 @@ VolumeGrid::VolumeGrid(const RGBColor &sa, const RGBColor &ss, float gg,
 {
 	density.assign(d, d+(nx*ny*nz));
 }
+VolumeGrid::VolumeGrid(const RGBColor &sa, const RGBColor &ss, float gg,
+	const RGBColor &emit, const BBox &e, const Transform &v2w,
+	const boost::shared_ptr<SparseGrid> &g) :
+	DensityVolume<RGBVolume>("VolumeGrid-"  + boost::lexical_cast<string>(this),
+		RGBVolume(sa, ss, emit, gg)),
+	grid(g), nx(g->Nx()), ny(g->Ny()), nz(g->Nz()), extent(e),
+	VolumeToWorld(v2w)
+{
+}
 float VolumeGrid::Density(const Point &p) const
 {
 	const Point pp(Inverse(VolumeToWorld) * p);
@@ -57,6 +66,8 @@ float VolumeGrid::Density(const Point &p) const
 	int vy = luxrays::Floor2Int(voxy);
 	int vz = luxrays::Floor2Int(voxz);
 	float dx = voxx - vx, dy = voxy - vy, dz = voxz - vz;
+	if (grid)
+		return grid->Interpolate(vx, vy, vz, dx, dy, dz);
 	// Trilinearly interpolate density values to compute local density
 	float d00 = luxrays::Lerp(dx, D(vx, vy, vz), D(vx + 1, vy, vz));
 	float d10 = luxrays::Lerp(dx, D(vx, vy + 1, vz), D(vx + 1, vy + 1, vz));
@@ -75,10 +86,20 @@ Region * VolumeGrid::CreateVolumeRegion(const Transform &volume2world,
 	RGBColor Le = params.FindOneRGBColor("Le", 0.);
 	Point p0 = params.FindOnePoint("p0", Point(0,0,0));
 	Point p1 = params.FindOnePoint("p1", Point(1,1,1));
+	// A sparse grid file takes precedence over inline density values
+	const string filename = AdjustFilename(params.FindOneString("filename", ""));
+	if (filename != "") {
+		boost::shared_ptr<SparseGrid> grid(new SparseGrid());
+		if (!grid->Load(filename))
+			return NULL;
+		return new VolumeRegion<VolumeGrid>(volume2world, BBox(p0, p1),
+			VolumeGrid(sigma_a, sigma_s, g, Le, BBox(p0, p1),
+			volume2world, grid));
+	}
 	u_int nitems;
 	const float *data = params.FindFloat("density", &nitems);
 	if (!data) {
-		LOG(LUX_ERROR,LUX_MISSINGDATA)<< "No \"density\" values provided for volume grid?";
+		LOG(LUX_ERROR,LUX_MISSINGDATA)<< "No \"density\" values or \"filename\" provided for volume grid?";
 		return NULL;
 	}
 	int nx = params.FindOneInt("nx", 1);
@@ -22,6 +22,7 @@
 
 // volumegrid.cpp*
 #include "volume.h"
+#include "sparsegrid.h"
 
 namespace lux
 {
@@ -33,9 +34,14 @@ public:
 	VolumeGrid(const RGBColor &sa, const RGBColor &ss, float gg,
  		const RGBColor &emit, const BBox &e, const Transform &v2w,
 		int nx, int ny, int nz, const float *d);
+	VolumeGrid(const RGBColor &sa, const RGBColor &ss, float gg,
+ 		const RGBColor &emit, const BBox &e, const Transform &v2w,
+		const boost::shared_ptr<SparseGrid> &g);
 	virtual ~VolumeGrid() { }
 	virtual float Density(const Point &Pobj) const;
 	float D(int x, int y, int z) const {
+		if (grid)
+			return grid->D(x, y, z);
 		x = luxrays::Clamp(x, 0, nx - 1);
 		y = luxrays::Clamp(y, 0, ny - 1);
 		z = luxrays::Clamp(z, 0, nz - 1);
@@ -46,6 +52,8 @@ public:
 private:
 	// VolumeGrid Private Data
 	std::vector<float> density;
+	// Memory mapped sparse voxels used instead of density if set
+	boost::shared_ptr<SparseGrid> grid;
 	const int nx, ny, nz;
 	const BBox extent;
 	Transform VolumeToWorld;